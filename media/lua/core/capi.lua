@@ -146,6 +146,35 @@ capi.set_dynent_falling = function(ent, fl)
     set_dynent_falling(ent, fl[1], fl[2], fl[3])
 end
 
+--[[
+    Buffers for reading or writing many dynents in one call. Fill uids,
+    then get_dynents/set_dynents cover the first n of them (all by default).
+    Vector fields hold b.n x, then b.n y, then b.n z whatever n is; found
+    says which uids exist.
+]]
+capi.new_dynent_batch = function(n)
+    return {
+        n = n, uids = ffi_new("int[?]", n),
+        position = ffi_new("double[?]", 3 * n),
+        velocity = ffi_new("double[?]", 3 * n),
+        yaw = ffi_new("float[?]", n), pitch = ffi_new("float[?]", n),
+        found = ffi_new("bool[?]", n)
+    }
+end
+
+local get_dynents, set_dynents in capi
+local min = math.min
+
+capi.get_dynents = function(b, n)
+    return get_dynents(b.uids, min(n or b.n, b.n), b.n, b.position,
+        b.velocity, b.yaw, b.pitch, b.found)
+end
+
+capi.set_dynents = function(b, n)
+    return set_dynents(b.uids, min(n or b.n, b.n), b.n, b.position,
+        b.velocity, b.yaw, b.pitch)
+end
+
 if not SERVER then
     local get_target_entity_uid in capi
     capi.get_target_entity_uid = function()
@@ -733,11 +733,21 @@ M.Entity = table2.Object:clone {
 
     --[[!
         If this is true for the entity class, it will call the $__run method
-        every frame. That is often convenient, but in most static entities
-        undesirable. It's true by default.
+        every frame while the entity has work pending, that is actions in its
+        queue to run (see {{$actions.Action_Queue}}). That is often convenient,
+        but in most static entities undesirable. It's true by default.
     ]]
     __per_frame = true,
 
+    --[[!
+        If this is true as well as $__per_frame, $__run is called every frame
+        even when the entity has no work pending. Set it for entities that do
+        their own work every frame, like animated lights. It's false by
+        default, so an idle entity costs nothing per frame whatever its $__run
+        does.
+    ]]
+    __run_always = false,
+
     --[[!
         Here you store the state variables. Every inherited entity class
         also inherits its parent's properties in addition to the newly
@@ -768,6 +778,8 @@ M.Entity = table2.Object:clone {
         self.svar_values, self.svar_value_timestamps = {}, {}
         -- no longer deactivated
         self.deactivated = false
+        -- otherwise runnable once actions are queued
+        frame.set_runnable(self, self.__per_frame and self.__run_always)
 
         -- lock
         self.setup_complete = true
@@ -790,13 +802,18 @@ M.Entity = table2.Object:clone {
     end,
 
     --[[!
-        Called per frame unless $__per_frame is false. All inherited classes
+        Called per frame while the entity has work pending, unless
+        $__per_frame is false (see also $__run_always). All inherited classes
         must call this in their own overrides. The argument specifies how
         long to manage the action queue (how much will the counters change
         internally), specified in milliseconds.
     ]]
     __run = function(self, millis)
-        self.action_queue:run(millis)
+        local queue = self.action_queue
+        queue:run(millis)
+        if not self.__run_always and not queue:busy() then
+            frame.set_runnable(self, false)
+        end
     end,
 
     --! Enqueues an action into the entity's queue. Returns the action.
@@ -1057,15 +1074,15 @@ M.Entity = table2.Object:clone {
             msg.send(var.reliable and capi.statedata_changerequest
                 or capi.statedata_changerequest_unreliable,
                 self.uid, names_to_ids[self.name][var.name],
-                var:to_wire(val))
+                var:to_net(val))
         end
 
         -- from a server or set clientside, update now
         if nfh or cset or csfh then
             debug then log(INFO, "    local update")
-            -- from the server, in wire format
+            -- from the server, in network format
             if nfh then
-                val = var:from_wire(val)
+                val = var:from_net(val)
             end
             -- TODO: avoid assertions
             assert(var:validate(val))
@@ -1086,7 +1103,7 @@ M.Entity = table2.Object:clone {
         end
 
         if actor_uid and actor_uid != -1 then
-            val = var:from_wire(val)
+            val = var:from_net(val)
             if not var.client_write then
                 log(ERROR, "Entity.set_sdata: client " .. actor_uid
                     .. " tried to change " .. key)
@@ -1117,7 +1134,7 @@ M.Entity = table2.Object:clone {
                     or capi.statedata_update_unreliable,
                 self.uid,
                 names_to_ids[self.name][key],
-                var:to_wire(val),
+                var:to_net(val),
                 (var.client_set and actor_uid and actor_uid != -1)
                     and storage[actor_uid].cn or msg.ALL_CLIENTS
             }
@@ -1463,6 +1480,30 @@ M.set_sdata = function(uid, kpid, value, auid)
 end
 set_external("entity_set_sdata", M.set_sdata)
 
+--[[!
+    Like $set_sdata, but for 3 component vector values, which arrive from
+    the network as three separate numbers.
+
+    External as `entity_set_sdata_vec3`.
+]]
+M.set_sdata_vec3 = function(uid, kpid, x, y, z, auid)
+    M.set_sdata(uid, kpid, { x, y, z }, auid)
+end
+set_external("entity_set_sdata_vec3", M.set_sdata_vec3)
+
+--[[!
+    Returns the protocol ID of the state variable with the given name on the
+    entity with the given unique ID, or -1 when there is no such entity or
+    state variable.
+
+    External as `entity_get_sdata_id`.
+]]
+set_external("entity_get_sdata_id", function(uid, name)
+    local ent = storage[uid]
+    local id = ent and names_to_ids[ent.name][name]
+    return id and tonumber(id) or -1
+end)
+
 set_external("entity_set_sdata_full", function(uid, sd)
     get_ent(uid):set_sdata_full(sd)
 end)
@@ -1579,4 +1620,37 @@ M.send = SERVER and function(cn)
 end or nil
 set_external("entities_send_all", M.send)
 
+--[[! Function: send_chunk
+    Adds entities to the snapshot chunk being streamed to a joining client,
+    in order of uid starting from the given one, until the chunk holds at
+    least the given number of bytes. When starting from 0, notifies the
+    client of the number of entities first. Takes the client number, the
+    uid and the byte count and returns the uid the next chunk starts from,
+    or -1 once all entities are in. Works only serverside. External as
+    `entities_send_chunk`.
+]]
+M.send_chunk = SERVER and function(cn, from, size)
+    if from == 0 then
+        local nents = 0
+        for uid = 1, highest_uid do
+            if storage[uid] then nents = nents + 1 end
+        end
+        msg.send(cn, capi.notify_numents, nents)
+    end
+    local acn, add = msg.ALL_CLIENTS, capi.entity_stream_add
+    for uid = (from > 0) and from or 1, highest_uid do
+        local ent = storage[uid]
+        if ent then
+            local scn = ent.cn
+            if add(uid, scn and scn or acn, ent.name, ent:build_sdata(
+                { target_cn = cn, compressed = true })) >= size
+            and uid < highest_uid then
+                return uid + 1
+            end
+        end
+    end
+    return -1
+end or nil
+set_external("entities_send_chunk", M.send_chunk)
+
 return M
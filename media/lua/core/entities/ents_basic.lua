@@ -174,6 +174,14 @@ M.Character = Entity:clone {
     -- so that it isn't nonsauer
     sauer_type = -1,
 
+    --[[!
+        How much the server favors sending this character's position when
+        a client's bandwidth budget is tight, relative to other characters
+        (default 1, 0 means only when there is room left). Override it
+        in subclasses, e.g. to favor players over background NPCs.
+    ]]
+    network_priority = 1,
+
     --[[!
         Defines the "client states". 0 is ALIVE, 1 is DEAD, 2 is SPAWNING,
         3 is LAGGED, 4 is EDITING, 5 is SPECTATOR.
@@ -391,6 +399,7 @@ M.Character = Entity:clone {
         self.cn = kwargs and kwargs.cn or -1
         assert(self.cn >= 0)
         capi.setup_character(self.uid, self.cn)
+        capi.set_network_priority(self.uid, self.network_priority)
 
         Entity.__activate(self, kwargs)
 
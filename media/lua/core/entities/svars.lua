@@ -269,6 +269,27 @@ M.State_Variable = table2.Object:clone {
     ]]
     from_wire = function(self, val)
         return tostring(val)
+    end,
+
+    --[[!
+        Converts the given value to the form it's sent over the network in
+        state data updates and change requests. Unlike $to_wire, the result
+        doesn't have to be a string - integers, floats, booleans, strings
+        and 3 component arrays are sent in binary as they are. By default
+        simply returns the result of $to_wire.
+    ]]
+    to_net = function(self, val)
+        return self:to_wire(val)
+    end,
+
+    --[[!
+        Converts a value received over the network (see $to_net) back to
+        the original format. Strings are passed to $from_wire, anything
+        else is returned as it is.
+    ]]
+    from_net = function(self, val)
+        if type(val) == "string" then return self:from_wire(val) end
+        return val
     end
 }
 State_Variable = M.State_Variable
@@ -282,7 +303,9 @@ M.State_Integer = State_Variable:clone {
     name = "State_Integer",
 
     to_wire   = function(self, val) return tostring(val) end,
-    from_wire = function(self, val) return floor(tonumber(val)) end
+    from_wire = function(self, val) return floor(tonumber(val)) end,
+    to_net    = function(self, val) return floor(val) end,
+    from_net  = function(self, val) return floor(tonumber(val)) end
 }
 State_Integer = M.State_Integer
 
@@ -296,7 +319,9 @@ M.State_Float = State_Variable:clone {
     name = "State_Float",
 
     to_wire   = function(self, val) return tostring(round(val, 2)) end,
-    from_wire = function(self, val) return tonumber(val) end
+    from_wire = function(self, val) return tonumber(val) end,
+    to_net    = function(self, val) return val end,
+    from_net  = function(self, val) return tonumber(val) end
 }
 State_Float = M.State_Float
 
@@ -309,7 +334,12 @@ M.State_Boolean = State_Variable:clone {
     name = "State_Boolean",
 
     to_wire   = function(self, val) return tostring(val) end,
-    from_wire = function(self, val) return val == "true" and true or false end
+    from_wire = function(self, val) return val == "true" and true or false end,
+    to_net    = function(self, val) return not not val end,
+    from_net  = function(self, val)
+        if type(val) == "string" then return val == "true" end
+        return val
+    end
 }
 State_Boolean = M.State_Boolean
 
@@ -638,7 +668,16 @@ M.State_Vec2 = State_Array_Float:clone {
 ]]
 M.State_Vec3 = State_Array_Float:clone {
     name = "State_Vec3",
-    surrogate = geom.Vec3_Surrogate
+    surrogate = geom.Vec3_Surrogate,
+
+    --[[!
+        Vec3 values are sent over the network as three binary floats
+        rather than in the string wire format.
+    ]]
+    to_net = function(self, val)
+        local a = val.to_array and val:to_array() or val
+        return { a[1], a[2], a[3] }
+    end
 }
 
 --[[!
@@ -22,6 +22,9 @@ local table2 = require("core.lua.table")
 local compact = table2.compact
 
 local createtable = capi.table_create
+local set_runnable = require("core.events.frame").set_runnable
+local timers = require("core.events.timers")
+local ceil = math.ceil
 
 --! Module: actions
 local M = {}
@@ -179,7 +182,13 @@ M.Action = table2.Object:clone {
     priv_finish = function(self)
         self.finished = true
         local sys = self.queue
-        if sys then sys._changed = true end
+        if sys then
+            sys._changed = true
+            if sys.timed == self then
+                timers.cancel(sys.timer)
+                sys.timer, sys.timed = nil, nil
+            end
+        end
 
         if self.animation and self.last_animation != nil then
             local lanim = self.last_animation
@@ -229,6 +238,13 @@ M.Infinite_Action = Action:clone {
 --[[!
     An action queue.
 
+    An action that only waits out its time (one that keeps the default
+    "__run" and is not parallel to another) is not run every frame. Once it
+    has started, the queue hands its remaining time to the timer wheel (see
+    {{$timers}}) and finishes it when that is up, so an entity waiting on such
+    actions costs nothing per frame. Meanwhile the action's "millis_left" is
+    not updated.
+
     Fields:
         - parent - the parent entity of this action queue.
         - actions - an array of actions.
@@ -246,6 +262,8 @@ M.Action_Queue = table2.Object:clone {
         self.parent   = parent
         self.actions  = createtable(4)
         self._changed = false
+        -- the timer finishing the action it is waiting on, if any
+        self.timer, self.timed = nil, nil
     end,
 
     --[[!
@@ -260,15 +278,54 @@ M.Action_Queue = table2.Object:clone {
             compact(acts, |i, v| not v.finished)
             self._changed = false
         end
-        if #acts > 0 then
+        if #acts > 0 and not self.timed then
             local act = acts[1]
             debug then log(INFO, table.concat { "Executing ", act.name })
 
             -- keep the removal for the next frame
-            act:priv_run(millis)
+            if not act:priv_run(millis) and act.__run == Action.__run
+            and act.parallel_to == false and not act.finished then
+                self:wait(act)
+            end
         end
     end,
 
+    --[[!
+        Lets the timer wheel finish the given action, the first in the queue,
+        once its "millis_left" is up. Called by $run.
+    ]]
+    wait = function(self, act)
+        self.timed = act
+        self.timer = timers.add(ceil(act.millis_left), function()
+            self.timer, self.timed = nil, nil
+            local parent = self.parent
+            if act.finished or (type(parent) == "table"
+            and parent.deactivated) then return end
+            act.millis_left = 0
+            act:priv_finish()
+            -- the next action starts with the next frame it runs in
+            if type(parent) == "table" and parent.__per_frame
+            and self:busy() then
+                set_runnable(parent, true)
+            end
+        end)
+        if not self.timer then self.timed = nil end
+    end,
+
+    --[[!
+        Returns true if the queue has an action to run in the coming frames,
+        that is if its first unfinished action is not one the timer wheel is
+        waiting on.
+    ]]
+    busy = function(self)
+        local acts = self.actions
+        for i = 1, #acts do
+            local act = acts[i]
+            if not act.finished then return act != self.timed end
+        end
+        return false
+    end,
+
     --[[!
         Enqueues an action. If multiple actions of the same type are not
         enabled on the action we're queuing, this first checks the existing
@@ -293,16 +350,33 @@ M.Action_Queue = table2.Object:clone {
         acts[#acts + 1] = act
         act.actor = self.parent
         act.queue = self
+
+        local parent = self.parent
+        if type(parent) == "table" and parent.__per_frame then
+            set_runnable(parent, true)
+        end
     end,
 
     --[[!
-        Clears the action queue (cancels every action in the queue).
+        Clears the action queue (cancels every action in the queue). The
+        timer wheel stops waiting on an action even if it cannot be
+        canceled; such an action goes back to running every frame.
     ]]
     clear = function(self)
         local acts = self.actions
         for i = 1, #acts do
             acts[i]:cancel()
         end
+        local timed = self.timed
+        if timed then
+            timers.cancel(self.timer)
+            self.timer, self.timed = nil, nil
+            local parent = self.parent
+            if not timed.finished and type(parent) == "table"
+            and parent.__per_frame then
+                set_runnable(parent, true)
+            end
+        end
     end
 }
 
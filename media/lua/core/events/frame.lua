@@ -22,22 +22,39 @@ local current_frame_time = 0
 local last_millis        = 0
 
 local require, setmetatable = require, setmetatable
-local ents, get_ents, get_highest_uid
 
 local copy = table2.copy
 
+-- entities whose __run is called every frame, in the order they started;
+-- __runnable is nil when not listed, false when about to be dropped
+local runnable, nrunnable = {}, 0
+
+--[[!
+    Sets whether the given entity runs every frame. Only these entities
+    are visited by $handle_frame, so an entity that has nothing to do costs
+    nothing per frame. Entities manage this themselves, see the entity
+    $__per_frame member.
+]]
+M.set_runnable = function(ent, run)
+    if not run then
+        if ent.__runnable then ent.__runnable = false end
+    elseif ent.__runnable == nil then
+        ent.__runnable = true
+        nrunnable = nrunnable + 1
+        runnable[nrunnable] = ent
+    else
+        ent.__runnable = true
+    end
+end
+
 --[[!
     Executed per frame from C++. It handles the current frame, meaning
     it first  updates all the required timing vars ($get_frame, $get_time,
-    $get_frame_time, $get_last_millis) and then runs on all available
-    activated entities. External as "frame_handle".
+    $get_frame_time, $get_last_millis) and then runs on all activated
+    entities that are runnable (see $set_runnable). External as
+    "frame_handle".
 ]]
 M.handle_frame = function(millis, lastmillis)
-    if not ents then
-        ents = require("core.entities.ents")
-        get_ents, get_highest_uid = ents.get_all, ents.get_highest_uid
-    end
-
     debug then log(INFO, "frame.handle_frame: New frame")
     current_frame = current_frame + 1
 
@@ -47,13 +64,27 @@ M.handle_frame = function(millis, lastmillis)
 
     debug then log(INFO, "frame.handle_frame: Acting on entities")
 
-    local storage = get_ents()
-    for uid = 1, get_highest_uid() do
-        local ent = storage[uid]
-        if ent and not ent.deactivated and ent.__per_frame then
+    -- entities becoming runnable meanwhile start with the next frame
+    local n = nrunnable
+    for i = 1, n do
+        local ent = runnable[i]
+        if ent.__runnable and not ent.deactivated then
             ent:__run(millis)
         end
     end
+
+    local j = 0
+    for i = 1, nrunnable do
+        local ent = runnable[i]
+        if ent.__runnable and not ent.deactivated then
+            j = j + 1
+            runnable[j] = ent
+        else
+            ent.__runnable = nil
+        end
+    end
+    for i = j + 1, nrunnable do runnable[i] = nil end
+    nrunnable = j
 end
 require("core.externals").set("frame_handle", M.handle_frame)
 
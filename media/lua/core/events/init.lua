@@ -3,6 +3,9 @@ local log = require("core.logger")
 log.log(log.DEBUG, ":::: Frame handling.")
 require("core.events.frame")
 
+log.log(log.DEBUG, ":::: Timers.")
+require("core.events.timers")
+
 log.log(log.DEBUG, ":::: Signal system.")
 require("core.events.signal")
 
@@ -0,0 +1,77 @@
+--[[!<
+    Timers scheduled by the engine. The engine keeps the deadlines in a timer
+    wheel and only calls into Lua when some are due, handing over their
+    handles in batches, so waiting timers cost nothing per frame no matter
+    how many there are.
+
+    License:
+        See COPYING.txt.
+]]
+
+local capi = require("capi")
+local ffi = require("ffi")
+
+local timer_add, timer_cancel, timer_fetch, timers_clear in capi
+
+--! Module: timers
+local M = {}
+
+local callbacks = {}
+local periodic  = {}
+
+local BATCH = 256
+local due = ffi.new("uint[?]", BATCH)
+
+-- a fresh scripting state starts with no timers
+timers_clear()
+
+--[[!
+    Schedules a callback.
+
+    Arguments:
+        - delay - milliseconds until the first call, at least 1.
+        - fun - the callback, it gets the timer handle.
+        - period - optional, if given and above zero, the callback is
+          called again every period milliseconds until cancelled.
+
+    Returns:
+        The timer handle, or nil if it could not be scheduled.
+]]
+M.add = function(delay, fun, period)
+    period = period or 0
+    local h = timer_add(delay, period)
+    if h == 0 then return nil end
+    callbacks[h] = fun
+    if period > 0 then periodic[h] = true end
+    return h
+end
+
+--! Cancels the timer of the given handle. Returns true if it was scheduled.
+M.cancel = function(h)
+    if not callbacks[h] then return false end
+    callbacks[h] = nil
+    periodic[h] = nil
+    return timer_cancel(h)
+end
+
+--[[!
+    Runs the callbacks of all due timers. Executed from C++ before each
+    frame is handled, when any are due. External as "timers_handle".
+]]
+M.handle_timers = function()
+    while true do
+        local n = timer_fetch(due, BATCH)
+        if n == 0 then break end
+        for i = 0, n - 1 do
+            local h = due[i]
+            local fun = callbacks[h]
+            if fun then
+                if not periodic[h] then callbacks[h] = nil end
+                fun(h)
+            end
+        end
+    end
+end
+require("core.externals").set("timers_handle", M.handle_timers)
+
+return M
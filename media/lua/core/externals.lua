@@ -26,6 +26,7 @@ M.unset = function(name)
     local old = externals[name]
     if old == nil then return nil end
     externals[name] = nil
+    capi.external_changed()
     return old
 end
 
@@ -33,6 +34,7 @@ end
 M.set = function(name, fun)
     local old = externals[name]
     externals[name] = fun
+    capi.external_changed()
     return old
 end
 
@@ -9,9 +9,11 @@
 ]]
 
 local capi = require("capi")
+local ffi = require("ffi")
 local log = require("core.logger")
 
 local type = type
+local ffi_new = ffi.new
 local floor, min, max, abs = math.floor, math.min, math.max, math.abs
 local pow, sqrt = math.pow, math.sqrt
 local atan2, asin = math.atan2, math.asin
@@ -117,6 +119,45 @@ M.is_los = function(o, d)
     return capi.ray_los(o.x, o.y, o.z, d.x, d.y, d.z)
 end
 
+ffi.cdef [[
+    typedef struct ray_t {
+        struct { float x, y, z; } origin, direction;
+        float radius, distance;
+        struct { float x, y, z; } hit;
+    } ray_t;
+]]
+
+--[[!
+    The modes of <ray_batch>. POS traces each ray from its origin along its
+    direction up to its radius, like the single ray position query. LOS
+    checks the line from the origin to the point given as the direction.
+    FLOOR looks for the floor below the origin, up to the radius.
+]]
+M.ray_modes = {:
+    POS = 0, LOS = 1, FLOOR = 2
+:}
+
+--[[!
+    Allocates a buffer of the given number of rays for <ray_batch>.
+]]
+M.new_rays = function(n)
+    return ffi_new("ray_t[?]", n)
+end
+
+--[[!
+    Traces a buffer of rays in a single call into the engine. Fills in the
+    distance each ray got to and the position it stopped at (hit), and
+    returns how many of them hit something in range.
+
+    Arguments:
+        - rays - a buffer from <new_rays>.
+        - n - the number of rays in the buffer to trace.
+        - mode - one of <ray_modes>, defaults to POS.
+]]
+M.ray_batch = function(rays, n, mode)
+    return capi.ray_batch(rays, n, mode or 0)
+end
+
 --[[!
     Calculates the yaw from an origin to a target. Done on 2D data only.
     If the last "reverse" argument is given as true, it calculates away
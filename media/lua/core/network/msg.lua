@@ -48,4 +48,47 @@ M.show_client_message = SERVER and function(cn, title, text)
     send(cn, require("capi").personal_servmsg, title, text)
 end or nil
 
+local capi = require("capi")
+local ffi = require("ffi")
+local ffi_new = ffi.new
+
+--! The number of buckets in the handler time histogram of $get_stats.
+M.STATS_BUCKETS = 16
+
+--[[!
+    Returns the stats of a message type (given by its code) as a table with
+    the fields count, bytes, micros (the total time its handlers took) and
+    histogram, an array of $STATS_BUCKETS handler counts where bucket 1 is
+    under a microsecond and bucket b is under 2^(b-1) microseconds. Passing
+    true as the second argument gives the stats of sent messages instead of
+    received ones, where the times are always zero. The counters run since
+    startup or the last $reset_stats.
+]]
+M.get_stats = function(code, out)
+    local stor = ffi_new("double[?]", 3 + M.STATS_BUCKETS)
+    if not capi.msgstats_get(code, out or false, stor) then return nil end
+    local hist = {}
+    for i = 1, M.STATS_BUCKETS do hist[i] = stor[i + 2] end
+    return { count = stor[0], bytes = stor[1], micros = stor[2],
+        histogram = hist }
+end
+
+--[[!
+    Returns an array of up to n (16 by default) entities that took the most
+    bytes in a state data message type, heaviest first, each as a table with
+    the fields uid and bytes. The bytes are an upper bound.
+]]
+M.get_top_uids = function(code, out, n)
+    n = n or 16
+    local uids, bytes = ffi_new("int[?]", n), ffi_new("double[?]", n)
+    local ret = {}
+    for i = 0, capi.msgstats_get_top_uids(code, out or false, uids, bytes, n) - 1 do
+        ret[#ret + 1] = { uid = uids[i], bytes = bytes[i] }
+    end
+    return ret
+end
+
+--! Resets the counters of all message types.
+M.reset_stats = capi.msgstats_reset
+
 return M
@@ -29,6 +29,9 @@ local Entity = ents.Entity
 local Day_Manager = Entity:clone {
     name = "Day_Manager",
 
+    --! The day progresses every frame.
+    __run_always = true,
+
     __properties = {
         day_seconds = svars.State_Integer(),
         day_progress = svars.State_Integer { reliable = false }
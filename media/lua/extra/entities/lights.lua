@@ -42,6 +42,9 @@ local Dynamic_Light = Marker:clone {
     --! Set to true, as <__run> doesn't work on static entities by default.
     __per_frame = true,
 
+    --! Set to true, as the light is added anew every frame.
+    __run_always = true,
+
     __init_svars = function(self, kwargs, nd)
         Marker.__init_svars(self, kwargs, nd)
         self:set_attr("radius", 100, nd[4])
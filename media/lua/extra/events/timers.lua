@@ -8,13 +8,17 @@
         See COPYING.txt.
 ]]
 
+local timers = require("core.events.timers")
+
 --! Module: timers
 local M = {}
 
 --[[!
-    A general use timer. It's not automatically managed - you have to simulate
-    it yourself using the provided methods. That makes it flexible for various
-    scenarios (where the timing is not managed by the general event loop).
+    A general use timer. Once you $start it, the engine's timer wheel calls
+    the given function every interval (see core.events.timers), so a
+    waiting timer costs nothing per frame. You can also simulate it yourself
+    using $tick, for scenarios where the timing is not managed by the general
+    event loop.
 ]]
 M.Timer = require("core.lua.table").Object:clone {
     name = "Timer",
@@ -34,6 +38,38 @@ M.Timer = require("core.lua.table").Object:clone {
         self.interval   = interval
         self.carry_over = carry_over or false
         self.sum        = 0
+        self.handle     = nil
+    end,
+
+    --[[!
+        Starts calling the given function every interval, until $stop is
+        called. The function gets the timer. With carry_over, the calls keep
+        to the schedule set when starting even when a frame comes late,
+        otherwise each interval counts from the previous call. Restarts the
+        timer if it was running.
+    ]]
+    start = function(self, fun)
+        self:stop()
+        self.fun = fun
+        local interval = self.interval
+        if self.carry_over then
+            self.handle = timers.add(interval, function() fun(self) end,
+                interval)
+        else
+            local function fire()
+                self.handle = timers.add(interval, fire)
+                fun(self)
+            end
+            self.handle = timers.add(interval, fire)
+        end
+    end,
+
+    --! Stops calling the function given to $start.
+    stop = function(self)
+        if self.handle then
+            timers.cancel(self.handle)
+            self.handle = nil
+        end
     end,
 
     --[[!
@@ -59,9 +95,21 @@ M.Timer = require("core.lua.table").Object:clone {
         end
     end,
 
-    --! Manually sets sum to interval.
+    --[[!
+        Manually sets sum to interval, so that the next $tick reaches it. A
+        started timer calls its function with the next frame instead and
+        carries on from there.
+    ]]
     prime = function(self)
         self.sum = self.interval
+        if self.handle then
+            local fun = self.fun
+            self:stop()
+            self.handle = timers.add(1, function()
+                self:start(fun)
+                fun(self)
+            end)
+        end
     end
 }
 
@@ -60,6 +60,9 @@ end
 local Game_Player = Player:clone {
     name = "Game_Player",
 
+    --! The marks are drawn every frame.
+    __run_always = true,
+
     __properties = {
         new_mark = svars.State_Array_Float {
             client_set = true, has_history = false
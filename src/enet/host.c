@@ -101,10 +101,18 @@ enet_host_create (const ENetAddress * address, size_t peerCount, size_t channelL
     host -> bandwidthLimitedPeers = 0;
     host -> duplicatePeers = ENET_PROTOCOL_MAXIMUM_PEER_ID;
 
+    host -> datagramBatchSize = ENET_HOST_DEFAULT_DATAGRAM_BATCH;
+    host -> datagramBatchCapacity = 0;
+    host -> datagramBatchData = NULL;
+    host -> receivedBatchCount = 0;
+    host -> receivedBatchIndex = 0;
+    host -> sendBatchCount = 0;
+
     host -> compressor.context = NULL;
     host -> compressor.compress = NULL;
     host -> compressor.decompress = NULL;
     host -> compressor.destroy = NULL;
+    host -> compressingPeer = NULL;
 
     host -> intercept = NULL;
 
@@ -155,6 +163,9 @@ enet_host_destroy (ENetHost * host)
     if (host -> compressor.context != NULL && host -> compressor.destroy)
       (* host -> compressor.destroy) (host -> compressor.context);
 
+    if (host -> datagramBatchData != NULL)
+      enet_free (host -> datagramBatchData);
+
     enet_free (host -> peers);
     enet_free (host);
 }
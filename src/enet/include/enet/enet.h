@@ -209,6 +209,9 @@ enum
    ENET_HOST_SEND_BUFFER_SIZE             = 256 * 1024,
    ENET_HOST_BANDWIDTH_THROTTLE_INTERVAL  = 1000,
    ENET_HOST_DEFAULT_MTU                  = 1400,
+   ENET_HOST_DEFAULT_DATAGRAM_BATCH       = 16,
+   ENET_HOST_MAXIMUM_DATAGRAM_BATCH       = 64,
+   ENET_LZ_MAXIMUM_DICTIONARY             = 16384,
 
    ENET_PEER_DEFAULT_ROUND_TRIP_TIME      = 500,
    ENET_PEER_DEFAULT_PACKET_THROTTLE      = 32,
@@ -344,6 +347,7 @@ typedef int (ENET_CALLBACK * ENetInterceptCallback) (struct _ENetHost * host, st
     @sa enet_host_broadcast()
     @sa enet_host_compress()
     @sa enet_host_compress_with_range_coder()
+    @sa enet_host_compress_with_lz()
     @sa enet_host_channel_limit()
     @sa enet_host_bandwidth_limit()
     @sa enet_host_bandwidth_throttle()
@@ -372,6 +376,7 @@ typedef struct _ENetHost
    size_t               bufferCount;
    ENetChecksumCallback checksum;                    /**< callback the user can set to enable packet checksums for this host */
    ENetCompressor       compressor;
+   ENetPeer *           compressingPeer;             /**< the peer the datagram being compressed goes to, for compressors that keep per peer state */
    enet_uint8           packetData [2][ENET_PROTOCOL_MAXIMUM_MTU];
    ENetAddress          receivedAddress;
    enet_uint8 *         receivedData;
@@ -384,6 +389,16 @@ typedef struct _ENetHost
    size_t               connectedPeers;
    size_t               bandwidthLimitedPeers;
    size_t               duplicatePeers;              /**< optional number of allowed peers from duplicate IPs, defaults to ENET_PROTOCOL_MAXIMUM_PEER_ID */
+   size_t               datagramBatchSize;           /**< maximum number of datagrams sent or received per system call, 1 disables batching; defaults to ENET_HOST_DEFAULT_DATAGRAM_BATCH */
+   size_t               datagramBatchCapacity;
+   enet_uint8 *         datagramBatchData;
+   ENetAddress          receivedBatchAddresses [ENET_HOST_MAXIMUM_DATAGRAM_BATCH];
+   ENetBuffer           receivedBatch [ENET_HOST_MAXIMUM_DATAGRAM_BATCH];
+   size_t               receivedBatchCount;
+   size_t               receivedBatchIndex;
+   ENetAddress          sendBatchAddresses [ENET_HOST_MAXIMUM_DATAGRAM_BATCH];
+   ENetBuffer           sendBatch [ENET_HOST_MAXIMUM_DATAGRAM_BATCH];
+   size_t               sendBatchCount;
 } ENetHost;
 
 /**
@@ -488,6 +503,8 @@ ENET_API ENetSocket enet_socket_accept (ENetSocket, ENetAddress *);
 ENET_API int        enet_socket_connect (ENetSocket, const ENetAddress *);
 ENET_API int        enet_socket_send (ENetSocket, const ENetAddress *, const ENetBuffer *, size_t);
 ENET_API int        enet_socket_receive (ENetSocket, ENetAddress *, ENetBuffer *, size_t);
+ENET_API int        enet_socket_send_batch (ENetSocket, const ENetAddress *, const ENetBuffer *, size_t);
+ENET_API int        enet_socket_receive_batch (ENetSocket, ENetAddress *, ENetBuffer *, size_t);
 ENET_API int        enet_socket_wait (ENetSocket, enet_uint32 *, enet_uint32);
 ENET_API int        enet_socket_set_option (ENetSocket, ENetSocketOption, int);
 ENET_API int        enet_socket_get_option (ENetSocket, ENetSocketOption, int *);
@@ -546,6 +563,7 @@ ENET_API void       enet_host_flush (ENetHost *);
 ENET_API void       enet_host_broadcast (ENetHost *, enet_uint8, ENetPacket *);
 ENET_API void       enet_host_compress (ENetHost *, const ENetCompressor *);
 ENET_API int        enet_host_compress_with_range_coder (ENetHost * host);
+ENET_API int        enet_host_compress_with_lz (ENetHost * host, const void * dictionary, size_t dictionaryLength);
 ENET_API void       enet_host_channel_limit (ENetHost *, size_t);
 ENET_API void       enet_host_bandwidth_limit (ENetHost *, enet_uint32, enet_uint32);
 extern   void       enet_host_bandwidth_throttle (ENetHost *);
@@ -576,6 +594,11 @@ ENET_API void * enet_range_coder_create (void);
 ENET_API void   enet_range_coder_destroy (void *);
 ENET_API size_t enet_range_coder_compress (void *, const ENetBuffer *, size_t, size_t, enet_uint8 *, size_t);
 ENET_API size_t enet_range_coder_decompress (void *, const enet_uint8 *, size_t, enet_uint8 *, size_t);
+
+ENET_API void * enet_lz_create (const void *, size_t);
+ENET_API void   enet_lz_destroy (void *);
+ENET_API size_t enet_lz_compress (void *, const ENetBuffer *, size_t, size_t, enet_uint8 *, size_t);
+ENET_API size_t enet_lz_decompress (void *, const enet_uint8 *, size_t, enet_uint8 *, size_t);
    
 extern size_t enet_protocol_command_size (enet_uint8);
 
@@ -0,0 +1,272 @@
+/**
+ @file lz.c
+ @brief A fast LZ77 packet compressor with an optional preset dictionary
+*/
+#define ENET_BUILDING_LIB 1
+#include <string.h>
+#include "enet/enet.h"
+
+/* The format is a series of sequences, each a token byte holding the literal count in its high nibble
+   and the match length minus ENET_LZ_MINIMUM_MATCH in its low nibble, followed by extra length bytes
+   for a nibble of 15, the literals, a little endian 16 bit match offset and extra match length bytes.
+   The last sequence stops after its literals. Matches may reach back into the preset dictionary,
+   which behaves as if it directly preceded every packet. */
+enum
+{
+    ENET_LZ_MINIMUM_MATCH = 4,
+    ENET_LZ_HASH_BITS = 12,
+    ENET_LZ_HASH_SIZE = 1 << ENET_LZ_HASH_BITS,
+    ENET_LZ_WINDOW_SIZE = ENET_LZ_MAXIMUM_DICTIONARY + ENET_PROTOCOL_MAXIMUM_MTU
+};
+
+typedef struct _ENetLZ
+{
+    size_t dictionaryLength;
+    enet_uint16 dictionaryTable [ENET_LZ_HASH_SIZE];
+    enet_uint16 table [ENET_LZ_HASH_SIZE];
+    enet_uint8 window [ENET_LZ_WINDOW_SIZE];
+} ENetLZ;
+
+#define ENET_LZ_HASH(data) \
+    ((((enet_uint32) (data) [0] | ((enet_uint32) (data) [1] << 8) | ((enet_uint32) (data) [2] << 16) | ((enet_uint32) (data) [3] << 24)) * 2654435761U) >> (32 - ENET_LZ_HASH_BITS))
+
+/** Creates an LZ compressor context.
+    @param dictionary optional data that packets are likely to share; only the last ENET_LZ_MAXIMUM_DICTIONARY bytes are used
+    @param dictionaryLength length of the dictionary in bytes
+    @returns the context, or NULL on failure
+*/
+void *
+enet_lz_create (const void * dictionary, size_t dictionaryLength)
+{
+    ENetLZ * lz = (ENetLZ *) enet_malloc (sizeof (ENetLZ));
+    size_t position;
+    if (lz == NULL)
+      return NULL;
+
+    if (dictionary == NULL)
+      dictionaryLength = 0;
+    else
+    if (dictionaryLength > ENET_LZ_MAXIMUM_DICTIONARY)
+    {
+        dictionary = (const enet_uint8 *) dictionary + dictionaryLength - ENET_LZ_MAXIMUM_DICTIONARY;
+        dictionaryLength = ENET_LZ_MAXIMUM_DICTIONARY;
+    }
+    if (dictionaryLength > 0)
+      memcpy (lz -> window, dictionary, dictionaryLength);
+    lz -> dictionaryLength = dictionaryLength;
+
+    memset (lz -> dictionaryTable, 0, sizeof (lz -> dictionaryTable));
+    for (position = 0; position + ENET_LZ_MINIMUM_MATCH <= dictionaryLength; ++ position)
+      lz -> dictionaryTable [ENET_LZ_HASH (& lz -> window [position])] = (enet_uint16) position;
+
+    return lz;
+}
+
+void
+enet_lz_destroy (void * context)
+{
+    ENetLZ * lz = (ENetLZ *) context;
+    if (lz == NULL)
+      return;
+
+    enet_free (lz);
+}
+
+#define ENET_LZ_PUT_LENGTH(length) \
+{ \
+    size_t remaining = (length); \
+    for (; remaining >= 255; remaining -= 255) \
+    { \
+        if (outData >= outEnd) \
+          return 0; \
+        * outData ++ = 255; \
+    } \
+    if (outData >= outEnd) \
+      return 0; \
+    * outData ++ = (enet_uint8) remaining; \
+}
+
+#define ENET_LZ_PUT_LITERALS(literals, count) \
+{ \
+    if (count >= 15) \
+      ENET_LZ_PUT_LENGTH (count - 15); \
+    if ((size_t) (outEnd - outData) < count) \
+      return 0; \
+    memcpy (outData, literals, count); \
+    outData += count; \
+}
+
+size_t
+enet_lz_compress (void * context, const ENetBuffer * inBuffers, size_t inBufferCount, size_t inLimit, enet_uint8 * outData, size_t outLimit)
+{
+    ENetLZ * lz = (ENetLZ *) context;
+    enet_uint8 * outStart = outData, * outEnd = & outData [outLimit],
+               * inStart, * inEnd, * anchor, * current;
+
+    if (lz == NULL || inBufferCount <= 0 || inLimit <= 0 || inLimit > ENET_PROTOCOL_MAXIMUM_MTU)
+      return 0;
+
+    inStart = inEnd = & lz -> window [lz -> dictionaryLength];
+
+    for (; inBufferCount > 0 && inEnd < & inStart [inLimit]; ++ inBuffers, -- inBufferCount)
+    {
+        size_t length = inBuffers -> dataLength;
+        if (length > (size_t) (& inStart [inLimit] - inEnd))
+          length = & inStart [inLimit] - inEnd;
+        memcpy (inEnd, inBuffers -> data, length);
+        inEnd += length;
+    }
+
+    memcpy (lz -> table, lz -> dictionaryTable, sizeof (lz -> table));
+
+    anchor = current = inStart;
+    while (current + ENET_LZ_MINIMUM_MATCH <= inEnd)
+    {
+        enet_uint32 hash = ENET_LZ_HASH (current);
+        const enet_uint8 * match = & lz -> window [lz -> table [hash]];
+        size_t literalCount, matchLength, offset;
+        enet_uint8 * token;
+
+        lz -> table [hash] = (enet_uint16) (current - lz -> window);
+        if (match >= current || memcmp (match, current, ENET_LZ_MINIMUM_MATCH) != 0)
+        {
+            /* skip ahead faster through data that does not compress */
+            current += 1 + ((current - anchor) >> 5);
+            continue;
+        }
+
+        matchLength = ENET_LZ_MINIMUM_MATCH;
+        while (current + matchLength < inEnd && match [matchLength] == current [matchLength])
+          ++ matchLength;
+        offset = current - match;
+        literalCount = current - anchor;
+
+        if (outData >= outEnd)
+          return 0;
+        token = outData ++;
+        * token = (enet_uint8) ((literalCount < 15 ? literalCount : 15) << 4);
+        ENET_LZ_PUT_LITERALS (anchor, literalCount);
+
+        if (outEnd - outData < 2)
+          return 0;
+        * outData ++ = (enet_uint8) offset;
+        * outData ++ = (enet_uint8) (offset >> 8);
+        matchLength -= ENET_LZ_MINIMUM_MATCH;
+        * token |= (enet_uint8) (matchLength < 15 ? matchLength : 15);
+        if (matchLength >= 15)
+          ENET_LZ_PUT_LENGTH (matchLength - 15);
+
+        current += matchLength + ENET_LZ_MINIMUM_MATCH;
+        anchor = current;
+        if (current - 2 + ENET_LZ_MINIMUM_MATCH <= inEnd)
+          lz -> table [ENET_LZ_HASH (current - 2)] = (enet_uint16) (current - 2 - lz -> window);
+    }
+
+    if (anchor < inEnd || outData == outStart)
+    {
+        size_t literalCount = inEnd - anchor;
+        if (outData >= outEnd)
+          return 0;
+        * outData ++ = (enet_uint8) ((literalCount < 15 ? literalCount : 15) << 4);
+        ENET_LZ_PUT_LITERALS (anchor, literalCount);
+    }
+
+    return (size_t) (outData - outStart);
+}
+
+#define ENET_LZ_GET_LENGTH(length) \
+{ \
+    enet_uint8 extra; \
+    do \
+    { \
+        if (inData >= inEnd) \
+          return 0; \
+        extra = * inData ++; \
+        length += extra; \
+    } while (extra == 255); \
+}
+
+size_t
+enet_lz_decompress (void * context, const enet_uint8 * inData, size_t inLimit, enet_uint8 * outData, size_t outLimit)
+{
+    ENetLZ * lz = (ENetLZ *) context;
+    const enet_uint8 * inEnd = & inData [inLimit];
+    enet_uint8 * outStart = outData, * outEnd = & outData [outLimit];
+
+    if (lz == NULL || inLimit <= 0)
+      return 0;
+
+    while (inData < inEnd)
+    {
+        enet_uint8 token = * inData ++;
+        size_t literalCount = token >> 4, matchLength = token & 15, offset, produced;
+        const enet_uint8 * match;
+
+        if (literalCount == 15)
+          ENET_LZ_GET_LENGTH (literalCount);
+        if ((size_t) (inEnd - inData) < literalCount || (size_t) (outEnd - outData) < literalCount)
+          return 0;
+        memcpy (outData, inData, literalCount);
+        inData += literalCount;
+        outData += literalCount;
+        if (inData >= inEnd)
+          break;
+
+        if (inEnd - inData < 2)
+          return 0;
+        offset = inData [0] | (inData [1] << 8);
+        inData += 2;
+        if (matchLength == 15)
+          ENET_LZ_GET_LENGTH (matchLength);
+        matchLength += ENET_LZ_MINIMUM_MATCH;
+
+        produced = outData - outStart;
+        if (offset <= 0 || offset > produced + lz -> dictionaryLength || (size_t) (outEnd - outData) < matchLength)
+          return 0;
+        if (offset > produced)
+        {
+            size_t fromDictionary = offset - produced;
+            if (fromDictionary > matchLength)
+              fromDictionary = matchLength;
+            memcpy (outData, & lz -> window [lz -> dictionaryLength - (offset - produced)], fromDictionary);
+            outData += fromDictionary;
+            matchLength -= fromDictionary;
+        }
+
+        if (matchLength <= 0)
+          continue;
+
+        /* matches may overlap the bytes they produce, so copy forwards one at a time */
+        for (match = outData - offset; matchLength > 0; -- matchLength)
+          * outData ++ = * match ++;
+    }
+
+    return (size_t) (outData - outStart);
+}
+
+/** @defgroup host ENet host functions
+    @{
+*/
+
+/** Sets the packet compressor the host should use to the LZ compressor.
+    @param host host to enable the LZ compressor for
+    @param dictionary optional preset dictionary, which must be the same for both ends of a connection
+    @param dictionaryLength length of the dictionary in bytes
+    @returns 0 on success, < 0 on failure
+*/
+int
+enet_host_compress_with_lz (ENetHost * host, const void * dictionary, size_t dictionaryLength)
+{
+    ENetCompressor compressor;
+    memset (& compressor, 0, sizeof (compressor));
+    compressor.context = enet_lz_create (dictionary, dictionaryLength);
+    if (compressor.context == NULL)
+      return -1;
+    compressor.compress = enet_lz_compress;
+    compressor.decompress = enet_lz_decompress;
+    compressor.destroy = enet_lz_destroy;
+    enet_host_compress (host, & compressor);
+    return 0;
+}
+
+/** @} */
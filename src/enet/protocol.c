@@ -1210,30 +1210,180 @@ commandError:
     return 0;
 }
  
+/** Makes room for datagramBatchSize datagrams each way, if there is no batch in progress.
+    @returns the number of datagrams that can be batched, or 0 to not batch
+*/
+static size_t
+enet_protocol_reserve_datagram_batch (ENetHost * host)
+{
+    size_t batchSize = host -> datagramBatchSize;
+
+    if (batchSize > ENET_HOST_MAXIMUM_DATAGRAM_BATCH)
+      batchSize = ENET_HOST_MAXIMUM_DATAGRAM_BATCH;
+
+    if (batchSize <= 1)
+      return 0;
+
+    if (batchSize > host -> datagramBatchCapacity &&
+        host -> receivedBatchIndex >= host -> receivedBatchCount &&
+        host -> sendBatchCount == 0)
+    {
+        enet_uint8 * data = (enet_uint8 *) enet_malloc (2 * batchSize * ENET_PROTOCOL_MAXIMUM_MTU);
+        size_t i;
+
+        if (data == NULL)
+          return 0;
+
+        if (host -> datagramBatchData != NULL)
+          enet_free (host -> datagramBatchData);
+
+        host -> datagramBatchData = data;
+        host -> datagramBatchCapacity = batchSize;
+
+        for (i = 0; i < batchSize; ++ i)
+          host -> sendBatch [i].data = data + (batchSize + i) * ENET_PROTOCOL_MAXIMUM_MTU;
+    }
+
+    return batchSize < host -> datagramBatchCapacity ? batchSize : host -> datagramBatchCapacity;
+}
+
+/** Receives the next datagram into host -> receivedData, from the current batch or, once that
+    is used up, the socket.
+    @returns the length received, 0 if nothing is waiting, or -1 on error
+*/
 static int
-enet_protocol_receive_incoming_commands (ENetHost * host, ENetEvent * event)
+enet_protocol_receive_datagram (ENetHost * host)
 {
-    for (;;)
+    size_t batchSize;
+
+    if (host -> receivedBatchIndex >= host -> receivedBatchCount &&
+        (batchSize = enet_protocol_reserve_datagram_batch (host)) > 1)
     {
-       int receivedLength;
-       ENetBuffer buffer;
+        size_t i;
+        int receivedCount;
 
-       buffer.data = host -> packetData [0];
-       buffer.dataLength = sizeof (host -> packetData [0]);
+        for (i = 0; i < batchSize; ++ i)
+        {
+            host -> receivedBatch [i].data = host -> datagramBatchData + i * ENET_PROTOCOL_MAXIMUM_MTU;
+            host -> receivedBatch [i].dataLength = ENET_PROTOCOL_MAXIMUM_MTU;
+        }
+
+        receivedCount = enet_socket_receive_batch (host -> socket,
+                                                   host -> receivedBatchAddresses,
+                                                   host -> receivedBatch,
+                                                   batchSize);
+
+        if (receivedCount <= 0)
+          return receivedCount;
+
+        host -> receivedBatchCount = receivedCount;
+        host -> receivedBatchIndex = 0;
+    }
+
+    if (host -> receivedBatchIndex < host -> receivedBatchCount)
+    {
+        ENetBuffer * buffer = & host -> receivedBatch [host -> receivedBatchIndex];
 
-       receivedLength = enet_socket_receive (host -> socket,
-                                             & host -> receivedAddress,
-                                             & buffer,
-                                             1);
+        host -> receivedAddress = host -> receivedBatchAddresses [host -> receivedBatchIndex ++];
+        host -> receivedData = (enet_uint8 *) buffer -> data;
+        host -> receivedDataLength = buffer -> dataLength;
+
+        return (int) buffer -> dataLength;
+    }
+    else
+    {
+        int receivedLength;
+        ENetBuffer buffer;
+
+        buffer.data = host -> packetData [0];
+        buffer.dataLength = sizeof (host -> packetData [0]);
+
+        receivedLength = enet_socket_receive (host -> socket,
+                                              & host -> receivedAddress,
+                                              & buffer,
+                                              1);
+
+        if (receivedLength <= 0)
+          return receivedLength;
+
+        host -> receivedData = host -> packetData [0];
+        host -> receivedDataLength = receivedLength;
+
+        return receivedLength;
+    }
+}
+
+/** Sends the datagrams queued by enet_protocol_queue_datagram.
+    @returns 0, or -1 on error
+*/
+static int
+enet_protocol_flush_datagrams (ENetHost * host)
+{
+    size_t sent = 0;
+
+    while (sent < host -> sendBatchCount)
+    {
+        int sentCount = enet_socket_send_batch (host -> socket,
+                                                & host -> sendBatchAddresses [sent],
+                                                & host -> sendBatch [sent],
+                                                host -> sendBatchCount - sent);
+
+        if (sentCount < 0)
+        {
+            host -> sendBatchCount = 0;
+            return -1;
+        }
+
+        /* The socket would block; drop the rest, as a single send would have */
+        if (sentCount == 0)
+          break;
+
+        sent += sentCount;
+    }
+
+    host -> sendBatchCount = 0;
+    return 0;
+}
+
+/** Copies a datagram into the send batch, flushing the batch first if it is full.
+    @returns the length of the datagram, or -1 on error
+*/
+static int
+enet_protocol_queue_datagram (ENetHost * host, const ENetAddress * address, const ENetBuffer * buffers, size_t bufferCount)
+{
+    ENetBuffer * datagram;
+    enet_uint8 * data;
+    size_t i;
+
+    if (host -> sendBatchCount >= enet_protocol_reserve_datagram_batch (host) &&
+        enet_protocol_flush_datagrams (host) < 0)
+      return -1;
+
+    datagram = & host -> sendBatch [host -> sendBatchCount];
+    data = (enet_uint8 *) datagram -> data;
+    for (i = 0; i < bufferCount; ++ i)
+    {
+        memcpy (data, buffers [i].data, buffers [i].dataLength);
+        data += buffers [i].dataLength;
+    }
+    datagram -> dataLength = data - (enet_uint8 *) datagram -> data;
+    host -> sendBatchAddresses [host -> sendBatchCount ++] = * address;
+
+    return (int) datagram -> dataLength;
+}
+
+static int
+enet_protocol_receive_incoming_commands (ENetHost * host, ENetEvent * event)
+{
+    for (;;)
+    {
+       int receivedLength = enet_protocol_receive_datagram (host);
 
        if (receivedLength < 0)
          return -1;
 
        if (receivedLength == 0)
          return 0;
-
-       host -> receivedData = host -> packetData [0];
-       host -> receivedDataLength = receivedLength;
       
        host -> totalReceivedData += receivedLength;
        host -> totalReceivedPackets ++;
@@ -1638,7 +1788,7 @@ enet_protocol_send_outgoing_commands (ENetHost * host, ENetEvent * event, int ch
             enet_protocol_check_timeouts (host, currentPeer, event) == 1)
         {
             if (event != NULL && event -> type != ENET_EVENT_TYPE_NONE)
-              return 1;
+              return enet_protocol_flush_datagrams (host) < 0 ? -1 : 1;
             else
               continue;
         }
@@ -1702,8 +1852,10 @@ enet_protocol_send_outgoing_commands (ENetHost * host, ENetEvent * event, int ch
         shouldCompress = 0;
         if (host -> compressor.context != NULL && host -> compressor.compress != NULL)
         {
-            size_t originalSize = host -> packetSize - sizeof(ENetProtocolHeader),
-                   compressedSize = host -> compressor.compress (host -> compressor.context,
+            size_t originalSize, compressedSize;
+            host -> compressingPeer = currentPeer;
+            originalSize = host -> packetSize - sizeof(ENetProtocolHeader);
+            compressedSize = host -> compressor.compress (host -> compressor.context,
                                         & host -> buffers [1], host -> bufferCount - 1,
                                         originalSize,
                                         host -> packetData [1],
@@ -1738,7 +1890,11 @@ enet_protocol_send_outgoing_commands (ENetHost * host, ENetEvent * event, int ch
 
         currentPeer -> lastSendTime = host -> serviceTime;
 
-        sentLength = enet_socket_send (host -> socket, & currentPeer -> address, host -> buffers, host -> bufferCount);
+        /* Batched datagrams are copied, as the unreliable commands they are made of go right away */
+        if (enet_protocol_reserve_datagram_batch (host) > 1)
+          sentLength = enet_protocol_queue_datagram (host, & currentPeer -> address, host -> buffers, host -> bufferCount);
+        else
+          sentLength = enet_socket_send (host -> socket, & currentPeer -> address, host -> buffers, host -> bufferCount);
 
         enet_protocol_remove_sent_unreliable_commands (currentPeer);
 
@@ -1749,7 +1905,7 @@ enet_protocol_send_outgoing_commands (ENetHost * host, ENetEvent * event, int ch
         host -> totalSentPackets ++;
     }
    
-    return 0;
+    return enet_protocol_flush_datagrams (host);
 }
 
 /** Sends any queued packets on the host specified to its designated peers.
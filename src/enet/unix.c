@@ -4,6 +4,15 @@
 */
 #ifndef _WIN32
 
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+#ifndef HAS_MMSG
+#define HAS_MMSG 1
+#endif
+#endif
+
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
@@ -444,6 +453,152 @@ enet_socket_receive (ENetSocket socket,
     return recvLength;
 }
 
+/** Sends up to bufferCount datagrams, the i-th one made of buffers [i] and going to addresses [i],
+    in as few system calls as the platform allows.
+    @returns the number of datagrams sent, 0 if the socket would block, or -1 on error
+*/
+int
+enet_socket_send_batch (ENetSocket socket,
+                        const ENetAddress * addresses,
+                        const ENetBuffer * buffers,
+                        size_t bufferCount)
+{
+    size_t i;
+
+#ifdef HAS_MMSG
+    static int noMmsg = 0;
+
+    if (! noMmsg)
+    {
+        struct mmsghdr msgs [ENET_HOST_MAXIMUM_DATAGRAM_BATCH];
+        struct sockaddr_in sins [ENET_HOST_MAXIMUM_DATAGRAM_BATCH];
+        int sent;
+
+        if (bufferCount > ENET_HOST_MAXIMUM_DATAGRAM_BATCH)
+          bufferCount = ENET_HOST_MAXIMUM_DATAGRAM_BATCH;
+
+        memset (msgs, 0, sizeof (struct mmsghdr) * bufferCount);
+
+        for (i = 0; i < bufferCount; ++ i)
+        {
+            memset (& sins [i], 0, sizeof (struct sockaddr_in));
+
+            sins [i].sin_family = AF_INET;
+            sins [i].sin_port = ENET_HOST_TO_NET_16 (addresses [i].port);
+            sins [i].sin_addr.s_addr = addresses [i].host;
+
+            msgs [i].msg_hdr.msg_name = & sins [i];
+            msgs [i].msg_hdr.msg_namelen = sizeof (struct sockaddr_in);
+            msgs [i].msg_hdr.msg_iov = (struct iovec *) & buffers [i];
+            msgs [i].msg_hdr.msg_iovlen = 1;
+        }
+
+        sent = sendmmsg (socket, msgs, bufferCount, MSG_NOSIGNAL);
+
+        if (sent != -1)
+          return sent;
+
+        if (errno == EWOULDBLOCK)
+          return 0;
+
+        if (errno != ENOSYS)
+          return -1;
+
+        noMmsg = 1;
+    }
+#endif
+
+    for (i = 0; i < bufferCount; ++ i)
+    {
+        int sentLength = enet_socket_send (socket, & addresses [i], & buffers [i], 1);
+
+        if (sentLength < 0)
+          return i > 0 ? (int) i : -1;
+
+        if (sentLength == 0)
+          break;
+    }
+
+    return (int) i;
+}
+
+/** Receives up to bufferCount datagrams, the i-th one into buffers [i] (whose dataLength is
+    updated to the length received) from addresses [i], in as few system calls as the platform allows.
+    @returns the number of datagrams received, 0 if none are waiting, or -1 on error
+*/
+int
+enet_socket_receive_batch (ENetSocket socket,
+                           ENetAddress * addresses,
+                           ENetBuffer * buffers,
+                           size_t bufferCount)
+{
+    size_t i;
+
+#ifdef HAS_MMSG
+    static int noMmsg = 0;
+
+    if (! noMmsg)
+    {
+        struct mmsghdr msgs [ENET_HOST_MAXIMUM_DATAGRAM_BATCH];
+        struct sockaddr_in sins [ENET_HOST_MAXIMUM_DATAGRAM_BATCH];
+        int received;
+
+        if (bufferCount > ENET_HOST_MAXIMUM_DATAGRAM_BATCH)
+          bufferCount = ENET_HOST_MAXIMUM_DATAGRAM_BATCH;
+
+        memset (msgs, 0, sizeof (struct mmsghdr) * bufferCount);
+
+        for (i = 0; i < bufferCount; ++ i)
+        {
+            msgs [i].msg_hdr.msg_name = & sins [i];
+            msgs [i].msg_hdr.msg_namelen = sizeof (struct sockaddr_in);
+            msgs [i].msg_hdr.msg_iov = (struct iovec *) & buffers [i];
+            msgs [i].msg_hdr.msg_iovlen = 1;
+        }
+
+        received = recvmmsg (socket, msgs, bufferCount, MSG_NOSIGNAL, NULL);
+
+        if (received != -1)
+        {
+            for (i = 0; i < (size_t) received; ++ i)
+            {
+                if (msgs [i].msg_hdr.msg_flags & MSG_TRUNC)
+                  return -1;
+
+                buffers [i].dataLength = msgs [i].msg_len;
+                addresses [i].host = (enet_uint32) sins [i].sin_addr.s_addr;
+                addresses [i].port = ENET_NET_TO_HOST_16 (sins [i].sin_port);
+            }
+
+            return received;
+        }
+
+        if (errno == EWOULDBLOCK)
+          return 0;
+
+        if (errno != ENOSYS)
+          return -1;
+
+        noMmsg = 1;
+    }
+#endif
+
+    for (i = 0; i < bufferCount; ++ i)
+    {
+        int receivedLength = enet_socket_receive (socket, & addresses [i], & buffers [i], 1);
+
+        if (receivedLength < 0)
+          return i > 0 ? (int) i : -1;
+
+        if (receivedLength == 0)
+          break;
+
+        buffers [i].dataLength = receivedLength;
+    }
+
+    return (int) i;
+}
+
 int
 enet_socketset_select (ENetSocket maxSocket, ENetSocketSet * readSet, ENetSocketSet * writeSet, enet_uint32 timeout)
 {
@@ -357,6 +357,52 @@ enet_socket_receive (ENetSocket socket,
     return (int) recvLength;
 }
 
+int
+enet_socket_send_batch (ENetSocket socket,
+                        const ENetAddress * addresses,
+                        const ENetBuffer * buffers,
+                        size_t bufferCount)
+{
+    size_t i;
+
+    for (i = 0; i < bufferCount; ++ i)
+    {
+        int sentLength = enet_socket_send (socket, & addresses [i], & buffers [i], 1);
+
+        if (sentLength < 0)
+          return i > 0 ? (int) i : -1;
+
+        if (sentLength == 0)
+          break;
+    }
+
+    return (int) i;
+}
+
+int
+enet_socket_receive_batch (ENetSocket socket,
+                           ENetAddress * addresses,
+                           ENetBuffer * buffers,
+                           size_t bufferCount)
+{
+    size_t i;
+
+    for (i = 0; i < bufferCount; ++ i)
+    {
+        int receivedLength = enet_socket_receive (socket, & addresses [i], & buffers [i], 1);
+
+        if (receivedLength < 0)
+          return i > 0 ? (int) i : -1;
+
+        if (receivedLength == 0)
+          break;
+
+        buffers [i].dataLength = receivedLength;
+    }
+
+    return (int) i;
+}
+
 int
 enet_socketset_select (ENetSocket maxSocket, ENetSocketSet * readSet, ENetSocketSet * writeSet, enet_uint32 timeout)
 {
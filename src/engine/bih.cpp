@@ -1,5 +1,9 @@
 #include "engine.h"
 
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
 extern vec hitsurface;
 
 bool BIH::triintersect(const mesh &m, int tidx, const vec &mo, const vec &mray, float maxdist, float &dist, int mode)
@@ -135,10 +139,247 @@ inline bool BIH::traverse(const vec &o, const vec &ray, float maxdist, float &di
     return false;
 }
 
+// Ray packets: four lanes share one walk of the tree, so each node costs one 4-wide split test
+// instead of four scalar ones. A lane takes the same path it would alone and leaves the walk once
+// it hits something, so every lane ends with the distance the scalar traverse would give it.
+// Without SSE the lanes are traced one at a time.
+
+#ifdef __SSE__
+struct float4
+{
+    __m128 v;
+
+    float4() {}
+    float4(__m128 v) : v(v) {}
+    explicit float4(float f) : v(_mm_set1_ps(f)) {}
+    explicit float4(const float *f) : v(_mm_loadu_ps(f)) {}
+
+    float4 operator-(const float4 &o) const { return _mm_sub_ps(v, o.v); }
+    float4 operator*(const float4 &o) const { return _mm_mul_ps(v, o.v); }
+};
+
+static inline float4 min4(const float4 &a, const float4 &b) { return _mm_min_ps(a.v, b.v); }
+static inline float4 max4(const float4 &a, const float4 &b) { return _mm_max_ps(a.v, b.v); }
+// Masks of the lanes where a comparison holds
+static inline int lt4(const float4 &a, const float4 &b) { return _mm_movemask_ps(_mm_cmplt_ps(a.v, b.v)); }
+static inline int le4(const float4 &a, const float4 &b) { return _mm_movemask_ps(_mm_cmple_ps(a.v, b.v)); }
+
+struct traversestate4
+{
+    BIH::node *node;
+    float4 tmin, tmax;
+    int mask;
+};
+
+static int triintersect4(BIH &bih, const BIH::mesh &m, int tidx, const vec *mo, const vec *mray, raypacket &p, int mask, int mode)
+{
+    int hits = 0;
+    loopk(4) if(mask&(1<<k) && bih.triintersect(m, tidx, mo[k], mray[k], p.maxdist[k], p.dist[k], mode)) hits |= 1<<k;
+    return hits;
+}
+
+static int traverse4(BIH &bih, const BIH::mesh &m, raypacket &p, int mask, const ivec &order, int mode, BIH::node *curnode, float4 tmin, float4 tmax)
+{
+    traversestate4 stack[128];
+    int stacksize = 0, hits = 0;
+    float4 o[3] = { float4(p.o[0]), float4(p.o[1]), float4(p.o[2]) },
+           invray[3] = { float4(p.invray[0]), float4(p.invray[1]), float4(p.invray[2]) };
+    vec mo[4], mray[4];
+    loopk(4) if(mask&(1<<k))
+    {
+        mo[k] = m.invxform.transform(p.origin(k));
+        mray[k] = m.invxformnorm.transform(p.dir(k));
+    }
+    for(;;)
+    {
+        int axis = curnode->axis();
+        int nearidx = order[axis], faridx = nearidx^1;
+        float4 nearsplit = (float4(float(curnode->split[nearidx])) - o[axis])*invray[axis],
+               farsplit = (float4(float(curnode->split[faridx])) - o[axis])*invray[axis];
+        int nearmask = mask & ~le4(nearsplit, tmin), farmask = mask & lt4(farsplit, tmax);
+
+        // Leaves in the order the scalar traverse tests them: a near leaf, then the far child,
+        // which is also tested before descending into a near node when it is a leaf
+        if(curnode->isleaf(nearidx))
+        {
+            if(nearmask) hits |= triintersect4(bih, m, curnode->childindex(nearidx), mo, mray, p, nearmask, mode);
+            nearmask = 0;
+            farmask &= ~hits;
+        }
+        if(farmask && curnode->isleaf(faridx))
+        {
+            hits |= triintersect4(bih, m, curnode->childindex(faridx), mo, mray, p, farmask, mode);
+            farmask = 0;
+            nearmask &= ~hits;
+        }
+
+        if(nearmask)
+        {
+            if(farmask)
+            {
+                if(stacksize < int(sizeof(stack)/sizeof(stack[0])))
+                {
+                    traversestate4 &save = stack[stacksize++];
+                    save.node = curnode + curnode->childindex(faridx);
+                    save.tmin = max4(tmin, farsplit);
+                    save.tmax = tmax;
+                    save.mask = farmask;
+                }
+                else
+                {
+                    hits |= traverse4(bih, m, p, nearmask, order, mode, curnode + curnode->childindex(nearidx), tmin, min4(tmax, nearsplit));
+                    curnode += curnode->childindex(faridx);
+                    tmin = max4(tmin, farsplit);
+                    mask = farmask & ~hits;
+                    if(mask) continue;
+                    goto pop;
+                }
+            }
+            curnode += curnode->childindex(nearidx);
+            tmax = min4(tmax, nearsplit);
+            mask = nearmask;
+            continue;
+        }
+        if(farmask)
+        {
+            curnode += curnode->childindex(faridx);
+            tmin = max4(tmin, farsplit);
+            mask = farmask;
+            continue;
+        }
+    pop:
+        do
+        {
+            if(stacksize <= 0) return hits;
+            traversestate4 &restore = stack[--stacksize];
+            curnode = restore.node;
+            tmin = restore.tmin;
+            tmax = restore.tmax;
+            mask = restore.mask & ~hits;
+        } while(!mask);
+    }
+}
+
+#endif
+
+//! Traces the lanes of a packet set in mask, returning the mask of those that hit something.
+//! The lanes must head into the same octant, or they are traced one at a time.
+int BIH::traverse(raypacket &p, int mask, int mode)
+{
+    int hits = 0;
+#ifdef __SSE__
+    int octant = -1;
+    loopk(4) if(mask&(1<<k))
+    {
+        int lane = (p.ray[0][k]>0 ? 0 : 1) | (p.ray[1][k]>0 ? 0 : 2) | (p.ray[2][k]>0 ? 0 : 4);
+        if(octant < 0) octant = lane;
+        else if(octant != lane) { octant = -1; break; }
+    }
+    if(octant >= 0)
+    {
+        loopi(3) loopk(4) p.invray[i][k] = p.ray[i][k] ? 1/p.ray[i][k] : 1e16f;
+        ivec order(octant&1, (octant>>1)&1, (octant>>2)&1);
+        float4 maxdist(p.maxdist);
+        loopi(nummeshes)
+        {
+            mesh &m = meshes[i];
+            if(!(m.flags&MESH_RENDER) || (!(mode&RAY_SHADOW) && m.flags&MESH_NOCLIP)) continue;
+            int live = mask & ~hits;
+            if(!live) break;
+            // The slabs of the mesh's bounding box, four lanes at a time
+            float4 tmin, tmax;
+            loopj(3)
+            {
+                float4 o(p.o[j]), invray(p.invray[j]),
+                       t1 = (float4(m.bbmin[j]) - o)*invray,
+                       t2 = (float4(m.bbmax[j]) - o)*invray;
+                if(!j) { tmin = min4(t1, t2); tmax = max4(t1, t2); }
+                else { tmin = max4(tmin, min4(t1, t2)); tmax = min4(tmax, max4(t1, t2)); }
+            }
+            tmax = min4(tmax, maxdist);
+            live &= lt4(tmin, tmax);
+            if(live) hits |= traverse4(*this, m, p, live, order, mode, m.nodes, tmin, tmax);
+        }
+        return hits;
+    }
+#endif
+    loopk(4) if(mask&(1<<k) && traverse(p.origin(k), p.dir(k), p.maxdist[k], p.dist[k], mode)) hits |= 1<<k;
+    return hits;
+}
+
+VAR(bihsah, 0, 1, 1);
+
+#define BIHSAHBINS 16
+
+static inline float bihsurface(const ivec &bbmin, const ivec &bbmax)
+{
+    float dx = bbmax.x - bbmin.x, dy = bbmax.y - bbmin.y, dz = bbmax.z - bbmin.z;
+    return dx*dy + dy*dz + dz*dx;
+}
+
+// Picks the split with the least surface area heuristic cost among BIHSAHBINS candidates per axis.
+// Triangles are binned by their centers, which is also what decides their side in BIH::build.
+static bool findsahsplit(const BIH::tribb *tribbs, const ushort *indices, int numindices, const ivec &vmin, const ivec &vmax, int &bestaxis, int &bestsplit)
+{
+    struct sahbin
+    {
+        ivec bbmin, bbmax;
+        int count;
+    } bins[BIHSAHBINS];
+    float bestcost = 1e30f;
+    loopk(3)
+    {
+        int lo = vmin[k], range = vmax[k] - vmin[k] + 1;
+        if(range < 2) continue;
+        loopi(BIHSAHBINS)
+        {
+            bins[i].bbmin = ivec(INT_MAX, INT_MAX, INT_MAX);
+            bins[i].bbmax = ivec(INT_MIN, INT_MIN, INT_MIN);
+            bins[i].count = 0;
+        }
+        loopi(numindices)
+        {
+            const BIH::tribb &tri = tribbs[indices[i]];
+            sahbin &bin = bins[clamp((tri.center[k] - lo)*BIHSAHBINS/range, 0, BIHSAHBINS-1)];
+            bin.bbmin.min(ivec(tri.center).sub(ivec(tri.radius)));
+            bin.bbmax.max(ivec(tri.center).add(ivec(tri.radius)));
+            bin.count++;
+        }
+        float leftcost[BIHSAHBINS];
+        int leftcount[BIHSAHBINS];
+        ivec bbmin(INT_MAX, INT_MAX, INT_MAX), bbmax(INT_MIN, INT_MIN, INT_MIN);
+        int count = 0;
+        loopi(BIHSAHBINS-1)
+        {
+            if(bins[i].count) { bbmin.min(bins[i].bbmin); bbmax.max(bins[i].bbmax); count += bins[i].count; }
+            leftcount[i] = count;
+            leftcost[i] = count ? bihsurface(bbmin, bbmax)*count : 0;
+        }
+        bbmin = ivec(INT_MAX, INT_MAX, INT_MAX);
+        bbmax = ivec(INT_MIN, INT_MIN, INT_MIN);
+        count = 0;
+        for(int i = BIHSAHBINS-1; i > 0; i--)
+        {
+            if(bins[i].count) { bbmin.min(bins[i].bbmin); bbmax.max(bins[i].bbmax); count += bins[i].count; }
+            if(!count || !leftcount[i-1]) continue;
+            float cost = leftcost[i-1] + bihsurface(bbmin, bbmax)*count;
+            if(cost < bestcost)
+            {
+                bestcost = cost;
+                bestaxis = k;
+                // The lowest center that lands in bin i or above
+                bestsplit = lo + (i*range + BIHSAHBINS-1)/BIHSAHBINS;
+            }
+        }
+    }
+    return bestcost < 1e30f;
+}
+
 void BIH::build(mesh &m, ushort *indices, int numindices, const ivec &vmin, const ivec &vmax)
 {
-    int axis = 2;
-    loopk(2) if(vmax[k] - vmin[k] > vmax[axis] - vmin[axis]) axis = k;
+    int axis = 2, sahsplit = 0;
+    bool sah = bihsah && numindices > 2 && findsahsplit(m.tribbs, indices, numindices, vmin, vmax, axis, sahsplit);
+    if(!sah) loopk(2) if(vmax[k] - vmin[k] > vmax[axis] - vmin[axis]) axis = k;
 
     ivec leftmin, leftmax, rightmin, rightmax;
     int splitleft, splitright;
@@ -147,7 +388,8 @@ void BIH::build(mesh &m, ushort *indices, int numindices, const ivec &vmin, cons
     {
         leftmin = rightmin = ivec(INT_MAX, INT_MAX, INT_MAX);
         leftmax = rightmax = ivec(INT_MIN, INT_MIN, INT_MIN);
-        int split = (vmax[axis] + vmin[axis])/2;
+        int split = sah ? sahsplit : (vmax[axis] + vmin[axis])/2;
+        sah = false;
         for(left = 0, right = numindices, splitleft = SHRT_MIN, splitright = SHRT_MAX; left < right;)
         {
             const tribb &tri = m.tribbs[indices[left]];
@@ -271,12 +513,22 @@ BIH::BIH(vector<mesh> &buildmeshes)
     entradius = max(bbmin.squaredlen(), bbmax.squaredlen());
 
     nodes = new node[numtris];
+    if(!loadnodes())
+    {
+        buildnodes();
+        savenodes();
+    }
+}
+
+void BIH::buildnodes()
+{
     node *curnode = nodes;
     ushort *indices = new ushort[numtris];
     loopi(nummeshes)
     {
         mesh &m = meshes[i];
         m.nodes = curnode;
+        m.numnodes = 0;
         loopj(m.numtris) indices[j] = j;
         build(m, indices, m.numtris, ivec::floor(m.bbmin), ivec::ceil(m.bbmax));
         curnode += m.numnodes;
@@ -285,6 +537,159 @@ BIH::BIH(vector<mesh> &buildmeshes)
     numnodes = int(curnode - nodes);
 }
 
+// Built trees are cached on disk, named after a checksum of everything the build reads: the
+// triangle bounds of every mesh, their bounding boxes and the builder in use
+VARP(bihcache, 0, 1, 1);
+
+#define BIHCACHEVERSION 1
+
+void BIH::cachefile(string &file)
+{
+    uint crc = crc32(0, Z_NULL, 0), adler = adler32(0, Z_NULL, 0);
+    int header[3] = { BIHCACHEVERSION, bihsah, nummeshes };
+    crc = crc32(crc, (const Bytef *)header, sizeof(header));
+    adler = adler32(adler, (const Bytef *)header, sizeof(header));
+    loopi(nummeshes)
+    {
+        const mesh &m = meshes[i];
+        ivec bounds[2] = { ivec::floor(m.bbmin), ivec::ceil(m.bbmax) };
+        crc = crc32(crc, (const Bytef *)&m.numtris, sizeof(m.numtris));
+        crc = crc32(crc, (const Bytef *)bounds, sizeof(bounds));
+        adler = adler32(adler, (const Bytef *)bounds, sizeof(bounds));
+    }
+    crc = crc32(crc, (const Bytef *)tribbs, numtris*sizeof(tribb));
+    adler = adler32(adler, (const Bytef *)tribbs, numtris*sizeof(tribb));
+    formatstring(file, "cache/bih/%08x%08x.bih", crc, adler);
+}
+
+bool BIH::loadnodes()
+{
+    if(!bihcache) return false;
+    string file;
+    cachefile(file);
+    stream *f = openrawfile(file, "rb");
+    if(!f) return false;
+    bool valid = f->getlil<int>() == BIHCACHEVERSION && f->getlil<int>() == nummeshes && f->getlil<int>() == numtris;
+    node *curnode = nodes;
+    for(int i = 0; valid && i < nummeshes; i++)
+    {
+        mesh &m = meshes[i];
+        m.nodes = curnode;
+        m.numnodes = f->getlil<int>();
+        valid = m.numnodes >= 0 && m.numnodes <= m.numtris && curnode + m.numnodes <= nodes + numtris;
+        curnode += max(m.numnodes, 0);
+    }
+    numnodes = int(curnode - nodes);
+    if(valid)
+    {
+        valid = f->read(nodes, numnodes*sizeof(node)) == int(numnodes*sizeof(node));
+        lilswap((ushort *)nodes, numnodes*4);
+    }
+    delete f;
+    // A damaged cache must not make traversal wander off the node array
+    for(int i = 0; valid && i < nummeshes; i++)
+    {
+        const mesh &m = meshes[i];
+        loopj(m.numnodes) loopk(2)
+        {
+            const node &n = m.nodes[j];
+            int child = n.childindex(k);
+            if(n.isleaf(k) ? child >= m.numtris : child <= 0 || j + child >= m.numnodes) { valid = false; break; }
+        }
+    }
+    if(!valid) conoutf(CON_WARN, "ignoring damaged BIH cache %s", file);
+    return valid;
+}
+
+bool BIH::savenodes()
+{
+    if(!bihcache || !numnodes) return false;
+    string file;
+    cachefile(file);
+    stream *f = openrawfile(file, "wb");
+    if(!f) return false;
+    f->putlil<int>(BIHCACHEVERSION);
+    f->putlil<int>(nummeshes);
+    f->putlil<int>(numtris);
+    loopi(nummeshes) f->putlil<int>(meshes[i].numnodes);
+    lilswap((ushort *)nodes, numnodes*4);
+    bool written = f->write(nodes, numnodes*sizeof(node)) == int(numnodes*sizeof(node));
+    lilswap((ushort *)nodes, numnodes*4);
+    delete f;
+    return written;
+}
+
+static inline float bihbenchrnd(uint &seed, float scale)
+{
+    seed = seed*1664525 + 1013904223;
+    return (seed>>8)*scale/float(1<<24);
+}
+
+// Times building, tracing and loading from the cache for the trees of every map model in the
+// current map, with the old midpoint builder against the surface area heuristic
+static void bihbench(int *numrays)
+{
+    vector<BIH *> trees;
+    const vector<extentity *> &ents = entities::getents();
+    loopv(ents)
+    {
+        model *m = ents[i]->m;
+        if(!m || !m->setBIH() || trees.find(m->bih) >= 0 || !m->bih->numtris) continue;
+        trees.add(m->bih);
+    }
+    if(trees.empty()) { conoutf(CON_WARN, "no map models with triangle trees to benchmark"); return; }
+
+    int rays = clamp(*numrays > 0 ? *numrays : 10000, 1, 1000000), oldsah = bihsah, oldcache = bihcache;
+    int tris = 0;
+    loopv(trees) tris += trees[i]->numtris;
+    conoutf("bihbench: %d trees, %d triangles, %d rays per tree", trees.length(), tris, rays);
+    llong loadtime = 0;
+    loopk(2)
+    {
+        bihsah = k;
+        llong buildtime = 0, tracetime = 0;
+        int hits = 0;
+        loopv(trees)
+        {
+            BIH &b = *trees[i];
+            llong start = getmicros();
+            b.buildnodes();
+            buildtime += getmicros() - start;
+
+            // The same rays for both builders: from around the model towards points inside it
+            uint seed = 12345;
+            start = getmicros();
+            loopj(rays)
+            {
+                vec dir, target;
+                loopl(3) dir[l] = bihbenchrnd(seed, 2) - 1;
+                loopl(3) target[l] = b.bbmin[l] + bihbenchrnd(seed, b.bbmax[l] - b.bbmin[l]);
+                if(dir.iszero()) dir = vec(0, 0, 1);
+                vec o = dir.normalize().mul(b.radius*1.5f).add(b.center),
+                    ray = target.sub(o).normalize();
+                float dist;
+                if(b.traverse(o, ray, 1e16f, dist, RAY_SHADOW)) hits++;
+            }
+            tracetime += getmicros() - start;
+            if(k)
+            {
+                bihcache = 1;
+                b.savenodes();
+                start = getmicros();
+                if(!b.loadnodes()) b.buildnodes();
+                loadtime += getmicros() - start;
+            }
+        }
+        conoutf("  %s: build %.2f ms, trace %.3f us per ray (%d hits)", k ? "surface area heuristic" : "midpoint",
+            buildtime/1000.0f, float(tracetime)/(rays*trees.length()), hits);
+    }
+    conoutf("  loading every tree from the cache: %.2f ms", loadtime/1000.0f);
+    bihsah = oldsah;
+    bihcache = oldcache;
+    loopv(trees) if(!trees[i]->loadnodes()) trees[i]->buildnodes();
+}
+COMMAND(bihbench, "i");
+
 BIH::~BIH()
 {
     delete[] meshes;
@@ -340,6 +745,51 @@ bool mmintersect(const extentity &e, const vec &o, const vec &ray, float maxdist
     return false;
 }
 
+//! mmintersect for the lanes of a packet set in mask, returning the mask of those that hit. Only the
+//! distances are found: hitsurface is left as the last triangle tested set it
+int mmintersect(const extentity &e, const vec *o, const vec *ray, int mask, const float *maxdist, float *dist, int mode)
+{
+    model *m = e.m;
+    if(!m) return 0;
+    if(mode&RAY_SHADOW)
+    {
+        if(!m->shadow || e.flags&EF_NOSHADOW) return 0;
+    }
+    else if((mode&RAY_ENTS)!=RAY_ENTS && (!m->collide || e.flags&EF_NOCOLLIDE)) return 0;
+    if(!m->bih && !m->setBIH()) return 0;
+    int scale = e.attr[3], yaw = e.attr[0], pitch = e.attr[1], roll = e.attr[2]; // OF
+    vec2 yawrot = sincosmod360(-yaw), pitchrot = sincosmod360(-pitch), rollrot = sincosmod360(roll);
+    raypacket p;
+    int first = -1;
+    loopk(4) if(mask&(1<<k))
+    {
+        vec mo = vec(o[k]).sub(e.o), mray(ray[k]);
+        if(scale > 0) mo.mul(100.0f/scale);
+        float v = mo.dot(mray), inside = m->bih->entradius - mo.squaredlen();
+        if((inside < 0 && v > 0) || inside + v*v < 0) { mask &= ~(1<<k); continue; }
+        if(yaw != 0) { mo.rotate_around_z(yawrot); mray.rotate_around_z(yawrot); }
+        if(pitch != 0) { mo.rotate_around_x(pitchrot); mray.rotate_around_x(pitchrot); }
+        if(roll != 0) { mo.rotate_around_y(rollrot); mray.rotate_around_y(rollrot); }
+        loopi(3) { p.o[i][k] = mo[i]; p.ray[i][k] = mray[i]; }
+        p.maxdist[k] = maxdist[k] ? maxdist[k] : 1e16f;
+        if(first < 0) first = k;
+    }
+    if(!mask) return 0;
+    // Idle lanes copy a live one, so their arithmetic stays finite
+    loopk(4) if(!(mask&(1<<k)))
+    {
+        loopi(3) { p.o[i][k] = p.o[i][first]; p.ray[i][k] = p.ray[i][first]; }
+        p.maxdist[k] = p.maxdist[first];
+    }
+    int hits = m->bih->traverse(p, mask, mode);
+    loopk(4) if(hits&(1<<k))
+    {
+        dist[k] = p.dist[k];
+        if(scale > 0) dist[k] *= scale/100.0f;
+    }
+    return hits;
+}
+
 static inline float segmentdistance(const vec &d1, const vec &d2, const vec &r)
 {
     float a = d1.squaredlen(), e = d2.squaredlen(), f = d2.dot(r), s, t;
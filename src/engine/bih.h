@@ -1,3 +1,13 @@
+//! Up to four rays traced through a BIH together, with each component stored for all lanes
+struct raypacket
+{
+    float o[3][4], ray[3][4], invray[3][4];
+    float maxdist[4], dist[4];
+
+    vec origin(int k) const { return vec(o[0][k], o[1][k], o[2][k]); }
+    vec dir(int k) const { return vec(ray[0][k], ray[1][k], ray[2][k]); }
+};
+
 struct BIH
 {
     struct node
@@ -58,9 +68,14 @@ struct BIH
     ~BIH();
 
     void build(mesh &m, ushort *indices, int numindices, const ivec &vmin, const ivec &vmax);
+    void buildnodes();
+    void cachefile(string &file);
+    bool loadnodes();
+    bool savenodes();
 
     bool traverse(const vec &o, const vec &ray, float maxdist, float &dist, int mode);
     bool traverse(const mesh &m, const vec &o, const vec &ray, const vec &invray, float maxdist, float &dist, int mode, node *curnode, float tmin, float tmax);
+    int traverse(raypacket &p, int mask, int mode);
     bool triintersect(const mesh &m, int tidx, const vec &mo, const vec &mray, float maxdist, float &dist, int mode);
 
     bool boxcollide(physent *d, const vec &dir, float cutoff, const vec &o, int yaw, int pitch, int roll, float scale = 1);
@@ -75,4 +90,5 @@ struct BIH
 };
 
 extern bool mmintersect(const extentity &e, const vec &o, const vec &ray, float maxdist, int mode, float &dist);
+extern int mmintersect(const extentity &e, const vec *o, const vec *ray, int mask, const float *maxdist, float *dist, int mode);
 
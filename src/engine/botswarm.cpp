@@ -0,0 +1,423 @@
+// botswarm.cpp: loopback load generator, connects headless bots to this server to see how it scales
+
+#include "engine.h"
+#include "game.h"
+#include "network_system.h"
+#include "message_system.h"
+#include "of_world.h"
+
+extern ENetHost *serverhost;
+extern int getfreepeers();
+
+// A swarm is a set of headless clients that run inside the dedicated server, but talk to it only
+// through their own ENet host over loopback, like any remote player would. Each bot logs in, asks
+// for the current scenario and its entities, and once those are through walks a circle, sending
+// positions at the rate of a real client, pinging the server and now and then changing one of its
+// state variables. A swarm runs in steps of 1, 2, 4... bots: each step connects its bots, waits for
+// them to join, then measures the server's own time per tick (without the bots and without waiting
+// for the network), the bandwidth per bot and the round trip time of the pings.
+
+VAR(botswarmrate, 10, 40, 1000);          // ms between position updates, as c2sinfo
+VAR(botswarmpingrate, 50, 250, 10000);    // ms between pings
+VAR(botswarmsdatarate, 0, 1000, 60000);   // ms between state data changes of a bot, 0 for none
+SVAR(botswarmsdata, "character_name");    // the state variable bots change, a string
+VAR(botswarmradius, 8, 64, 1024);         // radius of the circles bots walk
+VAR(botswarmjointime, 1000, 15000, 120000); // ms bots are given to join before a step is measured anyway
+
+enum { BOT_CONNECTING = 0, BOT_LOGGINGIN, BOT_JOINING, BOT_JOINED, BOT_DISCONNECTED };
+enum { SWARM_IDLE = 0, SWARM_JOIN, SWARM_MEASURE, SWARM_LEAVE };
+
+struct swarmbot
+{
+    ENetPeer *peer;
+    int state, cn, uid, sdatakey, snapshot, changes;
+    int nextpos, nextping, nextsdata, joinmillis;
+    vec center;
+    float speed;
+
+    swarmbot() : peer(NULL), state(BOT_CONNECTING), cn(-1), uid(-1), sdatakey(-1), snapshot(0), changes(0),
+                 nextpos(0), nextping(0), nextsdata(0), joinmillis(0), center(0, 0, 0), speed(0) {}
+};
+
+struct swarmstep
+{
+    int bots, joined, slices;
+    float tickavg, tickp99, tickmax, kbin, kbout, ping50, ping95, ping99;
+};
+
+static ENetHost *swarmhost = NULL;
+static vector<swarmbot *> swarmbots;
+static vector<int> swarmticks, swarmpings;
+static vector<swarmstep> swarmsteps;
+static int swarmphase = SWARM_IDLE, swarmphasestart = 0, swarmsize = 0, swarmmax = 0, swarmmillis = 0;
+static bool swarmcapped = false, swarmquit = false;
+static llong swarmepoch = 0;
+
+static void sendbotpacket(swarmbot &b, int chan, ENetPacket *packet)
+{
+    if(enet_peer_send(b.peer, chan, packet) < 0) enet_packet_destroy(packet);
+}
+
+template<class T> static void sendbotmessage(swarmbot &b, typename T::Fields &msg, bool reliable = true)
+{
+    sendbotpacket(b, MAIN_CHANNEL, MessageSystem::buildMessage<T>(msg, reliable));
+}
+
+static void joinbot(swarmbot &b)
+{
+    if(b.state == BOT_JOINED) return;
+    b.state = BOT_JOINED;
+    b.joinmillis = totalmillis;
+    b.nextpos = b.nextping = totalmillis;
+    b.nextsdata = totalmillis + (botswarmsdatarate ? rnd(botswarmsdatarate) : 0);
+    int r = min(botswarmradius, worldsize/4);
+    b.center = vec(r + rnd(max(worldsize - 2*r, 1)), r + rnd(max(worldsize - 2*r, 1)), worldsize/2);
+    b.speed = (40 + rnd(40))/float(r); // 40-80 units per second along the circle
+    b.sdatakey = -1;
+    if(botswarmsdata[0] && b.uid >= 0)
+        lua::pop_external_ret(lua::call_external_ret("entity_get_sdata_id", "is", "i", b.uid, botswarmsdata, &b.sdatakey));
+}
+
+static void parsebotmessage(swarmbot &b, ucharbuf &p)
+{
+    // Every message the bots act on arrives in a packet of its own, anything else is only counted
+    int type = getint(p);
+    switch(type)
+    {
+        case MessageSystem::InitS2C::CODE:
+        {
+            MessageSystem::InitS2C::Fields msg;
+            if(!MessageSystem::readMessage(p, msg)) break;
+            if(msg.protocolVersion != PROTOCOL_VERSION)
+            {
+                conoutf(CON_ERROR, "botswarm: server uses protocol %d, bots %d", msg.protocolVersion, PROTOCOL_VERSION);
+                enet_peer_disconnect(b.peer, DISC_NONE);
+                break;
+            }
+            b.cn = msg.explicitClientNumber;
+            b.state = BOT_LOGGINGIN;
+            MessageSystem::LoginRequest::Fields login;
+            sendbotmessage<MessageSystem::LoginRequest>(b, login);
+            break;
+        }
+
+        case MessageSystem::YourUniqueId::CODE:
+        {
+            MessageSystem::YourUniqueId::Fields msg;
+            if(MessageSystem::readMessage(p, msg)) b.uid = msg.uid;
+            break;
+        }
+
+        case MessageSystem::LoginResponse::CODE:
+        {
+            MessageSystem::LoginResponse::Fields msg;
+            if(!MessageSystem::readMessage(p, msg)) break;
+            if(!msg.success) { enet_peer_disconnect(b.peer, DISC_NONE); break; }
+            MessageSystem::RequestCurrentScenario::Fields request;
+            sendbotmessage<MessageSystem::RequestCurrentScenario>(b, request);
+            break;
+        }
+
+        case MessageSystem::NotifyAboutCurrentScenario::CODE:
+        {
+            // Bots have the map already: it is the one this server runs
+            MessageSystem::NotifyAboutCurrentScenario::Fields msg;
+            if(!MessageSystem::readMessage(p, msg)) break;
+            b.state = BOT_JOINING;
+            MessageSystem::ActiveEntitiesRequest::Fields request = { msg.sc };
+            sendbotmessage<MessageSystem::ActiveEntitiesRequest>(b, request);
+            break;
+        }
+
+        case MessageSystem::AllActiveEntitiesSent::CODE:
+            joinbot(b);
+            break;
+
+        case N_PONG:
+        {
+            int sent = getint(p);
+            if(swarmphase == SWARM_MEASURE) swarmpings.add(int(getmicros() - swarmepoch) - sent);
+            break;
+        }
+    }
+}
+
+static void parsebotpacket(swarmbot &b, int chan, ENetPacket *packet)
+{
+    ucharbuf p(packet->data, packet->dataLength);
+    switch(chan)
+    {
+        case 0:
+            while(p.remaining()) switch(getint(p))
+            {
+                case N_POS:
+                {
+                    NetworkSystem::PositionUpdater::QuantizedInfo info;
+                    info.generateFrom(p);
+                    break;
+                }
+
+                case N_SNAPSHOT:
+                {
+                    // The base of a snapshot is always one the bot acknowledged, so bots acknowledge
+                    // every snapshot they get without decoding it, as a real client would after decoding
+                    int sequence = getint(p);
+                    getint(p);
+                    p.subbuf(getuint(p));
+                    if(sequence > 0 && !p.overread()) b.snapshot = sequence;
+                    break;
+                }
+
+                default: return;
+            }
+            break;
+
+        case MAIN_CHANNEL:
+            parsebotmessage(b, p);
+            break;
+
+        case ENTITY_CHANNEL:
+            if(getint(p) == 1) // The last chunk of the entity snapshot
+            {
+                MessageSystem::EntityStreamReceived::Fields msg;
+                sendbotmessage<MessageSystem::EntityStreamReceived>(b, msg);
+                joinbot(b);
+            }
+            break;
+    }
+}
+
+//! Sends what a joined bot has due: its position, acknowledgements, pings and state data changes
+static void updatebot(swarmbot &b)
+{
+    if(b.state != BOT_JOINED || totalmillis - b.nextpos < 0) return;
+    b.nextpos = totalmillis + botswarmrate;
+
+    float r = min(botswarmradius, worldsize/4), angle = (totalmillis - b.joinmillis)/1000.0f*b.speed;
+    vec o(b.center.x + cosf(angle)*r, b.center.y + sinf(angle)*r, b.center.z),
+        vel(-sinf(angle)*r*b.speed, cosf(angle)*r*b.speed, 0);
+
+    NetworkSystem::PositionUpdater::QuantizedInfo info;
+    info.clientNumber = b.cn;
+    info.position = ivec(int(o.x*DMF), int(o.y*DMF), int(o.z*DMF));
+    info.yaw = uchar(int(angle*128/PI) + 64);
+    info.pitch = info.roll = 128;
+    info.velocity = ivec(int(vel.x*DVELF), int(vel.y*DVELF), int(vel.z*DVELF));
+    info.hasFalling = false;
+    info.falling = ivec(0, 0, 0);
+    info.misc = PHYS_FLOOR | ((1 + 1) << 4) | ((0 + 1) << 6); // Walking forward, not strafing
+    info.crouching = false;
+    info.mapDefinedPositionData = 0;
+    packetbuf q(100);
+    info.applyToBuffer(q);
+    enet_peer_send(b.peer, 0, q.finalize());
+
+    packetbuf p(MAXTRANS);
+    if(b.snapshot)
+    {
+        putint(p, N_SNAPACK);
+        putint(p, b.snapshot);
+        b.snapshot = 0;
+    }
+    if(totalmillis - b.nextping >= 0)
+    {
+        putint(p, N_PING);
+        putint(p, int(getmicros() - swarmepoch));
+        b.nextping = totalmillis + botswarmpingrate;
+    }
+    if(p.length()) enet_peer_send(b.peer, MAIN_CHANNEL, p.finalize());
+
+    if(botswarmsdatarate && b.sdatakey >= 0 && totalmillis - b.nextsdata >= 0)
+    {
+        b.nextsdata = totalmillis + botswarmsdatarate;
+        defformatstring(value, "bot %d #%d", b.cn, ++b.changes);
+        MessageSystem::StateDataChangeRequest::Fields msg = { b.uid, b.sdatakey, MessageSystem::StateDataValue() };
+        msg.value.setstring(value, strlen(value));
+        sendbotmessage<MessageSystem::StateDataChangeRequest>(b, msg);
+    }
+}
+
+static void clearswarm()
+{
+    swarmbots.deletecontents();
+    if(swarmhost) { enet_host_destroy(swarmhost); swarmhost = NULL; }
+}
+
+//! How many more clients the server has room for. The network I/O thread may own the host, so
+//! this goes through the count it publishes rather than the peers
+static int swarmcapacity()
+{
+    return getfreepeers();
+}
+
+static void startswarmstep()
+{
+    clearswarm();
+    swarmhost = enet_host_create(NULL, swarmsize, server::numchannels(), 0, 0);
+    if(!swarmhost) { conoutf(CON_ERROR, "botswarm: could not create a host for %d bots", swarmsize); swarmphase = SWARM_IDLE; return; }
+    ENetAddress address;
+    enet_address_set_host(&address, "127.0.0.1");
+    address.port = serverhost->address.port;
+    loopi(swarmsize)
+    {
+        swarmbot *b = new swarmbot;
+        b->peer = enet_host_connect(swarmhost, &address, server::numchannels(), 0);
+        if(!b->peer) { delete b; break; }
+        b->peer->data = b;
+        swarmbots.add(b);
+    }
+    swarmphase = SWARM_JOIN;
+    swarmphasestart = totalmillis;
+}
+
+static float percentile(vector<int> &v, float p)
+{
+    return v.length() ? v[min(int(v.length()*p), v.length() - 1)] : 0;
+}
+
+static void printswarmstep(const swarmstep &s)
+{
+    conoutf("  %3d bots (%3d joined): tick %6.3f ms avg %6.3f p99 %6.3f max, %7.1f KB/s in %6.1f KB/s out per bot, ping %5.1f p50 %5.1f p95 %5.1f p99 ms",
+        s.bots, s.joined, s.tickavg, s.tickp99, s.tickmax, s.kbin, s.kbout, s.ping50, s.ping95, s.ping99);
+}
+
+static void finishswarmstep()
+{
+    float seconds = max(totalmillis - swarmphasestart, 1)/1000.0f;
+    swarmstep &s = swarmsteps.add();
+    s.bots = swarmbots.length();
+    s.joined = 0;
+    loopv(swarmbots) if(swarmbots[i]->state == BOT_JOINED) s.joined++;
+    s.slices = swarmticks.length();
+    llong ticktime = 0;
+    loopv(swarmticks) ticktime += swarmticks[i];
+    swarmticks.sort();
+    swarmpings.sort();
+    s.tickavg = ticktime/1000.0f/max(s.slices, 1);
+    s.tickp99 = percentile(swarmticks, 0.99f)/1000.0f;
+    s.tickmax = percentile(swarmticks, 1)/1000.0f;
+    // What the bots' host received is what the server sent them, and the other way around
+    s.kbin = swarmhost->totalReceivedData/1024.0f/seconds/max(s.bots, 1);
+    s.kbout = swarmhost->totalSentData/1024.0f/seconds/max(s.bots, 1);
+    s.ping50 = percentile(swarmpings, 0.5f)/1000.0f;
+    s.ping95 = percentile(swarmpings, 0.95f)/1000.0f;
+    s.ping99 = percentile(swarmpings, 0.99f)/1000.0f;
+    printswarmstep(s);
+
+    loopv(swarmbots) if(swarmbots[i]->state != BOT_DISCONNECTED) enet_peer_disconnect(swarmbots[i]->peer, DISC_NONE);
+    swarmphase = SWARM_LEAVE;
+    swarmphasestart = totalmillis;
+}
+
+static void stopbotswarm()
+{
+    if(swarmphase == SWARM_IDLE) return;
+    loopv(swarmbots) if(swarmbots[i]->state != BOT_DISCONNECTED) enet_peer_disconnect_now(swarmbots[i]->peer, DISC_NONE);
+    clearswarm();
+    swarmphase = SWARM_IDLE;
+    conoutf("botswarm: %d steps up to %d bots, %d ms each%s", swarmsteps.length(), swarmsize, swarmmillis,
+        swarmcapped ? " (capped by the free client slots, see maxclients)" : "");
+    loopv(swarmsteps) printswarmstep(swarmsteps[i]);
+
+    extern bool should_quit;
+    if(swarmquit) should_quit = true;
+}
+
+static void nextswarmstep()
+{
+    int capacity = swarmcapacity();
+    int size = min(swarmsize ? swarmsize*2 : 1, swarmmax);
+    if(size > capacity) { size = capacity; swarmcapped = true; }
+    if(size <= swarmsize) { stopbotswarm(); return; }
+    swarmsize = size;
+    startswarmstep();
+}
+
+//! Ramps a swarm of bots up to 'maxbots', measuring each step for 'millis' ms, quitting after if 'quit' is set
+void startbotswarm(int maxbots, int millis, bool quit)
+{
+    stopbotswarm();
+    if(!serverhost || !world::scenario_code[0]) { conoutf(CON_ERROR, "botswarm: the server is not running a map"); return; }
+    swarmmax = maxbots;
+    swarmmillis = millis;
+    swarmquit = quit;
+    swarmsize = 0;
+    swarmcapped = false;
+    swarmsteps.setsize(0);
+    swarmepoch = getmicros();
+    conoutf("botswarm: ramping up to %d bots, measuring %d ms per step", maxbots, millis);
+    nextswarmstep();
+}
+
+static void botswarm(int *maxbots, int *millis)
+{
+    if(*maxbots <= 0) { stopbotswarm(); return; }
+    startbotswarm(*maxbots, *millis > 0 ? *millis : 5000, false);
+}
+COMMAND(botswarm, "ii");
+
+//! Runs the bots for a slice, returning the microseconds that took so the server can leave it out of its own time
+llong updatebotswarm()
+{
+    if(!swarmhost) return 0;
+    llong start = getmicros();
+
+    ENetEvent event;
+    while(enet_host_service(swarmhost, &event, 0) > 0) switch(event.type)
+    {
+        case ENET_EVENT_TYPE_RECEIVE:
+        {
+            swarmbot *b = (swarmbot *)event.peer->data;
+            if(b) parsebotpacket(*b, event.channelID, event.packet);
+            enet_packet_destroy(event.packet);
+            break;
+        }
+
+        case ENET_EVENT_TYPE_DISCONNECT:
+        {
+            swarmbot *b = (swarmbot *)event.peer->data;
+            if(b) b->state = BOT_DISCONNECTED;
+            break;
+        }
+
+        default: break;
+    }
+    loopv(swarmbots) updatebot(*swarmbots[i]);
+    enet_host_flush(swarmhost);
+
+    switch(swarmphase)
+    {
+        case SWARM_JOIN:
+        {
+            int joined = 0;
+            loopv(swarmbots) if(swarmbots[i]->state == BOT_JOINED) joined++;
+            if(joined < swarmbots.length() && totalmillis - swarmphasestart < botswarmjointime) break;
+            if(joined < swarmbots.length()) conoutf(CON_WARN, "botswarm: only %d of %d bots joined", joined, swarmbots.length());
+            swarmticks.setsize(0);
+            swarmpings.setsize(0);
+            swarmhost->totalReceivedData = swarmhost->totalSentData = 0;
+            swarmphase = SWARM_MEASURE;
+            swarmphasestart = totalmillis;
+            break;
+        }
+
+        case SWARM_MEASURE:
+            if(totalmillis - swarmphasestart >= swarmmillis) finishswarmstep();
+            break;
+
+        case SWARM_LEAVE:
+        {
+            bool gone = true;
+            loopv(swarmbots) if(swarmbots[i]->state != BOT_DISCONNECTED) gone = false;
+            if(gone || totalmillis - swarmphasestart >= 3000) nextswarmstep();
+            break;
+        }
+    }
+    return getmicros() - start;
+}
+
+//! Counts the server's own time for a slice, while a swarm is being measured
+void countbotswarmtick(int micros)
+{
+    if(swarmphase == SWARM_MEASURE) swarmticks.add(micros);
+}
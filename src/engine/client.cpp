@@ -33,6 +33,7 @@ void setrate(int rate)
 }
 
 VARF(rate, 0, 0, 1024, setrate(rate));
+VARF(clientcompression, 0, 0, 2, setnetcompression(clienthost, clientcompression));
 
 void throttle();
 
@@ -57,6 +58,14 @@ const ENetAddress *connectedpeer()
     return curpeer ? &curpeer->address : NULL;
 }
 
+//! Takes note of the network dictionary the server announced, so we compress against ours only if it is the same
+void setservernetdictionary(int id)
+{
+    if(!curpeer) return;
+    if(!setnetpeerdictionary(clienthost, curpeer, id) && id != getnetdictionary())
+        conoutf(CON_WARN, "the server uses network dictionary %d, we use %d: compressing without one", id, getnetdictionary());
+}
+
 void abortconnect()
 {
     if(!connpeer) return;
@@ -104,11 +113,16 @@ void connectserv(const char *servername, int serverport, const char *serverpassw
     }
 
     if(!clienthost)
+    {
         clienthost = enet_host_create(NULL, 2, server::numchannels(), rate*1024, rate*1024);
+        setupnetcompression(clienthost, clientcompression);
+    }
 
     if(clienthost)
     {
-        connpeer = enet_host_connect(clienthost, &address, server::numchannels(), 0);
+        // The server learns our network dictionary from the connect data, and tells us its own in InitS2C
+        connpeer = enet_host_connect(clienthost, &address, server::numchannels(), getnetdictionary());
+        setnetpeerdictionary(clienthost, connpeer, 0);
         enet_host_flush(clienthost);
         connmillis = totalmillis;
         connattempts = 0;
@@ -134,6 +148,7 @@ void disconnect(bool async, bool cleanup)
         }
         curpeer = NULL;
         discmillis = 0;
+        abortmapdownload(); // Whatever made it to disk is resumed on the next connect
         conoutf("disconnected");
         game::gamedisconnect(cleanup);
 #ifndef SERVER
@@ -104,6 +104,7 @@ extern void cleanuptextures();
 extern void clearpvs();
 extern bool pvsoccluded(const ivec &bbmin, const ivec &bbmax);
 extern bool pvsoccludedsphere(const vec &center, float radius);
+extern bool pvsoccludedfrom(const vec &viewer, const ivec &bbmin, const ivec &bbmax);
 extern bool waterpvsoccluded(int height);
 extern void setviewcell(const vec &p);
 extern void savepvs(stream *f);
@@ -544,6 +545,21 @@ extern void localclienttoserver(int chan, ENetPacket *, int cn=-1); // INTENSITY
 extern int localconnect(); // INTENSITY: Added returning of client number
 extern bool serveroption(char *opt);
 
+// netcompress
+extern void setupnetcompression(ENetHost *host, int method);
+extern void setnetcompression(ENetHost *host, int method);
+extern bool setnetpeerdictionary(ENetHost *host, ENetPeer *peer, int id);
+
+// maptransfer
+extern void freemapupload(int cn);
+extern void resetmapuploads();
+extern void abortmapdownload();
+
+// botswarm
+extern void startbotswarm(int maxbots, int millis, bool quit);
+extern llong updatebotswarm();
+extern void countbotswarmtick(int micros);
+
 // serverbrowser
 extern bool resolverwait(const char *name, ENetAddress *address);
 extern int connectwithtimeout(ENetSocket sock, const char *hostname, const ENetAddress &address);
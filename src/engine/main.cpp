@@ -801,9 +801,11 @@ VARP(maxfps, 0, 125, 1000);
 void limitfps(int &millis, int curmillis)
 {
     int limit = (mainmenu || minimized) && menufps ? (maxfps ? min(maxfps, menufps) : menufps) : maxfps;
-    if(!limit) return;
+    if(!limit) { lua::gc_step(0); return; }
     static int fpserror = 0;
     int delay = 1000/limit - (millis-curmillis);
+    // the Lua collector gets the time we would sleep anyway
+    int gctime = lua::gc_step(max(delay, 0)*1000);
     if(delay < 0) fpserror = 0;
     else
     {
@@ -815,7 +817,7 @@ void limitfps(int &millis, int curmillis)
         }
         if(delay > 0)
         {
-            SDL_Delay(delay);
+            if(delay > gctime/1000) SDL_Delay(delay - gctime/1000);
             millis += delay;
         }
     }
@@ -1186,7 +1188,8 @@ int main(int argc, char **argv)
 
         checkinput();
         ovr::update();
-        lua::call_external("gui_update", "");
+        static lua::external guiupdate("gui_update");
+        lua::call_external(guiupdate);
         tryedit();
 
         if(lastmillis) game::updateworld();
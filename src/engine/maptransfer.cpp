@@ -0,0 +1,408 @@
+// maptransfer.cpp: streams the current map to clients in hashed chunks read straight from disk
+
+#include "engine.h"
+#include "of_world.h"
+#include "hash.h"
+
+namespace MessageSystem
+{
+    void send_RequestMap();
+}
+
+// A client without an intact copy of the map asks for it with RequestMap and is answered on the
+// file channel with a manifest: the map's size, its crc and a tiger hash for every chunk. The
+// client then keeps a window of chunk requests in flight and writes each chunk into a partial
+// file as soon as it checks out against the manifest, so a transfer that is cut short resumes
+// from whatever the partial file already holds once the client comes back.
+enum { MT_MANIFEST = 0, MT_GETCHUNK, MT_CHUNK };
+
+#define MAPTRANSFER_CHANNEL 2
+
+// The name comes from the server and ends up in paths that are written and removed, so it must
+// not lead out of media/
+static bool validmapname(const char *name)
+{
+    return name[0] && name[0] != '/' && !strstr(name, "..") && !strchr(name, '\\') && !strchr(name, ':');
+}
+
+static const char *mapfilename(const char *name)
+{
+    static string file;
+    string dir;
+    copystring(dir, name);
+    int len = strlen(dir);
+    if(len > 7) dir[len - 7] = '\0';
+    formatstring(file, "media/%s/map.ogz", dir);
+    return path(file);
+}
+
+static bool samehash(const tiger::hashval &a, const tiger::hashval &b)
+{
+    return !memcmp(a.bytes, b.bytes, sizeof(a.bytes));
+}
+
+// server
+
+VAR(maptransferchunk, 1024, 16384, 1<<16);
+VAR(maptransfercompress, 0, 1, 1);
+
+struct mapmanifest
+{
+    bool valid;
+    string name, file;
+    uint crc;
+    int size, chunksize;
+    vector<tiger::hashval> hashes;
+
+    int chunklen(int i) const { return min(chunksize, size - i*chunksize); }
+};
+
+// A chunk is only sent again when it arrived corrupted, and the client gives up after as many
+// corrupted chunks as this, so a client asking for more is just using the server as an amplifier
+#define MAXCHUNKRESENDS 8
+
+struct mapupload
+{
+    stream *f;
+    vector<uchar> sent;
+    int resent;
+
+    mapupload() : f(NULL), resent(0) {}
+    ~mapupload() { DELETEP(f); }
+};
+
+static mapmanifest manifest;
+static vector<mapupload *> uploads;
+
+// Hashes the map a chunk at a time, so even a huge map is never held in memory as a whole
+static bool buildmapmanifest()
+{
+    if(manifest.valid && !strcmp(manifest.name, world::curr_map_id)) return true;
+    manifest.valid = false;
+    manifest.hashes.setsize(0);
+    if(!world::curr_map_id[0]) return false;
+    copystring(manifest.name, world::curr_map_id);
+    copystring(manifest.file, mapfilename(manifest.name));
+    stream *f = openrawfile(manifest.file, "rb");
+    if(!f) { conoutf(CON_ERROR, "could not read map %s for transfer", manifest.file); return false; }
+    manifest.crc = getmapcrc();
+    manifest.chunksize = maptransferchunk;
+    manifest.size = 0;
+    uchar *buf = new uchar[manifest.chunksize];
+    for(int len; (len = f->read(buf, manifest.chunksize)) > 0; manifest.size += len)
+        tiger::hash(buf, len, manifest.hashes.add());
+    delete[] buf;
+    delete f;
+    manifest.valid = manifest.size > 0;
+    return manifest.valid;
+}
+
+void freemapupload(int cn)
+{
+    if(uploads.inrange(cn)) DELETEP(uploads[cn]);
+}
+
+void resetmapuploads()
+{
+    loopv(uploads) freemapupload(i);
+    manifest.valid = false;
+}
+
+void sendmapmanifest(int cn)
+{
+    bool valid = buildmapmanifest();
+    packetbuf p(MAXTRANS, ENET_PACKET_FLAG_RELIABLE);
+    putint(p, MT_MANIFEST);
+    sendstring(world::curr_map_id, p);
+    if(!valid) loopi(4) putint(p, 0);
+    else
+    {
+        putint(p, int(manifest.crc));
+        putint(p, manifest.size);
+        putint(p, manifest.chunksize);
+        putint(p, manifest.hashes.length());
+        loopv(manifest.hashes) p.put(manifest.hashes[i].bytes, sizeof(manifest.hashes[i].bytes));
+    }
+    sendpacket(cn, MAPTRANSFER_CHANNEL, p.finalize());
+}
+
+static bool sendmapchunk(int cn, int index)
+{
+    while(uploads.length() <= cn) uploads.add(NULL);
+    if(!uploads[cn]) uploads[cn] = new mapupload;
+    mapupload &u = *uploads[cn];
+    while(u.sent.length() < manifest.hashes.length()) u.sent.add(0);
+    if(u.sent[index] && ++u.resent > MAXCHUNKRESENDS) return false;
+    u.sent[index] = 1;
+    stream *&f = u.f;
+    if(!f && !(f = openrawfile(manifest.file, "rb"))) return true;
+
+    static vector<uchar> raw, packed;
+    int rawlen = manifest.chunklen(index);
+    raw.setsize(0);
+    if(!f->seek(stream::offset(index)*manifest.chunksize) || f->read(raw.pad(rawlen), rawlen) != rawlen)
+    {
+        conoutf(CON_ERROR, "could not read chunk %d of map %s", index, manifest.file);
+        DELETEP(f);
+        return true;
+    }
+
+    // Maps are gzipped already, so chunks are only sent deflated when that actually helps
+    const uchar *data = raw.getbuf();
+    uLongf len = compressBound(rawlen);
+    packed.setsize(0);
+    if(maptransfercompress && compress2(packed.pad(len), &len, data, rawlen, Z_BEST_SPEED) == Z_OK && int(len) < rawlen) data = packed.getbuf();
+    else len = rawlen;
+
+    packetbuf p(len + 32, ENET_PACKET_FLAG_RELIABLE);
+    putint(p, MT_CHUNK);
+    putint(p, index);
+    putint(p, rawlen);
+    putint(p, len);
+    p.put(data, len);
+    sendpacket(cn, MAPTRANSFER_CHANNEL, p.finalize());
+    return true;
+}
+
+void parsemaprequest(int cn, ucharbuf &p)
+{
+    while(p.remaining()) switch(getint(p))
+    {
+        case MT_GETCHUNK:
+        {
+            int index = getint(p);
+            // Requests for a map that has since been replaced are dropped, the client starts over
+            if(manifest.valid && manifest.hashes.inrange(index) && !sendmapchunk(cn, index))
+            {
+                disconnect_client(cn, DISC_OVERFLOW);
+                return;
+            }
+            break;
+        }
+
+        default: return;
+    }
+}
+
+// client
+
+VARP(maptransfer, 0, 1, 1);
+VARP(maptransferwindow, 1, 8, 64);
+
+enum { CHUNK_MISSING = 0, CHUNK_REQUESTED, CHUNK_DONE };
+
+struct mapdownload : mapmanifest
+{
+    string partfile;
+    stream *part;
+    vector<uchar> state;
+    int next, inflight, done, resumed, failures, bytes, startmillis;
+};
+
+static mapdownload download;
+
+void abortmapdownload()
+{
+    DELETEP(download.part);
+    download.name[0] = '\0';
+    download.hashes.setsize(0);
+    download.state.setsize(0);
+}
+
+bool startmapdownload(const char *name)
+{
+    abortmapdownload();
+    if(!validmapname(name))
+    {
+        // Neither downloaded nor loaded locally, so it is handled here all the same
+        conoutf(CON_ERROR, "server sent an invalid map name %s", name);
+        disconnect();
+        return true;
+    }
+    if(!maptransfer || !connectedpeer()) return false;
+    copystring(download.name, name);
+    download.startmillis = totalmillis;
+    MessageSystem::send_RequestMap();
+    return true;
+}
+
+// Marks the chunks a file already holds intact, and returns how many that is
+static int checkmapchunks(stream *f)
+{
+    uchar *buf = new uchar[download.chunksize];
+    int intact = 0;
+    loopv(download.hashes)
+    {
+        int len = download.chunklen(i);
+        if(!f->seek(stream::offset(i)*download.chunksize) || f->read(buf, len) != len) break;
+        tiger::hashval hash;
+        tiger::hash(buf, len, hash);
+        if(samehash(hash, download.hashes[i])) { download.state[i] = CHUNK_DONE; intact++; }
+    }
+    delete[] buf;
+    return intact;
+}
+
+// A download that cannot go on falls back on the local copy of the map, even if it is out of date,
+// and without one leaves the server, rather than keep the player on the loading screen for good
+static void failmapdownload()
+{
+    string name, file;
+    copystring(name, download.name);
+    copystring(file, mapfilename(name));
+    abortmapdownload();
+    stream *f = openrawfile(file, "rb");
+    if(f)
+    {
+        delete f;
+        conoutf(CON_WARN, "loading the local copy of map %s instead, it may not match the server's", name);
+        world::set_map(name);
+        return;
+    }
+    conoutf(CON_ERROR, "could not download map %s and there is no local copy of it", name);
+    disconnect();
+}
+
+static void finishmapdownload()
+{
+    if(download.part)
+    {
+        DELETEP(download.part);
+        string partfile, file;
+        copystring(partfile, findfile(download.partfile, "w"));
+        copystring(file, findfile(download.file, "w"));
+        remove(file);
+        if(rename(partfile, file))
+        {
+            conoutf(CON_ERROR, "could not move %s into place", partfile);
+            failmapdownload();
+            return;
+        }
+        conoutf("received map %s: %d KB in %d chunks (%d resumed) in %d ms", download.name,
+            download.bytes/1024, download.hashes.length() - download.resumed, download.resumed, totalmillis - download.startmillis);
+    }
+    string name;
+    copystring(name, download.name);
+    uint crc = download.crc;
+    abortmapdownload();
+    world::set_map(name);
+    if(crc && getmapcrc() != crc) conoutf(CON_WARN, "map %s does not match the copy on the server", name);
+}
+
+static void requestmapchunks()
+{
+    packetbuf p(MAXTRANS, ENET_PACKET_FLAG_RELIABLE);
+    for(; download.inflight < maptransferwindow && download.next < download.state.length(); download.next++)
+    {
+        if(download.state[download.next] != CHUNK_MISSING) continue;
+        putint(p, MT_GETCHUNK);
+        putint(p, download.next);
+        download.state[download.next] = CHUNK_REQUESTED;
+        download.inflight++;
+    }
+    if(p.length()) sendclientpacket(p.finalize(), MAPTRANSFER_CHANNEL);
+}
+
+static void parsemapmanifest(ucharbuf &p)
+{
+    string name;
+    getstring(name, p);
+    uint crc = uint(getint(p));
+    int size = getint(p), chunksize = getint(p), numchunks = getint(p);
+    if(!download.name[0] || strcmp(name, download.name)) return;
+    if(size <= 0 || chunksize <= 0 || numchunks != (size + chunksize - 1)/chunksize || numchunks > p.remaining()/int(sizeof(tiger::hashval)))
+    {
+        conoutf(CON_WARN, "server could not send map %s, loading the local copy", name);
+        finishmapdownload();
+        return;
+    }
+
+    download.crc = crc;
+    download.size = size;
+    download.chunksize = chunksize;
+    loopi(numchunks)
+    {
+        p.get(download.hashes.add().bytes, sizeof(tiger::hashval));
+        download.state.add(CHUNK_MISSING);
+    }
+    copystring(download.file, mapfilename(name));
+    formatstring(download.partfile, "%s.part", download.file);
+    download.next = download.inflight = download.failures = download.bytes = 0;
+
+    stream *f = openrawfile(download.file, "rb");
+    if(f)
+    {
+        bool intact = f->size() == size && checkmapchunks(f) == numchunks;
+        delete f;
+        if(intact) { finishmapdownload(); return; }
+        loopv(download.state) download.state[i] = CHUNK_MISSING;
+    }
+
+    download.part = openrawfile(download.partfile, "r+b");
+    if(download.part && download.part->size() > size) DELETEP(download.part);
+    download.resumed = download.part ? checkmapchunks(download.part) : 0;
+    if(!download.part) download.part = openrawfile(download.partfile, "w+b");
+    if(!download.part)
+    {
+        conoutf(CON_ERROR, "could not write map to %s", download.partfile);
+        failmapdownload();
+        return;
+    }
+    download.done = download.resumed;
+    if(download.done >= numchunks) { finishmapdownload(); return; }
+    conoutf("downloading map %s (%d KB, %d of %d chunks resumed)", name, size/1024, download.resumed, numchunks);
+    requestmapchunks();
+}
+
+static void parsemapchunk(ucharbuf &p)
+{
+    int index = getint(p), rawlen = getint(p), len = getint(p);
+    if(len <= 0 || len > rawlen || p.remaining() < len) return;
+    ucharbuf q = p.subbuf(len);
+    if(!download.part || !download.state.inrange(index) || download.state[index] != CHUNK_REQUESTED || rawlen != download.chunklen(index)) return;
+    download.inflight--;
+    download.bytes += len;
+
+    static vector<uchar> raw;
+    const uchar *data = q.buf;
+    if(len < rawlen)
+    {
+        uLongf rawsize = rawlen;
+        raw.setsize(0);
+        data = uncompress(raw.pad(rawlen), &rawsize, q.buf, len) == Z_OK && int(rawsize) == rawlen ? raw.getbuf() : NULL;
+    }
+    tiger::hashval hash;
+    if(data) tiger::hash(data, rawlen, hash);
+    if(!data || !samehash(hash, download.hashes[index]))
+    {
+        if(++download.failures > 8)
+        {
+            conoutf(CON_ERROR, "map %s keeps arriving corrupted, giving up", download.name);
+            failmapdownload();
+            return;
+        }
+        download.state[index] = CHUNK_MISSING;
+        download.next = min(download.next, index);
+    }
+    else if(!download.part->seek(stream::offset(index)*download.chunksize) || download.part->write(data, rawlen) != rawlen)
+    {
+        conoutf(CON_ERROR, "could not write map to %s", download.partfile);
+        failmapdownload();
+        return;
+    }
+    else
+    {
+        download.state[index] = CHUNK_DONE;
+        if(++download.done >= download.state.length()) { finishmapdownload(); return; }
+    }
+    requestmapchunks();
+}
+
+void parsemapdata(ucharbuf &p)
+{
+    switch(getint(p))
+    {
+        case MT_MANIFEST: parsemapmanifest(p); break;
+        case MT_CHUNK: parsemapchunk(p); break;
+    }
+}
@@ -0,0 +1,365 @@
+// netcompress.cpp: datagram compression for ENet hosts, plus capture, dictionary training and benchmarking
+
+#include "engine.h"
+
+// Every compressed datagram starts with the method that compressed it, so a host decompresses
+// whatever its peer chose to send regardless of its own setting. LZ datagrams also carry the id
+// of the dictionary they were compressed against. The two ends tell each other their dictionary
+// ids when connecting (see setnetpeerdictionary), and a host only compresses against its
+// dictionary for peers that have the same one, falling back to plain LZ for everyone else.
+enum { NETCOMPRESS_NONE = 0, NETCOMPRESS_RANGECODER, NETCOMPRESS_LZ };
+
+SVAR(netdictionary, "config/netdict.bin");
+
+static uchar *netdict = NULL;
+static int netdictlen = 0, netdictid = 0;
+
+static int dictionaryid(const uchar *data, int len)
+{
+    uint h = 5381;
+    loopi(len) h = ((h<<5)+h)^data[i];
+    return 1 + h%255;
+}
+
+// The dictionary is loaded once, as both ends of a connection need to agree on it for its lifetime
+static void loadnetdictionary()
+{
+    static bool loaded = false;
+    if(loaded) return;
+    loaded = true;
+    netdict = (uchar *)loadfile(netdictionary, &netdictlen, false);
+    if(!netdict) { netdictlen = 0; return; }
+    netdictid = dictionaryid(netdict, netdictlen);
+    conoutf("loaded network dictionary %s (%d bytes)", netdictionary, netdictlen);
+}
+
+static stream *netcapture = NULL;
+static int netcaptured = 0;
+
+struct netcompressor
+{
+    ENetHost *host;
+    int method;
+    void *rangecoder, *lz, *lzdict;
+    uchar *peerdicts; // Per peer: whether it has our dictionary, sized once so the I/O thread may read it
+
+    netcompressor(ENetHost *host, int method) : host(host), method(method)
+    {
+        rangecoder = enet_range_coder_create();
+        lz = enet_lz_create(NULL, 0);
+        lzdict = netdict ? enet_lz_create(netdict, netdictlen) : NULL;
+        peerdicts = new uchar[host->peerCount];
+        memset(peerdicts, 0, host->peerCount);
+    }
+    ~netcompressor()
+    {
+        if(rangecoder) enet_range_coder_destroy(rangecoder);
+        if(lz) enet_lz_destroy(lz);
+        if(lzdict) enet_lz_destroy(lzdict);
+        delete[] peerdicts;
+    }
+
+    bool peerhasdict()
+    {
+        ENetPeer *peer = host->compressingPeer;
+        return lzdict && peer && peerdicts[peer - host->peers];
+    }
+
+    size_t compress(const ENetBuffer *in, size_t count, size_t inlimit, uchar *out, size_t outlimit)
+    {
+        if(netcapture)
+        {
+            netcapture->putlil<ushort>(inlimit);
+            for(size_t i = 0, left = inlimit; i < count && left > 0; i++)
+            {
+                size_t len = min(in[i].dataLength, left);
+                netcapture->write(in[i].data, len);
+                left -= len;
+            }
+            netcaptured++;
+        }
+        if(outlimit < 3) return 0;
+        size_t len = 0;
+        switch(method)
+        {
+            case NETCOMPRESS_RANGECODER:
+                if(!rangecoder) return 0;
+                len = enet_range_coder_compress(rangecoder, in, count, inlimit, &out[1], outlimit-1);
+                if(!len) return 0;
+                out[0] = NETCOMPRESS_RANGECODER;
+                return len + 1;
+            case NETCOMPRESS_LZ:
+            {
+                if(!lz) return 0;
+                bool usedict = peerhasdict();
+                len = enet_lz_compress(usedict ? lzdict : lz, in, count, inlimit, &out[2], outlimit-2);
+                if(!len) return 0;
+                out[0] = NETCOMPRESS_LZ;
+                out[1] = usedict ? netdictid : 0;
+                return len + 2;
+            }
+        }
+        return 0;
+    }
+
+    size_t decompress(const uchar *in, size_t inlimit, uchar *out, size_t outlimit)
+    {
+        if(inlimit < 2) return 0;
+        switch(in[0])
+        {
+            case NETCOMPRESS_RANGECODER:
+                return rangecoder ? enet_range_coder_decompress(rangecoder, &in[1], inlimit-1, out, outlimit) : 0;
+            case NETCOMPRESS_LZ:
+            {
+                // Peers only use a dictionary once they know we have it, see setnetpeerdictionary, so
+                // an unknown id means a peer that skipped the exchange
+                void *ctx = !in[1] ? lz : (in[1] == netdictid ? lzdict : NULL);
+                return ctx && inlimit > 2 ? enet_lz_decompress(ctx, &in[2], inlimit-2, out, outlimit) : 0;
+            }
+        }
+        return 0;
+    }
+};
+
+static size_t ENET_CALLBACK netcompress(void *context, const ENetBuffer *in, size_t count, size_t inlimit, enet_uint8 *out, size_t outlimit)
+{
+    return ((netcompressor *)context)->compress(in, count, inlimit, out, outlimit);
+}
+
+static size_t ENET_CALLBACK netdecompress(void *context, const enet_uint8 *in, size_t inlimit, enet_uint8 *out, size_t outlimit)
+{
+    return ((netcompressor *)context)->decompress(in, inlimit, out, outlimit);
+}
+
+static void ENET_CALLBACK netcompressdestroy(void *context)
+{
+    delete (netcompressor *)context;
+}
+
+//! Installs the compressor on a newly created host. It is installed even with compression off,
+//! since the peer may still send compressed datagrams.
+void setupnetcompression(ENetHost *host, int method)
+{
+    if(!host) return;
+    loadnetdictionary();
+    ENetCompressor compressor;
+    compressor.context = new netcompressor(host, method);
+    compressor.compress = netcompress;
+    compressor.decompress = netdecompress;
+    compressor.destroy = netcompressdestroy;
+    enet_host_compress(host, &compressor);
+}
+
+//! Changes the method a host compresses with, taking effect from its next datagram
+void setnetcompression(ENetHost *host, int method)
+{
+    if(host && host->compressor.compress == netcompress) ((netcompressor *)host->compressor.context)->method = method;
+}
+
+//! The id of the dictionary this end compresses against, 0 if none, to tell peers when connecting
+int getnetdictionary()
+{
+    loadnetdictionary();
+    return netdictid;
+}
+
+//! Records the dictionary id a peer announced, returning whether it matches ours. Datagrams to the
+//! peer use our dictionary only if it does, and plain LZ otherwise. The server calls this where it
+//! receives the connection, on the I/O thread if that owns the host, so this does not log.
+bool setnetpeerdictionary(ENetHost *host, ENetPeer *peer, int id)
+{
+    bool match = id && id == netdictid;
+    if(!host || !peer || host->compressor.compress != netcompress) return match;
+    ((netcompressor *)host->compressor.context)->peerdicts[peer - host->peers] = match ? 1 : 0;
+    return match;
+}
+
+static void stopnetcapture()
+{
+    if(!netcapture) return;
+    DELETEP(netcapture);
+    conoutf("captured %d datagrams", netcaptured);
+}
+
+//! Records every datagram the local hosts send, before compression, to the given file. An empty name stops.
+ICOMMAND(netcapture, "s", (char *name),
+{
+    extern bool netthreadactive();
+    if(netthreadactive()) { conoutf(CON_ERROR, "cannot capture while the server thread is running"); return; }
+    stopnetcapture();
+    if(!name[0]) return;
+    netcapture = openfile(name, "wb");
+    if(!netcapture) { conoutf(CON_ERROR, "could not open %s for capturing", name); return; }
+    netcaptured = 0;
+    conoutf("capturing datagrams to %s", name);
+});
+
+static bool loadcapture(const char *name, vector<uchar> &data, vector<int> &lengths)
+{
+    stream *f = openfile(name, "rb");
+    if(!f) { conoutf(CON_ERROR, "could not open capture %s", name); return false; }
+    for(;;)
+    {
+        ushort len = f->getlil<ushort>();
+        if(!len || len > ENET_PROTOCOL_MAXIMUM_MTU) break;
+        if(f->read(data.pad(len), len) != len) { data.setsize(data.length() - len); break; }
+        lengths.add(len);
+    }
+    delete f;
+    if(lengths.empty()) { conoutf(CON_ERROR, "capture %s has no datagrams", name); return false; }
+    return true;
+}
+
+// Dictionary training scores every SEGMENT byte segment of the captured datagrams by how often
+// its KGRAM byte substrings occur in the whole capture, then greedily keeps the best segments,
+// forgetting the substrings of each kept segment so the next ones add something new.
+enum { NETDICT_KGRAM = 8, NETDICT_SEGMENT = 48, NETDICT_HASHBITS = 20 };
+
+static inline uint kgramhash(const uchar *p)
+{
+    uint lo = p[0] | (p[1]<<8) | (p[2]<<16) | (p[3]<<24), hi = p[4] | (p[5]<<8) | (p[6]<<16) | (p[7]<<24);
+    return ((lo*2654435761U) ^ (hi*2246822519U)) >> (32 - NETDICT_HASHBITS);
+}
+
+void trainnetdict(char *capture, char *output, int *size)
+{
+    vector<uchar> data;
+    vector<int> lengths;
+    if(!loadcapture(capture, data, lengths)) return;
+    int dictsize = clamp(*size > 0 ? *size : 4096, int(NETDICT_SEGMENT), int(ENET_LZ_MAXIMUM_DICTIONARY));
+
+    int *counts = new int[1<<NETDICT_HASHBITS];
+    memset(counts, 0, sizeof(int)<<NETDICT_HASHBITS);
+    for(int start = 0, i = 0; i < lengths.length(); start += lengths[i++])
+        for(int j = 0; j + NETDICT_KGRAM <= lengths[i]; j++) counts[kgramhash(&data[start + j])]++;
+
+    vector<int> picked;
+    for(int used = 0; used + NETDICT_SEGMENT <= dictsize;)
+    {
+        int best = -1, bestscore = 0;
+        for(int start = 0, i = 0; i < lengths.length(); start += lengths[i++])
+        {
+            int grams = NETDICT_SEGMENT - NETDICT_KGRAM + 1, score = 0;
+            if(lengths[i] < NETDICT_SEGMENT) continue;
+            loopj(grams) score += counts[kgramhash(&data[start + j])];
+            for(int j = 0;; j++)
+            {
+                if(score > bestscore) { bestscore = score; best = start + j; }
+                if(j + NETDICT_SEGMENT >= lengths[i]) break;
+                score += counts[kgramhash(&data[start + j + grams])] - counts[kgramhash(&data[start + j])];
+            }
+        }
+        if(best < 0 || bestscore <= NETDICT_SEGMENT) break;
+        loopj(NETDICT_SEGMENT - NETDICT_KGRAM + 1) counts[kgramhash(&data[best + j])] = 0;
+        picked.add(best);
+        used += NETDICT_SEGMENT;
+    }
+    delete[] counts;
+
+    if(picked.empty()) { conoutf(CON_ERROR, "capture %s has too little repetition for a dictionary", capture); return; }
+    stream *f = openfile(output, "wb");
+    if(!f) { conoutf(CON_ERROR, "could not write dictionary %s", output); return; }
+    // the best segments go last, so they survive if the dictionary is ever truncated from the front
+    loopvrev(picked) f->write(&data[picked[i]], NETDICT_SEGMENT);
+    delete f;
+    conoutf("trained %d byte dictionary %s from %d datagrams", picked.length()*NETDICT_SEGMENT, output, lengths.length());
+}
+COMMAND(trainnetdict, "ssi");
+
+// Compresses and decompresses every captured datagram until at least the given time has passed
+static void benchcompressor(const char *name, ENetCompressor &c, vector<uchar> &data, vector<int> &lengths, int millis)
+{
+    uchar out[ENET_PROTOCOL_MAXIMUM_MTU], back[ENET_PROTOCOL_MAXIMUM_MTU];
+    vector<int> packed;
+    size_t original = 0, sent = 0;
+    for(int start = 0, i = 0; i < lengths.length(); start += lengths[i++])
+    {
+        ENetBuffer buf;
+        buf.data = &data[start];
+        buf.dataLength = lengths[i];
+        size_t len = c.compress(c.context, &buf, 1, lengths[i], out, lengths[i]);
+        if(len > 0 && int(len) < lengths[i])
+        {
+            if(c.decompress(c.context, out, len, back, sizeof(back)) != size_t(lengths[i]) || memcmp(back, &data[start], lengths[i]))
+            {
+                conoutf(CON_ERROR, "  %s: datagram %d did not survive a round trip", name, i);
+                return;
+            }
+        }
+        else len = lengths[i];
+        packed.add(len);
+        original += lengths[i];
+        sent += len;
+    }
+
+    uint bytes = 0, elapsed = 0, start = enet_time_get();
+    do
+    {
+        for(int offset = 0, i = 0; i < lengths.length(); offset += lengths[i++])
+        {
+            ENetBuffer buf;
+            buf.data = &data[offset];
+            buf.dataLength = lengths[i];
+            c.compress(c.context, &buf, 1, lengths[i], out, lengths[i]);
+        }
+        bytes += original;
+    } while((elapsed = enet_time_get() - start) < uint(millis));
+    double compressrate = bytes/(1024.0*1024.0)/max(elapsed, 1U)*1000;
+
+    // decompression replays the compressed form of each datagram, keeping them all in one buffer
+    vector<uchar> compressed;
+    for(int offset = 0, i = 0; i < lengths.length(); offset += lengths[i++]) if(packed[i] < lengths[i])
+    {
+        ENetBuffer buf;
+        buf.data = &data[offset];
+        buf.dataLength = lengths[i];
+        c.compress(c.context, &buf, 1, lengths[i], compressed.pad(packed[i]), lengths[i]);
+    }
+    bytes = 0;
+    start = enet_time_get();
+    do
+    {
+        for(int offset = 0, i = 0; i < lengths.length(); i++) if(packed[i] < lengths[i])
+        {
+            c.decompress(c.context, &compressed[offset], packed[i], back, sizeof(back));
+            offset += packed[i];
+            bytes += lengths[i];
+        }
+    } while(bytes && (elapsed = enet_time_get() - start) < uint(millis));
+    double decompressrate = bytes/(1024.0*1024.0)/max(elapsed, 1U)*1000;
+
+    conoutf("  %-16s %5.1f%% of original, compress %7.1f MB/s, decompress %7.1f MB/s", name, sent*100.0/max(original, size_t(1)), compressrate, decompressrate);
+}
+
+//! Replays a capture through each compressor and reports the size on the wire and the throughput
+void netcompressbench(char *capture, char *dictionary, int *millis)
+{
+    vector<uchar> data;
+    vector<int> lengths;
+    if(!loadcapture(capture, data, lengths)) return;
+    int duration = *millis > 0 ? *millis : 500;
+    conoutf("netcompressbench: %d datagrams, %d bytes", lengths.length(), data.length());
+
+    ENetCompressor c;
+    c.context = enet_range_coder_create();
+    c.compress = enet_range_coder_compress;
+    c.decompress = enet_range_coder_decompress;
+    if(c.context) { benchcompressor("range coder", c, data, lengths, duration); enet_range_coder_destroy(c.context); }
+
+    c.compress = enet_lz_compress;
+    c.decompress = enet_lz_decompress;
+    c.context = enet_lz_create(NULL, 0);
+    if(c.context) { benchcompressor("lz", c, data, lengths, duration); enet_lz_destroy(c.context); }
+
+    int dictlen = 0;
+    uchar *dict = dictionary[0] ? (uchar *)loadfile(dictionary, &dictlen, false) : NULL;
+    if(dictionary[0] && !dict) conoutf(CON_ERROR, "could not load dictionary %s", dictionary);
+    if(!dict && netdict) dict = netdict, dictlen = netdictlen;
+    if(dict)
+    {
+        c.context = enet_lz_create(dict, dictlen);
+        if(c.context) { benchcompressor("lz + dictionary", c, data, lengths, duration); enet_lz_destroy(c.context); }
+        if(dict != netdict) delete[] dict;
+    }
+}
+COMMAND(netcompressbench, "ssi");
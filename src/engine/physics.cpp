@@ -9,13 +9,53 @@
 
 #include "targeting.h" // INTENSITY
 
+#ifdef PHYSTHREADS
+#include <pthread.h>
+#endif
+
+struct physevent;
+
+// What a thread moving entities in moveplayers() keeps to itself: its own clip plane cache, and
+// the script events it holds back until the moves are committed
+struct physworker
+{
+    clipplanes *clipcache;
+    int clipcachereset;
+    vector<physevent> *events;
+#ifdef PHYSTHREADS
+    physcollision collision;
+#endif
+};
+
+#ifdef PHYSTHREADS
+// Made by moveplayers() before it starts any worker thread
+static pthread_key_t physworkerkey;
+static bool physworkerkeyready = false;
+
+static inline physworker *getphysworker()
+{
+    return physworkerkeyready ? (physworker *)pthread_getspecific(physworkerkey) : NULL;
+}
+
+static inline void setphysworker(physworker *w)
+{
+    pthread_setspecific(physworkerkey, w);
+}
+#else
+static physworker *curphysworker = NULL;
+
+static inline physworker *getphysworker() { return curphysworker; }
+static inline void setphysworker(physworker *w) { curphysworker = w; }
+#endif
+
 const int MAXCLIPPLANES = 1024;
 static clipplanes clipcache[MAXCLIPPLANES];
-static int clipcacheversion = -2;
+static int clipcacheversion = -2, clipcacheresets = 0;
 
 static inline clipplanes &getclipplanes(const cube &c, const ivec &o, int size, bool collide = true, int offset = 0)
 {
-    clipplanes &p = clipcache[int(&c - worldroot)&(MAXCLIPPLANES-1)];
+    physworker *w = getphysworker();
+    clipplanes &p = (w ? w->clipcache : clipcache)[int(&c - worldroot)&(MAXCLIPPLANES-1)];
     if(p.owner != &c || p.version != clipcacheversion+offset)
     {
         p.owner = &c;
@@ -32,6 +72,7 @@ void resetclipplanes()
     {
         memset(clipcache, 0, sizeof(clipcache));
         clipcacheversion = 2;
+        clipcacheresets++; // Workers clear their own caches the next time they run
     }
 }
 
@@ -412,9 +453,70 @@ float rayfloor(const vec &o, vec &floor, int mode, float radius)
 /////////////////////////  entity collision  ///////////////////////////////////////////////
 
 // info about collisions
+#ifdef PHYSTHREADS
+// Where the main thread keeps them, workers keep them in their physworker
+static physcollision mainphyscollision;
+
+physcollision &curphyscollision()
+{
+    physworker *w = getphysworker();
+    return w ? w->collision : mainphyscollision;
+}
+#else
 bool collideinside; // whether an internal collision happened
 physent *collideplayer; // whether the collection hit a player
 vec collidewall; // just the normal vectors.
+#endif
+
+// Script callbacks raised while moving. A worker queues them with the entity it is moving,
+// and moveplayers() runs them in entity order once every move is done.
+enum { PHYSEVENT_STATE = 0, PHYSEVENT_COLLIDE_CLIENT, PHYSEVENT_COLLIDE_AREA, PHYSEVENT_COLLIDE_MAPMODEL, PHYSEVENT_DEADLY, PHYSEVENT_OFF_MAP };
+
+struct physevent
+{
+    int type;
+    physent *d;
+    bool local;
+    int args[3];
+    vec wall;
+};
+
+static lua::external physics_collide_client("physics_collide_client"), physics_collide_area("physics_collide_area"),
+                     physics_collide_mapmodel("physics_collide_mapmodel"), physics_in_deadly("physics_in_deadly"),
+                     physics_off_map("physics_off_map");
+
+static void runphysevent(const physevent &e)
+{
+    switch(e.type)
+    {
+        case PHYSEVENT_STATE: game::physicstrigger(e.d, e.local, e.args[0], e.args[1], e.args[2]); break;
+        case PHYSEVENT_COLLIDE_CLIENT: lua::call_external(physics_collide_client, e.args[0], e.args[1], e.wall.x, e.wall.y, e.wall.z); break;
+        case PHYSEVENT_COLLIDE_AREA: lua::call_external(physics_collide_area, e.args[0], e.args[1]); break;
+        case PHYSEVENT_COLLIDE_MAPMODEL: lua::call_external(physics_collide_mapmodel, e.args[0], e.args[1]); break;
+        case PHYSEVENT_DEADLY: lua::call_external(physics_in_deadly, e.args[0], e.args[1]); break;
+        case PHYSEVENT_OFF_MAP: lua::call_external(physics_off_map, e.args[0]); break;
+    }
+}
+
+static void physicsevent(int type, physent *d, bool local, int arg0, int arg1 = 0, int arg2 = 0, const vec &wall = vec(0, 0, 0))
+{
+    physevent e;
+    e.type = type;
+    e.d = d;
+    e.local = local;
+    e.args[0] = arg0;
+    e.args[1] = arg1;
+    e.args[2] = arg2;
+    e.wall = wall;
+    physworker *w = getphysworker();
+    if(w) w->events->add(e);
+    else runphysevent(e);
+}
+
+static inline void physicstrigger(physent *d, bool local, int floorlevel, int waterlevel, int material = 0)
+{
+    physicsevent(PHYSEVENT_STATE, d, local, floorlevel, waterlevel, material);
+}
 
 const float STAIRHEIGHT = 4.1f;
 const float FLOORZ = 0.867f;
@@ -517,75 +619,184 @@ bool ellipsecollide(physent *d, const vec &dir, const vec &o, const vec &center,
 
 #define DYNENTCACHESIZE 1024
 
-static uint dynentframe = 0;
+// The broadphase over the dynents. What it tests of each one - position, radius and height - is
+// copied into flat arrays, and every dynent is filed by index under each dynentsize cell it
+// overlaps, the filings counting sorted by cell hash. A query scans those arrays and only
+// touches a physent once it passes the bounds test.
+struct dynentspan
+{
+    int x1, y1, x2, y2;
+
+    bool operator==(const dynentspan &o) const { return x1==o.x1 && y1==o.y1 && x2==o.x2 && y2==o.y2; }
+    bool operator!=(const dynentspan &o) const { return !(*this == o); }
+};
+
+struct dynentgrid
+{
+    bool dirty;
+    int millis;
+    vector<physent *> ents;
+    vector<float> x, y, z, radius, eyeheight, aboveeye;
+    vector<dynentspan> spans;
+    vector<uint> keys;
+    vector<int> indices;
+    int buckets[DYNENTCACHESIZE+1], cursor[DYNENTCACHESIZE];
+
+    dynentgrid() : dirty(true), millis(-1) {}
+};
+
+// Rebuilt from the live dynents once a frame, and kept current in between by updatedynentcache()
+static dynentgrid livegrid;
+
+// The dynents as they stood when moveplayers() started; workers collide against these copies,
+// so no entity sees another one half moved
+struct frozendynent : physent
+{
+    physent *owner;
+
+    frozendynent() : owner(NULL) {}
+    frozendynent(physent *d) : physent(*d), owner(d) {}
+};
 
-static struct dynentcacheentry
+static vector<frozendynent> frozendynents;
+static dynentgrid frozengrid;
+
+static inline physent *dynentowner(physent *d)
 {
-    int x, y;
-    uint frame;
-    vector<physent *> dynents;
-} dynentcache[DYNENTCACHESIZE];
+    return getphysworker() ? ((frozendynent *)d)->owner : d;
+}
 
 void cleardynentcache()
 {
-    dynentframe++;
-    if(!dynentframe || dynentframe == 1) loopi(DYNENTCACHESIZE) dynentcache[i].frame = 0;
-    if(!dynentframe) dynentframe = 1;
+    livegrid.dirty = true;
 }
 
 VARF(dynentsize, 4, 7, 12, cleardynentcache());
 
 #define DYNENTHASH(x, y) (((((x)^(y))<<5) + (((x)^(y))>>5)) & (DYNENTCACHESIZE - 1))
-
-const vector<physent *> &checkdynentcache(int x, int y)
-{
-    dynentcacheentry &dec = dynentcache[DYNENTHASH(x, y)];
-    if(dec.x == x && dec.y == y && dec.frame == dynentframe) return dec.dynents;
-    dec.x = x;
-    dec.y = y;
-    dec.frame = dynentframe;
-    dec.dynents.shrink(0);
-    int numdyns = game::numdynents(), dsize = 1<<dynentsize, dx = x<<dynentsize, dy = y<<dynentsize;
-    loopi(numdyns)
-    {
-        dynent *d = game::iterdynents(i);
-        if(d->state != CS_ALIVE ||
-           d->o.x+d->radius <= dx || d->o.x-d->radius >= dx+dsize ||
-           d->o.y+d->radius <= dy || d->o.y-d->radius >= dy+dsize)
-            continue;
-        dec.dynents.add(d);
-    }
-    return dec.dynents;
-}
+#define DYNENTKEY(x, y) ((uint(x)<<16) | uint(y))
 
 #define loopdynentcache(curx, cury, o, radius) \
     for(int curx = max(int(o.x-radius), 0)>>dynentsize, endx = min(int(o.x+radius), worldsize-1)>>dynentsize; curx <= endx; curx++) \
     for(int cury = max(int(o.y-radius), 0)>>dynentsize, endy = min(int(o.y+radius), worldsize-1)>>dynentsize; cury <= endy; cury++)
 
-void updatedynentcache(physent *d)
+// Loops j over the index of every dynent filed under a cell within radius of o
+#define loopdynentgrid(g, o, radius, j) \
+    loopdynentcache(curx, cury, o, radius) \
+    for(int k##j = (g).buckets[DYNENTHASH(curx, cury)], end##j = (g).buckets[DYNENTHASH(curx, cury)+1], j; k##j < end##j; k##j++) \
+        if((g).keys[k##j] == DYNENTKEY(curx, cury) && ((j = (g).indices[k##j]), true))
+
+static inline void storedynent(dynentgrid &g, int i)
+{
+    const physent *d = g.ents[i];
+    g.x[i] = d->o.x;
+    g.y[i] = d->o.y;
+    g.z[i] = d->o.z;
+    g.radius[i] = d->radius;
+    g.eyeheight[i] = d->eyeheight;
+    g.aboveeye[i] = d->aboveeye;
+    dynentspan &s = g.spans[i];
+    if(d->state != CS_ALIVE) { s.x1 = s.y1 = 0; s.x2 = s.y2 = -1; return; }
+    s.x1 = max(int(d->o.x-d->radius), 0)>>dynentsize;
+    s.y1 = max(int(d->o.y-d->radius), 0)>>dynentsize;
+    s.x2 = min(int(d->o.x+d->radius), worldsize-1)>>dynentsize;
+    s.y2 = min(int(d->o.y+d->radius), worldsize-1)>>dynentsize;
+}
+
+// Fills the arrays and filings from g.ents
+static void builddynentgrid(dynentgrid &g)
+{
+    int n = g.ents.length();
+    g.x.setsize(0); g.x.pad(n);
+    g.y.setsize(0); g.y.pad(n);
+    g.z.setsize(0); g.z.pad(n);
+    g.radius.setsize(0); g.radius.pad(n);
+    g.eyeheight.setsize(0); g.eyeheight.pad(n);
+    g.aboveeye.setsize(0); g.aboveeye.pad(n);
+    g.spans.setsize(0); g.spans.pad(n);
+    memset(g.buckets, 0, sizeof(g.buckets));
+    loopi(n)
+    {
+        g.ents[i]->dynentslot = i;
+        storedynent(g, i);
+        const dynentspan &s = g.spans[i];
+        for(int x = s.x1; x <= s.x2; x++) for(int y = s.y1; y <= s.y2; y++) g.buckets[DYNENTHASH(x, y)+1]++;
+    }
+    loopi(DYNENTCACHESIZE) g.buckets[i+1] += g.buckets[i];
+    int filings = g.buckets[DYNENTCACHESIZE];
+    g.keys.setsize(0); g.keys.pad(filings);
+    g.indices.setsize(0); g.indices.pad(filings);
+    memcpy(g.cursor, g.buckets, sizeof(g.cursor));
+    loopi(n)
+    {
+        const dynentspan &s = g.spans[i];
+        for(int x = s.x1; x <= s.x2; x++) for(int y = s.y1; y <= s.y2; y++)
+        {
+            int k = g.cursor[DYNENTHASH(x, y)]++;
+            g.keys[k] = DYNENTKEY(x, y);
+            g.indices[k] = i;
+        }
+    }
+    g.dirty = false;
+    g.millis = lastmillis;
+}
+
+static dynentgrid &checkdynentgrid()
 {
-    loopdynentcache(x, y, d->o, d->radius)
+    if(getphysworker()) return frozengrid;
+    if(livegrid.dirty || livegrid.millis != lastmillis)
     {
-        dynentcacheentry &dec = dynentcache[DYNENTHASH(x, y)];
-        if(dec.x != x || dec.y != y || dec.frame != dynentframe || dec.dynents.find(d) >= 0) continue;
-        dec.dynents.add(d);
+        livegrid.ents.setsize(0);
+        int numdyns = game::numdynents();
+        loopi(numdyns)
+        {
+            dynent *d = game::iterdynents(i);
+            if(d) livegrid.ents.add(d);
+        }
+        builddynentgrid(livegrid);
     }
+    return livegrid;
+}
+
+void updatedynentcache(physent *d)
+{
+    if(getphysworker()) return; // The snapshot stays frozen, moveplayers() updates the grid when it commits
+    dynentgrid &g = livegrid;
+    if(g.dirty || g.millis != lastmillis) return; // Rebuilt from scratch by the next query anyway
+    int i = d->dynentslot;
+    if(!g.ents.inrange(i) || g.ents[i] != d) { g.dirty = true; return; }
+    dynentspan span = g.spans[i];
+    storedynent(g, i);
+    if(g.spans[i] != span) g.dirty = true; // Only refiled when it crosses into other cells
 }
 
 bool overlapsdynent(const vec &o, float radius)
 {
-    loopdynentcache(x, y, o, radius)
+    dynentgrid &g = checkdynentgrid();
+    loopdynentgrid(g, o, radius, j)
     {
-        const vector<physent *> &dynents = checkdynentcache(x, y);
-        loopv(dynents)
-        {
-            physent *d = dynents[i];
-            if(o.dist(d->o)-d->radius < radius) return true;
-        }
+        if(o.dist(vec(g.x[j], g.y[j], g.z[j]))-g.radius[j] < radius) return true;
     }
     return false;
 }
 
+void dynentsnearray(const vec &from, const vec &to, vector<physent *> &nearby)
+{
+    dynentgrid &g = checkdynentgrid();
+    vec2 ray(to.x-from.x, to.y-from.y);
+    float raylen = ray.squaredlen(), zmin = min(from.z, to.z), zmax = max(from.z, to.z);
+    loopv(g.ents)
+    {
+        if(g.z[i]-g.eyeheight[i] > zmax || g.z[i]+g.aboveeye[i] < zmin) continue;
+        // Distance in the plane from the cylinder's axis to the segment
+        vec2 rel(g.x[i]-from.x, g.y[i]-from.y);
+        float t = raylen > 0 ? clamp(rel.dot(ray)/raylen, 0.0f, 1.0f) : 0;
+        rel.sub(vec2(ray).mul(t));
+        if(rel.squaredlen() > g.radius[i]*g.radius[i]) continue;
+        nearby.add(g.ents[i]);
+    }
+}
+
 template<class E, class O>
 static inline bool plcollide(physent *d, const vec &dir, physent *o)
 {
@@ -605,39 +816,41 @@ static inline bool plcollide(physent *d, const vec &dir, physent *o)
 bool plcollide(physent *d, const vec &dir)    // collide with player
 {
     if(d->type==ENT_CAMERA || d->state!=CS_ALIVE) return false;
-    loopdynentcache(x, y, d->o, d->radius)
+    dynentgrid &g = checkdynentgrid();
+    float bottom = d->o.z - d->eyeheight, top = d->o.z + d->aboveeye;
+    loopdynentgrid(g, d->o, d->radius, j)
     {
-        const vector<physent *> &dynents = checkdynentcache(x, y);
-        loopv(dynents)
+        float r = d->radius + g.radius[j];
+        if(fabs(g.x[j] - d->o.x) > r || fabs(g.y[j] - d->o.y) > r ||
+           g.z[j] - g.eyeheight[j] > top || g.z[j] + g.aboveeye[j] < bottom)
+            continue;
+        physent *o = g.ents[j];
+        if(dynentowner(o)==d) continue;
+        switch(d->collidetype)
         {
-            physent *o = dynents[i];
-            if(o==d || d->o.reject(o->o, d->radius+o->radius)) continue;
-            switch(d->collidetype)
-            {
-                case COLLIDE_ELLIPSE:
-                    if(o->collidetype == COLLIDE_ELLIPSE)
-                    {
-                        if(!ellipsecollide(d, dir, o->o, vec(0, 0, 0), o->yaw, o->xradius, o->yradius, o->aboveeye, o->eyeheight)) continue;
-                    }
-                    else if(!ellipseboxcollide(d, dir, o->o, vec(0, 0, 0), o->yaw, o->xradius, o->yradius, o->aboveeye, o->eyeheight)) continue;
-                    break;
-                case COLLIDE_OBB:
-                    if(o->collidetype == COLLIDE_ELLIPSE)
-                    {
-                        if(!plcollide<mpr::EntOBB, mpr::EntCylinder>(d, dir, o)) continue;
-                    }
-                    else if(!plcollide<mpr::EntOBB, mpr::EntOBB>(d, dir, o)) continue;
-                    break;
-                default: continue;
-            }
-            collideplayer = o;
-            /* OF */
-            CLogicEntity *dl = LogicSystem::getLogicEntity(d);
-            CLogicEntity *ol = LogicSystem::getLogicEntity(o);
-            if (dl && ol) lua::call_external("physics_collide_client", "iifff",
-                dl->getUniqueId(), ol->getUniqueId(), collidewall.x, collidewall.y, collidewall.z);
-            return true;
+            case COLLIDE_ELLIPSE:
+                if(o->collidetype == COLLIDE_ELLIPSE)
+                {
+                    if(!ellipsecollide(d, dir, o->o, vec(0, 0, 0), o->yaw, o->xradius, o->yradius, o->aboveeye, o->eyeheight)) continue;
+                }
+                else if(!ellipseboxcollide(d, dir, o->o, vec(0, 0, 0), o->yaw, o->xradius, o->yradius, o->aboveeye, o->eyeheight)) continue;
+                break;
+            case COLLIDE_OBB:
+                if(o->collidetype == COLLIDE_ELLIPSE)
+                {
+                    if(!plcollide<mpr::EntOBB, mpr::EntCylinder>(d, dir, o)) continue;
+                }
+                else if(!plcollide<mpr::EntOBB, mpr::EntOBB>(d, dir, o)) continue;
+                break;
+            default: continue;
         }
+        collideplayer = o = dynentowner(o);
+        /* OF */
+        CLogicEntity *dl = LogicSystem::getLogicEntity(d);
+        CLogicEntity *ol = LogicSystem::getLogicEntity(o);
+        if (dl && ol) physicsevent(PHYSEVENT_COLLIDE_CLIENT, d, false,
+            dl->getUniqueId(), ol->getUniqueId(), 0, collidewall);
+        return true;
     }
     return false;
 }
@@ -811,13 +1024,24 @@ bool areacollide(physent *d, const vec &dir, float cutoff, CLogicEntity *el) {
     return false;
 collision:
     CLogicEntity *dl = LogicSystem::getLogicEntity(d);
-    if (dl) lua::call_external("physics_collide_area", "ii",
+    if (dl) physicsevent(PHYSEVENT_COLLIDE_AREA, d, false,
         dl->getUniqueId(), el->getUniqueId());
     return e.attr[6];
 }
 
 VAR(testtricol, 0, 0, 2);
 
+// Resolves the model a mapmodel collides with, loading it the first time it is needed
+static model *collidemodel(extentity &e)
+{
+    if(!e.collide && e.m)
+    {
+        model *m = e.m->collidemodel ? loadmodel(e.m->collidemodel) : NULL;
+        e.collide = m ? m : e.m;
+    }
+    return e.collide;
+}
+
 bool mmcollide(physent *d, const vec &dir, float cutoff, octaentities &oc) // collide with a mapmodel
 {
     const vector<extentity *> &ents = entities::getents();
@@ -831,13 +1055,8 @@ bool mmcollide(physent *d, const vec &dir, float cutoff, octaentities &oc) // co
             if (areacollide(d, dir, cutoff, el)) return true;
             continue;
         }
-        model *m = e.collide;
-        if(!m) {
-            if (!e.m) continue;
-            if (e.m->collidemodel) m = loadmodel(e.m->collidemodel);
-            if (!m) m = e.m;
-            e.collide = m;
-        }
+        model *m = collidemodel(e);
+        if (!m) continue;
         int  mcol = e.m->collide;
         if (!mcol) continue;
 
@@ -895,7 +1114,7 @@ bool mmcollide(physent *d, const vec &dir, float cutoff, octaentities &oc) // co
         continue;
 collision:
         CLogicEntity *dl = LogicSystem::getLogicEntity(d);
-        if (dl) lua::call_external("physics_collide_mapmodel", "ii",
+        if (dl) physicsevent(PHYSEVENT_COLLIDE_MAPMODEL, d, false,
             dl->getUniqueId(), el->getUniqueId());
         return true;
     }
@@ -1650,7 +1869,11 @@ void avoidcollision(physent *d, const vec &dir, physent *obstacle, float space)
         float dist = ((dir[i] > 0 ? bbmax[i] : bbmin[i]) - d->o[i]) / dir[i];
         mindist = min(mindist, dist);
     }
-    if(mindist >= 0.0f && mindist < 1e15f) d->o.add(vec(dir).mul(mindist));
+    if(mindist >= 0.0f && mindist < 1e15f)
+    {
+        d->o.add(vec(dir).mul(mindist));
+        updatedynentcache(d);
+    }
 }
 
 bool movecamera(physent *pl, const vec &dir, float dist, float stepdist)
@@ -1765,6 +1988,17 @@ FVAR(straferoll, 0, 0.033f, 90);
 FVAR(faderoll, 0, 0.95f, 1);
 VAR(floatspeed, 1, 100, 10000);
 
+// Longest substep a move is split into, in cubes, 0 always splits moves into moveres substeps.
+// A still or slow entity then needs just the one substep, and only a contact brings back the
+// full precision for the rest of the move.
+FVAR(physstep, 0, 0.5f, 16);
+
+static inline int movesteps(const vec &d, int moveres)
+{
+    if(physstep <= 0) return moveres;
+    return clamp(int(ceilf(d.magnitude()/physstep)), 1, max(moveres, 1));
+}
+
 void modifyvelocity(physent *pl, bool local, bool water, bool floating, int curtime)
 {
     if(floating)
@@ -1787,7 +2021,7 @@ void modifyvelocity(physent *pl, bool local, bool water, bool floating, int curt
             pl->vel.z = max(pl->vel.z, pl->jumpvel); // physics impulse upwards
             if(water) { pl->vel.x /= 8.0f; pl->vel.y /= 8.0f; } // dampen velocity change even harder, gives correct water feel
 
-            game::physicstrigger(pl, local, 1, 0);
+            physicstrigger(pl, local, 1, 0);
         }
     }
     if(!floating && pl->physstate == PHYS_FALL) pl->timeinair += curtime;
@@ -1893,15 +2127,26 @@ bool moveplayer(physent *pl, int moveres, bool local, int curtime)
     }
     else                        // apply velocity with collision
     {
-        const float f = 1.0f/moveres;
         const int timeinair = pl->timeinair;
-        int collisions = 0;
+        int steps = movesteps(d, moveres), collisions = 0;
+        bool refined = steps >= moveres;
 
-        d.mul(f);
-        loopi(moveres) if(!move(pl, d) && ++collisions<5) i--; // discrete steps collision detection & sliding
+        d.mul(1.0f/steps);
+        loopi(steps) if(!move(pl, d) && ++collisions<5) // discrete steps collision detection & sliding
+        {
+            if(!refined)
+            {
+                // Once something is hit, what is left of the move goes at the full moveres precision
+                int left = steps - i, fine = max((left*moveres + steps - 1)/steps, 1);
+                d.mul(float(left)/fine);
+                steps = i + fine;
+                refined = true;
+            }
+            i--;
+        }
         if(timeinair > 800 && !pl->timeinair && !water) // if we land after long time must have been a high jump, make thud sound
         {
-            game::physicstrigger(pl, local, -1, 0);
+            physicstrigger(pl, local, -1, 0);
         }
     }
 
@@ -1919,14 +2164,14 @@ bool moveplayer(physent *pl, int moveres, bool local, int curtime)
         material = lookupmaterial(vec(pl->o.x, pl->o.y, pl->o.z + (pl->aboveeye - pl->eyeheight)/2));
         water = isliquid(material&MATF_VOLUME);
     }
-    if(!pl->inwater && water) game::physicstrigger(pl, local, 0, -1, material&MATF_VOLUME);
-    else if(pl->inwater && !water) game::physicstrigger(pl, local, 0, 1, pl->inwater);
+    if(!pl->inwater && water) physicstrigger(pl, local, 0, -1, material&MATF_VOLUME);
+    else if(pl->inwater && !water) physicstrigger(pl, local, 0, 1, pl->inwater);
     pl->inwater = water ? material&MATF_VOLUME : MAT_AIR;
 
     if (material&MAT_DEATH)
-        lua::call_external("physics_in_deadly", "ii", LogicSystem::getUniqueId(pl), material&MATF_VOLUME);
+        physicsevent(PHYSEVENT_DEADLY, pl, local, LogicSystem::getUniqueId(pl), material&MATF_VOLUME);
     else if (pl->o.z < 0)
-        lua::call_external("physics_off_map", "i", LogicSystem::getUniqueId(pl));
+        physicsevent(PHYSEVENT_OFF_MAP, pl, local, LogicSystem::getUniqueId(pl));
     return true;
 }
 
@@ -1997,6 +2242,236 @@ void moveplayer(physent *pl, int moveres, bool local)
 #endif
 }
 
+// Moves a batch of entities on by a frame, as moveplayer() does one at a time, except that they all
+// collide with the others as they stood before any of them moved. The result then no longer depends
+// on the order they are moved in, so the standalone server shares the moves out among a pool of
+// worker threads. Whatever scripts the moves trigger run afterwards on the main thread, in batch order.
+
+struct physjob
+{
+    physent *d;
+    int moveres, steps, frametime;
+    vector<physevent> events;
+};
+
+static vector<physjob> physjobs;
+static int numphysjobs = 0, nextphysjob = 0;
+static physworker *mainphysworker = NULL;
+
+static physworker *newphysworker()
+{
+    physworker *w = new physworker;
+    w->clipcache = new clipplanes[MAXCLIPPLANES];
+    loopi(MAXCLIPPLANES) w->clipcache[i].owner = NULL;
+    w->clipcachereset = clipcacheresets;
+    w->events = NULL;
+#ifdef PHYSTHREADS
+    w->collision.wall = vec(0, 0, 0);
+    w->collision.inside = false;
+    w->collision.player = NULL;
+#endif
+    return w;
+}
+
+static void deletephysworker(physworker *w)
+{
+    delete[] w->clipcache;
+    delete w;
+}
+
+static void runphysjobs(physworker &w)
+{
+    if(w.clipcachereset != clipcacheresets)
+    {
+        loopi(MAXCLIPPLANES) w.clipcache[i].owner = NULL;
+        w.clipcachereset = clipcacheresets;
+    }
+    setphysworker(&w);
+    for(;;)
+    {
+#ifdef PHYSTHREADS
+        int i = __atomic_fetch_add(&nextphysjob, 1, __ATOMIC_RELAXED);
+#else
+        int i = nextphysjob++;
+#endif
+        if(i >= numphysjobs) break;
+        physjob &j = physjobs[i];
+        w.events = &j.events;
+        loopk(j.steps) moveplayer(j.d, j.moveres, false, j.frametime);
+    }
+    w.events = NULL;
+    setphysworker(NULL);
+}
+
+// Workers must never load anything, so every collision model is made ready before they start
+static void prepcollidemodels()
+{
+    const vector<extentity *> &ents = entities::getents();
+    loopv(ents)
+    {
+        extentity &e = *ents[i];
+        model *m = collidemodel(e);
+        if(!m) continue;
+        vec center, radius;
+        m->collisionbox(center, radius);
+        if((e.m->collide == COLLIDE_TRI || testtricol) && !m->bih) m->setBIH();
+    }
+}
+
+#ifdef PHYSTHREADS
+#define MAXPHYSTHREADS 32
+
+static pthread_t physthreadids[MAXPHYSTHREADS];
+static int numphysthreads = 0, physgeneration = 0, physbusy = 0;
+static bool physthreadsready = false, physthreadquit = false;
+static pthread_mutex_t physmutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t physstartcond = PTHREAD_COND_INITIALIZER, physdonecond = PTHREAD_COND_INITIALIZER;
+
+static void *physthreadmain(void *arg)
+{
+    physworker *w = newphysworker();
+    int generation = int(size_t(arg));
+    pthread_mutex_lock(&physmutex);
+    for(;;)
+    {
+        while(generation == physgeneration && !physthreadquit) pthread_cond_wait(&physstartcond, &physmutex);
+        if(physthreadquit) break;
+        generation = physgeneration;
+        pthread_mutex_unlock(&physmutex);
+        runphysjobs(*w);
+        pthread_mutex_lock(&physmutex);
+        if(!--physbusy) pthread_cond_signal(&physdonecond);
+    }
+    pthread_mutex_unlock(&physmutex);
+    deletephysworker(w);
+    return NULL;
+}
+
+static void stopphysthreads()
+{
+    if(!numphysthreads) return;
+    pthread_mutex_lock(&physmutex);
+    physthreadquit = true;
+    pthread_cond_broadcast(&physstartcond);
+    pthread_mutex_unlock(&physmutex);
+    loopi(numphysthreads) pthread_join(physthreadids[i], NULL);
+    numphysthreads = 0;
+    physthreadquit = false;
+}
+
+static void startphysthreads();
+
+// Threads helping the main thread move entities, 0 moves them all on the main thread
+VARF(physthreads, 0, 0, MAXPHYSTHREADS, { if(physthreadsready) startphysthreads(); });
+
+static void startphysthreads()
+{
+    stopphysthreads();
+    physthreadsready = true;
+    while(numphysthreads < physthreads)
+    {
+        // Started between batches, so a thread begins waiting for the batch after the current generation
+        if(pthread_create(&physthreadids[numphysthreads], NULL, physthreadmain, (void *)size_t(physgeneration)))
+        {
+            conoutf(CON_ERROR, "could not start physics worker thread %d", numphysthreads);
+            break;
+        }
+        numphysthreads++;
+    }
+}
+#endif
+
+// Metrics, reported by physthreadstats
+static llong physbatchtime = 0;
+static int physbatches = 0, physbatchents = 0;
+
+void moveplayers(physent **ents, int numents, int moveres)
+{
+    llong start = getmicros();
+
+    prepcollidemodels();
+    frozendynents.shrink(0);
+    int numdyns = game::numdynents();
+    loopi(numdyns) frozendynents.add(frozendynent(game::iterdynents(i)));
+
+    numphysjobs = nextphysjob = 0;
+    loopi(numents)
+    {
+        physent *d = ents[i];
+        // INTENSITY: Don't move an entity not fully set up yet
+        if(!d || !LogicSystem::getLogicEntity(d)) continue;
+        TargetingControl::calcPhysicsFrames(d);
+        gameent *e = (gameent *)d;
+        if(e->physsteps <= 0) continue;
+        if(physjobs.length() <= numphysjobs) physjobs.add();
+        physjob &j = physjobs[numphysjobs++];
+        j.d = d;
+        j.moveres = moveres;
+        j.steps = e->physsteps;
+        j.frametime = e->physframetime;
+        j.events.setsize(0);
+    }
+    if(!numphysjobs) return;
+
+    // Workers only ever read this grid, so they share it
+    frozengrid.ents.setsize(0);
+    loopv(frozendynents) frozengrid.ents.add(&frozendynents[i]);
+    builddynentgrid(frozengrid);
+
+#ifdef PHYSTHREADS
+    if(!physworkerkeyready)
+    {
+        pthread_key_create(&physworkerkey, NULL);
+        physworkerkeyready = true;
+    }
+#endif
+    if(!mainphysworker) mainphysworker = newphysworker();
+#ifdef PHYSTHREADS
+    if(!physthreadsready) startphysthreads();
+    if(numphysthreads && numphysjobs > 1)
+    {
+        pthread_mutex_lock(&physmutex);
+        physbusy = numphysthreads;
+        physgeneration++;
+        pthread_cond_broadcast(&physstartcond);
+        pthread_mutex_unlock(&physmutex);
+        runphysjobs(*mainphysworker);
+        pthread_mutex_lock(&physmutex);
+        while(physbusy) pthread_cond_wait(&physdonecond, &physmutex);
+        pthread_mutex_unlock(&physmutex);
+    }
+    else
+#endif
+    runphysjobs(*mainphysworker);
+
+    loopi(numphysjobs)
+    {
+        physjob &job = physjobs[i];
+        if(job.d->state==CS_ALIVE) updatedynentcache(job.d);
+        loopvj(job.events) runphysevent(job.events[j]);
+    }
+
+    physbatchtime += getmicros() - start;
+    physbatches++;
+    physbatchents += numphysjobs;
+}
+
+void physthreadstats()
+{
+#ifdef PHYSTHREADS
+    int threads = numphysthreads;
+#else
+    int threads = 0;
+#endif
+    if(physbatches)
+        conoutf("entity physics with %d worker threads: %.3f ms per batch, %.2f us per entity, over %d batches of %.1f entities",
+            threads, physbatchtime/(1000.0f*physbatches), float(physbatchtime)/max(physbatchents, 1), physbatches, float(physbatchents)/physbatches);
+    else conoutf("entity physics with %d worker threads: no batches run", threads);
+    physbatchtime = 0;
+    physbatches = physbatchents = 0;
+}
+COMMAND(physthreadstats, "");
+
 bool bounce(physent *d, float elasticity, float waterfric, float grav)
 {
     if(physsteps <= 0)
@@ -2109,3 +2584,204 @@ CLUAICOMMAND(ray_floor, float, (float x, float y, float z, float radius), {
     return rayfloor(vec(x, y, z), floor, 0, radius);
 });
 
+/* OF: ray batches, so a script tracing many rays crosses into the engine just once */
+
+struct ray_t
+{
+    vec origin, direction; // for RAY_BATCH_LOS, the direction is the point to look at
+    float radius, distance;
+    vec hit;
+};
+
+enum { RAY_BATCH_POS = 0, RAY_BATCH_LOS, RAY_BATCH_FLOOR };
+
+struct raysortkey
+{
+    uint key;
+    int index;
+
+    bool operator<(const raysortkey &o) const { return key < o.key; }
+};
+
+static inline uint mortonspread(uint v)
+{
+    v &= 0x3FF;
+    v = (v | (v << 16)) & 0x030000FF;
+    v = (v | (v <<  8)) & 0x0300F00F;
+    v = (v | (v <<  4)) & 0x030C30C3;
+    v = (v | (v <<  2)) & 0x09249249;
+    return v;
+}
+
+// Rays starting close together and heading the same way walk the same octree nodes and
+// clip planes, so they are traced in Morton order of their origins, grouped by direction octant
+static uint raycoherencekey(const ray_t &r, int mode)
+{
+    vec dir = mode == RAY_BATCH_LOS ? vec(r.direction).sub(r.origin) : (mode == RAY_BATCH_FLOOR ? vec(0, 0, -1) : r.direction);
+    uint octant = (dir.x < 0 ? 1 : 0) | (dir.y < 0 ? 2 : 0) | (dir.z < 0 ? 4 : 0);
+    float scale = 512.0f/worldsize;
+    uint x = clamp(int(r.origin.x*scale), 0, 511),
+         y = clamp(int(r.origin.y*scale), 0, 511),
+         z = clamp(int(r.origin.z*scale), 0, 511);
+    return (octant<<27) | mortonspread(x) | (mortonspread(y)<<1) | (mortonspread(z)<<2);
+}
+
+// Traces one ray as RAY_BATCH_POS, RAY_BATCH_LOS or RAY_BATCH_FLOOR, returning 1 if it hits something
+static int traceray(ray_t &r, int mode)
+{
+    switch(mode)
+    {
+        case RAY_BATCH_POS:
+            r.distance = raycubepos(r.origin, r.direction, r.hit, r.radius, RAY_CLIPMAT | RAY_POLY);
+            return r.distance >= 0 && (r.radius <= 0 || r.distance < r.radius) ? 1 : 0;
+        case RAY_BATCH_LOS:
+        {
+            bool los = raycubelos(r.origin, r.direction, r.hit);
+            r.distance = r.hit.dist(r.origin);
+            return los ? 0 : 1;
+        }
+        case RAY_BATCH_FLOOR:
+        {
+            vec floor(0, 0, 1);
+            r.distance = rayfloor(r.origin, floor, 0, r.radius);
+            r.hit = vec(r.origin).addz(-max(r.distance, 0.0f));
+            return r.distance >= 0 && (r.radius <= 0 || r.distance < r.radius) ? 1 : 0;
+        }
+    }
+    return 0;
+}
+
+// Rays of a packet are traced against the world's cubes one at a time, but against the mapmodels
+// near them together, four lanes sharing each walk of a model's BIH (see BIH::traverse). A ray
+// whose bounds span more than RAYPACKETCELLS entity cells of the octree is traced on its own, as
+// gathering the mapmodels in its bounds would cost more than walking along it.
+#define RAYPACKETCELLS 64
+
+extern int octaentsize;
+
+static vector<int> packetmms;
+static vector<uchar> packetmmlanes; // by entity, the lanes that pass near it
+
+static void findpacketmms(cube *c, const ivec &o, int size, const ivec &bo, const ivec &br, int lane)
+{
+    loopoctabox(o, size, bo, br)
+    {
+        if(c[i].ext && c[i].ext->ents)
+        {
+            const vector<int> &mms = c[i].ext->ents->mapmodels;
+            loopvj(mms)
+            {
+                if(!packetmmlanes[mms[j]]) packetmms.add(mms[j]);
+                packetmmlanes[mms[j]] |= 1<<lane;
+            }
+        }
+        if(c[i].children && size > octaentsize)
+        {
+            ivec co(i, o, size);
+            findpacketmms(c[i].children, co, size>>1, bo, br, lane);
+        }
+    }
+}
+
+// Traces up to four rays heading into the same octant as RAY_BATCH_POS or RAY_BATCH_LOS, with the
+// same results traceray() gives them
+static int traceraypacket(ray_t **rays, int numrays, int mode)
+{
+    const vector<extentity *> &ents = entities::getents();
+    while(packetmmlanes.length() < ents.length()) packetmmlanes.add(0);
+    vec o[4], ray[4];
+    float maxdist[4], dist[4];
+    int traced = 0, mask = 0, hits = 0, cellsize = max(octaentsize, 16);
+    loopk(numrays)
+    {
+        ray_t &r = *rays[k];
+        o[k] = r.origin;
+        if(mode == RAY_BATCH_LOS)
+        {
+            ray[k] = vec(r.direction).sub(r.origin);
+            maxdist[k] = ray[k].magnitude();
+            if(maxdist[k] <= 0) { hits += traceray(r, mode); continue; }
+            ray[k].mul(1/maxdist[k]);
+        }
+        else
+        {
+            ray[k] = r.direction;
+            maxdist[k] = r.radius;
+            if(ray[k].iszero()) { hits += traceray(r, mode); continue; }
+        }
+        dist[k] = raycube(o[k], ray[k], maxdist[k], RAY_CLIPMAT);
+        traced |= 1<<k;
+        if(dist[k] <= 0) continue;
+        vec end = vec(ray[k]).mul(dist[k]).add(o[k]);
+        ivec bo = vec(o[k]).min(end).sub(1), br = vec(o[k]).max(end).add(1);
+        if(((br.x-bo.x)/cellsize + 1)*((br.y-bo.y)/cellsize + 1)*((br.z-bo.z)/cellsize + 1) > RAYPACKETCELLS)
+        {
+            traced &= ~(1<<k);
+            hits += traceray(r, mode);
+            continue;
+        }
+        findpacketmms(worldroot, ivec(0, 0, 0), 1<<(worldscale-1), bo, br, k);
+        mask |= 1<<k;
+    }
+    loopv(packetmms)
+    {
+        int id = packetmms[i], lanes = packetmmlanes[id];
+        packetmmlanes[id] = 0;
+        extentity &e = *ents[id];
+        if(!(e.flags&EF_OCTA)) continue;
+        float f[4];
+        int hit = mmintersect(e, o, ray, lanes, dist, f, RAY_CLIPMAT | RAY_POLY);
+        loopk(4) if(hit&(1<<k) && f[k] > 0 && f[k] < dist[k]) dist[k] = f[k];
+    }
+    packetmms.setsize(0);
+    loopk(numrays) if(traced&(1<<k))
+    {
+        ray_t &r = *rays[k];
+        float d = maxdist[k] > 0 && dist[k] >= maxdist[k] ? maxdist[k] : dist[k];
+        r.hit = vec(ray[k]).mul(d).add(o[k]);
+        if(mode == RAY_BATCH_LOS)
+        {
+            r.distance = r.hit.dist(o[k]);
+            if(d < maxdist[k]) hits++;
+        }
+        else
+        {
+            r.distance = d;
+            if(d >= 0 && (maxdist[k] <= 0 || d < maxdist[k])) hits++;
+        }
+    }
+    return hits;
+}
+
+// Traces numrays rays in place and returns how many of them hit something within their range
+CLUAICOMMAND(ray_batch, int, (ray_t *rays, int numrays, int mode), {
+    if(!rays || numrays <= 0 || mode < RAY_BATCH_POS || mode > RAY_BATCH_FLOOR) return 0;
+    static vector<raysortkey> order;
+    order.setsize(0);
+    loopi(numrays)
+    {
+        raysortkey &k = order.add();
+        k.key = numrays >= 16 ? raycoherencekey(rays[i], mode) : 0;
+        k.index = i;
+    }
+    int hits = 0;
+    if(numrays < 16 || mode == RAY_BATCH_FLOOR)
+    {
+        // Too few rays to share anything, or only cubes to hit
+        if(numrays >= 16) order.sort();
+        loopv(order) hits += traceray(rays[order[i].index], mode);
+        return hits;
+    }
+    order.sort();
+    for(int i = 0; i < order.length();)
+    {
+        // Packets of up to four consecutive rays in the same octant
+        ray_t *packet[4];
+        int n = 0;
+        uint octant = order[i].key>>27;
+        while(n < 4 && i < order.length() && order[i].key>>27 == octant) packet[n++] = &rays[order[i++].index];
+        hits += traceraypacket(packet, n, mode);
+    }
+    return hits;
+});
+
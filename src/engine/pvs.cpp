@@ -286,6 +286,7 @@ static struct
 static vector<materialsurface *> waterfalls;
 uint numwaterplanes = 0;
 
+#ifndef SERVER
 struct pvsworker
 {
     pvsworker() : thread(NULL), pvsnodes(new pvsnode[origpvsnodes.length()])
@@ -809,6 +810,7 @@ struct pvsworker
         return 0;
     }
 };
+#endif
 
 struct viewcellnode
 {
@@ -829,6 +831,7 @@ struct viewcellnode
     }
 };
 
+#ifndef SERVER
 VARP(pvsthreads, 0, 0, 16);
 static vector<pvsworker *> pvsworkers;
 
@@ -942,6 +945,7 @@ static void genviewcells(viewcellnode &p, cube *c, const ivec &co, int size, int
         }
     }
 }
+#endif
 
 static viewcellnode *viewcells = NULL;
 static int lockedwaterplanes[MAXWATERPVS];
@@ -1019,6 +1023,7 @@ void clearpvs()
 
 COMMAND(clearpvs, "");
 
+#ifndef SERVER
 static void findwaterplanes()
 {
     extern vector<vtxarray *> valist;
@@ -1178,6 +1183,7 @@ void genpvs(int *viewcellsize)
 }
 
 COMMAND(genpvs, "i");
+#endif
 
 void pvsstats()
 {
@@ -1236,6 +1242,16 @@ bool pvsoccludedsphere(const vec &center, float radius)
     return pvsoccluded(curpvs, bbmin, bbmax);
 }
 
+// Tests a bounding box against the view cell containing an arbitrary viewer
+// rather than the camera, so the server can cull by visibility per client.
+bool pvsoccludedfrom(const vec &viewer, const ivec &bbmin, const ivec &bbmax)
+{
+    if(!usepvs) return false;
+    pvsdata *d = lookupviewcell(viewer);
+    if(!d) return false;
+    return pvsoccluded(&pvsbuf[d->offset + d->len%9], bbmin, bbmax);
+}
+
 bool waterpvsoccluded(int height)
 {
     if(!curwaterpvs) return false;
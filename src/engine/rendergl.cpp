@@ -2857,7 +2857,8 @@ void gl_drawframe()
     {
         if(mainmenu) gl_drawmainmenu();
         else if (ClientSystem::scenarioStarted()) gl_drawview();
-        lua::call_external("gui_render", "");
+        static lua::external guirender("gui_render");
+        lua::call_external(guirender);
         gl_drawhud();
         if(!ovr::enabled) break;
         ovr::warp();
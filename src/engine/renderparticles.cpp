@@ -1508,7 +1508,8 @@ int density, float scale, float speed, int gravity, int uid), {
 enum { PART_TEXT = 0, PART_ICON };
 
 static void makeparticles(const extentity &e) {
-    lua::call_external("particle_entity_emit", "i", e.uid);
+    static lua::external emit("particle_entity_emit");
+    lua::call_external(emit, e.uid);
 }
 
 void seedparticles()
@@ -13,6 +13,13 @@
 #include <direct.h>
 #endif
 
+// The network I/O thread (serverthread) is only available in the standalone server, on POSIX systems
+#if defined(SERVER) && !defined(WIN32)
+#define NETTHREAD
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
 namespace server
 {
     extern bool shutdown_if_empty;
@@ -122,13 +129,14 @@ void conoutf(const char *fmt, ...)
 
 #define DEFAULTCLIENTS 8
 
-enum { ST_EMPTY, ST_LOCAL, ST_TCPIP };
+enum { ST_EMPTY, ST_LOCAL, ST_TCPIP, ST_REPLAY };
 
 struct client                   // server side version of "dynent" type
 {
     int type;
     int num;
     ENetPeer *peer;
+    enet_uint32 connectid; // Identifies the connection on 'peer', which ENet reuses after disconnects
     string hostname;
     void *info;
 };
@@ -162,7 +170,7 @@ client &addclient(int type)
     c->type = type;
     switch(type)
     {
-        case ST_TCPIP: nonlocalclients++; break;
+        case ST_TCPIP: case ST_REPLAY: nonlocalclients++; break;
         case ST_LOCAL: localclients++; break;
     }
     return *c;
@@ -174,11 +182,13 @@ void delclient(client *c)
     switch(c->type)
     {
         case ST_TCPIP: nonlocalclients--; if(c->peer) c->peer->data = NULL; break;
+        case ST_REPLAY: nonlocalclients--; break;
         case ST_LOCAL: localclients--; break;
         case ST_EMPTY: return;
     }
     c->type = ST_EMPTY;
     c->peer = NULL;
+    freemapupload(c->num);
     if(c->info)
     {
         server::deleteclientinfo(c->info);
@@ -186,8 +196,28 @@ void delclient(client *c)
     }
 }
 
+#ifdef NETTHREAD
+static void stopnetthread();
+#endif
+
+// What the server sent to the stand-in clients of a packet replay, counted by sendpacket
+static uint replaysentpackets = 0, replaysentbytes = 0;
+static void forgetreplayclient(int n);
+
+static llong serverwait = 0; // Microseconds the last slice spent waiting for network events
+
+static int countfreepeers()
+{
+    int free = 0;
+    loopi(serverhost->peerCount) if(serverhost->peers[i].state == ENET_PEER_STATE_DISCONNECTED) free++;
+    return free;
+}
+
 void cleanupserver()
 {
+#ifdef NETTHREAD
+    stopnetthread();
+#endif
     if(serverhost) enet_host_destroy(serverhost);
     serverhost = NULL;
 
@@ -201,10 +231,263 @@ VARF(maxdupclients, 0, 0, MAXCLIENTS, { if(serverhost) serverhost->duplicatePeer
 void process(ENetPacket *packet, int sender, int chan);
 //void disconnect_client(int n, int reason);
 
+#ifdef NETTHREAD
+// Network I/O thread: with serverthread 1, a separate thread owns the ENet host. It services it
+// continuously and passes received events to the game thread, and the packets, disconnects and
+// flushes the game thread asks for back to ENet, through a pair of lock-free queues. That way a
+// long Lua frame or physics step no longer delays receiving packets and acknowledging them.
+//
+// ENet is not thread safe, so once the thread runs nothing else may call into the host or its
+// peers (reading peer statistics is tolerated, they may just be slightly stale). Packets given
+// to sendpacket() are handed over as copies when the game thread flushes, so the reference
+// counts and free callbacks of the originals stay on the game thread.
+
+//! A bounded queue with one producer thread and one consumer thread, needing no locks
+template<class T, int SIZE> struct spscqueue
+{
+    T items[SIZE];
+    int head, tail; // Only the consumer writes head, and only the producer writes tail
+
+    spscqueue() : head(0), tail(0) {}
+
+    int length() const
+    {
+        return (__atomic_load_n(&tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&head, __ATOMIC_ACQUIRE) + SIZE) % SIZE;
+    }
+
+    bool push(const T &item)
+    {
+        int next = (tail + 1) % SIZE;
+        if(next == __atomic_load_n(&head, __ATOMIC_ACQUIRE)) return false;
+        items[tail] = item;
+        __atomic_store_n(&tail, next, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    bool pop(T &item)
+    {
+        if(head == __atomic_load_n(&tail, __ATOMIC_ACQUIRE)) return false;
+        item = items[head];
+        __atomic_store_n(&head, (head + 1) % SIZE, __ATOMIC_RELEASE);
+        return true;
+    }
+};
+
+struct netevent
+{
+    ENetEventType type;
+    ENetPeer *peer;
+    enet_uint32 connectid, data, time;
+    int chan;
+    ENetPacket *packet;
+};
+
+enum { NETCMD_SEND = 0, NETCMD_RELEASE, NETCMD_DISCONNECT, NETCMD_FLUSH, NETCMD_COMPRESSION };
+
+struct netcommand
+{
+    int type;
+    ENetPeer *peer;
+    enet_uint32 connectid;
+    int chan, reason; // reason is the method for NETCMD_COMPRESSION
+    ENetPacket *packet;
+};
+
+#define NETQUEUESIZE 4096
+
+static spscqueue<netevent, NETQUEUESIZE> netevents;
+static spscqueue<netcommand, NETQUEUESIZE> netcommands;
+static vector<netcommand> netoutbox; // Sends queued by the game thread since its last flush
+static pthread_t netthreadid;
+static bool netthreadrunning = false;
+static int netthreadquit = 0;
+
+// Metrics, reported by netthreadstats
+static int neteventpeak = 0, netcommandpeak = 0, netlatencymax = 0;
+static uint netlatencysum = 0, netlatencycount = 0;
+
+static void runnetcommand(netcommand &cmd)
+{
+    switch(cmd.type)
+    {
+        case NETCMD_SEND:
+            // The peer may have been reset, or even reused by a new connection, since this was queued
+            if(cmd.peer->connectID == cmd.connectid) enet_peer_send(cmd.peer, cmd.chan, cmd.packet);
+            break;
+        case NETCMD_RELEASE:
+            if(--cmd.packet->referenceCount == 0) enet_packet_destroy(cmd.packet);
+            break;
+        case NETCMD_DISCONNECT:
+            if(cmd.peer->connectID == cmd.connectid) enet_peer_disconnect(cmd.peer, cmd.reason);
+            break;
+        case NETCMD_FLUSH:
+            enet_host_flush(serverhost);
+            break;
+        case NETCMD_COMPRESSION:
+            setnetcompression(serverhost, cmd.reason);
+            break;
+    }
+}
+
+static bool netthreadquitting() { return __atomic_load_n(&netthreadquit, __ATOMIC_ACQUIRE) != 0; }
+
+static int netfreepeers = 0; // Published by the I/O thread, as the game thread may not walk the peers
+
+static void *netthreadmain(void *)
+{
+    ENetEvent event;
+    while(!netthreadquitting())
+    {
+        netcommand cmd;
+        while(netcommands.pop(cmd)) runnetcommand(cmd);
+        __atomic_store_n(&netfreepeers, countfreepeers(), __ATOMIC_RELEASE);
+
+        // A short wait, so new commands are picked up promptly
+        if(enet_host_service(serverhost, &event, 1) <= 0) continue;
+        do
+        {
+            netevent e;
+            e.type = event.type;
+            e.peer = event.peer;
+            e.connectid = event.peer->connectID;
+            e.data = event.data;
+            e.time = enet_time_get();
+            e.chan = event.channelID;
+            e.packet = event.packet;
+            if(e.type == ENET_EVENT_TYPE_CONNECT) setnetpeerdictionary(serverhost, e.peer, e.data);
+            while(!netevents.push(e))
+            {
+                if(netthreadquitting()) { if(e.packet) enet_packet_destroy(e.packet); break; }
+                usleep(100);
+            }
+        } while(enet_host_check_events(serverhost, &event) > 0);
+    }
+    netcommand cmd;
+    while(netcommands.pop(cmd)) runnetcommand(cmd);
+    enet_host_flush(serverhost);
+    return NULL;
+}
+
+static void pushnetcommand(const netcommand &cmd)
+{
+    while(!netcommands.push(cmd)) usleep(100);
+    netcommandpeak = max(netcommandpeak, netcommands.length());
+}
+
+//! Hands the queued sends over to the I/O thread, and optionally has it flush the host
+static void flushnetoutbox(bool flush)
+{
+    static vector<ENetPacket *> originals;
+    originals.setsize(0);
+    loopv(netoutbox)
+    {
+        netcommand &cmd = netoutbox[i];
+        ENetPacket *original = cmd.packet;
+        if(!original->userData)
+        {
+            ENetPacket *copy = enet_packet_create(original->data, original->dataLength,
+                                                  original->flags & ~ENET_PACKET_FLAG_NO_ALLOCATE);
+            copy->referenceCount = 1; // Held until the RELEASE below, after all its sends
+            original->userData = copy;
+            originals.add(original);
+        }
+        cmd.packet = (ENetPacket *)original->userData;
+        pushnetcommand(cmd);
+        original->referenceCount--; // Drop the reference queuenetsend() took, as ENet would once it went out
+    }
+    netoutbox.setsize(0);
+    loopv(originals)
+    {
+        ENetPacket *original = originals[i];
+        netcommand cmd;
+        cmd.type = NETCMD_RELEASE;
+        cmd.packet = (ENetPacket *)original->userData;
+        pushnetcommand(cmd);
+        original->userData = NULL;
+        if(!original->referenceCount) enet_packet_destroy(original);
+    }
+    if(flush)
+    {
+        netcommand cmd;
+        cmd.type = NETCMD_FLUSH;
+        pushnetcommand(cmd);
+    }
+}
+
+static void queuenetsend(client *c, int chan, ENetPacket *packet)
+{
+    packet->referenceCount++; // Like enet_peer_send(), so callers see the packet as in use
+    netcommand &cmd = netoutbox.add();
+    cmd.type = NETCMD_SEND;
+    cmd.peer = c->peer;
+    cmd.connectid = c->connectid;
+    cmd.chan = chan;
+    cmd.packet = packet;
+}
+
+static void startnetthread()
+{
+    if(netthreadrunning || !serverhost) return;
+    __atomic_store_n(&netthreadquit, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&netfreepeers, countfreepeers(), __ATOMIC_RELEASE);
+    if(pthread_create(&netthreadid, NULL, netthreadmain, NULL))
+    {
+        conoutf(CON_ERROR, "could not start the network I/O thread");
+        return;
+    }
+    netthreadrunning = true;
+    conoutf("network I/O thread started");
+}
+
+static void stopnetthread()
+{
+    if(!netthreadrunning) return;
+    flushnetoutbox(true);
+    __atomic_store_n(&netthreadquit, 1, __ATOMIC_RELEASE);
+    pthread_join(netthreadid, NULL);
+    netthreadrunning = false;
+    conoutf("network I/O thread stopped");
+}
+
+VARF(serverthread, 0, 0, 1, { if(serverthread) startnetthread(); else stopnetthread(); });
+
+void netthreadstats()
+{
+    conoutf("network I/O thread: %s, queued events: %d (peak %d), queued commands: %d (peak %d)",
+        netthreadrunning ? "running" : "off", netevents.length(), neteventpeak, netcommands.length(), netcommandpeak);
+    if(netlatencycount)
+        conoutf("receive to processing: %.2f ms average, %d ms max, over %u packets",
+            float(netlatencysum)/netlatencycount, netlatencymax, netlatencycount);
+    neteventpeak = netcommandpeak = netlatencymax = 0;
+    netlatencysum = netlatencycount = 0;
+}
+COMMAND(netthreadstats, "");
+#endif
+
+bool netthreadactive()
+{
+#ifdef NETTHREAD
+    return netthreadrunning;
+#else
+    return false;
+#endif
+}
+
+//! How many peers of the server host are free for new connections
+int getfreepeers()
+{
+    if(!serverhost) return 0;
+#ifdef NETTHREAD
+    if(netthreadrunning) return __atomic_load_n(&netfreepeers, __ATOMIC_ACQUIRE);
+#endif
+    return countfreepeers();
+}
+
 int getservermtu() { return serverhost ? serverhost->mtu : -1; }
 void *getclientinfo(int i) { return !clients.inrange(i) || clients[i]->type==ST_EMPTY ? NULL : clients[i]->info; }
 int getnumclients()        { return clients.length(); }
 uint getclientip(int n)    { return clients.inrange(n) && clients[n]->type==ST_TCPIP ? clients[n]->peer->address.host : 0; }
+ENetPeer *getclientpeer(int n) { return clients.inrange(n) && clients[n]->type==ST_TCPIP ? clients[n]->peer : NULL; }
 
 void sendpacket(int n, int chan, ENetPacket *packet, int exclude)
 {
@@ -219,6 +502,10 @@ void sendpacket(int n, int chan, ENetPacket *packet, int exclude)
     {
         case ST_TCPIP:
         {
+#ifdef NETTHREAD
+            if(netthreadrunning) queuenetsend(clients[n], chan, packet);
+            else
+#endif
             enet_peer_send(clients[n]->peer, chan, packet);
 
             //NetworkSystem::Cataloger::packetSent(chan, packet->dataLength); // INTENSITY
@@ -229,6 +516,11 @@ void sendpacket(int n, int chan, ENetPacket *packet, int exclude)
         case ST_LOCAL:
             localservertoclient(chan, packet);
             break;
+
+        case ST_REPLAY:
+            replaysentpackets++;
+            replaysentbytes += packet->dataLength;
+            break;
     }
 }
 
@@ -311,8 +603,22 @@ const char *disc_reasons[] = { "normal", "end of packet", "client num", "kicked/
 
 void disconnect_client(int n, int reason)
 {
-    if(!clients.inrange(n) || clients[n]->type!=ST_TCPIP) return;
-    enet_peer_disconnect(clients[n]->peer, reason);
+    if(!clients.inrange(n) || (clients[n]->type!=ST_TCPIP && clients[n]->type!=ST_REPLAY)) return;
+    if(clients[n]->type==ST_REPLAY) forgetreplayclient(n);
+#ifdef NETTHREAD
+    else if(netthreadrunning)
+    {
+        netcommand cmd;
+        cmd.type = NETCMD_DISCONNECT;
+        cmd.peer = clients[n]->peer;
+        cmd.connectid = clients[n]->connectid;
+        cmd.reason = reason;
+        flushnetoutbox(false); // Whatever was sent to them goes out first
+        pushnetcommand(cmd);
+    }
+    else
+#endif
+    if(clients[n]->type==ST_TCPIP) enet_peer_disconnect(clients[n]->peer, reason);
     server::clientdisconnect(n);
     delclient(clients[n]);
     defformatstring(s, "client (%s) disconnected because: %s", clients[n]->hostname, disc_reasons[reason]);
@@ -322,7 +628,7 @@ void disconnect_client(int n, int reason)
 
 void kicknonlocalclients(int reason)
 {
-    loopv(clients) if(clients[i]->type==ST_TCPIP) disconnect_client(i, reason);
+    loopv(clients) if(clients[i]->type==ST_TCPIP || clients[i]->type==ST_REPLAY) disconnect_client(i, reason);
 }
 
 void process(ENetPacket *packet, int sender, int chan)   // sender may be -1
@@ -332,6 +638,225 @@ void process(ENetPacket *packet, int sender, int chan)   // sender may be -1
     if(p.overread()) { disconnect_client(sender, DISC_EOP); return; }
 }
 
+// Packet recording and replay
+//
+// A recording holds everything remote clients sent the server - their connects, packets and
+// disconnects - each stamped with the milliseconds since recording began, along with what the
+// server broadcast in return. A replay connects a stand-in client for each recorded one and feeds
+// it the recorded packets, either at the recorded pace or as fast as slices run, and reports the
+// tick time, allocations and bandwidth the server needed for it.
+
+#define PACKETRECORD_MAGIC "OFPACKETRECORD"
+#define PACKETRECORD_VERSION 1
+
+struct packetrecordheader
+{
+    char magic[16];
+    int version, protocol;
+};
+
+enum { RECORD_CONNECT = 0, RECORD_PACKET, RECORD_DISCONNECT, RECORD_BROADCAST };
+
+struct packetrecord
+{
+    int millis, type, cn, chan, len;
+};
+
+static stream *recordfile = NULL;
+static enet_uint32 recordstart = 0;
+static int recordedevents = 0;
+
+static void stoprecording()
+{
+    if(!recordfile) return;
+    DELETEP(recordfile);
+    conoutf("recorded %d events", recordedevents);
+}
+
+void recordpackets(char *name)
+{
+    stoprecording();
+    if(!name[0]) return;
+    recordfile = opengzfile(name, "wb");
+    if(!recordfile) { conoutf(CON_ERROR, "could not open %s for recording", name); return; }
+    packetrecordheader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    copystring(hdr.magic, PACKETRECORD_MAGIC, sizeof(hdr.magic));
+    hdr.version = PACKETRECORD_VERSION;
+    hdr.protocol = PROTOCOL_VERSION;
+    lilswap(&hdr.version, 2);
+    recordfile->write(&hdr, sizeof(hdr));
+    recordstart = enet_time_get();
+    recordedevents = 0;
+    conoutf("recording client packets to %s", name);
+}
+COMMAND(recordpackets, "s");
+
+static void recordevent(int type, int cn, int chan = 0, const void *data = NULL, int len = 0)
+{
+    if(!recordfile) return;
+    packetrecord r = { int(enet_time_get() - recordstart), type, cn, chan, len };
+    lilswap(&r.millis, 5);
+    recordfile->write(&r, sizeof(r));
+    if(len > 0) recordfile->write(data, len);
+    recordedevents++;
+}
+
+static stream *replayfile = NULL;
+static packetrecord replaynext;
+static bool replayhasnext = false, replayfast = false, replayquit = false;
+static vector<int> replayclients; // Recorded client number to stand-in client number, or -1
+static enet_uint32 replaystart = 0;
+static int replayskipped = 0, replayevents = 0, replayslices = 0, replaymaxtick = 0;
+static llong replayticktime = 0;
+static uint replayallocations = 0, recordedbroadcast = 0, replaybroadcast = 0;
+
+//! Counts what the game broadcasts, so a replay can compare it with what was recorded
+void recordbroadcast(int chan, const void *data, int len)
+{
+    recordevent(RECORD_BROADCAST, -1, chan, data, len);
+    if(replayfile) replaybroadcast += len;
+}
+
+static void forgetreplayclient(int n)
+{
+    loopv(replayclients) if(replayclients[i] == n) replayclients[i] = -1;
+}
+
+static bool readreplayrecord()
+{
+    replayhasnext = replayfile->read(&replaynext, sizeof(replaynext)) == sizeof(replaynext);
+    if(replayhasnext) lilswap(&replaynext.millis, 5);
+    return replayhasnext;
+}
+
+static void stopreplay()
+{
+    if(!replayfile) return;
+    DELETEP(replayfile);
+    loopv(replayclients) if(replayclients[i] >= 0)
+    {
+        server::clientdisconnect(replayclients[i]);
+        delclient(clients[replayclients[i]]);
+    }
+    replayclients.setsize(0);
+
+    int recorded = replayhasnext ? replaynext.millis : replayskipped + int(enet_time_get() - replaystart);
+    uint allocated = allocations - replayallocations;
+    conoutf("replay finished: %d events, %d ms recorded, %d ms taken", replayevents, recorded, int(enet_time_get() - replaystart));
+    conoutf("  %d slices, tick time %.3f ms average, %.3f ms max", replayslices, replayticktime/1000.0f/max(replayslices, 1), replaymaxtick/1000.0f);
+    conoutf("  %u allocations, %.1f per slice", allocated, allocated/float(max(replayslices, 1)));
+    conoutf("  sent %u packets, %u bytes to stand-in clients (%.1f KB per recorded second)", replaysentpackets, replaysentbytes, replaysentbytes/1024.0f/max(recorded/1000.0f, 0.001f));
+    conoutf("  broadcast %u bytes, recorded %u bytes", replaybroadcast, recordedbroadcast);
+
+    extern bool should_quit;
+    if(replayquit) should_quit = true;
+}
+
+//! Replays a recording into this server, as fast as possible if 'fast' is set, quitting after if 'quit' is
+void startreplay(const char *name, bool fast, bool quit)
+{
+    stopreplay();
+    replayfile = opengzfile(name, "rb");
+    if(!replayfile) { conoutf(CON_ERROR, "could not open recording %s", name); return; }
+    packetrecordheader hdr;
+    if(replayfile->read(&hdr, sizeof(hdr)) != sizeof(hdr) || memcmp(hdr.magic, PACKETRECORD_MAGIC, sizeof(PACKETRECORD_MAGIC)))
+    {
+        conoutf(CON_ERROR, "%s is not a packet recording", name);
+        DELETEP(replayfile);
+        return;
+    }
+    lilswap(&hdr.version, 2);
+    if(hdr.version != PACKETRECORD_VERSION || hdr.protocol != PROTOCOL_VERSION)
+    {
+        conoutf(CON_ERROR, "recording %s uses %s version %d", name, hdr.version != PACKETRECORD_VERSION ? "format" : "protocol", hdr.version != PACKETRECORD_VERSION ? hdr.version : hdr.protocol);
+        DELETEP(replayfile);
+        return;
+    }
+    replayfast = fast;
+    replayquit = quit;
+    replaystart = enet_time_get();
+    replayskipped = replayevents = replayslices = replaymaxtick = 0;
+    replayticktime = replaysentpackets = replaysentbytes = recordedbroadcast = replaybroadcast = 0;
+    replayallocations = allocations;
+    readreplayrecord();
+    conoutf("replaying %s%s", name, fast ? " as fast as possible" : "");
+}
+
+ICOMMAND(replaypackets, "si", (char *name, int *fast), { if(name[0]) startreplay(name, *fast!=0, false); else stopreplay(); });
+
+static void replayrecord(const packetrecord &r)
+{
+    int cn = replayclients.inrange(r.cn) ? replayclients[r.cn] : -1;
+    switch(r.type)
+    {
+        case RECORD_CONNECT:
+        {
+            if(r.cn < 0 || r.cn >= MAXCLIENTS) break;
+            while(replayclients.length() <= r.cn) replayclients.add(-1);
+            client &c = addclient(ST_REPLAY);
+            c.peer = NULL;
+            c.connectid = 0;
+            formatstring(c.hostname, "replay %d", r.cn);
+            replayclients[r.cn] = c.num;
+            int reason = server::clientconnect(c.num, 0);
+            if(reason) disconnect_client(c.num, reason);
+            break;
+        }
+
+        case RECORD_PACKET:
+        {
+            ENetPacket *packet = enet_packet_create(NULL, r.len, 0);
+            if(replayfile->read(packet->data, r.len) != r.len) { enet_packet_destroy(packet); replayhasnext = false; return; }
+            if(cn >= 0) process(packet, cn, r.chan);
+            if(!packet->referenceCount) enet_packet_destroy(packet);
+            break;
+        }
+
+        case RECORD_DISCONNECT:
+            if(cn < 0) break;
+            replayclients[r.cn] = -1;
+            server::clientdisconnect(cn);
+            delclient(clients[cn]);
+            break;
+
+        case RECORD_BROADCAST:
+            recordedbroadcast += r.len;
+            if(!replayfile->seek(r.len, SEEK_CUR)) { replayhasnext = false; return; }
+            break;
+    }
+    replayevents++;
+}
+
+//! Feeds the replayed server every recorded event that is due
+static void updatereplay()
+{
+    if(!replayfile) return;
+    int now = replayskipped + int(enet_time_get() - replaystart);
+    if(replayfast && replayhasnext && replaynext.millis > now)
+    {
+        replayskipped += replaynext.millis - now;
+        now = replaynext.millis;
+    }
+    while(replayhasnext && replaynext.millis <= now)
+    {
+        packetrecord r = replaynext;
+        if(r.len < 0 || r.len > (1<<24)) { conoutf(CON_ERROR, "packet recording is corrupt"); replayhasnext = false; break; }
+        replayrecord(r);
+        if(replayhasnext) readreplayrecord();
+    }
+    if(!replayhasnext) stopreplay();
+}
+
+//! How long a replaying server may wait for network events before the next recorded one is due
+static uint replaytimeout(uint timeout)
+{
+    if(!replayfile || !replayhasnext) return timeout;
+    if(replayfast) return 0;
+    int due = replaynext.millis - replayskipped - int(enet_time_get() - replaystart);
+    return uint(clamp(due, 0, int(timeout)));
+}
+
 void localclienttoserver(int chan, ENetPacket *packet, int cn) // INTENSITY: Added cn
 {
     client *c = NULL;
@@ -386,8 +911,93 @@ void updatetime()
     }
 }
 
+static void handleserverevent(ENetEvent &event, enet_uint32 connectid)
+{
+    switch(event.type)
+    {
+        case ENET_EVENT_TYPE_CONNECT:
+        {
+            client &c = addclient(ST_TCPIP);
+            c.peer = event.peer;
+            c.peer->data = &c;
+            c.connectid = connectid;
+            recordevent(RECORD_CONNECT, c.num);
+            char hn[1024];
+            copystring(c.hostname, (enet_address_get_host_ip(&c.peer->address, hn, sizeof(hn))==0) ? hn : "unknown");
+            logoutf("client connected (%s)", c.hostname);
+            // The client announces its network dictionary in the connect data. With the I/O thread
+            // running, that thread has recorded it already, as it compresses for the peer
+#ifdef NETTHREAD
+            if(!netthreadrunning)
+#endif
+                setnetpeerdictionary(serverhost, c.peer, event.data);
+            if(int(event.data) != getnetdictionary())
+                logoutf("client uses network dictionary %d, we use %d: compressing without one", int(event.data), getnetdictionary());
+            int reason = server::clientconnect(c.num, c.peer->address.host);
+            if(reason) disconnect_client(c.num, reason);
+            break;
+        }
+        case ENET_EVENT_TYPE_RECEIVE:
+        {
+            client *c = (client *)event.peer->data;
+            if(c)
+            {
+                recordevent(RECORD_PACKET, c->num, event.channelID, event.packet->data, event.packet->dataLength);
+                process(event.packet, c->num, event.channelID);
+            }
+            if(event.packet->referenceCount==0) enet_packet_destroy(event.packet);
+            break;
+        }
+        case ENET_EVENT_TYPE_DISCONNECT:
+        {
+            client *c = (client *)event.peer->data;
+            if(!c) break;
+            recordevent(RECORD_DISCONNECT, c->num);
+            logoutf("disconnected client (%s)", c->hostname);
+            server::clientdisconnect(c->num);
+            delclient(c);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+#ifdef NETTHREAD
+//! Handles the events the I/O thread received, waiting up to 'timeout' ms for the first
+static void processnetevents(uint timeout)
+{
+    llong waitstart = getmicros();
+    for(uint waited = 0; waited < timeout && !netevents.length(); waited++) usleep(1000);
+    serverwait += getmicros() - waitstart;
+    neteventpeak = max(neteventpeak, netevents.length());
+    netevent e;
+    while(netevents.pop(e))
+    {
+        ENetEvent event;
+        event.type = e.type;
+        event.peer = e.peer;
+        event.channelID = e.chan;
+        event.data = e.data;
+        event.packet = e.packet;
+        if(e.type == ENET_EVENT_TYPE_RECEIVE)
+        {
+            int latency = int(enet_time_get() - e.time);
+            netlatencysum += latency;
+            netlatencycount++;
+            netlatencymax = max(netlatencymax, latency);
+        }
+        handleserverevent(event, e.connectid);
+    }
+}
+#endif
+
 void serverslice(bool dedicated, uint timeout)   // main server update, called from main loop in sp, or from below in dedicated server
 {
+    serverwait = 0;
+    updatereplay();
+    timeout = replaytimeout(timeout);
+
     if(!serverhost)
     {
         server::serverupdate();
@@ -406,48 +1016,28 @@ void serverslice(bool dedicated, uint timeout)   // main server update, called f
     }
     server::serverupdate();
 
+#ifdef NETTHREAD
+    if(netthreadrunning)
+    {
+        processnetevents(timeout);
+        flushnetoutbox(server::sendpackets());
+        return;
+    }
+#endif
+
     ENetEvent event;
     bool serviced = false;
     while(!serviced)
     {
         if(enet_host_check_events(serverhost, &event) <= 0)
         {
-            if(enet_host_service(serverhost, &event, timeout) <= 0) break;
+            llong waitstart = getmicros();
+            int status = enet_host_service(serverhost, &event, timeout);
+            serverwait += getmicros() - waitstart;
+            if(status <= 0) break;
             serviced = true;
         }
-        switch(event.type)
-        {
-            case ENET_EVENT_TYPE_CONNECT:
-            {
-                client &c = addclient(ST_TCPIP);
-                c.peer = event.peer;
-                c.peer->data = &c;
-                char hn[1024];
-                copystring(c.hostname, (enet_address_get_host_ip(&c.peer->address, hn, sizeof(hn))==0) ? hn : "unknown");
-                logoutf("client connected (%s)", c.hostname);
-                int reason = server::clientconnect(c.num, c.peer->address.host);
-                if(reason) disconnect_client(c.num, reason);
-                break;
-            }
-            case ENET_EVENT_TYPE_RECEIVE:
-            {
-                client *c = (client *)event.peer->data;
-                if(c) process(event.packet, c->num, event.channelID);
-                if(event.packet->referenceCount==0) enet_packet_destroy(event.packet);
-                break;
-            }
-            case ENET_EVENT_TYPE_DISCONNECT:
-            {
-                client *c = (client *)event.peer->data;
-                if(!c) break;
-                logoutf("disconnected client (%s)", c->hostname);
-                server::clientdisconnect(c->num);
-                delclient(c);
-                break;
-            }
-            default:
-                break;
-        }
+        handleserverevent(event, event.peer->connectID);
     }
     if(server::sendpackets()) enet_host_flush(serverhost);
 }
@@ -463,14 +1053,93 @@ void force_network_flush()
         return;
     }
 
+#ifdef NETTHREAD
+    if(netthreadrunning) { flushnetoutbox(true); return; }
+#endif
+
 //    if(sv->sendpackets())
         enet_host_flush(serverhost);
 }
 
 void flushserver(bool force)
 {
-    if(server::sendpackets(force) && serverhost) enet_host_flush(serverhost);
+    if(!server::sendpackets(force) || !serverhost) return;
+#ifdef NETTHREAD
+    if(netthreadrunning) { flushnetoutbox(true); return; }
+#endif
+    enet_host_flush(serverhost);
+}
+
+//! Runs one round of enetbench: 'numclients' hosts each send bursts of datagrams to a server host
+//! over loopback, which answers each round with a few datagrams to everyone. Returns how many
+//! datagrams the server sends and receives per second of its own time, or -1 if it could not set up.
+static int enetbenchround(int numclients, int millis, int batch)
+{
+    ENetAddress address;
+    enet_address_set_host(&address, "127.0.0.1");
+    address.port = ENET_PORT_ANY;
+    ENetHost *server = enet_host_create(&address, numclients, 1, 0, 0);
+    if(!server) return -1;
+    enet_socket_get_address(server->socket, &address);
+    server->datagramBatchSize = batch;
+
+    vector<ENetHost *> hosts;
+    loopi(numclients)
+    {
+        ENetHost *host = enet_host_create(NULL, 1, 1, 0, 0);
+        if(!host) break;
+        host->datagramBatchSize = batch;
+        enet_host_connect(host, &address, 1, 0);
+        hosts.add(host);
+    }
+
+    ENetEvent event;
+    int connected = 0;
+    for(enet_uint32 start = enet_time_get(); connected < hosts.length() && enet_time_get() - start < 2000;)
+    {
+        loopv(hosts) while(enet_host_service(hosts[i], &event, 0) > 0);
+        while(enet_host_service(server, &event, 1) > 0) if(event.type == ENET_EVENT_TYPE_CONNECT) connected++;
+    }
+
+    uchar payload[1000];
+    memset(payload, 0x5A, sizeof(payload));
+    server->totalSentPackets = server->totalReceivedPackets = 0;
+    // Only the server's side is timed. Its phases are short, but millisecond rounding evens out over many
+    enet_uint32 start = enet_time_get(), servertime = 0;
+    while(enet_time_get() - start < enet_uint32(millis))
+    {
+        loopv(hosts)
+        {
+            loopj(4) enet_peer_send(&hosts[i]->peers[0], 0, enet_packet_create(payload, sizeof(payload), 0));
+            enet_host_flush(hosts[i]);
+        }
+        enet_uint32 serverstart = enet_time_get();
+        while(enet_host_service(server, &event, 0) > 0) if(event.packet) enet_packet_destroy(event.packet);
+        loopj(4) enet_host_broadcast(server, 0, enet_packet_create(payload, sizeof(payload), 0));
+        enet_host_flush(server);
+        servertime += enet_time_get() - serverstart;
+        loopv(hosts) while(enet_host_service(hosts[i], &event, 0) > 0) if(event.packet) enet_packet_destroy(event.packet);
+    }
+
+    int datagrams = server->totalSentPackets + server->totalReceivedPackets;
+    loopv(hosts) enet_host_destroy(hosts[i]);
+    enet_host_destroy(server);
+    return connected ? int(datagrams*1000.0/max(servertime, enet_uint32(1))) : -1;
+}
+
+//! Loopback benchmark of the server's UDP path, without and with batched system calls
+void enetbench(int *numclients, int *millis)
+{
+    int clients = clamp(*numclients > 0 ? *numclients : 16, 1, 256), duration = *millis > 0 ? *millis : 1000;
+    int unbatched = enetbenchround(clients, duration, 1),
+        batched = enetbenchround(clients, duration, ENET_HOST_DEFAULT_DATAGRAM_BATCH);
+    if(unbatched < 0 || batched < 0) { conoutf(CON_ERROR, "enetbench: could not set up loopback hosts"); return; }
+    conoutf("enetbench: %d clients, %d ms per run, datagrams per second of server time", clients, duration);
+    conoutf("  one datagram per syscall: %d datagrams/s", unbatched);
+    conoutf("  batched (%d per syscall): %d datagrams/s (%+.1f%%)", ENET_HOST_DEFAULT_DATAGRAM_BATCH, batched,
+        unbatched ? (batched - unbatched)*100.0/unbatched : 0.0);
 }
+COMMAND(enetbench, "ii");
 
 void localdisconnect(bool cleanup, int cn) // INTENSITY: Added cn
 {
@@ -532,6 +1201,26 @@ bool servererror(bool dedicated, const char *desc)
     return false;
 }
 
+static void applyservercompression();
+
+VARF(servercompression, 0, 0, 2, applyservercompression());
+
+// The compressor belongs to whichever thread services the host, so the I/O thread makes the change
+static void applyservercompression()
+{
+#ifdef NETTHREAD
+    if(netthreadrunning)
+    {
+        netcommand cmd;
+        cmd.type = NETCMD_COMPRESSION;
+        cmd.reason = servercompression;
+        pushnetcommand(cmd);
+        return;
+    }
+#endif
+    setnetcompression(serverhost, servercompression);
+}
+
 bool setuplistenserver(bool dedicated)
 {
     ENetAddress address = { ENET_HOST_ANY, enet_uint16(serverport <= 0 ? server::serverport() : serverport) };
@@ -552,6 +1241,7 @@ bool setuplistenserver(bool dedicated)
     serverhost->duplicatePeers = maxdupclients ? maxdupclients : MAXCLIENTS;
     loopi(maxclients) serverhost->peers[i].data = NULL;
     serverhost->intercept = serverinfointercept;
+    setupnetcompression(serverhost, servercompression);
     return true;
 }
 
@@ -566,6 +1256,10 @@ void initserver(bool listen, bool dedicated)
 
     server::serverinit();
 
+#ifdef NETTHREAD
+    if(listen && serverthread) startnetthread();
+#endif
+
     if(listen)
     {
         if(dedicated) rundedicatedserver(); // never returns
@@ -624,10 +1318,28 @@ void server_runslice()
     clientkeepalive();
     serverkeepalive();*/
 
-    serverslice(true, 5);
+    llong slicestart = getmicros(), botswarmtime = updatebotswarm();
+
+    // the Lua collector ran at the end of the last slice, in time it would otherwise have waited
+    // for the network in
+    static int gctime = 0;
+    serverslice(true, max(5 - gctime/1000, 0));
 
     if(lastmillis) game::updateworld();
 
+    // What the slice cost the server itself, in microseconds: neither waiting for the network nor
+    // running the bots of a swarm count
+    int ticktime = int(getmicros() - slicestart - serverwait - botswarmtime);
+    if(replayfile)
+    {
+        replayticktime += ticktime;
+        replaymaxtick = max(replaymaxtick, ticktime);
+        replayslices++;
+    }
+    countbotswarmtick(ticktime);
+
+    gctime = lua::gc_step(5000);
+
     checksleep(lastmillis);
 
     static time_t shutdown_idle_last_update = 0;
@@ -684,6 +1396,9 @@ int main(int argc, char **argv)
 
     char *loglevel  = (char*)"WARNING";
     char *map_asset = NULL;
+    const char *replay_file = NULL; // Replayed once the map is set, quitting after
+    bool replay_fast = false;
+    int swarm_bots = 0; // Likewise, a bot swarm is run and the server quits after
     const char *dir = NULL;
     for(int i = 1; i < argc; i++)
     {
@@ -714,9 +1429,16 @@ int main(int argc, char **argv)
             case 'g': logoutf("Setting logging level %s", &argv[i][2]); loglevel = &argv[i][2]; break;
             case 'l': logoutf("Setting log file: %s", &argv[i][2]); setlogfile(&argv[i][2]); break;
             case 'm': logoutf("Setting map %s", &argv[i][2]); map_asset = &argv[i][2]; break;
+            case 'c': logoutf("Setting max clients %s", &argv[i][2]); setvar("maxclients", atoi(&argv[i][2])); break;
             default:
             {
-                if (!strcmp(argv[i], "-shutdown-if-empty"))
+                if (!strcmp(argv[i], "-replay") && i + 1 < argc)
+                    replay_file = argv[++i];
+                else if (!strcmp(argv[i], "-replay-fast") && i + 1 < argc)
+                    replay_file = argv[++i], replay_fast = true;
+                else if (!strcmp(argv[i], "-botswarm") && i + 1 < argc)
+                    swarm_bots = atoi(argv[++i]);
+                else if (!strcmp(argv[i], "-shutdown-if-empty"))
                     server::shutdown_if_empty = true;
                 else if (!strcmp(argv[i], "-shutdown-if-idle"))
                     server::shutdown_if_idle = true;
@@ -750,6 +1472,8 @@ int main(int argc, char **argv)
             logger::log(logger::DEBUG, "Setting map to %s ..", map_asset);
             world::set_map(map_asset);
             map_asset = NULL;
+            if (replay_file) startreplay(replay_file, replay_fast, true);
+            if (swarm_bots > 0) startbotswarm(swarm_bots, 5000, true);
         }
     }
 
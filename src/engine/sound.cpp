@@ -406,6 +406,8 @@ void stopmapsound(extentity *e)
     }
 }
 
+static lua::external playmap("sound_play_map");
+
 void checkmapsounds()
 {
     const vector<extentity *> &ents = entities::getents();
@@ -416,7 +418,7 @@ void checkmapsounds()
         if(camera1->o.dist(e.o) < e.attr[0])
         {
             if(!(e.flags&EF_SOUND))
-                lua::call_external("sound_play_map", "i", e.uid);
+                lua::call_external(playmap, e.uid);
         }
         else if(e.flags&EF_SOUND) stopmapsound(&e);
     }
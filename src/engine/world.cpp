@@ -644,6 +644,8 @@ void renderentcone(const extentity &e, const vec &dir, float radius, float angle
     xtraverts += gle::end();
 }
 
+static lua::external drawattached("entity_draw_attached");
+
 void renderentradius(extentity &e, bool color)
 {
     switch(e.type)
@@ -696,7 +698,7 @@ void renderentradius(extentity &e, bool color)
         default:
         attach:
             if (color) gle::colorf(0, 1, 1);
-            lua::call_external("entity_draw_attached", "i", e.uid);
+            lua::call_external(drawattached, e.uid);
             break;
     }
 }
@@ -1212,10 +1214,10 @@ void resetmap()
 {
     clearoverrides();
     clearmapsounds();
+    clearpvs();
 #ifndef SERVER
     resetblendmap();
     clearlights();
-    clearpvs();
 #endif
     clearslots();
     clearparticles();
@@ -574,6 +574,7 @@ bool load_world(const char *mname, const char *cname)        // still supports a
     LogicSystem::init(); // INTENSITY: Start our game data system, wipe all existing LogicEntities, and add the player
 
     setmapfilenames(mname, cname);
+    resetmapuploads(); // Clients fetch the new map from scratch
 
     _saved_mname = mname; // INTENSITY
     _saved_cname = cname; // INTENSITY
@@ -749,8 +750,8 @@ bool load_world(const char *mname, const char *cname)        // still supports a
     renderprogress(0, "validating...");
     validatec(worldroot, hdr.worldsize>>1);
 
-#ifndef SERVER // INTENSITY: Server doesn't need lightmaps, pvs and blendmap (and current code for server wouldn't clean
-              //            them up if we did read them, so would have a leak)
+    // INTENSITY: Server doesn't need lightmaps and blendmap (and current code for server wouldn't clean
+    //            them up if we did read them, so would have a leak). It does keep the pvs, for interest management.
     if(!failed)
     {
         loopi(hdr.lightmaps)
@@ -767,11 +768,12 @@ bool load_world(const char *mname, const char *cname)        // still supports a
         }
 
         if(hdr.numpvs > 0) loadpvs(f, hdr.numpvs);
+#ifndef SERVER
         if(hdr.blendmap) loadblendmap(f, hdr.blendmap);
+#endif
     }
-#endif // INTENSITY
 
-//    mapcrc = f->getcrc(); // INTENSITY: We use our own signatures
+    mapcrc = f->getcrc(); // Compared against the server's after a map transfer
     delete f;
 
 #ifndef SERVER
@@ -54,10 +54,14 @@ namespace game
         needclipboard = -1;
     }
 
+    //! The position snapshots received from the server, which later ones are deltas against
+    static NetworkSystem::PositionUpdater::SnapshotHistory snapshots;
+
     void gameconnect(bool _remote)
     {
         connected = true;
         remote = _remote;
+        snapshots.reset();
     }
 
     void gamedisconnect(bool cleanup)
@@ -197,6 +201,13 @@ namespace game
                     break;
                 }
                 case 's': sendstring(va_arg(args, const char *), p); nums++; break;
+                case 'm':
+                {
+                    int n = va_arg(args, int);
+                    p.put(va_arg(args, uchar *), n);
+                    nums++;
+                    break;
+                }
             }
             va_end(args);
         }
@@ -206,6 +217,13 @@ namespace game
         {
             if(msgsize && num!=msgsize) { fatal("inconsistent msg size for %d (%d != %d)", type, num, msgsize); }
         }
+        addmsgdata(buf, p.length(), reliable, mcn);
+    }
+
+    // queues an already encoded message, see MessageSystem::addMessage
+    void addmsgdata(const uchar *buf, int len, bool reliable, int mcn)
+    {
+        if(!connected) return;
         if(reliable) messagereliable = true;
         if(mcn != messagecn)
         {
@@ -216,7 +234,8 @@ namespace game
             messages.put(mbuf, m.length());
             messagecn = mcn;
         }
-        messages.put(buf, p.length());
+        messages.put(buf, len);
+        MessageSystem::countMessageSent(buf, len);
     }
 
     void toserver(char *text)
@@ -358,12 +377,75 @@ namespace game
                 break;
             }
 
+            case N_SNAPSHOT:                   // positions of other clients, as a delta
+            {
+                int sequence = NetworkSystem::PositionUpdater::readSnapshot(p, snapshots);
+                addmsg(N_SNAPACK, "i", sequence);
+                break;
+            }
+
             default:
                 neterr("positions-type");
                 return;
         }
     }
 
+#ifndef SERVER
+    //! Applies a chunk of the entity snapshot streamed on joining, see server::startentitystream
+    static void parseentitystream(ucharbuf &p)
+    {
+        static int chunks = 0, entities = 0, bytes = 0;
+        static vector<uchar> inflated;
+        static vector<char> sdata;
+
+        bool last = getint(p) != 0;
+        int rawlen = getuint(p), len = getuint(p);
+        if(rawlen < 0 || len < 0 || len > p.remaining()) { neterr("entity stream"); return; }
+        ucharbuf deflated = p.subbuf(len);
+        uLongf inflatedlen = rawlen;
+        inflated.setsize(0);
+        if(uncompress(inflated.pad(rawlen), &inflatedlen, deflated.buf, len) != Z_OK || int(inflatedlen) != rawlen)
+        {
+            neterr("entity stream");
+            return;
+        }
+        chunks++;
+        bytes += len;
+
+        ucharbuf q(inflated.getbuf(), rawlen);
+        vector<char *> classes;
+        int uid = 0;
+        while(q.remaining())
+        {
+            uid += getint(q);
+            int cn = getint(q), cls = getint(q);
+            if(cls == classes.length())
+            {
+                string name;
+                getstring(name, q);
+                classes.add(newstring(name));
+            }
+            int sdatalen = getuint(q);
+            if(!classes.inrange(cls) || sdatalen < 0 || sdatalen > q.remaining()) { neterr("entity stream"); break; }
+            sdata.setsize(0);
+            sdata.put((const char *)q.subbuf(sdatalen).buf, sdatalen);
+            sdata.add('\0');
+            MessageSystem::receive_LogicEntityComplete(cn, uid, classes[cls], sdata.getbuf());
+            entities++;
+        }
+        classes.deletearrays();
+
+        if(last)
+        {
+            conoutf("received %d entities in %d chunks (%.1f KB), joining took %d ms", entities, chunks, bytes/1024.0f,
+                totalmillis - MessageSystem::activeEntitiesRequestMillis);
+            chunks = entities = bytes = 0;
+            ClientSystem::finishLoadWorld();
+            MessageSystem::send_EntityStreamReceived(); // The server sends what it held back meanwhile
+        }
+    }
+#endif
+
     void parsepacketclient(int chan, packetbuf &p)   // processes any updates from the server
     {
         if(p.packet->flags&ENET_PACKET_FLAG_UNSEQUENCED) return;
@@ -373,7 +455,8 @@ namespace game
         switch(chan)
         {   // Kripken: channel 0 is just positions, for as-fast-as-possible position updates. We do not want to change this.
             //          channel 1 is used by essentially all the game logic events
-            //          channel 2: a binary file is received, a map or a demo
+            //          channel 2: the map, sent in chunks when a client lacks it
+            //          channel 3: the entity snapshot streamed on joining
             case 0:
                 parsepositions(p);
                 break;
@@ -383,10 +466,14 @@ namespace game
                 break;
 
             case 2:
-                // kripken: TODO: For now, this should only be for players, not NPCs on the server
-                assert(0);
-//                receivefile(p.get_buf(), p.maxlen);
+                parsemapdata(p);
                 break;
+
+#ifndef SERVER
+            case ENTITY_CHANNEL:
+                parseentitystream(p);
+                break;
+#endif
         }
     }
 
@@ -213,7 +213,8 @@ namespace game
 
 #if (SERVER_DRIVEN_PLAYERS == 1)
             // Enable this to let server drive client movement
-            lua::call_external("entity_refresh_attr", "is", d->uid, "position");
+            static lua::external refresh("entity_refresh_attr");
+            lua::call_external(refresh, d->uid, "position");
 #endif
         }
     }
@@ -263,6 +264,8 @@ namespace game
 #else // SERVER
     #if 1
         // Loop over NPCs we control, moving and sending their info c2sinfo for each.
+        static vector<physent *> npcs;
+        npcs.setsize(0);
         loopv(players)
         {
             gameent* npc = players[i];
@@ -276,11 +279,16 @@ namespace game
             while(npc->pitch < -180.0f) npc->pitch += 360.0f;
             while(npc->pitch > +180.0f) npc->pitch -= 360.0f;
 
-            // Apply physics to actually move the player
-            moveplayer(npc, 10, false); // FIXME: Use Config param for resolution and local. 1, false does seem ok though
+            npcs.add(npc);
+        }
+
+        // Apply physics to actually move them all, shared out among the physics worker threads
+        moveplayers(npcs.getbuf(), npcs.length(), 10); // FIXME: Use Config param for resolution. 1 does seem ok though
 
-            logger::log(logger::INFO, "updateworld, server-controlled client %d: moved to %f,%f,%f", i,
-                                            npc->o.x, npc->o.y, npc->o.z);
+        loopv(npcs)
+        {
+            logger::log(logger::INFO, "updateworld, server-controlled client %d: moved to %f,%f,%f", ((gameent*)npcs[i])->clientnum,
+                                            npcs[i]->o.x, npcs[i]->o.y, npcs[i]->o.z);
 
             //?? Dummy singleton still needs to send the messages vector. XXX - do we need this even without NPCs? XXX - works without it
         }
@@ -293,6 +301,8 @@ namespace game
         logger::log(logger::INFO, "updateworld(?, %d)", curtime);
         INDENT_LOG(logger::INFO);
 
+        MessageSystem::updateMessageStats();
+
         // SERVER used to initialize turn_move, move, look_updown_move and strafe to 0 for NPCs here
 
         if(!curtime)
@@ -480,7 +490,8 @@ namespace game
 
     void physicstrigger(physent *d, bool local, int floorlevel, int waterlevel, int material)
     {
-        lua::call_external("physics_state_change", "ibiii", LogicSystem::getUniqueId(d),
+        static lua::external statechange("physics_state_change");
+        lua::call_external(statechange, LogicSystem::getUniqueId(d),
             local, floorlevel, waterlevel, material);
     }
 
@@ -49,11 +49,12 @@ enum
     N_ADDBOT, N_DELBOT, N_INITAI, N_FROMAI, N_BOTLIMIT, N_BOTBALANCE,
     N_MAPCRC, N_CHECKMAPS,
     N_SWITCHNAME, N_SWITCHMODEL, N_SWITCHTEAM,
+    N_SNAPSHOT, N_SNAPACK,
     N_SERVCMD, NUMSV
 };
 
 #define TESSERACT_SERVER_PORT 42000
-#define PROTOCOL_VERSION 1 // bump when protocol changes
+#define PROTOCOL_VERSION 9 // bump when protocol changes
 
 struct gameent : dynent
 {
@@ -96,6 +97,11 @@ struct gameent : dynent
     unsigned int mapDefinedPositionData;
 
     int uid;
+    uint logichandle;
+
+    //! How much the server favours sending this entity's position when a client's bandwidth budget
+    //! is tight (see snapshotbudget). Set per entity class from Lua, through set_network_priority.
+    float networkpriority;
 
     gameent() : weight(100), clientnum(-1), lastupdate(0), plag(0), ping(0), lifesequence(0), lastpain(0), edit(NULL), smoothmillis(-1), ai(NULL)
                                                                       , lastServerUpdate(0)
@@ -103,7 +109,7 @@ struct gameent : dynent
                                                                       , serverControlled(false)
 #endif
                                                                       , physsteps(0), physframetime(5), lastphysframe(0), lastPhysicsPosition(0,0,0)
-                                                                      , mapDefinedPositionData(0), uid(-821)
+                                                                      , mapDefinedPositionData(0), uid(-821), logichandle(0), networkpriority(1)
                { name[0] = team[0] = info[0] = 0; respawn(); }
     ~gameent()
     {
@@ -179,6 +185,7 @@ namespace game
 
     extern int parseplayer(const char *arg);
     extern void addmsg(int type, const char *fmt = NULL, ...);
+    extern void addmsgdata(const uchar *buf, int len, bool reliable, int mcn = -1);
     extern void changemap(const char *name, int mode);
     extern void c2sinfo(bool force = false);
     extern void sendposition(gameent *d, bool reliable = false);
@@ -214,6 +221,22 @@ namespace server
     extern void setClientScenario(int cn, const char *sc);
 
     extern bool isRunningCurrentScenario(int clientNumber);
+
+    //! Starts sending a client all active entities as a snapshot on ENTITY_CHANNEL, if it is
+    //! to be sent that way. The client is logged in once the snapshot is through.
+    extern bool startentitystream(int cn);
+
+    //! Called when a client acknowledges the last chunk of its entity snapshot, releasing the
+    //! main channel messages held back meanwhile
+    extern void finishentitystream(int cn);
+
+    //! Holds back a main channel message to a client whose entity snapshot is not through yet.
+    //! Returns false if the message is to be sent right away.
+    extern bool holdentitymessage(int cn, ENetPacket *packet);
+
+    //! Whether a client is close enough to an entity to care about its unreliable updates. Always true
+    //! unless interest management is enabled (interestradius).
+    extern bool isinterested(int cn, int uid);
 }
 
 #endif
@@ -21,7 +21,8 @@ namespace game
             return;
         }
         bool tp = isthirdperson();
-        lua::call_external("game_render", "bb", tp, !tp && playerfpsshadow);
+        static lua::external render("game_render");
+        lua::call_external(render, tp, !tp && playerfpsshadow);
     }
 
     int swaymillis = 0;
@@ -43,7 +44,8 @@ namespace game
 
     void renderavatar()
     {
-        lua::call_external("game_render_hud", "");
+        static lua::external renderhud("game_render_hud");
+        lua::call_external(renderhud);
     }
 }
 
@@ -23,6 +23,7 @@
 #include "of_tools.h"
 
 extern bool should_quit;
+extern bool pvsoccludedfrom(const vec &viewer, const ivec &bbmin, const ivec &bbmax);
 
 namespace server
 {
@@ -59,11 +60,36 @@ namespace server
         ENetPacket *clipboard;
         int lastclipboard, needclipboard;
 
+        //! The latest full position state of this client's entity, for snapshot deltas
+        NetworkSystem::PositionUpdater::QuantizedInfo posstate;
+        bool hasposstate;
+        //! The snapshots sent to this client, allocated when the first one is sent
+        NetworkSystem::PositionUpdater::SnapshotHistory *snapshots;
+
+        //! Adaptive send rate: how often (ms) this client is sent world state, when it was last
+        //! sent, and the relayed messages held back in between
+        int sendinterval;
+        enet_uint32 lastworldstate;
+        vector<uchar> pendingmessages;
+        bool pendingreliable, pendingsnapshot;
+        //! The priority each other client's entity has built up, by client number, see snapshotbudget
+        vector<float> priorities;
+
+        //! Streaming of the entity snapshot a joining client is sent: the uid the next chunk starts
+        //! from (-1 when not streaming), when it may be sent, and totals for the log
+        int entitystreamuid, entitystreamnext, entitystreamstart, entitystreamchunks, entitystreambytes;
+        //! Main channel messages held back until the client has applied the whole snapshot, as ENet
+        //! orders no channel against another, see holdentitymessage, and until when the client has to
+        //! confirm that once the last chunk is sent
+        bool holdmessages;
+        vector<ENetPacket *> heldmessages;
+        int holddeadline;
+
         //! The current scenario being run by the client
         bool runningCurrentScenario;
 
-        clientinfo() : clipboard(NULL) { reset(); }
-        ~clientinfo() { cleanclipboard(); }
+        clientinfo() : clipboard(NULL), snapshots(NULL) { reset(); }
+        ~clientinfo() { cleanclipboard(); cleanheldmessages(); DELETEP(snapshots); }
 
         void mapchange()
         {
@@ -71,6 +97,11 @@ namespace server
             timesync = false;
             lastevent = 0;
             overflow = 0;
+            hasposstate = false;
+            // Sequence numbers keep going, so the client never confuses old snapshots with new ones
+            if(snapshots) snapshots->acked = 0;
+            entitystreamuid = -1; // The client asks for the new scenario's entities itself
+            sendheldmessages(); // In order, ahead of whatever the new scenario sends
 
             runningCurrentScenario = false;
         }
@@ -81,8 +112,22 @@ namespace server
             if(fullclean) lastclipboard = 0;
         }
 
+        void cleanheldmessages()
+        {
+            loopv(heldmessages) if(--heldmessages[i]->referenceCount <= 0) enet_packet_destroy(heldmessages[i]);
+            heldmessages.setsize(0);
+            holdmessages = false;
+        }
+
+        void sendheldmessages()
+        {
+            loopv(heldmessages) sendpacket(clientnum, MAIN_CHANNEL, heldmessages[i]);
+            cleanheldmessages();
+        }
+
         void reset()
         {
+            cleanheldmessages();
             uniqueId = DUMMY_SINGLETON_CLIENT_UNIQUE_ID - 5; // Kripken: Negative, and also different from dummy singleton
             isAdmin = false; // Kripken
 
@@ -91,6 +136,11 @@ namespace server
             position.setsize(0);
             messages.setsize(0);
             needclipboard = 0;
+            sendinterval = 0;
+            lastworldstate = 0;
+            pendingmessages.setsize(0);
+            pendingreliable = pendingsnapshot = false;
+            priorities.setsize(0);
             cleanclipboard();
             mapchange();
         }
@@ -261,7 +311,7 @@ namespace server
         // only allow edit messages in coop-edit mode
 //        if(type>=N_EDITENT && type<=N_GETMAP && gamemode!=1) return -1; // Kripken: FIXME: For now, allowing editing all the time
         // server only messages
-        static const int servtypes[] = { N_SERVINFO, N_INITCLIENT, N_WELCOME, N_MAPRELOAD, N_SERVMSG, N_DAMAGE, N_HITPUSH, N_SHOTFX, N_DIED, N_SPAWNSTATE, N_FORCEDEATH, N_ITEMACC, N_ITEMSPAWN, N_TIMEUP, N_CDIS, N_CURRENTMASTER, N_PONG, N_RESUME, N_BASESCORE, N_BASEINFO, N_BASEREGEN, N_ANNOUNCE, N_SENDDEMOLIST, N_SENDDEMO, N_DEMOPLAYBACK, N_SENDMAP, N_DROPFLAG, N_SCOREFLAG, N_RETURNFLAG, N_RESETFLAG, N_INVISFLAG, N_CLIENT, N_AUTHCHAL, N_INITAI };
+        static const int servtypes[] = { N_SERVINFO, N_INITCLIENT, N_WELCOME, N_MAPRELOAD, N_SERVMSG, N_DAMAGE, N_HITPUSH, N_SHOTFX, N_DIED, N_SPAWNSTATE, N_FORCEDEATH, N_ITEMACC, N_ITEMSPAWN, N_TIMEUP, N_CDIS, N_CURRENTMASTER, N_PONG, N_RESUME, N_BASESCORE, N_BASEINFO, N_BASEREGEN, N_ANNOUNCE, N_SENDDEMOLIST, N_SENDDEMO, N_DEMOPLAYBACK, N_SENDMAP, N_DROPFLAG, N_SCOREFLAG, N_RETURNFLAG, N_RESETFLAG, N_INVISFLAG, N_CLIENT, N_AUTHCHAL, N_INITAI, N_SNAPSHOT };
         if(ci)
         {
             loopi(sizeof(servtypes)/sizeof(int))
@@ -296,6 +346,229 @@ namespace server
         }
     }
 
+    // Interest management: when interestradius is nonzero, each client is only sent the positions
+    // (and unreliable state data) of entities within that radius of it, optionally also culled
+    // against the map's PVS. A value of 0 relays everything to everyone, as Sauer does.
+    VAR(interestradius, 0, 0, 1<<16);
+    VAR(interestcellsize, 16, 256, 1<<16);
+    VAR(interestpvs, 0, 1, 1);
+
+    //! A uniform grid over the positions of the current clients, rebuilt each time we relay
+    //! world state. Cells are hashed on their x/y coordinates; z only matters for the radius check.
+    struct interestgrid
+    {
+        hashtable<ivec2, int> cells; //!< First client index (into 'clients') in each cell, chained through 'next'
+        vector<int> next;
+        vector<gameent *> ents;
+        int cellsize;
+
+        interestgrid() : cellsize(256) {}
+
+        ivec2 cellof(const vec &o) const
+        {
+            return ivec2(int(floor(o.x/cellsize)), int(floor(o.y/cellsize)));
+        }
+
+        void build()
+        {
+            cells.clear();
+            next.setsize(0);
+            ents.setsize(0);
+            cellsize = interestcellsize;
+            loopv(clients)
+            {
+                gameent *d = game::getclient(clients[i]->clientnum);
+                ents.add(d);
+                next.add(-1);
+                if(!d) continue;
+                int &head = cells.access(cellof(d->o), -1);
+                next[i] = head;
+                head = i;
+            }
+        }
+
+        bool perceives(gameent *viewer, gameent *d) const
+        {
+            if(!viewer || !d) return true;
+            if(viewer->o.squaredist(d->o) > float(interestradius)*float(interestradius)) return false;
+            if(interestpvs)
+            {
+                ivec bbmin(vec(d->o).sub(vec(d->radius, d->radius, d->eyeheight))),
+                     bbmax(vec(d->o).add(vec(d->radius, d->radius, d->aboveeye)).add(1));
+                if(pvsoccludedfrom(viewer->o, bbmin, bbmax)) return false;
+            }
+            return true;
+        }
+
+        //! Marks in 'relevant' the clients whose updates client 'n' should receive
+        void collect(int n, vector<uchar> &relevant)
+        {
+            relevant.setsize(0);
+            gameent *viewer = ents[n];
+            loopv(ents) relevant.add(!ents[i] || !viewer ? 1 : 0);
+            if(!viewer) return;
+            ivec2 lo = cellof(vec(viewer->o).sub(interestradius)), hi = cellof(vec(viewer->o).add(interestradius));
+            if((hi.x-lo.x+1)*(hi.y-lo.y+1) >= ents.length())
+            {
+                // Searching the cells would be more work than just checking everyone
+                loopv(ents) if(ents[i] && perceives(viewer, ents[i])) relevant[i] = 1;
+                return;
+            }
+            for(int y = lo.y; y <= hi.y; y++) for(int x = lo.x; x <= hi.x; x++)
+            {
+                int *head = cells.access(ivec2(x, y));
+                if(head) for(int i = *head; i >= 0; i = next[i]) if(perceives(viewer, ents[i])) relevant[i] = 1;
+            }
+        }
+    };
+    static interestgrid interest;
+
+    //! Whether client 'cn' should hear about changes to the entity 'uid'. Used to filter unreliable
+    //! state data updates, which are not worth sending to clients too far away to notice them.
+    bool isinterested(int cn, int uid)
+    {
+        if(!interestradius) return true;
+        clientinfo *ci = getinfo(cn);
+        if(!ci || ci->uniqueId == DUMMY_SINGLETON_CLIENT_UNIQUE_ID) return true;
+        gameent *viewer = game::getclient(cn);
+        if(!viewer) return true;
+#ifdef SERVER
+        if(viewer->serverControlled) return true;
+#endif
+        CLogicEntity *entity = LogicSystem::getLogicEntity(uid);
+        if(!entity) return true;
+        if(entity->dynamicEntity) return interest.perceives(viewer, (gameent *)entity->dynamicEntity);
+        if(entity->staticEntity)
+            return viewer->o.squaredist(entity->staticEntity->o) <= float(interestradius)*float(interestradius);
+        return true;
+    }
+
+    // Snapshot deltas: positions are sent to remote clients as deltas against the last snapshot
+    // they acknowledged, see NetworkSystem::PositionUpdater::Snapshot. 0 relays each N_POS as is.
+    VAR(snapshotdeltas, 0, 1, 1);
+
+    // Bandwidth budget: when snapshotbudget is nonzero, each snapshot holds at most that many bytes
+    // of entity updates. Changed entities build up priority every tick they wait, faster when they
+    // are closer (halving at prioritydistance) and by their Lua-set network_priority, and only the
+    // highest ones that fit are sent. Those left out keep their priority until their turn comes.
+    VAR(snapshotbudget, 0, 0, MAXTRANS);
+    VAR(prioritydistance, 1, 256, 1<<16);
+
+    struct snapshotcandidate
+    {
+        int index, bits;
+        float priority;
+    };
+
+    static bool snapshotcandidatecmp(const snapshotcandidate &a, const snapshotcandidate &b)
+    {
+        return a.priority > b.priority;
+    }
+
+    //! Sends client 'n' a snapshot of the positions it should know about, if anything changed since
+    //! the last one it acknowledged. Returns whether a packet was sent.
+    static bool sendsnapshot(int n, const vector<uchar> &relevant, bool changed)
+    {
+        using namespace NetworkSystem::PositionUpdater;
+        clientinfo &ci = *clients[n];
+        if(!ci.snapshots) ci.snapshots = new SnapshotHistory;
+        SnapshotHistory &history = *ci.snapshots;
+        int sequence = history.nextSequence;
+        // Nothing new arrived and the client has everything we sent, so there is nothing to do
+        if(!changed && history.acked == sequence-1) return false;
+
+        const Snapshot *base = sequence - history.acked < MAXSNAPSHOTS ? history.find(history.acked) : NULL;
+        Snapshot &snap = history.start(sequence, base);
+        if(!snapshotbudget)
+        {
+            loopv(clients) if(i != n && clients[i]->hasposstate && (relevant.empty() || relevant[i]))
+                snap.set(clients[i]->posstate);
+        }
+        else
+        {
+            static vector<snapshotcandidate> candidates;
+            candidates.setsize(0);
+            gameent *viewer = game::getclient(ci.clientnum);
+            loopv(clients) if(i != n && clients[i]->hasposstate && (relevant.empty() || relevant[i]))
+            {
+                clientinfo &source = *clients[i];
+                int bits = deltaBits(source.posstate, base ? base->find(source.clientnum) : NULL);
+                if(!bits) continue;
+                while(ci.priorities.length() <= source.clientnum) ci.priorities.add(0);
+                float &priority = ci.priorities[source.clientnum];
+                gameent *d = game::getclient(source.clientnum);
+                float weight = d ? d->networkpriority : 1;
+                if(viewer && d) weight *= prioritydistance/(prioritydistance + viewer->o.dist(d->o));
+                priority += weight*max(ci.sendinterval, 1);
+                snapshotcandidate &c = candidates.add();
+                c.index = i;
+                c.bits = bits;
+                c.priority = priority;
+            }
+            candidates.sort(snapshotcandidatecmp);
+            int budget = snapshotbudget*8;
+            loopv(candidates)
+            {
+                snapshotcandidate &c = candidates[i];
+                // Always send at least one, so a tiny budget still makes progress
+                if(i > 0 && c.bits > budget)
+                {
+                    ci.pendingsnapshot = true; // Try the rest next time, even if nothing new arrives
+                    break;
+                }
+                budget -= c.bits;
+                clientinfo &source = *clients[c.index];
+                snap.set(source.posstate);
+                ci.priorities[source.clientnum] = 0;
+            }
+        }
+
+        packetbuf q(MAXTRANS);
+        if(!writeSnapshot(q, snap, base))
+        {
+            snap.sequence = 0;
+            return false;
+        }
+        history.nextSequence++;
+        logger::log(logger::INFO, "Sending snapshot %d (base %d) to %d, size: %d", sequence, base ? base->sequence : 0,
+                     ci.clientnum, q.length());
+        sendpacket(ci.clientnum, 0, q.finalize());
+        return true;
+    }
+
+    // Adaptive send rate: world state is built at up to maxsendrate (Hz), and each client is sent it
+    // at its own rate between that and minsendrate, depending on how well its connection keeps up.
+    // By default no client is sent more than the old fixed rate of 25 Hz; raise maxsendrate for more.
+    VAR(minsendrate, 1, 10, 1000);
+    VAR(maxsendrate, 1, 25, 1000);
+
+    //! The interval (ms) client 'ci' should be sent world state at. ENet lowers packetThrottle as
+    //! packets to a peer go unacknowledged, so we slow down in proportion; loss pushes towards the
+    //! slowest rate (10% loss or more reaches it), and updates much more frequent than the round
+    //! trip time, or its variance, just pile up in the peer's queues.
+    static int targetsendinterval(clientinfo &ci)
+    {
+        int fastest = 1000/maxsendrate, slowest = max(1000/min(minsendrate, maxsendrate), fastest);
+        ENetPeer *peer = ci.local ? NULL : getclientpeer(ci.clientnum);
+        if(!peer) return fastest;
+        float interval = fastest*float(ENET_PEER_PACKET_THROTTLE_SCALE)/max(peer->packetThrottle, enet_uint32(1));
+        interval += (slowest - fastest)*min(10*float(peer->packetLoss)/ENET_PEER_PACKET_LOSS_SCALE, 1.0f);
+        interval = max(interval, peer->roundTripTime/8.0f + peer->roundTripTimeVariance/2.0f);
+        return clamp(int(interval), fastest, slowest);
+    }
+
+    //! Whether client 'ci' is due to be sent world state this tick; if so, also adapts its interval
+    static bool sendisdue(clientinfo &ci, enet_uint32 now)
+    {
+        if(ci.local || ci.uniqueId == DUMMY_SINGLETON_CLIENT_UNIQUE_ID) return true;
+        int tick = 1000/maxsendrate;
+        if(ci.lastworldstate && int(now - ci.lastworldstate) + tick/2 < ci.sendinterval) return false;
+        int target = targetsendinterval(ci);
+        ci.sendinterval = ci.sendinterval ? (3*ci.sendinterval + target)/4 : target; // Smooth out the measurements
+        ci.lastworldstate = now;
+        return true;
+    }
+
     bool buildworldstate()
     {
         static struct { int posoff, msgoff, msglen; } pkt[MAXCLIENTS];
@@ -334,20 +607,26 @@ namespace server
         int psize = ws.positions.length(), msize = ws.messages.length();
         if(psize)
         {
-            //recordpacket(0, ws.positions.getbuf(), psize);
+            recordpacket(0, ws.positions.getbuf(), psize);
             ucharbuf p = ws.positions.reserve(psize);
             p.put(ws.positions.getbuf(), psize);
             ws.positions.addbuf(p);
         }
         if(msize)
         {
-            //recordpacket(1, ws.messages.getbuf(), msize);
+            recordpacket(1, ws.messages.getbuf(), msize);
             ucharbuf p = ws.messages.reserve(msize);
             p.put(ws.messages.getbuf(), msize);
             ws.messages.addbuf(p);
         }
         ws.uses = 0;
 
+        static vector<uchar> relevant;
+        relevant.setsize(0);
+        if(interestradius && (psize || snapshotdeltas)) interest.build();
+        bool flushed = false;
+        enet_uint32 now = enet_time_get();
+
         loopv(clients)
         {
             clientinfo &ci = *clients[i];
@@ -364,9 +643,36 @@ namespace server
             if (!currClient->serverControlled || ci.uniqueId == DUMMY_SINGLETON_CLIENT_UNIQUE_ID) // Send also to singleton dummy client
 #endif
             {
+                bool due = sendisdue(ci, now);
 
                 ENetPacket *packet;
-                if(psize && (pkt[i].posoff<0 || psize-ci.position.length()>0))
+                if(snapshotdeltas && !ci.local && ci.uniqueId != DUMMY_SINGLETON_CLIENT_UNIQUE_ID)
+                {
+                    // A snapshot always has the latest state, so skipping ticks loses nothing
+                    if(due)
+                    {
+                        bool changed = psize > 0 || ci.pendingsnapshot;
+                        ci.pendingsnapshot = false;
+                        if(interestradius) interest.collect(i, relevant);
+                        if(sendsnapshot(i, relevant, changed)) flushed = true;
+                    }
+                    else if(psize) ci.pendingsnapshot = true;
+                }
+                else if(psize && interestradius && ci.uniqueId != DUMMY_SINGLETON_CLIENT_UNIQUE_ID)
+                {
+                    // Only the N_POS blocks of entities this client can perceive, so cost no longer grows
+                    // with the square of the number of clients when they are spread around the map
+                    interest.collect(i, relevant);
+                    packetbuf q(psize);
+                    loopvj(clients) if(j != i && pkt[j].posoff >= 0 && relevant[j])
+                        q.put(&ws.positions[pkt[j].posoff], clients[j]->position.length());
+                    if(q.length())
+                    {
+                        logger::log(logger::INFO, "Sending filtered positions packet to %d", ci.clientnum);
+                        sendpacket(ci.clientnum, 0, q.finalize());
+                    }
+                }
+                else if(psize && (pkt[i].posoff<0 || psize-ci.position.length()>0))
                 {
                     // Kripken: Trickery with offsets here prevents relaying back to the same client. Ditto below
                     packet = enet_packet_create(&ws.positions[pkt[i].posoff<0 ? 0 : pkt[i].posoff+ci.position.length()],
@@ -381,7 +687,33 @@ namespace server
                     else { ++ws.uses; packet->freeCallback = cleanworldstate; }
                 }
 
-                if(msize && (pkt[i].msgoff<0 || msize-pkt[i].msglen>0))
+                int msgstart = pkt[i].msgoff<0 ? 0 : pkt[i].msgoff+pkt[i].msglen,
+                    msglen = pkt[i].msgoff<0 ? msize : msize-pkt[i].msglen;
+                if(!due)
+                {
+                    // Hold the messages back, to go in a single larger packet when the client is due
+                    if(msglen > 0)
+                    {
+                        ci.pendingmessages.put(&ws.messages[msgstart], msglen);
+                        if(reliablemessages) ci.pendingreliable = true;
+                    }
+                }
+                else if(ci.pendingmessages.length())
+                {
+                    if(msglen > 0) ci.pendingmessages.put(&ws.messages[msgstart], msglen);
+                    packet = enet_packet_create(ci.pendingmessages.getbuf(), ci.pendingmessages.length(),
+                                                ci.pendingreliable || reliablemessages ? ENET_PACKET_FLAG_RELIABLE : 0);
+
+                    logger::log(logger::INFO, "Sending held back messages packet to %d, size: %d", ci.clientnum,
+                                 ci.pendingmessages.length());
+
+                    sendpacket(ci.clientnum, 1, packet);
+                    if(!packet->referenceCount) enet_packet_destroy(packet);
+                    ci.pendingmessages.setsize(0);
+                    ci.pendingreliable = false;
+                    flushed = true;
+                }
+                else if(msglen > 0)
                 {
                     packet = enet_packet_create(&ws.messages[pkt[i].msgoff<0 ? 0 : pkt[i].msgoff+pkt[i].msglen],
                                                 pkt[i].msgoff<0 ? msize : msize-pkt[i].msglen,
@@ -407,7 +739,7 @@ namespace server
         if(!ws.uses)
         {
             delete &ws;
-            return false;
+            return flushed;
         }
         else
         {
@@ -420,9 +752,11 @@ namespace server
     {
         if(clients.empty()) return false;
         enet_uint32 curtime = enet_time_get()-lastsend;
-        if(curtime<40 && !force) return false; // kripken: Server sends packets at most every 40ms? FIXME: fast rate, we might slow or dynamic this
+        int tick = 1000/maxsendrate; // Clients further apart get their own, slower rates, see sendisdue()
+        if(int(curtime)<tick && !force) return false;
+        MessageSystem::flush_StateDataUpdates();
         bool flush = buildworldstate();
-        lastsend += curtime - (curtime%40);
+        lastsend += curtime - (curtime%tick);
         return flush;
     }
 
@@ -448,7 +782,8 @@ namespace server
         if(sender<0 || p.packet->flags&ENET_PACKET_FLAG_UNSEQUENCED || chan > 2) return;
         if(chan==2) // Kripken: Channel 2 is, just like with the client, for file transfers
         {
-            assert(0); // We do file transfers completely differently
+            parsemaprequest(sender, p);
+            return;
         }
         if(p.packet->flags&ENET_PACKET_FLAG_RELIABLE) reliablemessages = true;
         char text[MAXTRANS];
@@ -513,11 +848,29 @@ namespace server
                     ci->position.setsize(0);
                     loopk(temp.length()) ci->position.add(temp.buf[k]);
                     delete[] data;
+
+                    clientinfo *source = getinfo(cn);
+                    if(source)
+                    {
+                        info.mergeInto(source->posstate);
+                        source->hasposstate = true;
+                    }
                 }
 //                if(smode && ci->state.state==CS_ALIVE) smode->moved(ci, oldpos, ci->state.o); // Kripken:Gametype(ctf etc.)-specific stuff
                 break;
             }
 
+            case N_SNAPACK:
+            {
+                int sequence = getint(p);
+                if(!ci || !ci->snapshots) break;
+                // 0 means the client could not decode a snapshot, so start over with a full one
+                if(!sequence) ci->snapshots->acked = 0;
+                else if(sequence - ci->snapshots->acked > 0 && sequence < ci->snapshots->nextSequence)
+                    ci->snapshots->acked = sequence;
+                break;
+            }
+
             case N_TEXT:
             {
                 getstring(text, p);
@@ -774,7 +1127,7 @@ namespace server
         clients.add(ci);
 
         // Start the connection handshake process
-        MessageSystem::send_InitS2C(n, n, PROTOCOL_VERSION);
+        MessageSystem::send_InitS2C(n, n, PROTOCOL_VERSION, getnetdictionary());
 
         return DISC_NONE;
     }
@@ -837,19 +1190,280 @@ namespace server
             N_ADDBOT, 2, N_DELBOT, 1, N_INITAI, 0, N_FROMAI, 2, N_BOTLIMIT, 2, N_BOTBALANCE, 2,
             N_MAPCRC, 0, N_CHECKMAPS, 1,
             N_SWITCHNAME, 0, N_SWITCHMODEL, 2, N_SWITCHTEAM, 0,
+            N_SNAPSHOT, 0, N_SNAPACK, 2,
             -1
         };
         for(int *p = msgsizes; *p>=0; p += 2) if(*p==msg) return p[1];
         return -1;
     }
 
+    // Entity snapshots for joining clients
+    //
+    // Rather than one LogicEntityCompleteNotification per entity, a joining client is sent all
+    // entities as a stream of deflated chunks on ENTITY_CHANNEL. Lua serializes entities into a
+    // chunk until it holds entitystreamchunk bytes, and chunks are paced to entitystreamrate, so
+    // the server keeps ticking while even a large map streams. A chunk is an int that is 1 on the
+    // last chunk, the uint inflated and deflated lengths and the deflated data. Inflated, that is
+    // per entity: the int uid delta, int client number, int class (an index among the classes
+    // already named in the chunk, or their count followed by a new name) and the uint length and
+    // bytes of the state data.
+
+    VAR(entitystreams, 0, 1, 1);
+    VAR(entitystreamchunk, 1024, 16384, 1<<20);
+    VAR(entitystreamrate, 1, 512, 1<<20); // KB per second per client
+    VAR(entitystreamhold, 64, 4096, 1<<16); // Messages held for a client at most while it gets the snapshot
+    VAR(entitystreamacktime, 1000, 30000, 600000); // How long a client may take to apply the snapshot, in ms
+
+    static vector<uchar> entitychunk;
+    static vector<char *> entitychunkclasses;
+    static int entitychunkuid = 0, entitychunkentities = 0;
+
+    static void resetentitychunk()
+    {
+        entitychunk.setsize(0);
+        entitychunkclasses.deletearrays();
+        entitychunkuid = entitychunkentities = 0;
+    }
+
+    //! Adds an entity to the chunk being built, returning its size so far
+    int addentitytochunk(int uid, int cn, const char *cls, const char *sdata)
+    {
+        putint(entitychunk, uid - entitychunkuid);
+        entitychunkuid = uid;
+        putint(entitychunk, cn);
+        int clsidx = entitychunkclasses.length();
+        loopv(entitychunkclasses) if(!strcmp(entitychunkclasses[i], cls)) { clsidx = i; break; }
+        putint(entitychunk, clsidx);
+        if(clsidx == entitychunkclasses.length())
+        {
+            entitychunkclasses.add(newstring(cls));
+            sendstring(cls, entitychunk);
+        }
+        int len = strlen(sdata);
+        putuint(entitychunk, len);
+        entitychunk.put((const uchar *)sdata, len);
+        entitychunkentities++;
+        return entitychunk.length();
+    }
+
+    CLUAICOMMAND(entity_stream_add, int, (int uid, int cn, const char *cls, const char *sdata), {
+        return addentitytochunk(uid, cn, cls, sdata);
+    });
+
+    //! Deflates the chunk built so far into a packet for ENTITY_CHANNEL
+    static ENetPacket *buildentitychunkpacket(bool last)
+    {
+        static vector<uchar> deflated;
+        uLongf len = compressBound(entitychunk.length());
+        deflated.setsize(0);
+        if(compress2(deflated.pad(len), &len, entitychunk.getbuf(), entitychunk.length(), Z_BEST_SPEED) != Z_OK) return NULL;
+        packetbuf p(len + 16, ENET_PACKET_FLAG_RELIABLE);
+        putint(p, last ? 1 : 0);
+        putuint(p, entitychunk.length());
+        putuint(p, len);
+        p.put(deflated.getbuf(), len);
+        ENetPacket *packet = p.finalize();
+        p.packet = NULL;
+        return packet;
+    }
+
+    //! Starts streaming the entity snapshot to a client that asked for the active entities.
+    //! Returns false for clients that are sent individual notifications instead.
+    bool startentitystream(int cn)
+    {
+        clientinfo *ci = getinfo(cn);
+        if(!entitystreams || !ci || ci->local || ci->uniqueId == DUMMY_SINGLETON_CLIENT_UNIQUE_ID) return false;
+        ci->entitystreamuid = 0;
+        ci->entitystreamnext = ci->entitystreamstart = totalmillis;
+        ci->entitystreamchunks = ci->entitystreambytes = 0;
+        ci->holdmessages = true;
+        return true;
+    }
+
+    void finishentitystream(int cn)
+    {
+        clientinfo *ci = getinfo(cn);
+        // An acknowledgement of an earlier stream does not cover one still being sent
+        if(!ci || !ci->holdmessages || ci->entitystreamuid >= 0) return;
+        logger::log(logger::INFO, "client %d has all entities, sending %d held messages", cn, ci->heldmessages.length());
+        ci->sendheldmessages();
+    }
+
+    bool holdentitymessage(int cn, ENetPacket *packet)
+    {
+        clientinfo *ci = getinfo(cn);
+        if(!ci || !ci->holdmessages) return false;
+        // The client is dropped by checkheldmessages, so what it would be sent no longer matters
+        if(ci->heldmessages.length() >= entitystreamhold) return true;
+        packet->referenceCount++;
+        ci->heldmessages.add(packet);
+        return true;
+    }
+
+    //! Messages are not held for good: a client that lets too many pile up, or does not confirm the
+    //! snapshot in time, is disconnected
+    static void checkheldmessages()
+    {
+        loopvrev(clients)
+        {
+            clientinfo *ci = clients[i];
+            if(!ci->holdmessages) continue;
+            if(ci->heldmessages.length() >= entitystreamhold)
+            {
+                logger::log(logger::WARNING, "client %d has %d messages held back while it gets the entities, disconnecting", ci->clientnum, ci->heldmessages.length());
+                disconnect_client(ci->clientnum, DISC_OVERFLOW);
+            }
+            else if(ci->entitystreamuid < 0 && totalmillis - ci->holddeadline >= 0)
+            {
+                logger::log(logger::WARNING, "client %d did not confirm the entities in time, disconnecting", ci->clientnum);
+                disconnect_client(ci->clientnum, DISC_TIMEOUT);
+            }
+        }
+    }
+
+    static void sendentitystreams()
+    {
+        loopv(clients)
+        {
+            clientinfo *ci = clients[i];
+            if(ci->entitystreamuid < 0 || totalmillis - ci->entitystreamnext < 0) continue;
+            resetentitychunk();
+            int next = -1;
+            lua::pop_external_ret(lua::call_external_ret("entities_send_chunk", "iii", "i",
+                ci->clientnum, ci->entitystreamuid, entitystreamchunk, &next));
+            ENetPacket *packet = buildentitychunkpacket(next < 0);
+            if(!packet)
+            {
+                logger::log(logger::ERROR, "could not deflate entities for client %d", ci->clientnum);
+                next = -1;
+                ci->sendheldmessages();
+            }
+            else
+            {
+                ci->entitystreamchunks++;
+                ci->entitystreambytes += packet->dataLength;
+                ci->entitystreamnext = totalmillis + int(packet->dataLength*1000/(entitystreamrate*1024));
+                sendpacket(ci->clientnum, ENTITY_CHANNEL, packet);
+                if(!packet->referenceCount) enet_packet_destroy(packet);
+            }
+            ci->entitystreamuid = next;
+            if(next < 0)
+            {
+                ci->holddeadline = totalmillis + entitystreamacktime;
+                logger::log(logger::INFO, "streamed entities to client %d in %d chunks, %d bytes, %d ms",
+                    ci->clientnum, ci->entitystreamchunks, ci->entitystreambytes, totalmillis - ci->entitystreamstart);
+                lua::call_external("event_player_login", "i", ci->uniqueId);
+            }
+        }
+        resetentitychunk();
+    }
+
+    static void benchentitystream(int numents)
+    {
+        static const char * const classes[] = { "Light", "Mapmodel", "Marker", "Door", "Character" };
+        vector<char *> sdatas;
+        loopi(numents)
+        {
+            defformatstring(sdata, "[1]=\"%d|%d|%d\",[2]=\"%d\",[4]=\"[]\",[6]=\"%s\",[7]=\"%d\",[9]=\"%.2f\"",
+                rnd(4096), rnd(4096), rnd(1024), rnd(360), i%7 ? "" : "areatrigger", rnd(100), rndscale(1));
+            sdatas.add(newstring(sdata));
+        }
+
+        // The old way: one reliable packet per entity, each of which costs ENet a command header
+        enet_uint32 start = enet_time_get(), elapsed;
+        int runs = 0, legacybytes = 0;
+        do
+        {
+            legacybytes = 0;
+            loopi(numents)
+            {
+                MessageSystem::LogicEntityCompleteNotification::Fields msg = { -1, i+1, classes[i%5], sdatas[i] };
+                ENetPacket *packet = MessageSystem::buildMessage<MessageSystem::LogicEntityCompleteNotification>(msg);
+                legacybytes += packet->dataLength + sizeof(ENetProtocolSendReliable);
+                enet_packet_destroy(packet);
+            }
+            runs++;
+        } while((elapsed = enet_time_get() - start) < 200);
+        float legacytime = elapsed/float(runs);
+
+        vector<ENetPacket *> chunks;
+        start = enet_time_get();
+        runs = 0;
+        do
+        {
+            loopv(chunks) enet_packet_destroy(chunks[i]);
+            chunks.setsize(0);
+            resetentitychunk();
+            loopi(numents)
+            {
+                if(addentitytochunk(i+1, -1, classes[i%5], sdatas[i]) < entitystreamchunk && i+1 < numents) continue;
+                chunks.add(buildentitychunkpacket(i+1 == numents));
+                resetentitychunk();
+            }
+            runs++;
+        } while((elapsed = enet_time_get() - start) < 200);
+        float streamtime = elapsed/float(runs);
+        int streambytes = 0;
+        loopv(chunks) streambytes += chunks[i]->dataLength + sizeof(ENetProtocolSendFragment)*((chunks[i]->dataLength + 1399)/1400);
+
+        // What the client does with each chunk, short of creating the entities
+        static vector<uchar> inflated;
+        start = enet_time_get();
+        runs = 0;
+        do
+        {
+            loopv(chunks)
+            {
+                ucharbuf p(chunks[i]->data, chunks[i]->dataLength);
+                getint(p);
+                int rawlen = getuint(p), len = getuint(p);
+                uLongf inflatedlen = rawlen;
+                inflated.setsize(0);
+                uncompress(inflated.pad(rawlen), &inflatedlen, &p.buf[p.len], len);
+                ucharbuf q(inflated.getbuf(), rawlen);
+                string name;
+                int numclasses = 0;
+                while(q.remaining())
+                {
+                    getint(q);
+                    getint(q);
+                    if(getint(q) == numclasses) { getstring(name, q); numclasses++; }
+                    q.subbuf(getuint(q));
+                }
+            }
+            runs++;
+        } while((elapsed = enet_time_get() - start) < 200);
+        float decodetime = elapsed/float(runs);
+        loopv(chunks) enet_packet_destroy(chunks[i]);
+        resetentitychunk();
+        sdatas.deletearrays();
+
+        // Joining takes about as long as building plus the transfer at the stream's rate
+        float rate = entitystreamrate*1024/1000.0f;
+        conoutf("%d entities:", numents);
+        conoutf("  notifications: %.2f ms to build, %d bytes, about %.0f ms to join", legacytime, legacybytes, legacytime + legacybytes/rate);
+        conoutf("  stream: %.2f ms to build, %d chunks, %d bytes, %.2f ms to decode, about %.0f ms to join", streamtime, chunks.length(), streambytes, decodetime, streamtime + decodetime + streambytes/rate);
+    }
+
+    //! Compares sending a joining client one notification per entity with the entity stream,
+    //! for synthetic entities. Lua's serializing of state data, the same either way, is left out.
+    void entitystreambench(int *numents)
+    {
+        if(*numents > 0) benchentitystream(*numents);
+        else { benchentitystream(1000); benchentitystream(10000); }
+    }
+    COMMAND(entitystreambench, "i");
+
     void serverupdate()
     {
         gamemillis += curtime;
+        sendentitystreams();
+        checkheldmessages();
     }
 
     void recordpacket(int chan, void *data, int len)
     {
+        recordbroadcast(chan, data, len);
     }
 
     bool allowbroadcast(int n)
@@ -860,7 +1474,7 @@ namespace server
 
     int reserveclients() { return 3+1; }
 
-    int numchannels() { return 3; };
+    int numchannels() { return 4; };
 
     const char *defaultmaster() { return "nada/nullo/"; } ;
 
@@ -873,6 +1487,7 @@ namespace server
             clientinfo *ci = clients[i];
             ci->mapchange(); // Old sauer method to reset scenario/game/map transient info
         }
+        MessageSystem::clear_StateDataUpdates(); // Their unique IDs refer to the old scenario's entities
     }
 
     void setClientScenario(int cn, const char *sc)
@@ -14,6 +14,11 @@
 extern void removeentity(extentity* entity);
 extern void addentity(extentity* entity);
 
+namespace timers
+{
+    int advance(uint millis);
+}
+
 //=========================
 // Logic Entities
 //=========================
@@ -146,8 +151,14 @@ vec& CLogicEntity::getAttachmentPosition(const char *tag)
 // LogicSystem
 //=========================
 
-LogicSystem::LogicEntityMap LogicSystem::logicEntities;
 bool LogicSystem::initialized = false;
+vector<LogicSystem::Slot> LogicSystem::slots;
+vector<uchar *> LogicSystem::pool;
+int LogicSystem::firstFree = -1;
+hashtable<int, LogicHandle> LogicSystem::uidHandles;
+
+#define LOGICPOOL_BLOCKBITS 8
+#define LOGICPOOL_BLOCKSIZE (1<<LOGICPOOL_BLOCKBITS)
 
 void LogicSystem::clear(bool restart_lua)
 {
@@ -157,7 +168,7 @@ void LogicSystem::clear(bool restart_lua)
     if (lua::L)
     {
         lua::call_external("entities_remove_all", "");
-        enumerate(logicEntities, CLogicEntity*, ent, assert(!ent));
+        loopv(slots) assert(!slots[i].entity);
         if (restart_lua) lua::reset();
     }
 
@@ -170,14 +181,54 @@ void LogicSystem::init()
     LogicSystem::initialized = true;
 }
 
-void LogicSystem::registerLogicEntity(CLogicEntity *newEntity)
+int LogicSystem::allocSlot()
+{
+    if (firstFree >= 0)
+    {
+        int slot = firstFree;
+        firstFree = slots[slot].nextFree;
+        return slot;
+    }
+    int slot = slots.length();
+    if (slot > LOGICHANDLE_INDEXMASK) fatal("too many logic entities");
+    if (!(slot & (LOGICPOOL_BLOCKSIZE-1))) pool.add(new uchar[LOGICPOOL_BLOCKSIZE*sizeof(CLogicEntity)]);
+    Slot &s = slots.add();
+    s.entity = NULL;
+    s.uniqueId = -1;
+    s.generation = 1;
+    s.nextFree = -1;
+    return slot;
+}
+
+void *LogicSystem::slotStorage(int slot)
+{
+    return pool[slot>>LOGICPOOL_BLOCKBITS] + (slot&(LOGICPOOL_BLOCKSIZE-1))*sizeof(CLogicEntity);
+}
+
+template<class T>
+CLogicEntity *LogicSystem::newLogicEntity(T base)
+{
+    int slot = allocSlot();
+    CLogicEntity *newEntity = new (slotStorage(slot)) CLogicEntity(base);
+    registerLogicEntity(newEntity, slot);
+    return newEntity;
+}
+
+void LogicSystem::registerLogicEntity(CLogicEntity *newEntity, int slot)
 {
     logger::log(logger::DEBUG, "C registerLogicEntity: %d", newEntity->getUniqueId());
     INDENT_LOG(logger::DEBUG);
 
     int uniqueId = newEntity->getUniqueId();
-    assert(!logicEntities.access(uniqueId));
-    logicEntities.access(uniqueId, newEntity);
+    assert(!uidHandles.access(uniqueId));
+    Slot &s = slots[slot];
+    s.entity = newEntity;
+    s.uniqueId = uniqueId;
+    newEntity->handle = (s.generation<<LOGICHANDLE_INDEXBITS) | slot;
+    uidHandles.access(uniqueId, newEntity->handle);
+    // Lets the engine get from its own entities to the logic entity without going through the uid
+    if (newEntity->dynamicEntity) ((gameent*)newEntity->dynamicEntity)->logichandle = newEntity->handle;
+    else if (newEntity->staticEntity) newEntity->staticEntity->logichandle = newEntity->handle;
 
     logger::log(logger::DEBUG, "C registerLogicEntity completes");
 }
@@ -190,11 +241,9 @@ CLogicEntity *LogicSystem::registerLogicEntity(physent* entity)
         assert(0);
     }
 
-    CLogicEntity *newEntity = new CLogicEntity(entity);
+    CLogicEntity *newEntity = newLogicEntity(entity);
 
-    logger::log(logger::DEBUG, "adding physent %d", newEntity->getUniqueId());
-
-    registerLogicEntity(newEntity);
+    logger::log(logger::DEBUG, "added physent %d", newEntity->getUniqueId());
 
     return newEntity;
 }
@@ -207,64 +256,84 @@ CLogicEntity *LogicSystem::registerLogicEntity(extentity* entity)
         assert(0);
     }
 
-    CLogicEntity *newEntity = new CLogicEntity(entity);
-
 //    logger::log(logger::DEBUG, "adding entity %d : %d,%d,%d,%d", entity->type, entity->attr[0], entity->attr[1], entity->attr[2], entity->attr[3]);
 
-    registerLogicEntity(newEntity);
-
-    return newEntity;
+    return newLogicEntity(entity);
 }
 
 void LogicSystem::registerLogicEntityNonSauer(int uniqueId)
 {
-    CLogicEntity *newEntity = new CLogicEntity(uniqueId);
     logger::log(logger::DEBUG, "adding non-Sauer entity %d", uniqueId);
-    registerLogicEntity(newEntity);
-//    return newEntity;
+    newLogicEntity(uniqueId);
 }
 
 void LogicSystem::unregisterLogicEntityByUniqueId(int uniqueId)
 {
     logger::log(logger::DEBUG, "UNregisterLogicEntity by UniqueID: %d", uniqueId);
 
-    if (!logicEntities.access(uniqueId)) return;
-
-    CLogicEntity *ptr = logicEntities[uniqueId];
-    logicEntities.remove(uniqueId);
-
-    ptr->clear_attachments();
-    delete ptr;
+    LogicHandle *handle = uidHandles.access(uniqueId);
+    if (!handle) return;
+
+    int slot = *handle & LOGICHANDLE_INDEXMASK;
+    uidHandles.remove(uniqueId);
+
+    Slot &s = slots[slot];
+    s.entity->clear_attachments();
+    s.entity->~CLogicEntity();
+    s.entity = NULL;
+    s.uniqueId = -1;
+    // Outstanding handles to the slot stop resolving
+    s.generation = (s.generation + 1) & LOGICHANDLE_GENERATIONMASK;
+    if (!s.generation) s.generation = 1;
+    s.nextFree = firstFree;
+    firstFree = slot;
 }
 
 void LogicSystem::manageActions(long millis)
 {
     logger::log(logger::INFO, "manageActions: %d", millis);
     INDENT_LOG(logger::INFO);
-    if (lua::L) lua::call_external("frame_handle", "ii", millis, lastmillis);
+    static lua::external timers_handle("timers_handle"), frame_handle("frame_handle");
+    if (!lua::L) return;
+    // Timers first, and only when some are due
+    if (timers::advance(uint(max(millis, 0L)))) lua::call_external(timers_handle);
+    lua::call_external(frame_handle, int(millis), lastmillis);
     logger::log(logger::INFO, "manageActions complete");
 }
 
 CLogicEntity *LogicSystem::getLogicEntity(int uniqueId)
 {
-    if (!logicEntities.access(uniqueId))
+    LogicHandle *handle = uidHandles.access(uniqueId);
+    if (!handle)
     {
         logger::log(logger::INFO, "(C++) Trying to get a non-existant logic entity %d", uniqueId);
         return NULL;
     }
 
-    return logicEntities[uniqueId];
+    return resolveHandle(*handle);
 }
 
+// Engine entities carry the handle of their logic entity, so they only need the uid when that is stale.
+// Physics worker threads look entities up through these too, so a miss is not logged: the logger is
+// only ever used from the main thread.
 CLogicEntity *LogicSystem::getLogicEntity(const extentity &extent)
 {
-    return getLogicEntity(extent.uid);
+    CLogicEntity *entity = resolveHandle(extent.logichandle, extent.uid);
+    return entity ? entity : resolveHandle(getHandle(extent.uid), extent.uid);
 }
 
 
 CLogicEntity *LogicSystem::getLogicEntity(physent* entity)
 {
-    return getLogicEntity(getUniqueId(entity)); // TODO: do this directly, without the intermediary getUniqueId, for speed?
+    gameent *d = (gameent*)entity;
+    CLogicEntity *logicEntity = resolveHandle(d->logichandle, d->uid);
+    return logicEntity ? logicEntity : resolveHandle(getHandle(d->uid), d->uid);
+}
+
+LogicHandle LogicSystem::getHandle(int uniqueId)
+{
+    LogicHandle *handle = uidHandles.access(uniqueId);
+    return handle ? *handle : 0;
 }
 
 int LogicSystem::getUniqueId(extentity* staticEntity)
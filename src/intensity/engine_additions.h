@@ -12,6 +12,15 @@
 //! LogicEntities have unique IDs. These are unique in a module (but not a map - entities can
 //! move between maps).
 
+//! A handle to a logic entity: the index of its slot in the low bits, and the generation of that slot in the
+//! high bits. Slots are reused under a new generation, so a handle to an entity that is gone resolves to NULL.
+//! 0 is never a valid handle.
+typedef uint LogicHandle;
+
+#define LOGICHANDLE_INDEXBITS 20
+#define LOGICHANDLE_INDEXMASK ((1<<LOGICHANDLE_INDEXBITS)-1)
+#define LOGICHANDLE_GENERATIONMASK ((1<<(32-LOGICHANDLE_INDEXBITS))-1)
+
 struct entlinkpos {
     vec pos;
     int millis;
@@ -28,6 +37,8 @@ struct CLogicEntity
 
     int uniqueId; //!< Only used for nonSauer
 
+    LogicHandle handle; //!< Set when registered
+
     //! The attachments for this entity
     vector<modelattach> attachments;
 
@@ -44,16 +55,16 @@ struct CLogicEntity
     //! Whether this entity can move on its own volition
     bool canMove;
 
-    CLogicEntity(): dynamicEntity(NULL), staticEntity(NULL), uniqueId(-8), anim(0), startTime(0)
+    CLogicEntity(): dynamicEntity(NULL), staticEntity(NULL), uniqueId(-8), handle(0), anim(0), startTime(0)
         { attachments.add(modelattach()); };
     CLogicEntity(physent*    _dynamicEntity) : dynamicEntity(_dynamicEntity),
-        staticEntity(NULL), uniqueId(-8), anim(0), startTime(0)
+        staticEntity(NULL), uniqueId(-8), handle(0), anim(0), startTime(0)
         { attachments.add(modelattach()); };
     CLogicEntity(extentity* _staticEntity): dynamicEntity(NULL),
-        staticEntity(_staticEntity), uniqueId(-8), anim(0), startTime(0)
+        staticEntity(_staticEntity), uniqueId(-8), handle(0), anim(0), startTime(0)
         { attachments.add(modelattach()); };
     CLogicEntity(int _uniqueId): dynamicEntity(NULL), staticEntity(NULL),
-        uniqueId(_uniqueId), anim(0), startTime(0)
+        uniqueId(_uniqueId), handle(0), anim(0), startTime(0)
         { attachments.add(modelattach()); }; // This is a non-Sauer LE
     ~CLogicEntity() { clear_attachments(); }
 
@@ -88,10 +99,22 @@ struct CLogicEntity
 
 struct LogicSystem
 {
-    typedef hashtable<int, CLogicEntity*> LogicEntityMap;
+    //! All the entities in the scenario live in a slot map. They are constructed in place in blocks of a pool
+    //! that never moves, so pointers to them stay good, and are found through their handle by indexing. Uids
+    //! are mapped to handles only for where entities are named by uid - the network and Lua.
+    struct Slot
+    {
+        CLogicEntity *entity; //!< NULL if free
+        int uniqueId;
+        uint generation;
+        int nextFree;
+    };
 
     static bool initialized;
-    static LogicEntityMap logicEntities; //!< All the entities in the scenario
+    static vector<Slot> slots;
+    static vector<uchar *> pool;
+    static int firstFree;
+    static hashtable<int, LogicHandle> uidHandles;
 
     //! Called before a map loads. Empties list of entities, and unloads the PC logic entity. Removes the lua engine
     static void clear(bool restart_lua = false);
@@ -99,8 +122,14 @@ struct LogicSystem
     //! Calls clear(), and creates a new lua engine
     static void init();
 
-    //! Register a logic entity in the LogicSystem system. Must be done so that entities are accessible and are managed.
-    static void          registerLogicEntity(CLogicEntity *newEntity);
+    //! Register a logic entity in the LogicSystem system, constructed in the storage of the given slot. Must be done
+    //! so that entities are accessible and are managed.
+    static void          registerLogicEntity(CLogicEntity *newEntity, int slot);
+
+    static int           allocSlot();
+    static void         *slotStorage(int slot);
+    template<class T>
+    static CLogicEntity *newLogicEntity(T base);
 
     static CLogicEntity *registerLogicEntity(physent* entity);
     static CLogicEntity *registerLogicEntity(extentity* entity);
@@ -121,6 +150,24 @@ struct LogicSystem
     static CLogicEntity *getLogicEntity(const extentity &extent);
     static CLogicEntity *getLogicEntity(physent* entity);
 
+    static LogicHandle   getHandle(int uniqueId);
+
+    //! The entity a handle refers to, NULL if it is gone
+    static inline CLogicEntity *resolveHandle(LogicHandle handle)
+    {
+        uint index = handle & LOGICHANDLE_INDEXMASK;
+        if (index >= uint(slots.length())) return NULL;
+        const Slot &s = slots[index];
+        return s.generation == handle >> LOGICHANDLE_INDEXBITS ? s.entity : NULL;
+    }
+
+    //! As above, but also only if the entity is still registered under the given uid
+    static inline CLogicEntity *resolveHandle(LogicHandle handle, int uniqueId)
+    {
+        CLogicEntity *entity = resolveHandle(handle);
+        return entity && slots[handle & LOGICHANDLE_INDEXMASK].uniqueId == uniqueId ? entity : NULL;
+    }
+
     static int           getUniqueId(extentity* staticEntity);
     static int           getUniqueId(physent*    dynamicEntity);
 
@@ -20,6 +20,225 @@ void MessageType::receive(int receiver, int sender, ucharbuf &p)
 }
 
 
+// Message stats
+
+VARP(msgstats, 0, 1, 1);
+VARP(msgstatsinterval, 0, 0, 24*60*60);
+SVARP(msgstatsfile, "msgstats.csv");
+
+enum { MSGSTATS_IN = 0, MSGSTATS_OUT, MSGSTATS_DIRS };
+enum { MSGSTATS_TYPES = 64, MSGSTATS_BUCKETS = 16, MSGSTATS_TOPUIDS = 16 };
+
+static const char * const msgstatsdirs[MSGSTATS_DIRS] = { "in", "out" };
+
+//! The heaviest entities are tracked with the space-saving algorithm: a fixed set of slots, where
+//! an entity that is not in any takes over the lightest one along with its bytes. The bytes of a
+//! slot are thus an upper bound, exact for entities that have held their slot since the reset.
+struct MessageUidStats
+{
+    int uid, count;
+    llong bytes;
+};
+
+struct MessageStats
+{
+    int count;
+    llong bytes, micros;
+    int histogram[MSGSTATS_BUCKETS]; //!< handler times: bucket 0 is under a microsecond, bucket b under 2^b
+    MessageUidStats uids[MSGSTATS_TOPUIDS];
+    int numuids;
+
+    void adduid(int uid, int len)
+    {
+        int lightest = 0;
+        loopi(numuids)
+        {
+            if (uids[i].uid == uid) { uids[i].count++; uids[i].bytes += len; return; }
+            if (uids[i].bytes < uids[lightest].bytes) lightest = i;
+        }
+        if (numuids < MSGSTATS_TOPUIDS)
+        {
+            MessageUidStats &slot = uids[numuids++];
+            slot.uid = uid;
+            slot.count = 1;
+            slot.bytes = len;
+            return;
+        }
+        MessageUidStats &slot = uids[lightest];
+        slot.uid = uid;
+        slot.count++;
+        slot.bytes += len;
+    }
+
+    void sortuids()
+    {
+        for (int i = 1; i < numuids; i++) for (int j = i; j > 0 && uids[j].bytes > uids[j-1].bytes; j--) swap(uids[j], uids[j-1]);
+    }
+};
+
+static MessageStats messagestats[MSGSTATS_DIRS][MSGSTATS_TYPES];
+static int msgstatsreset = 0, msgstatsdumped = 0;
+
+static bool isStateDataType(int type)
+{
+    switch (type)
+    {
+        case 1011: case 1012: case 1013: case 1014: case 1036: return true;
+        default: return false;
+    }
+}
+
+static int peekint(const ucharbuf &p)
+{
+    ucharbuf q = p;
+    return getint(q);
+}
+
+static MessageStats *getMessageStats(int dir, int type)
+{
+    int index = type - INTENSITY_MSG_TYPE_MIN;
+    return index >= 0 && index < MSGSTATS_TYPES ? &messagestats[dir][index] : NULL;
+}
+
+static void countMessage(int dir, int type, int len, int count, int uid, llong micros)
+{
+    MessageStats *stats = getMessageStats(dir, type);
+    if (!stats) return;
+    stats->count += count;
+    stats->bytes += llong(len)*count;
+    if (uid >= 0) loopi(count) stats->adduid(uid, len);
+    if (dir != MSGSTATS_IN) return;
+    stats->micros += micros;
+    int bucket = 0;
+    while (bucket < MSGSTATS_BUCKETS-1 && micros >= (1<<bucket)) bucket++;
+    stats->histogram[bucket]++;
+}
+
+void countMessageSent(const uchar *data, int len, int recipients)
+{
+    if (!msgstats || recipients <= 0 || len <= 0) return;
+    ucharbuf p((uchar *)data, len);
+    int type = getint(p);
+    if (type < INTENSITY_MSG_TYPE_MIN) return;
+    countMessage(MSGSTATS_OUT, type, len, recipients, isStateDataType(type) ? getint(p) : -1, 0);
+}
+
+static const char *getMessageName(int type)
+{
+    MessageType **message_type = MessageManager::messageTypes.access(type);
+    return message_type ? (*message_type)->type_name : "unknown";
+}
+
+static void resetMessageStats()
+{
+    memset(messagestats, 0, sizeof(messagestats));
+    msgstatsreset = totalmillis;
+}
+
+//! Appends a row per message type to a .csv file, or rewrites a .json file with the current totals.
+//! Counters are cumulative since the last reset, so dashboards plot the difference between dumps.
+static bool dumpMessageStats(const char *filename)
+{
+    const char *ext = strrchr(filename, '.');
+    bool json = ext && !strcasecmp(ext, ".json");
+    stream *f = openfile(filename, json ? "w" : "a");
+    if (!f) { conoutf(CON_ERROR, "could not write message stats to %s", filename); return false; }
+    int now = int(time(NULL)), first = 1;
+    if (json) f->printf("{\"time\": %d, \"millis\": %d, \"messages\": [", now, totalmillis - msgstatsreset);
+    else if (!f->size())
+    {
+        f->printf("time,millis,direction,code,name,count,bytes,micros");
+        loopi(MSGSTATS_BUCKETS) f->printf(",under%dus", 1<<i);
+        f->printf(",topuids\n");
+    }
+    loop(dir, MSGSTATS_DIRS) loopi(MSGSTATS_TYPES)
+    {
+        MessageStats &stats = messagestats[dir][i];
+        if (!stats.count) continue;
+        stats.sortuids();
+        int type = INTENSITY_MSG_TYPE_MIN + i;
+        if (json)
+        {
+            f->printf("%s\n  {\"direction\": \"%s\", \"code\": %d, \"name\": \"%s\", \"count\": %d, \"bytes\": %lld, \"micros\": %lld, \"histogram\": [",
+                first ? "" : ",", msgstatsdirs[dir], type, getMessageName(type), stats.count, stats.bytes, stats.micros);
+            loopj(MSGSTATS_BUCKETS) f->printf("%s%d", j ? ", " : "", stats.histogram[j]);
+            f->printf("], \"topuids\": [");
+            loopj(stats.numuids) f->printf("%s{\"uid\": %d, \"count\": %d, \"bytes\": %lld}", j ? ", " : "", stats.uids[j].uid, stats.uids[j].count, stats.uids[j].bytes);
+            f->printf("]}");
+        }
+        else
+        {
+            f->printf("%d,%d,%s,%d,%s,%d,%lld,%lld", now, totalmillis - msgstatsreset, msgstatsdirs[dir], type, getMessageName(type), stats.count, stats.bytes, stats.micros);
+            loopj(MSGSTATS_BUCKETS) f->printf(",%d", stats.histogram[j]);
+            f->printf(",");
+            loopj(stats.numuids) f->printf("%s%d:%lld", j ? " " : "", stats.uids[j].uid, stats.uids[j].bytes);
+            f->printf("\n");
+        }
+        first = 0;
+    }
+    if (json) f->printf("\n]}\n");
+    delete f;
+    return true;
+}
+
+void updateMessageStats()
+{
+    if (!msgstatsinterval || totalmillis - msgstatsdumped < msgstatsinterval*1000) return;
+    msgstatsdumped = totalmillis;
+    if (!dumpMessageStats(msgstatsfile)) msgstatsinterval = 0; // Do not spam the console every interval
+}
+
+ICOMMAND(msgstatsreset, "", (), resetMessageStats());
+ICOMMAND(msgstatsdump, "s", (char *filename), dumpMessageStats(filename[0] ? filename : msgstatsfile));
+
+static bool messageStatsLess(const MessageStats *x, const MessageStats *y) { return x->bytes > y->bytes; }
+
+//! Lists the message types by bytes, heaviest first, along with their heaviest entities
+static void printmsgstats()
+{
+    vector<MessageStats *> sorted;
+    loop(dir, MSGSTATS_DIRS) loopi(MSGSTATS_TYPES) if (messagestats[dir][i].count) sorted.add(&messagestats[dir][i]);
+    sorted.sort(messageStatsLess);
+    float seconds = max(totalmillis - msgstatsreset, 1)/1000.0f;
+    conoutf("message stats over the last %.1f seconds:", seconds);
+    loopv(sorted)
+    {
+        MessageStats &stats = *sorted[i];
+        int index = int(&stats - &messagestats[0][0]), dir = index/MSGSTATS_TYPES, type = INTENSITY_MSG_TYPE_MIN + index%MSGSTATS_TYPES;
+        conoutf("  %-3s %s (%d): %d msgs, %.1f KB, %.2f KB/s%s", msgstatsdirs[dir], getMessageName(type), type,
+            stats.count, stats.bytes/1024.0f, stats.bytes/1024.0f/seconds,
+            dir == MSGSTATS_IN ? tempformatstring(", %.1f us per handler", double(stats.micros)/stats.count) : "");
+        stats.sortuids();
+        loopj(min(stats.numuids, 5)) conoutf("      uid %d: %d msgs, %.1f KB", stats.uids[j].uid, stats.uids[j].count, stats.uids[j].bytes/1024.0f);
+    }
+}
+COMMAND(printmsgstats, "");
+
+//! Fills 'val' with the count, bytes and handler microseconds of a message type, followed by its
+//! handler time histogram. Returns false for codes that are out of range.
+CLUAICOMMAND(msgstats_get, bool, (int type, bool out, double *val), {
+    MessageStats *stats = getMessageStats(out ? MSGSTATS_OUT : MSGSTATS_IN, type);
+    if (!stats) return false;
+    val[0] = stats->count;
+    val[1] = stats->bytes;
+    val[2] = stats->micros;
+    loopi(MSGSTATS_BUCKETS) val[3 + i] = stats->histogram[i];
+    return true;
+});
+
+//! Fills up to 'n' of the heaviest entities of a state data type, heaviest first, returning how many
+CLUAICOMMAND(msgstats_get_top_uids, int, (int type, bool out, int *uids, double *bytes, int n), {
+    MessageStats *stats = getMessageStats(out ? MSGSTATS_OUT : MSGSTATS_IN, type);
+    if (!stats) return 0;
+    stats->sortuids();
+    n = min(n, stats->numuids);
+    loopi(n) { uids[i] = stats->uids[i].uid; bytes[i] = stats->uids[i].bytes; }
+    return n;
+});
+
+CLUAICOMMAND(msgstats_reset, void, (), resetMessageStats());
+
+
 // MessageManager
 
 struct Message_Storage {
@@ -55,11 +274,88 @@ bool MessageManager::receive(int type, int receiver, int sender, ucharbuf &p)
     logger::log(logger::DEBUG,     "MessageSystem: Receiving a message of type %d from %d: %s", type, sender, message_type->type_name);
     INDENT_LOG(logger::DEBUG);
 
+    int start = p.len;
+    int uid = msgstats && isStateDataType(type) ? peekint(p) : -1;
+    llong began = msgstats ? getmicros() : 0;
+
     message_type->receive(receiver, sender, p);
 
+    // The type code was read before we got here; putint() spends three bytes on codes of 128 and up
+    if (msgstats) countMessage(MSGSTATS_IN, type, p.len - start + 3, 1, uid, getmicros() - began);
+
     logger::log(logger::DEBUG, "MessageSystem: message successfully handled");
 
     return true;
 }
 
+
+// StateDataValue
+
+void StateDataValue::put(ucharbuf &p) const
+{
+    putint(p, type);
+    switch(type)
+    {
+        case SDATA_INT: putint(p, i); break;
+        case SDATA_FLOAT: putfloat(p, f); break;
+        case SDATA_VEC3: loopk(3) putfloat(p, v[k]); break;
+        case SDATA_STRING: p.put(uchar(len)); p.put((const uchar *)str, len); break;
+        case SDATA_BLOB: putuint(p, len); p.put((const uchar *)str, len); break;
+    }
+}
+
+bool StateDataValue::get(ucharbuf &p)
+{
+    type = getint(p);
+    switch(type)
+    {
+        case SDATA_INT: i = getint(p); break;
+        case SDATA_FLOAT: f = getfloat(p); break;
+        case SDATA_VEC3: loopk(3) v[k] = getfloat(p); break;
+        case SDATA_FALSE: case SDATA_TRUE: break;
+        case SDATA_STRING: case SDATA_BLOB:
+        {
+            len = type == SDATA_STRING ? p.get() : getuint(p);
+            if(len < 0 || len > p.remaining()) { p.forceoverread(); return false; }
+            str = (const char *)p.subbuf(len).buf;
+            break;
+        }
+        default:
+            logger::log(logger::ERROR, "MessageSystem: invalid state data type %d", type);
+            p.forceoverread();
+            return false;
+    }
+    return !p.overread();
+}
+
+void StateDataValue::apply(int uid, int keyProtocolId, int actor) const
+{
+#ifdef SERVER
+    #define SDATA_ARGS(fmt) "ii" fmt "i"
+#else
+    #define SDATA_ARGS(fmt) "ii" fmt
+#endif
+    // The trailing actor argument is ignored by the format on the client, where it is not used
+    switch(type)
+    {
+        case SDATA_INT:
+            lua::call_external("entity_set_sdata", SDATA_ARGS("i"), uid, keyProtocolId, i, actor);
+            break;
+        case SDATA_FLOAT:
+            lua::call_external("entity_set_sdata", SDATA_ARGS("f"), uid, keyProtocolId, double(f), actor);
+            break;
+        case SDATA_VEC3:
+            lua::call_external("entity_set_sdata_vec3", SDATA_ARGS("fff"), uid, keyProtocolId,
+                double(v[0]), double(v[1]), double(v[2]), actor);
+            break;
+        case SDATA_FALSE: case SDATA_TRUE:
+            lua::call_external("entity_set_sdata", SDATA_ARGS("b"), uid, keyProtocolId, type == SDATA_TRUE, actor);
+            break;
+        case SDATA_STRING: case SDATA_BLOB:
+            lua::call_external("entity_set_sdata", SDATA_ARGS("S"), uid, keyProtocolId, str, len, actor);
+            break;
+    }
+    #undef SDATA_ARGS
+}
+
 }
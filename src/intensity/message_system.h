@@ -13,6 +13,9 @@
 //! As per Sauer: 0 is fast positions, 1 is (reliable?) standard messages
 #define MAIN_CHANNEL 1
 
+//! The snapshot of all entities a joining client is sent, see server::startentitystream
+#define ENTITY_CHANNEL 3
+
 //! Extensions to the Sauerbraten client-server messaging system
 
 //! Instead of hard-coding messages into gameserver.h as in Sauerbraten, we instead have the
@@ -67,6 +70,146 @@ struct MessageManager
     static bool receive(int type, int receiver, int sender, ucharbuf &p);
 };
 
+//! State data values travel in binary, prefixed by one of these tags, instead of as strings that
+//! both sides have to format and parse. Booleans are folded into the tag itself.
+enum
+{
+    SDATA_INT = 0, SDATA_FLOAT, SDATA_VEC3, SDATA_FALSE, SDATA_TRUE, SDATA_STRING, SDATA_BLOB
+};
+
+//! The longest string sent with a one-byte length (SDATA_STRING); longer ones go as SDATA_BLOB
+#define SDATA_MAXSHORTSTR 255
+
+//! A typed state data value. Strings and blobs are not copied: they point into the Lua string
+//! being sent, or into the packet being received, and are only valid for as long as those are.
+struct StateDataValue
+{
+    int type;
+    union
+    {
+        int i;
+        float f;
+        float v[3];
+    };
+    const char *str;
+    int len;
+
+    StateDataValue() : type(SDATA_STRING), str(""), len(0) {}
+
+    void setint(int n) { type = SDATA_INT; i = n; }
+    void setfloat(float n) { type = SDATA_FLOAT; f = n; }
+    void setvec(float x, float y, float z) { type = SDATA_VEC3; v[0] = x; v[1] = y; v[2] = z; }
+    void setbool(bool b) { type = b ? SDATA_TRUE : SDATA_FALSE; }
+    void setstring(const char *s, int n) { type = n > SDATA_MAXSHORTSTR ? SDATA_BLOB : SDATA_STRING; str = s; len = n; }
+
+    //! Writes the tag and the value
+    void put(ucharbuf &p) const;
+    //! Reads a value written by put(). Returns false (and marks the buffer as overread) on malformed input
+    bool get(ucharbuf &p);
+    //! Hands the value to the entity's state data in Lua (the entity_set_sdata external). 'actor' is the
+    //! unique ID of the client requesting the change, and is only passed on the server.
+    void apply(int uid, int keyProtocolId, int actor = -1) const;
+};
+
+//! Message codecs. Each message type lists its fields once, in wire order, in a nested Fields struct
+//! whose visit() hands every field to a visitor. Encoding and decoding are two such visitors, so the
+//! compiler generates both from the one list and they cannot disagree, and there is no format
+//! string to parse at runtime. Fields are ints, bools, strings and StateDataValues.
+//!
+//! Strings travel as their length, their bytes and a NUL. That lets a decoded string point straight
+//! into the packet rather than be copied out, so it is only valid for as long as the packet is.
+
+//! For message types that carry nothing but their code
+struct NoFields
+{
+    template<class V> void visit(V &) {}
+};
+
+template<class B> struct MessageWriter
+{
+    B &p;
+
+    MessageWriter(B &p) : p(p) {}
+
+    void operator()(int n) { putint(p, n); }
+    void operator()(bool b) { putint(p, b ? 1 : 0); }
+    void operator()(const char *s)
+    {
+        int len = int(strlen(s));
+        putuint(p, len);
+        p.put((const uchar *)s, len);
+        p.put(uchar(0));
+    }
+    void operator()(const StateDataValue &v)
+    {
+        static uchar buf[MAXTRANS];
+        ucharbuf q(buf, sizeof(buf));
+        v.put(q);
+        p.put(buf, q.length());
+    }
+};
+
+struct MessageReader
+{
+    ucharbuf &p;
+
+    MessageReader(ucharbuf &p) : p(p) {}
+
+    void operator()(int &n) { n = getint(p); }
+    void operator()(bool &b) { b = getint(p) != 0; }
+    void operator()(const char *&s)
+    {
+        int len = getuint(p);
+        if (len < 0 || len >= p.remaining() || p.buf[p.len + len]) { p.forceoverread(); s = ""; return; }
+        s = (const char *)p.subbuf(len + 1).buf;
+    }
+    void operator()(StateDataValue &v) { v.get(p); }
+};
+
+//! Builds a packet holding a message of type T, for send_AnyMessage
+template<class T> ENetPacket *buildMessage(typename T::Fields &msg, bool reliable = true)
+{
+    packetbuf p(MAXTRANS, reliable ? ENET_PACKET_FLAG_RELIABLE : 0);
+    putint(p, int(T::CODE));
+    MessageWriter<packetbuf> writer(p);
+    msg.visit(writer);
+    ENetPacket *packet = p.finalize();
+    p.packet = NULL;
+    return packet;
+}
+
+//! Queues an encoded message to the server, along with the other messages of this frame
+void queueMessage(const uchar *buf, int len, bool reliable);
+
+//! Queues a message of type T to the server
+template<class T> void addMessage(typename T::Fields &msg, bool reliable = true)
+{
+    static uchar buf[MAXTRANS];
+    ucharbuf p(buf, sizeof(buf));
+    putint(p, int(T::CODE));
+    MessageWriter<ucharbuf> writer(p);
+    msg.visit(writer);
+    queueMessage(buf, p.length(), reliable);
+}
+
+//! Reads the fields of a message. Returns false on malformed input, in which case the fields must not be used
+template<class F> bool readMessage(ucharbuf &p, F &msg)
+{
+    MessageReader reader(p);
+    msg.visit(reader);
+    return !p.overread();
+}
+
+//! Always-on counters of our message types, per direction: how many were sent and received, how
+//! many bytes they took, how long their handlers ran, and for the state data types the entities
+//! that took the most bytes. Readable with the printmsgstats command and from Lua, and dumped every
+//! msgstatsinterval seconds to msgstatsfile for dashboards.
+
+//! Counts a message about to be sent, 'data' starting with its type code, once per recipient
+void countMessageSent(const uchar *data, int len, int recipients = 1);
+//! Writes the stats out to msgstatsfile if msgstatsinterval has passed since the last time
+void updateMessageStats();
+
 // Include all the procedurally-generated message data
 #include "messages.h"
 
@@ -25,10 +25,10 @@ namespace server
 namespace MessageSystem
 {
 
-    void send_AnyMessage(int clientNumber, int chan, bool toDummyServer, bool toNPCs, ENetPacket *packet, int exclude=-1) {
+    void send_AnyMessage(int clientNumber, int chan, bool toDummyServer, bool toNPCs, ENetPacket *packet, int exclude=-1, int aboutUid=-1) {
         INDENT_LOG(logger::DEBUG);
 
-        int start, finish;
+        int start, finish, recipients = 0;
         if (clientNumber == -1) 
             start = 0, finish = getnumclients();            // send to all
         else
@@ -46,30 +46,41 @@ namespace MessageSystem
                 } else {
                     if (serverControlled && !toNPCs) continue;
                 }
+                if (aboutUid >= 0 && !server::isinterested(clientNumber, aboutUid)) continue;
                 logger::log(logger::DEBUG, "Sending to %d (%d) ((%d))", clientNumber, testUniqueId, serverControlled);
             #endif
+            #ifdef SERVER
+                // Until a joining client has all entities, messages about them wait for the snapshot
+                if (chan == MAIN_CHANNEL && server::holdentitymessage(clientNumber, packet)) { recipients++; continue; }
+            #endif
             sendpacket(clientNumber, chan, packet, -1);
+            recipients++;
         }
 
+        countMessageSent(packet->data, packet->dataLength, recipients);
         if(!packet->referenceCount) enet_packet_destroy(packet);
     }
 
+    void queueMessage(const uchar *buf, int len, bool reliable)
+    {
+        game::addmsgdata(buf, len, reliable);
+    }
+
     // PersonalServerMessage
 
     void send_PersonalServerMessage(int clientNumber, const char* title, const char* content)
     {
         logger::log(logger::DEBUG, "Sending a message of type PersonalServerMessage (1001)");
-        send_AnyMessage(clientNumber, MAIN_CHANNEL, false, false, buildf("riss", 1001, title, content));
+        PersonalServerMessage::Fields msg = { title, content };
+        send_AnyMessage(clientNumber, MAIN_CHANNEL, false, false, buildMessage<PersonalServerMessage>(msg));
     }
 
 #ifndef SERVER
     void PersonalServerMessage::receive(int receiver, int sender, ucharbuf &p)
     {
-        char title[MAXTRANS];
-        getstring(title, p);
-        char content[MAXTRANS];
-        getstring(content, p);
-        assert(lua::call_external("gui_show_message", "ss", title, content));
+        PersonalServerMessage::Fields msg;
+        if (!readMessage(p, msg)) return;
+        assert(lua::call_external("gui_show_message", "ss", msg.title, msg.content));
     }
 #endif
 
@@ -81,16 +92,17 @@ namespace MessageSystem
         logger::log(logger::DEBUG, "Sending a message of type RequestServerMessageToAll (1002)");
         INDENT_LOG(logger::DEBUG);
 
-        game::addmsg(1002, "rs", message);
+        RequestServerMessageToAll::Fields msg = { message };
+        addMessage<RequestServerMessageToAll>(msg);
     }
 
 #ifdef SERVER
     void RequestServerMessageToAll::receive(int receiver, int sender, ucharbuf &p)
     {
-        char message[MAXTRANS];
-        getstring(message, p);
+        RequestServerMessageToAll::Fields msg;
+        if (!readMessage(p, msg)) return;
 
-        send_PersonalServerMessage(-1, "Message from Client", message);
+        send_PersonalServerMessage(-1, "Message from Client", msg.message);
     }
 #endif
 
@@ -101,7 +113,8 @@ namespace MessageSystem
         logger::log(logger::DEBUG, "Sending a message of type LoginRequest (1003)");
         INDENT_LOG(logger::DEBUG);
 
-        game::addmsg(1003, "r");
+        LoginRequest::Fields msg;
+        addMessage<LoginRequest>(msg);
     }
 
 #ifdef SERVER
@@ -134,16 +147,18 @@ namespace MessageSystem
     {
         logger::log(logger::DEBUG, "Sending a message of type YourUniqueId (1004)");
         server::getUniqueId(clientNumber) = uid;
-        send_AnyMessage(clientNumber, MAIN_CHANNEL, false, false, buildf("rii", 1004, uid));
+        YourUniqueId::Fields msg = { uid };
+        send_AnyMessage(clientNumber, MAIN_CHANNEL, false, false, buildMessage<YourUniqueId>(msg));
     }
 
 #ifndef SERVER
     void YourUniqueId::receive(int receiver, int sender, ucharbuf &p)
     {
-        int uid = getint(p);
+        YourUniqueId::Fields msg;
+        if (!readMessage(p, msg)) return;
 
-        logger::log(logger::DEBUG, "Told my unique ID: %d", uid);
-        ClientSystem::uniqueId = uid;
+        logger::log(logger::DEBUG, "Told my unique ID: %d", msg.uid);
+        ClientSystem::uniqueId = msg.uid;
     }
 #endif
 
@@ -155,18 +170,19 @@ namespace MessageSystem
         logger::log(logger::DEBUG, "Sending a message of type LoginResponse (1005)");
         if (success) server::createluaEntity(clientNumber);
 
-        send_AnyMessage(clientNumber, MAIN_CHANNEL, false, false, buildf("riii", 1005, success, local));
+        LoginResponse::Fields msg = { success, local };
+        send_AnyMessage(clientNumber, MAIN_CHANNEL, false, false, buildMessage<LoginResponse>(msg));
     }
 
 #ifndef SERVER
     void LoginResponse::receive(int receiver, int sender, ucharbuf &p)
     {
-        bool success = getint(p);
-        bool local = getint(p);
+        LoginResponse::Fields msg;
+        if (!readMessage(p, msg)) return;
 
-        if (success)
+        if (msg.success)
         {
-            ClientSystem::finishLogin(local); // This player will be known as 'uniqueID' in the current module
+            ClientSystem::finishLogin(msg.local); // This player will be known as 'uniqueID' in the current module
             conoutf("Login was successful.");
             send_RequestCurrentScenario();
         } else {
@@ -182,17 +198,18 @@ namespace MessageSystem
     void send_PrepareForNewScenario(int clientNumber, const char* scenarioCode)
     {
         logger::log(logger::DEBUG, "Sending a message of type PrepareForNewScenario (1006)");
-        send_AnyMessage(clientNumber, MAIN_CHANNEL, false, false, buildf("ris", 1006, scenarioCode));
+        PrepareForNewScenario::Fields msg = { scenarioCode };
+        send_AnyMessage(clientNumber, MAIN_CHANNEL, false, false, buildMessage<PrepareForNewScenario>(msg));
     }
 
 #ifndef SERVER
     void PrepareForNewScenario::receive(int receiver, int sender, ucharbuf &p)
     {
-        char scenarioCode[MAXTRANS];
-        getstring(scenarioCode, p);
+        PrepareForNewScenario::Fields msg;
+        if (!readMessage(p, msg)) return;
         assert(lua::call_external("gui_show_message", "ss", "Server",
             "Map is being prepared on the server, please wait..."));
-        ClientSystem::prepareForNewScenario(scenarioCode);
+        ClientSystem::prepareForNewScenario(msg.scenarioCode);
     }
 #endif
 
@@ -204,7 +221,8 @@ namespace MessageSystem
         logger::log(logger::DEBUG, "Sending a message of type RequestCurrentScenario (1007)");
         INDENT_LOG(logger::DEBUG);
 
-        game::addmsg(1007, "r");
+        RequestCurrentScenario::Fields msg;
+        addMessage<RequestCurrentScenario>(msg);
     }
 
 #ifdef SERVER
@@ -221,19 +239,19 @@ namespace MessageSystem
     void send_NotifyAboutCurrentScenario(int clientNumber, const char* mid, const char* sc)
     {
         logger::log(logger::DEBUG, "Sending a message of type NotifyAboutCurrentScenario (1008)");
-        send_AnyMessage(clientNumber, MAIN_CHANNEL, false, false, buildf("riss", 1008, mid, sc));
+        NotifyAboutCurrentScenario::Fields msg = { mid, sc };
+        send_AnyMessage(clientNumber, MAIN_CHANNEL, false, false, buildMessage<NotifyAboutCurrentScenario>(msg));
     }
 
 #ifndef SERVER
     void NotifyAboutCurrentScenario::receive(int receiver, int sender, ucharbuf &p)
     {
-        char mid[MAXTRANS];
-        getstring(mid, p);
-        char sc[MAXTRANS];
-        getstring(sc, p);
+        NotifyAboutCurrentScenario::Fields msg;
+        if (!readMessage(p, msg)) return;
 
-        copystring(ClientSystem::currScenarioCode, sc);
-        world::set_map(mid);
+        copystring(ClientSystem::currScenarioCode, msg.sc);
+        if (startmapdownload(msg.mid)) return; // Loaded once the map is through
+        world::set_map(msg.mid);
     }
 #endif
 
@@ -245,7 +263,8 @@ namespace MessageSystem
         logger::log(logger::DEBUG, "Sending a message of type RestartMap (1009)");
         INDENT_LOG(logger::DEBUG);
 
-        game::addmsg(1009, "r");
+        RestartMap::Fields msg;
+        addMessage<RestartMap>(msg);
     }
 
 #ifdef SERVER
@@ -269,21 +288,19 @@ namespace MessageSystem
         logger::log(logger::DEBUG, "Sending a message of type NewEntityRequest (1010)");
         INDENT_LOG(logger::DEBUG);
 
-        game::addmsg(1010, "rsiiiss", _class, int(x*DMF), int(y*DMF), int(z*DMF), stateData, newent_data);
+        NewEntityRequest::Fields msg = { _class, int(x*DMF), int(y*DMF), int(z*DMF), stateData, newent_data };
+        addMessage<NewEntityRequest>(msg);
     }
 
 #ifdef SERVER
     void NewEntityRequest::receive(int receiver, int sender, ucharbuf &p)
     {
-        char _class[MAXTRANS];
-        getstring(_class, p);
-        float x = float(getint(p))/DMF;
-        float y = float(getint(p))/DMF;
-        float z = float(getint(p))/DMF;
-        char stateData[MAXTRANS];
-        getstring(stateData, p);
-        char newent_data[MAXTRANS];
-        getstring(newent_data, p);
+        NewEntityRequest::Fields msg;
+        if (!readMessage(p, msg)) return;
+        const char *_class = msg._class, *stateData = msg.stateData, *newent_data = msg.newent_data;
+        float x = float(msg.x)/DMF;
+        float y = float(msg.y)/DMF;
+        float z = float(msg.z)/DMF;
 
         if (!world::scenario_code[0]) return;
         if (!server::isAdmin(sender))
@@ -306,21 +323,169 @@ namespace MessageSystem
 
 // StateDataUpdate
 
-    void send_StateDataUpdate(int clientNumber, int uid, int keyProtocolId, const char* value, int originalClientNumber)
+    // uid, keyProtocolId, then the typed value (see StateDataValue)
+    template<class T> static ENetPacket *build_StateData(bool reliable, int uid, int keyProtocolId, const StateDataValue& value, int originalClientNumber)
+    {
+        typename T::Fields msg = { uid, keyProtocolId, value, originalClientNumber };
+        return buildMessage<T>(msg, reliable);
+    }
+
+    // State data updates are not sent right away, but accumulated until the next time the server
+    // sends packets (see flush_StateDataUpdates), so an entity that changes several values in one frame,
+    // or the same value several times, costs one message per client rather than one per change.
+    // Anything else sent about an entity must not overtake them, so it flushes that entity's first.
+    VAR(sdatacoalesce, 0, 1, 1);
+
+    struct PendingStateData
+    {
+        int clientNumber, uid, keyProtocolId, originalClientNumber;
+        bool reliable, dropped;
+        vector<uchar> value; // Encoded StateDataValue - the Lua string it may point to is gone by the time we flush
+    };
+
+    static vector<PendingStateData> pendingStateData;
+    static hashtable<ivec, int> pendingStateDataIndex; // (clientNumber, uid, keyProtocolId) -> index in pendingStateData
+    static hashtable<ivec, int> pendingTargetedCount; // (uid, keyProtocolId, 0) -> pending entries for single clients
+
+    // Broadcasts are flushed before the entries for single clients, so a broadcast must take the place of
+    // any value still pending for a single client, or that older value would arrive last and stick.
+    // Returns whether one of the dropped entries was reliable.
+    static bool drop_TargetedStateData(int uid, int keyProtocolId)
+    {
+        int *count = pendingTargetedCount.access(ivec(uid, keyProtocolId, 0));
+        if (!count || !*count) return false;
+        bool reliable = false;
+        loopv(pendingStateData)
+        {
+            PendingStateData &pending = pendingStateData[i];
+            if (pending.dropped || pending.clientNumber == -1 || pending.uid != uid || pending.keyProtocolId != keyProtocolId) continue;
+            pending.dropped = true;
+            reliable = reliable || pending.reliable;
+            pendingStateDataIndex.remove(ivec(pending.clientNumber, uid, keyProtocolId));
+        }
+        *count = 0;
+        return reliable;
+    }
+
+    static void queue_StateData(int clientNumber, int uid, int keyProtocolId, const StateDataValue& value, int originalClientNumber, bool reliable)
+    {
+        if (clientNumber != -1 && clientNumber == originalClientNumber) return; // Would be excluded when sent anyhow
+
+        if (clientNumber == -1) reliable = drop_TargetedStateData(uid, keyProtocolId) || reliable;
+        else pendingTargetedCount.access(ivec(uid, keyProtocolId, 0), 0)++;
+
+        int &index = pendingStateDataIndex.access(ivec(clientNumber, uid, keyProtocolId), -1);
+        if (index < 0)
+        {
+            index = pendingStateData.length();
+            PendingStateData &pending = pendingStateData.add();
+            pending.clientNumber = clientNumber;
+            pending.uid = uid;
+            pending.keyProtocolId = keyProtocolId;
+            pending.reliable = pending.dropped = false;
+        }
+        // A later value replaces an earlier one. If either was reliable, the final value must be too
+        PendingStateData &pending = pendingStateData[index];
+        pending.originalClientNumber = originalClientNumber;
+        pending.reliable = pending.reliable || reliable;
+
+        static uchar buf[MAXTRANS];
+        ucharbuf q(buf, sizeof(buf));
+        value.put(q);
+        pending.value.setsize(0);
+        pending.value.put(buf, q.length());
+    }
+
+    static bool pendingStateDataLess(int a, int b)
+    {
+        const PendingStateData &x = pendingStateData[a], &y = pendingStateData[b];
+        if (x.clientNumber != y.clientNumber) return x.clientNumber < y.clientNumber;
+        if (x.uid != y.uid) return x.uid < y.uid;
+        if (x.reliable != y.reliable) return x.reliable;
+        if (x.originalClientNumber != y.originalClientNumber) return x.originalClientNumber < y.originalClientNumber;
+        return a < b;
+    }
+
+    void flush_StateDataUpdates(int uid)
+    {
+        if (pendingStateData.empty()) return;
+
+        logger::log(logger::DEBUG, "Flushing %d state data updates", pendingStateData.length());
+        INDENT_LOG(logger::DEBUG);
+
+        static vector<int> order;
+        order.setsize(0);
+        loopv(pendingStateData)
+        {
+            const PendingStateData &pending = pendingStateData[i];
+            if (!pending.dropped && (uid < 0 || pending.uid == uid)) order.add(i);
+        }
+        order.sort(pendingStateDataLess);
+
+        // One StateDataBatch per recipient and entity (and reliability, and client to exclude)
+        for (int start = 0, end; start < order.length(); start = end)
+        {
+            const PendingStateData &first = pendingStateData[order[start]];
+            for (end = start + 1; end < order.length(); end++)
+            {
+                const PendingStateData &next = pendingStateData[order[end]];
+                if (next.clientNumber != first.clientNumber || next.uid != first.uid ||
+                    next.reliable != first.reliable || next.originalClientNumber != first.originalClientNumber) break;
+            }
+
+            packetbuf p(MAXTRANS, first.reliable ? ENET_PACKET_FLAG_RELIABLE : 0);
+            putint(p, int(StateDataBatch::CODE));
+            StateDataBatch::Fields msg = { first.uid, first.originalClientNumber, end - start };
+            MessageWriter<packetbuf> writer(p);
+            msg.visit(writer);
+            for (int i = start; i < end; i++)
+            {
+                const PendingStateData &pending = pendingStateData[order[i]];
+                putint(p, pending.keyProtocolId);
+                p.put(pending.value.getbuf(), pending.value.length());
+            }
+            ENetPacket *packet = p.finalize();
+            p.packet = NULL;
+            send_AnyMessage(first.clientNumber, MAIN_CHANNEL, false, true, packet, first.originalClientNumber,
+                first.reliable ? -1 : first.uid);
+        }
+
+        if (uid < 0)
+        {
+            clear_StateDataUpdates();
+            return;
+        }
+        // The rest stay pending until the server next sends packets
+        loopv(order)
+        {
+            PendingStateData &pending = pendingStateData[order[i]];
+            pending.dropped = true;
+            pendingStateDataIndex.remove(ivec(pending.clientNumber, uid, pending.keyProtocolId));
+            pendingTargetedCount.remove(ivec(uid, pending.keyProtocolId, 0));
+        }
+    }
+
+    void clear_StateDataUpdates()
+    {
+        pendingStateData.setsize(0);
+        pendingStateDataIndex.clear();
+        pendingTargetedCount.clear();
+    }
+
+    void send_StateDataUpdate(int clientNumber, int uid, int keyProtocolId, const StateDataValue& value, int originalClientNumber)
     {
         logger::log(logger::DEBUG, "Sending a message of type StateDataUpdate (1011)");
         INDENT_LOG(logger::DEBUG);
 
-        send_AnyMessage(clientNumber, MAIN_CHANNEL, false, true, buildf("riiisi", 1011, uid, keyProtocolId, value, originalClientNumber), originalClientNumber);
+        if (sdatacoalesce) queue_StateData(clientNumber, uid, keyProtocolId, value, originalClientNumber, true);
+        else send_AnyMessage(clientNumber, MAIN_CHANNEL, false, true, build_StateData<StateDataUpdate>(true, uid, keyProtocolId, value, originalClientNumber), originalClientNumber);
     }
 
     void StateDataUpdate::receive(int receiver, int sender, ucharbuf &p)
     {
-        int uid = getint(p);
-        int keyProtocolId = getint(p);
-        char value[MAXTRANS];
-        getstring(value, p);
-        int originalClientNumber = getint(p);
+        Fields msg;
+        if (!readMessage(p, msg)) return;
+        int uid = msg.uid, keyProtocolId = msg.keyProtocolId, originalClientNumber = msg.originalClientNumber;
 
         #ifdef SERVER
             #define STATE_DATA_UPDATE \
@@ -333,11 +498,11 @@ namespace MessageSystem
             #define STATE_DATA_UPDATE \
                 assert(originalClientNumber == -1 || ClientSystem::playerNumber != originalClientNumber); /* Can be -1, or else cannot be us */ \
                 \
-                logger::log(logger::DEBUG, "StateDataUpdate: %d, %d, %s", uid, keyProtocolId, value); \
+                logger::log(logger::DEBUG, "StateDataUpdate: %d, %d, (type %d)", uid, keyProtocolId, msg.value.type); \
                 \
                 if (!LogicSystem::initialized) \
                     return; \
-                lua::call_external("entity_set_sdata", "iis", uid, keyProtocolId, value);
+                msg.value.apply(uid, keyProtocolId);
         #endif
         STATE_DATA_UPDATE
     }
@@ -345,7 +510,7 @@ namespace MessageSystem
 
 // StateDataChangeRequest
 
-    void send_StateDataChangeRequest(int uid, int keyProtocolId, const char* value)
+    void send_StateDataChangeRequest(int uid, int keyProtocolId, const StateDataValue& value)
     {        // This isn't a perfect way to differentiate transient state data changes from permanent ones
         // that justify saying 'changes were made', but for now it will do. Note that even checking
         // for changes to persistent entities is not enough - transient changes on them are generally
@@ -357,45 +522,46 @@ namespace MessageSystem
         logger::log(logger::DEBUG, "Sending a message of type StateDataChangeRequest (1012)");
         INDENT_LOG(logger::DEBUG);
 
-        game::addmsg(1012, "riis", uid, keyProtocolId, value);
+        StateDataChangeRequest::Fields msg = { uid, keyProtocolId, value };
+        addMessage<StateDataChangeRequest>(msg);
     }
 
 #ifdef SERVER
     void StateDataChangeRequest::receive(int receiver, int sender, ucharbuf &p)
     {
-        int uid = getint(p);
-        int keyProtocolId = getint(p);
-        char value[MAXTRANS];
-        getstring(value, p);
+        Fields msg;
+        if (!readMessage(p, msg)) return;
+        int uid = msg.uid, keyProtocolId = msg.keyProtocolId;
+        const StateDataValue &value = msg.value;
 
         if (!world::scenario_code[0]) return;
         #define STATE_DATA_REQUEST \
         int actorUniqueId = server::getUniqueId(sender); \
         \
-        logger::log(logger::DEBUG, "client %d requests to change %d to value: %s", actorUniqueId, keyProtocolId, value); \
+        logger::log(logger::DEBUG, "client %d requests to change %d (type %d)", actorUniqueId, keyProtocolId, value.type); \
         \
         if ( !server::isRunningCurrentScenario(sender) ) return; /* Silently ignore info from previous scenario */ \
-        lua::call_external("entity_set_sdata", "iisi", uid, keyProtocolId, value, actorUniqueId);
+        value.apply(uid, keyProtocolId, actorUniqueId);
         STATE_DATA_REQUEST
     }
 #endif
 
 // UnreliableStateDataUpdate
 
-    void send_UnreliableStateDataUpdate(int clientNumber, int uid, int keyProtocolId, const char* value, int originalClientNumber)
+    void send_UnreliableStateDataUpdate(int clientNumber, int uid, int keyProtocolId, const StateDataValue& value, int originalClientNumber)
     {
         logger::log(logger::DEBUG, "Sending a message of type UnreliableStateDataUpdate (1013)");
 
-        send_AnyMessage(clientNumber, MAIN_CHANNEL, false, true, buildf("iiisi", 1013, uid, keyProtocolId, value, originalClientNumber), originalClientNumber);
+        // Unreliable updates are transient (e.g. animations, movement hints), so clients out of interest range can skip them
+        if (sdatacoalesce) queue_StateData(clientNumber, uid, keyProtocolId, value, originalClientNumber, false);
+        else send_AnyMessage(clientNumber, MAIN_CHANNEL, false, true, build_StateData<UnreliableStateDataUpdate>(false, uid, keyProtocolId, value, originalClientNumber), originalClientNumber, uid);
     }
 
     void UnreliableStateDataUpdate::receive(int receiver, int sender, ucharbuf &p)
     {
-        int uid = getint(p);
-        int keyProtocolId = getint(p);
-        char value[MAXTRANS];
-        getstring(value, p);
-        int originalClientNumber = getint(p);
+        Fields msg;
+        if (!readMessage(p, msg)) return;
+        int uid = msg.uid, keyProtocolId = msg.keyProtocolId, originalClientNumber = msg.originalClientNumber;
 
         STATE_DATA_UPDATE
     }
@@ -403,41 +569,222 @@ namespace MessageSystem
 
 // UnreliableStateDataChangeRequest
 
-    void send_UnreliableStateDataChangeRequest(int uid, int keyProtocolId, const char* value)
+    void send_UnreliableStateDataChangeRequest(int uid, int keyProtocolId, const StateDataValue& value)
     {
         logger::log(logger::DEBUG, "Sending a message of type UnreliableStateDataChangeRequest (1014)");
         INDENT_LOG(logger::DEBUG);
 
-        game::addmsg(1014, "iis", uid, keyProtocolId, value);
+        UnreliableStateDataChangeRequest::Fields msg = { uid, keyProtocolId, value };
+        addMessage<UnreliableStateDataChangeRequest>(msg, false);
     }
 
 #ifdef SERVER
     void UnreliableStateDataChangeRequest::receive(int receiver, int sender, ucharbuf &p)
     {
-        int uid = getint(p);
-        int keyProtocolId = getint(p);
-        char value[MAXTRANS];
-        getstring(value, p);
+        Fields msg;
+        if (!readMessage(p, msg)) return;
+        int uid = msg.uid, keyProtocolId = msg.keyProtocolId;
+        const StateDataValue &value = msg.value;
 
         if (!world::scenario_code[0]) return;
         STATE_DATA_REQUEST
     }
 #endif
 
+    // Compares the typed state data encoding with the string one it replaced: bytes per update
+    // (including the message header) and decode time, where the string path includes parsing the
+    // value back, as Lua's from_wire used to do.
+    void sdatabench(int *n)
+    {
+        enum { NUMSAMPLES = 5 };
+        int iters = *n > 0 ? *n : 100000;
+        StateDataValue samples[NUMSAMPLES];
+        samples[0].setint(42);
+        samples[1].setfloat(3.25f);
+        samples[2].setbool(true);
+        samples[3].setvec(512.5f, 380.25f, 96.0f);
+        samples[4].setstring("idle", 4);
+        const char *strings[NUMSAMPLES] = { "42", "3.25", "true", "[512.5|380.25|96]", "idle" };
+
+        uchar strbufs[NUMSAMPLES][64], typedbufs[NUMSAMPLES][64];
+        int strlens[NUMSAMPLES], typedlens[NUMSAMPLES], strbytes = 0, typedbytes = 0;
+        loopi(NUMSAMPLES)
+        {
+            ucharbuf s(strbufs[i], sizeof(strbufs[i])), t(typedbufs[i], sizeof(typedbufs[i]));
+            putint(s, 1011); putint(s, 1234); putint(s, 17);
+            putint(t, 1011); putint(t, 1234); putint(t, 17);
+            sendstring(strings[i], s);
+            samples[i].put(t);
+            putint(s, -1); putint(t, -1);
+            strbytes += strlens[i] = s.length();
+            typedbytes += typedlens[i] = t.length();
+        }
+
+        volatile double sink = 0;
+        enet_uint32 start = enet_time_get();
+        loopi(iters) loopj(NUMSAMPLES)
+        {
+            ucharbuf p(strbufs[j], strlens[j]);
+            getint(p); getint(p); getint(p);
+            char value[MAXTRANS];
+            getstring(value, p);
+            switch(j)
+            {
+                case 0: sink += atoi(value); break;
+                case 1: sink += atof(value); break;
+                case 2: sink += !strcmp(value, "true"); break;
+                case 3:
+                {
+                    float x, y, z;
+                    if(sscanf(value, "[%f|%f|%f]", &x, &y, &z) == 3) sink += x + y + z;
+                    break;
+                }
+                case 4: sink += strlen(value); break;
+            }
+            sink += getint(p);
+        }
+        enet_uint32 strtime = enet_time_get() - start;
+
+        start = enet_time_get();
+        loopi(iters) loopj(NUMSAMPLES)
+        {
+            ucharbuf p(typedbufs[j], typedlens[j]);
+            getint(p); getint(p); getint(p);
+            StateDataValue value;
+            if(value.get(p)) sink += value.type + value.len;
+            sink += getint(p);
+        }
+        enet_uint32 typedtime = enet_time_get() - start;
+
+        double updates = double(iters)*NUMSAMPLES;
+        conoutf("sdatabench: %d updates", int(updates));
+        conoutf("  string: %.2f bytes/update, %.1f ns/decode", strbytes/double(NUMSAMPLES), strtime*1e6/updates);
+        conoutf("  typed:  %.2f bytes/update, %.1f ns/decode", typedbytes/double(NUMSAMPLES), typedtime*1e6/updates);
+    }
+    COMMAND(sdatabench, "i");
+
+    // Compares the generated codecs against the format string path they replaced: buildf packs the
+    // arguments through varargs and every string is copied out into a MAXTRANS buffer on the way in
+    struct codecbenchcase
+    {
+        const char *name;
+        int len;
+        uchar buf[MAXTRANS];
+    };
+
+    static void msgcodecbench(int *n)
+    {
+        int iters = *n > 0 ? *n : 100000;
+        const char *title = "Server", *content = "Map is being prepared on the server, please wait...";
+        const char *_class = "Door", *stateData = "{\"model_name\":\"door\",\"attr1\":90}", *newent_data = "";
+        enum { NUMCASES = 4 };
+        static codecbenchcase cases[NUMCASES] =
+        {
+            { "PersonalServerMessage", 0, { 0 } }, { "NewEntityRequest", 0, { 0 } },
+            { "LogicEntityCompleteNotification", 0, { 0 } }, { "DoClick", 0, { 0 } }
+        };
+        volatile int sink = 0;
+
+        enet_uint32 start = enet_time_get();
+        loopi(iters)
+        {
+            ENetPacket *packets[NUMCASES] =
+            {
+                buildf("riss", 1001, title, content),
+                buildf("risiiiss", 1010, _class, int(512*DMF), int(380*DMF), int(96*DMF), stateData, newent_data),
+                buildf("riiiss", 1018, 3, 1234, _class, stateData),
+                buildf("riiiiiii", 1031, 1, 1, int(512*DMF), int(380*DMF), int(96*DMF), 1234)
+            };
+            loopj(NUMCASES)
+            {
+                if(!i) { cases[j].len = packets[j]->dataLength; memcpy(cases[j].buf, packets[j]->data, cases[j].len); }
+                sink += packets[j]->dataLength;
+                enet_packet_destroy(packets[j]);
+            }
+        }
+        enet_uint32 oldencode = enet_time_get() - start;
+        int oldbytes = 0;
+        loopj(NUMCASES) oldbytes += cases[j].len;
+
+        start = enet_time_get();
+        loopi(iters) loopj(NUMCASES)
+        {
+            ucharbuf p(cases[j].buf, cases[j].len);
+            getint(p);
+            char a[MAXTRANS], b[MAXTRANS], c[MAXTRANS];
+            switch(j)
+            {
+                case 0: getstring(a, p); getstring(b, p); sink += a[0] + b[0]; break;
+                case 1: getstring(a, p); loopk(3) sink += getint(p); getstring(b, p); getstring(c, p); sink += a[0] + b[0] + c[0]; break;
+                case 2: sink += getint(p) + getint(p); getstring(a, p); getstring(b, p); sink += a[0] + b[0]; break;
+                case 3: loopk(6) sink += getint(p); break;
+            }
+        }
+        enet_uint32 olddecode = enet_time_get() - start;
+
+        start = enet_time_get();
+        loopi(iters)
+        {
+            PersonalServerMessage::Fields psm = { title, content };
+            NewEntityRequest::Fields ner = { _class, int(512*DMF), int(380*DMF), int(96*DMF), stateData, newent_data };
+            LogicEntityCompleteNotification::Fields lecn = { 3, 1234, _class, stateData };
+            DoClick::Fields dc = { 1, 1, int(512*DMF), int(380*DMF), int(96*DMF), 1234 };
+            ENetPacket *packets[NUMCASES] =
+            {
+                buildMessage<PersonalServerMessage>(psm),
+                buildMessage<NewEntityRequest>(ner),
+                buildMessage<LogicEntityCompleteNotification>(lecn),
+                buildMessage<DoClick>(dc)
+            };
+            loopj(NUMCASES)
+            {
+                if(!i) { cases[j].len = packets[j]->dataLength; memcpy(cases[j].buf, packets[j]->data, cases[j].len); }
+                sink += packets[j]->dataLength;
+                enet_packet_destroy(packets[j]);
+            }
+        }
+        enet_uint32 newencode = enet_time_get() - start;
+        int newbytes = 0;
+        loopj(NUMCASES) newbytes += cases[j].len;
+
+        start = enet_time_get();
+        loopi(iters) loopj(NUMCASES)
+        {
+            ucharbuf p(cases[j].buf, cases[j].len);
+            getint(p);
+            switch(j)
+            {
+                case 0: { PersonalServerMessage::Fields msg; if(readMessage(p, msg)) sink += msg.title[0] + msg.content[0]; break; }
+                case 1: { NewEntityRequest::Fields msg; if(readMessage(p, msg)) sink += msg._class[0] + msg.x + msg.stateData[0]; break; }
+                case 2: { LogicEntityCompleteNotification::Fields msg; if(readMessage(p, msg)) sink += msg.otherUniqueId + msg.otherClass[0]; break; }
+                case 3: { DoClick::Fields msg; if(readMessage(p, msg)) sink += msg.button + msg.uid; break; }
+            }
+        }
+        enet_uint32 newdecode = enet_time_get() - start;
+
+        double msgs = double(iters)*NUMCASES;
+        conoutf("msgcodecbench: %d messages of %d types", int(msgs), int(NUMCASES));
+        conoutf("  buildf:  %.1f bytes/msg, %.1f ns/encode, %.1f ns/decode", oldbytes/double(NUMCASES), oldencode*1e6/msgs, olddecode*1e6/msgs);
+        conoutf("  codecs:  %.1f bytes/msg, %.1f ns/encode, %.1f ns/decode", newbytes/double(NUMCASES), newencode*1e6/msgs, newdecode*1e6/msgs);
+    }
+    COMMAND(msgcodecbench, "i");
+
 // NotifyNumEntities
 
     void send_NotifyNumEntities(int clientNumber, int num)
     {
         logger::log(logger::DEBUG, "Sending a message of type NotifyNumEntities (1015)");
-        send_AnyMessage(clientNumber, MAIN_CHANNEL, false, false, buildf("rii", 1015, num));
+        NotifyNumEntities::Fields msg = { num };
+        send_AnyMessage(clientNumber, MAIN_CHANNEL, false, false, buildMessage<NotifyNumEntities>(msg));
     }
 
 #ifndef SERVER
     void NotifyNumEntities::receive(int receiver, int sender, ucharbuf &p)
     {
-        int num = getint(p);
+        NotifyNumEntities::Fields msg;
+        if (!readMessage(p, msg)) return;
 
-        world::set_num_expected_entities(num);
+        world::set_num_expected_entities(msg.num);
     }
 #endif
 
@@ -447,7 +794,8 @@ namespace MessageSystem
     void send_AllActiveEntitiesSent(int clientNumber)
     {
         logger::log(logger::DEBUG, "Sending a message of type AllActiveEntitiesSent (1016)");
-        send_AnyMessage(clientNumber, MAIN_CHANNEL, false, false, buildf("ri", 1016));
+        AllActiveEntitiesSent::Fields msg;
+        send_AnyMessage(clientNumber, MAIN_CHANNEL, false, false, buildMessage<AllActiveEntitiesSent>(msg));
     }
 
 #ifndef SERVER
@@ -460,19 +808,24 @@ namespace MessageSystem
 
 // ActiveEntitiesRequest
 
+    int activeEntitiesRequestMillis = 0;
+
     void send_ActiveEntitiesRequest(const char* scenarioCode)
     {
         logger::log(logger::DEBUG, "Sending a message of type ActiveEntitiesRequest (1017)");
         INDENT_LOG(logger::DEBUG);
 
-        game::addmsg(1017, "rs", scenarioCode);
+        ActiveEntitiesRequest::Fields msg = { scenarioCode };
+        addMessage<ActiveEntitiesRequest>(msg);
+        activeEntitiesRequestMillis = totalmillis;
     }
 
 #ifdef SERVER
     void ActiveEntitiesRequest::receive(int receiver, int sender, ucharbuf &p)
     {
-        char scenarioCode[MAXTRANS];
-        getstring(scenarioCode, p);
+        ActiveEntitiesRequest::Fields msg;
+        if (!readMessage(p, msg)) return;
+        const char *scenarioCode = msg.scenarioCode;
 
         #ifdef SERVER
             if (!world::scenario_code[0]) return;
@@ -486,6 +839,7 @@ namespace MessageSystem
                 send_PersonalServerMessage(sender, "Invalid scenario", "An error occured in synchronizing scenarios");
                 return;
             }
+            if (server::startentitystream(sender)) return; // Logged in once the stream is through
             assert(lua::call_external("entities_send_all", "i", sender));
             MessageSystem::send_AllActiveEntitiesSent(sender);
             assert(lua::call_external("event_player_login", "i", server::getUniqueId(sender)));
@@ -506,22 +860,26 @@ namespace MessageSystem
     void send_LogicEntityCompleteNotification(int clientNumber, int otherClientNumber, int otherUniqueId, const char* otherClass, const char* stateData)
     {
         logger::log(logger::DEBUG, "Sending a message of type LogicEntityCompleteNotification (1018)");
-        send_AnyMessage(clientNumber, MAIN_CHANNEL, false, true, buildf("riiiss", 1018, otherClientNumber, otherUniqueId, otherClass, stateData));
+        LogicEntityCompleteNotification::Fields msg = { otherClientNumber, otherUniqueId, otherClass, stateData };
+        flush_StateDataUpdates(otherUniqueId);
+        send_AnyMessage(clientNumber, MAIN_CHANNEL, false, true, buildMessage<LogicEntityCompleteNotification>(msg));
     }
 
     void LogicEntityCompleteNotification::receive(int receiver, int sender, ucharbuf &p)
     {
-        int otherClientNumber = getint(p);
-        int otherUniqueId = getint(p);
-        char otherClass[MAXTRANS];
-        getstring(otherClass, p);
-        char stateData[MAXTRANS];
-        getstring(stateData, p);
+        Fields msg;
+        if (!readMessage(p, msg)) return;
 
         #ifdef SERVER
             return; // We do send this to the NPCs sometimes, as it is sent during their creation (before they are fully
                     // registered even). But we have no need to process it on the server.
         #endif
+        receive_LogicEntityComplete(msg.otherClientNumber, msg.otherUniqueId, msg.otherClass, msg.stateData);
+    }
+
+    // Also used for each entity of the snapshot sent to joining clients
+    void receive_LogicEntityComplete(int otherClientNumber, int otherUniqueId, const char* otherClass, const char* stateData)
+    {
         if (!LogicSystem::initialized)
             return;
         logger::log(logger::DEBUG, "RECEIVING LE: %d,%d,%s", otherClientNumber, otherUniqueId, otherClass);
@@ -579,13 +937,16 @@ namespace MessageSystem
         logger::log(logger::DEBUG, "Sending a message of type RequestLogicEntityRemoval (1019)");
         INDENT_LOG(logger::DEBUG);
 
-        game::addmsg(1019, "ri", uid);
+        RequestLogicEntityRemoval::Fields msg = { uid };
+        addMessage<RequestLogicEntityRemoval>(msg);
     }
 
 #ifdef SERVER
     void RequestLogicEntityRemoval::receive(int receiver, int sender, ucharbuf &p)
     {
-        int uid = getint(p);
+        Fields msg;
+        if (!readMessage(p, msg)) return;
+        int uid = msg.uid;
 
         if (!world::scenario_code[0]) return;
         if (!server::isAdmin(sender))
@@ -604,13 +965,17 @@ namespace MessageSystem
     void send_LogicEntityRemoval(int clientNumber, int uid)
     {
         logger::log(logger::DEBUG, "Sending a message of type LogicEntityRemoval (1020)");
-        send_AnyMessage(clientNumber, MAIN_CHANNEL, false, false, buildf("rii", 1020, uid));
+        LogicEntityRemoval::Fields msg = { uid };
+        flush_StateDataUpdates(uid);
+        send_AnyMessage(clientNumber, MAIN_CHANNEL, false, false, buildMessage<LogicEntityRemoval>(msg));
     }
 
 #ifndef SERVER
     void LogicEntityRemoval::receive(int receiver, int sender, ucharbuf &p)
     {
-        int uid = getint(p);
+        Fields msg;
+        if (!readMessage(p, msg)) return;
+        int uid = msg.uid;
 
         if (!LogicSystem::initialized)
             return;
@@ -624,17 +989,18 @@ namespace MessageSystem
     void send_ExtentCompleteNotification(int clientNumber, int otherUniqueId, const char* otherClass, const char* stateData)
     {
         logger::log(logger::DEBUG, "Sending a message of type ExtentCompleteNotification (1021)");
-        send_AnyMessage(clientNumber, MAIN_CHANNEL, false, false, buildf("riiss", 1021, otherUniqueId, otherClass, stateData));
+        ExtentCompleteNotification::Fields msg = { otherUniqueId, otherClass, stateData };
+        flush_StateDataUpdates(otherUniqueId);
+        send_AnyMessage(clientNumber, MAIN_CHANNEL, false, false, buildMessage<ExtentCompleteNotification>(msg));
     }
 
 #ifndef SERVER
     void ExtentCompleteNotification::receive(int receiver, int sender, ucharbuf &p)
     {
-        int otherUniqueId = getint(p);
-        char otherClass[MAXTRANS];
-        getstring(otherClass, p);
-        char stateData[MAXTRANS];
-        getstring(stateData, p);
+        Fields msg;
+        if (!readMessage(p, msg)) return;
+        int otherUniqueId = msg.otherUniqueId;
+        const char *otherClass = msg.otherClass, *stateData = msg.stateData;
 
         if (!LogicSystem::initialized)
             return;
@@ -663,17 +1029,19 @@ namespace MessageSystem
 
 // InitS2C
 
-    void send_InitS2C(int clientNumber, int explicitClientNumber, int protocolVersion)
+    void send_InitS2C(int clientNumber, int explicitClientNumber, int protocolVersion, int netDictionary)
     {
         logger::log(logger::DEBUG, "Sending a message of type InitS2C (1022)");
-        send_AnyMessage(clientNumber, MAIN_CHANNEL, false, false, buildf("riii", 1022, explicitClientNumber, protocolVersion));
+        InitS2C::Fields msg = { explicitClientNumber, protocolVersion, netDictionary };
+        send_AnyMessage(clientNumber, MAIN_CHANNEL, false, false, buildMessage<InitS2C>(msg));
     }
 
 #ifndef SERVER
     void InitS2C::receive(int receiver, int sender, ucharbuf &p)
     {
-        int explicitClientNumber = getint(p);
-        int protocolVersion = getint(p);
+        Fields msg;
+        if (!readMessage(p, msg)) return;
+        int explicitClientNumber = msg.explicitClientNumber, protocolVersion = msg.protocolVersion;
 
         logger::log(logger::DEBUG, "client.h: N_INITS2C gave us cn/protocol: %d/%d", explicitClientNumber, protocolVersion);
         if(protocolVersion != PROTOCOL_VERSION)
@@ -682,6 +1050,7 @@ namespace MessageSystem
             disconnect();
             return;
         }
+        setservernetdictionary(msg.netDictionary);
         #ifndef SERVER
             gameent *player1 = game::player1;
         #else
@@ -703,16 +1072,18 @@ namespace MessageSystem
         logger::log(logger::DEBUG, "Sending a message of type EditModeC2S (1028)");
         INDENT_LOG(logger::DEBUG);
 
-        game::addmsg(1028, "ri", mode);
+        EditModeC2S::Fields msg = { mode };
+        addMessage<EditModeC2S>(msg);
     }
 
 #ifdef SERVER
     void EditModeC2S::receive(int receiver, int sender, ucharbuf &p)
     {
-        int mode = getint(p);
+        Fields msg;
+        if (!readMessage(p, msg)) return;
 
         if (!world::scenario_code[0] || !server::isRunningCurrentScenario(sender)) return;
-        send_EditModeS2C(-1, sender, mode); // Relay
+        send_EditModeS2C(-1, sender, msg.mode); // Relay
     }
 #endif
 
@@ -722,19 +1093,20 @@ namespace MessageSystem
     {
         logger::log(logger::DEBUG, "Sending a message of type EditModeS2C (1029)");
 
-        send_AnyMessage(clientNumber, MAIN_CHANNEL, true, false, buildf("riii", 1029, otherClientNumber, mode), otherClientNumber);
+        EditModeS2C::Fields msg = { otherClientNumber, mode };
+        send_AnyMessage(clientNumber, MAIN_CHANNEL, true, false, buildMessage<EditModeS2C>(msg), otherClientNumber);
     }
 
     void EditModeS2C::receive(int receiver, int sender, ucharbuf &p)
     {
-        int otherClientNumber = getint(p);
-        int mode = getint(p);
+        Fields msg;
+        if (!readMessage(p, msg)) return;
 
-        dynent* d = game::getclient(otherClientNumber);
+        dynent* d = game::getclient(msg.otherClientNumber);
         // Code from sauer's client.h
         if (d)
         {
-            if (mode) 
+            if (msg.mode) 
             {
                 d->editstate = d->state;
                 d->state     = CS_EDITING;
@@ -754,14 +1126,15 @@ namespace MessageSystem
         logger::log(logger::DEBUG, "Sending a message of type RequestMap (1030)");
         INDENT_LOG(logger::DEBUG);
 
-        game::addmsg(1030, "r");
+        RequestMap::Fields msg;
+        addMessage<RequestMap>(msg);
     }
 
 #ifdef SERVER
     void RequestMap::receive(int receiver, int sender, ucharbuf &p)
     {
         if (!world::scenario_code[0]) return;
-        world::send_curr_map(sender);
+        sendmapmanifest(sender);
     }
 #endif
 
@@ -772,18 +1145,19 @@ namespace MessageSystem
         logger::log(logger::DEBUG, "Sending a message of type DoClick (1031)");
         INDENT_LOG(logger::DEBUG);
 
-        game::addmsg(1031, "riiiiii", button, down, int(x*DMF), int(y*DMF), int(z*DMF), uid);
+        DoClick::Fields msg = { button, down, int(x*DMF), int(y*DMF), int(z*DMF), uid };
+        addMessage<DoClick>(msg);
     }
 
 #ifdef SERVER
     void DoClick::receive(int receiver, int sender, ucharbuf &p)
     {
-        int button = getint(p);
-        int down = getint(p);
-        float x = float(getint(p))/DMF;
-        float y = float(getint(p))/DMF;
-        float z = float(getint(p))/DMF;
-        int uid = getint(p);
+        Fields msg;
+        if (!readMessage(p, msg)) return;
+        int button = msg.button, down = msg.down, uid = msg.uid;
+        float x = float(msg.x)/DMF;
+        float y = float(msg.y)/DMF;
+        float z = float(msg.z)/DMF;
 
         if (!world::scenario_code[0]) return;
         if (!server::isRunningCurrentScenario(sender)) return; // Silently ignore info from previous scenario
@@ -802,7 +1176,8 @@ namespace MessageSystem
         logger::log(logger::DEBUG, "Sending a message of type RequestPrivateEditMode (1034)");
         INDENT_LOG(logger::DEBUG);
 
-        game::addmsg(1034, "r");
+        RequestPrivateEditMode::Fields msg;
+        addMessage<RequestPrivateEditMode>(msg);
     }
 
 #ifdef SERVER
@@ -818,7 +1193,8 @@ namespace MessageSystem
     void send_NotifyPrivateEditMode(int clientNumber)
     {
         logger::log(logger::DEBUG, "Sending a message of type NotifyPrivateEditMode (1035)");
-        send_AnyMessage(clientNumber, MAIN_CHANNEL, false, false, buildf("ri", 1035));
+        NotifyPrivateEditMode::Fields msg;
+        send_AnyMessage(clientNumber, MAIN_CHANNEL, false, false, buildMessage<NotifyPrivateEditMode>(msg));
     }
 
 #ifndef SERVER
@@ -829,6 +1205,53 @@ namespace MessageSystem
     }
 #endif
 
+// StateDataBatch
+
+    void StateDataBatch::receive(int receiver, int sender, ucharbuf &p)
+    {
+        Fields msg;
+        if (!readMessage(p, msg)) return;
+        int uid = msg.uid, originalClientNumber = msg.originalClientNumber, num = msg.num;
+
+        logger::log(logger::DEBUG, "StateDataBatch: %d, %d values", uid, num);
+#ifndef SERVER
+        assert(originalClientNumber == -1 || ClientSystem::playerNumber != originalClientNumber); // Can be -1, or else cannot be us
+#else
+        originalClientNumber = originalClientNumber; // Prevent warnings
+#endif
+
+        loopi(num)
+        {
+            int keyProtocolId = getint(p);
+            StateDataValue value;
+            if (!value.get(p)) return;
+#ifndef SERVER // NPCs receive these too, but as with StateDataUpdate the server has no need to process them
+            if (LogicSystem::initialized) value.apply(uid, keyProtocolId);
+#else
+            keyProtocolId = keyProtocolId; // Prevent warnings
+#endif
+        }
+    }
+
+
+// EntityStreamReceived
+
+    void send_EntityStreamReceived()
+    {
+        logger::log(logger::DEBUG, "Sending a message of type EntityStreamReceived (1037)");
+        INDENT_LOG(logger::DEBUG);
+
+        EntityStreamReceived::Fields msg;
+        addMessage<EntityStreamReceived>(msg);
+    }
+
+#ifdef SERVER
+    void EntityStreamReceived::receive(int receiver, int sender, ucharbuf &p)
+    {
+        server::finishentitystream(sender);
+    }
+#endif
+
 
 // Register all messages
 
@@ -862,6 +1285,8 @@ void MessageManager::registerAll()
     registerMessageType( new DoClick() );
     registerMessageType( new RequestPrivateEditMode() );
     registerMessageType( new NotifyPrivateEditMode() );
+    registerMessageType( new StateDataBatch() );
+    registerMessageType( new EntityStreamReceived() );
 }
 
 }
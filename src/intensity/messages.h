@@ -10,7 +10,16 @@
 
 struct PersonalServerMessage : MessageType
 {
-    PersonalServerMessage() : MessageType(1001, "PersonalServerMessage") { };
+    enum { CODE = 1001 };
+
+    PersonalServerMessage() : MessageType(CODE, "PersonalServerMessage") { };
+
+    struct Fields
+    {
+        const char *title, *content;
+
+        template<class V> void visit(V &v) { v(title); v(content); }
+    };
 
 #ifndef SERVER
     void receive(int receiver, int sender, ucharbuf &p);
@@ -24,7 +33,16 @@ void send_PersonalServerMessage(int clientNumber, const char* title, const char*
 
 struct RequestServerMessageToAll : MessageType
 {
-    RequestServerMessageToAll() : MessageType(1002, "RequestServerMessageToAll") { };
+    enum { CODE = 1002 };
+
+    RequestServerMessageToAll() : MessageType(CODE, "RequestServerMessageToAll") { };
+
+    struct Fields
+    {
+        const char *message;
+
+        template<class V> void visit(V &v) { v(message); }
+    };
 
 #ifdef SERVER
     void receive(int receiver, int sender, ucharbuf &p);
@@ -38,7 +56,11 @@ void send_RequestServerMessageToAll(const char* message);
 
 struct LoginRequest : MessageType
 {
-    LoginRequest() : MessageType(1003, "LoginRequest") { };
+    enum { CODE = 1003 };
+
+    LoginRequest() : MessageType(CODE, "LoginRequest") { };
+
+    typedef NoFields Fields;
 
 #ifdef SERVER
     void receive(int receiver, int sender, ucharbuf &p);
@@ -52,7 +74,16 @@ void send_LoginRequest();
 
 struct YourUniqueId : MessageType
 {
-    YourUniqueId() : MessageType(1004, "YourUniqueId") { };
+    enum { CODE = 1004 };
+
+    YourUniqueId() : MessageType(CODE, "YourUniqueId") { };
+
+    struct Fields
+    {
+        int uid;
+
+        template<class V> void visit(V &v) { v(uid); }
+    };
 
 #ifndef SERVER
     void receive(int receiver, int sender, ucharbuf &p);
@@ -66,7 +97,16 @@ void send_YourUniqueId(int clientNumber, int uid);
 
 struct LoginResponse : MessageType
 {
-    LoginResponse() : MessageType(1005, "LoginResponse") { };
+    enum { CODE = 1005 };
+
+    LoginResponse() : MessageType(CODE, "LoginResponse") { };
+
+    struct Fields
+    {
+        bool success, local;
+
+        template<class V> void visit(V &v) { v(success); v(local); }
+    };
 
 #ifndef SERVER
     void receive(int receiver, int sender, ucharbuf &p);
@@ -80,7 +120,16 @@ void send_LoginResponse(int clientNumber, bool success, bool local);
 
 struct PrepareForNewScenario : MessageType
 {
-    PrepareForNewScenario() : MessageType(1006, "PrepareForNewScenario") { };
+    enum { CODE = 1006 };
+
+    PrepareForNewScenario() : MessageType(CODE, "PrepareForNewScenario") { };
+
+    struct Fields
+    {
+        const char *scenarioCode;
+
+        template<class V> void visit(V &v) { v(scenarioCode); }
+    };
 
 #ifndef SERVER
     void receive(int receiver, int sender, ucharbuf &p);
@@ -94,7 +143,11 @@ void send_PrepareForNewScenario(int clientNumber, const char* scenarioCode);
 
 struct RequestCurrentScenario : MessageType
 {
-    RequestCurrentScenario() : MessageType(1007, "RequestCurrentScenario") { };
+    enum { CODE = 1007 };
+
+    RequestCurrentScenario() : MessageType(CODE, "RequestCurrentScenario") { };
+
+    typedef NoFields Fields;
 
 #ifdef SERVER
     void receive(int receiver, int sender, ucharbuf &p);
@@ -108,7 +161,16 @@ void send_RequestCurrentScenario();
 
 struct NotifyAboutCurrentScenario : MessageType
 {
-    NotifyAboutCurrentScenario() : MessageType(1008, "NotifyAboutCurrentScenario") { };
+    enum { CODE = 1008 };
+
+    NotifyAboutCurrentScenario() : MessageType(CODE, "NotifyAboutCurrentScenario") { };
+
+    struct Fields
+    {
+        const char *mid, *sc;
+
+        template<class V> void visit(V &v) { v(mid); v(sc); }
+    };
 
 #ifndef SERVER
     void receive(int receiver, int sender, ucharbuf &p);
@@ -122,7 +184,11 @@ void send_NotifyAboutCurrentScenario(int clientNumber, const char* mid, const ch
 
 struct RestartMap : MessageType
 {
-    RestartMap() : MessageType(1009, "RestartMap") { };
+    enum { CODE = 1009 };
+
+    RestartMap() : MessageType(CODE, "RestartMap") { };
+
+    typedef NoFields Fields;
 
 #ifdef SERVER
     void receive(int receiver, int sender, ucharbuf &p);
@@ -136,7 +202,19 @@ void send_RestartMap();
 
 struct NewEntityRequest : MessageType
 {
-    NewEntityRequest() : MessageType(1010, "NewEntityRequest") { };
+    enum { CODE = 1010 };
+
+    NewEntityRequest() : MessageType(CODE, "NewEntityRequest") { };
+
+    //! The position is in DMF units
+    struct Fields
+    {
+        const char *_class;
+        int x, y, z;
+        const char *stateData, *newent_data;
+
+        template<class V> void visit(V &v) { v(_class); v(x); v(y); v(z); v(stateData); v(newent_data); }
+    };
 
 #ifdef SERVER
     void receive(int receiver, int sender, ucharbuf &p);
@@ -150,59 +228,97 @@ void send_NewEntityRequest(const char* _class, float x, float y, float z, const
 
 struct StateDataUpdate : MessageType
 {
-    StateDataUpdate() : MessageType(1011, "StateDataUpdate") { };
+    enum { CODE = 1011 };
+
+    StateDataUpdate() : MessageType(CODE, "StateDataUpdate") { };
+
+    struct Fields
+    {
+        int uid, keyProtocolId;
+        StateDataValue value;
+        int originalClientNumber;
+
+        template<class V> void visit(V &v) { v(uid); v(keyProtocolId); v(value); v(originalClientNumber); }
+    };
 
     void receive(int receiver, int sender, ucharbuf &p);
 };
 
-void send_StateDataUpdate(int clientNumber, int uid, int keyProtocolId, const char* value, int originalClientNumber);
+void send_StateDataUpdate(int clientNumber, int uid, int keyProtocolId, const StateDataValue& value, int originalClientNumber);
 
 
 // StateDataChangeRequest
 
 struct StateDataChangeRequest : MessageType
 {
-    StateDataChangeRequest() : MessageType(1012, "StateDataChangeRequest") { };
+    enum { CODE = 1012 };
+
+    StateDataChangeRequest() : MessageType(CODE, "StateDataChangeRequest") { };
+
+    struct Fields
+    {
+        int uid, keyProtocolId;
+        StateDataValue value;
+
+        template<class V> void visit(V &v) { v(uid); v(keyProtocolId); v(value); }
+    };
 
 #ifdef SERVER
     void receive(int receiver, int sender, ucharbuf &p);
 #endif
 };
 
-void send_StateDataChangeRequest(int uid, int keyProtocolId, const char* value);
+void send_StateDataChangeRequest(int uid, int keyProtocolId, const StateDataValue& value);
 
 
 // UnreliableStateDataUpdate
 
 struct UnreliableStateDataUpdate : MessageType
 {
-    UnreliableStateDataUpdate() : MessageType(1013, "UnreliableStateDataUpdate") { };
+    enum { CODE = 1013 };
+
+    UnreliableStateDataUpdate() : MessageType(CODE, "UnreliableStateDataUpdate") { };
+
+    typedef StateDataUpdate::Fields Fields;
 
     void receive(int receiver, int sender, ucharbuf &p);
 };
 
-void send_UnreliableStateDataUpdate(int clientNumber, int uid, int keyProtocolId, const char* value, int originalClientNumber);
+void send_UnreliableStateDataUpdate(int clientNumber, int uid, int keyProtocolId, const StateDataValue& value, int originalClientNumber);
 
 
 // UnreliableStateDataChangeRequest
 
 struct UnreliableStateDataChangeRequest : MessageType
 {
-    UnreliableStateDataChangeRequest() : MessageType(1014, "UnreliableStateDataChangeRequest") { };
+    enum { CODE = 1014 };
+
+    UnreliableStateDataChangeRequest() : MessageType(CODE, "UnreliableStateDataChangeRequest") { };
+
+    typedef StateDataChangeRequest::Fields Fields;
 
 #ifdef SERVER
     void receive(int receiver, int sender, ucharbuf &p);
 #endif
 };
 
-void send_UnreliableStateDataChangeRequest(int uid, int keyProtocolId, const char* value);
+void send_UnreliableStateDataChangeRequest(int uid, int keyProtocolId, const StateDataValue& value);
 
 
 // NotifyNumEntities
 
 struct NotifyNumEntities : MessageType
 {
-    NotifyNumEntities() : MessageType(1015, "NotifyNumEntities") { };
+    enum { CODE = 1015 };
+
+    NotifyNumEntities() : MessageType(CODE, "NotifyNumEntities") { };
+
+    struct Fields
+    {
+        int num;
+
+        template<class V> void visit(V &v) { v(num); }
+    };
 
 #ifndef SERVER
     void receive(int receiver, int sender, ucharbuf &p);
@@ -216,7 +332,11 @@ void send_NotifyNumEntities(int clientNumber, int num);
 
 struct AllActiveEntitiesSent : MessageType
 {
-    AllActiveEntitiesSent() : MessageType(1016, "AllActiveEntitiesSent") { };
+    enum { CODE = 1016 };
+
+    AllActiveEntitiesSent() : MessageType(CODE, "AllActiveEntitiesSent") { };
+
+    typedef NoFields Fields;
 
 #ifndef SERVER
     void receive(int receiver, int sender, ucharbuf &p);
@@ -230,7 +350,16 @@ void send_AllActiveEntitiesSent(int clientNumber);
 
 struct ActiveEntitiesRequest : MessageType
 {
-    ActiveEntitiesRequest() : MessageType(1017, "ActiveEntitiesRequest") { };
+    enum { CODE = 1017 };
+
+    ActiveEntitiesRequest() : MessageType(CODE, "ActiveEntitiesRequest") { };
+
+    struct Fields
+    {
+        const char *scenarioCode;
+
+        template<class V> void visit(V &v) { v(scenarioCode); }
+    };
 
 #ifdef SERVER
     void receive(int receiver, int sender, ucharbuf &p);
@@ -239,24 +368,47 @@ struct ActiveEntitiesRequest : MessageType
 
 void send_ActiveEntitiesRequest(const char* scenarioCode);
 
+//! When the active entities were last requested, for timing how long joining takes
+extern int activeEntitiesRequestMillis;
+
 
 // LogicEntityCompleteNotification
 
 struct LogicEntityCompleteNotification : MessageType
 {
-    LogicEntityCompleteNotification() : MessageType(1018, "LogicEntityCompleteNotification") { };
+    enum { CODE = 1018 };
+
+    LogicEntityCompleteNotification() : MessageType(CODE, "LogicEntityCompleteNotification") { };
+
+    struct Fields
+    {
+        int otherClientNumber, otherUniqueId;
+        const char *otherClass, *stateData;
+
+        template<class V> void visit(V &v) { v(otherClientNumber); v(otherUniqueId); v(otherClass); v(stateData); }
+    };
 
     void receive(int receiver, int sender, ucharbuf &p);
 };
 
 void send_LogicEntityCompleteNotification(int clientNumber, int otherClientNumber, int otherUniqueId, const char* otherClass, const char* stateData);
+void receive_LogicEntityComplete(int otherClientNumber, int otherUniqueId, const char* otherClass, const char* stateData);
 
 
 // RequestLogicEntityRemoval
 
 struct RequestLogicEntityRemoval : MessageType
 {
-    RequestLogicEntityRemoval() : MessageType(1019, "RequestLogicEntityRemoval") { };
+    enum { CODE = 1019 };
+
+    RequestLogicEntityRemoval() : MessageType(CODE, "RequestLogicEntityRemoval") { };
+
+    struct Fields
+    {
+        int uid;
+
+        template<class V> void visit(V &v) { v(uid); }
+    };
 
 #ifdef SERVER
     void receive(int receiver, int sender, ucharbuf &p);
@@ -270,7 +422,16 @@ void send_RequestLogicEntityRemoval(int uid);
 
 struct LogicEntityRemoval : MessageType
 {
-    LogicEntityRemoval() : MessageType(1020, "LogicEntityRemoval") { };
+    enum { CODE = 1020 };
+
+    LogicEntityRemoval() : MessageType(CODE, "LogicEntityRemoval") { };
+
+    struct Fields
+    {
+        int uid;
+
+        template<class V> void visit(V &v) { v(uid); }
+    };
 
 #ifndef SERVER
     void receive(int receiver, int sender, ucharbuf &p);
@@ -284,7 +445,17 @@ void send_LogicEntityRemoval(int clientNumber, int uid);
 
 struct ExtentCompleteNotification : MessageType
 {
-    ExtentCompleteNotification() : MessageType(1021, "ExtentCompleteNotification") { };
+    enum { CODE = 1021 };
+
+    ExtentCompleteNotification() : MessageType(CODE, "ExtentCompleteNotification") { };
+
+    struct Fields
+    {
+        int otherUniqueId;
+        const char *otherClass, *stateData;
+
+        template<class V> void visit(V &v) { v(otherUniqueId); v(otherClass); v(stateData); }
+    };
 
 #ifndef SERVER
     void receive(int receiver, int sender, ucharbuf &p);
@@ -298,20 +469,38 @@ void send_ExtentCompleteNotification(int clientNumber, int otherUniqueId, const
 
 struct InitS2C : MessageType
 {
-    InitS2C() : MessageType(1022, "InitS2C") { };
+    enum { CODE = 1022 };
+
+    InitS2C() : MessageType(CODE, "InitS2C") { };
+
+    struct Fields
+    {
+        int explicitClientNumber, protocolVersion, netDictionary;
+
+        template<class V> void visit(V &v) { v(explicitClientNumber); v(protocolVersion); v(netDictionary); }
+    };
 
 #ifndef SERVER
     void receive(int receiver, int sender, ucharbuf &p);
 #endif
 };
 
-void send_InitS2C(int clientNumber, int explicitClientNumber, int protocolVersion);
+void send_InitS2C(int clientNumber, int explicitClientNumber, int protocolVersion, int netDictionary);
 
 // EditModeC2S
 
 struct EditModeC2S : MessageType
 {
-    EditModeC2S() : MessageType(1028, "EditModeC2S") { };
+    enum { CODE = 1028 };
+
+    EditModeC2S() : MessageType(CODE, "EditModeC2S") { };
+
+    struct Fields
+    {
+        int mode;
+
+        template<class V> void visit(V &v) { v(mode); }
+    };
 
 #ifdef SERVER
     void receive(int receiver, int sender, ucharbuf &p);
@@ -325,7 +514,16 @@ void send_EditModeC2S(int mode);
 
 struct EditModeS2C : MessageType
 {
-    EditModeS2C() : MessageType(1029, "EditModeS2C") { };
+    enum { CODE = 1029 };
+
+    EditModeS2C() : MessageType(CODE, "EditModeS2C") { };
+
+    struct Fields
+    {
+        int otherClientNumber, mode;
+
+        template<class V> void visit(V &v) { v(otherClientNumber); v(mode); }
+    };
 
     void receive(int receiver, int sender, ucharbuf &p);
 };
@@ -337,7 +535,11 @@ void send_EditModeS2C(int clientNumber, int otherClientNumber, int mode);
 
 struct RequestMap : MessageType
 {
-    RequestMap() : MessageType(1030, "RequestMap") { };
+    enum { CODE = 1030 };
+
+    RequestMap() : MessageType(CODE, "RequestMap") { };
+
+    typedef NoFields Fields;
 
 #ifdef SERVER
     void receive(int receiver, int sender, ucharbuf &p);
@@ -351,7 +553,17 @@ void send_RequestMap();
 
 struct DoClick : MessageType
 {
-    DoClick() : MessageType(1031, "DoClick") { };
+    enum { CODE = 1031 };
+
+    DoClick() : MessageType(CODE, "DoClick") { };
+
+    //! The position is in DMF units
+    struct Fields
+    {
+        int button, down, x, y, z, uid;
+
+        template<class V> void visit(V &v) { v(button); v(down); v(x); v(y); v(z); v(uid); }
+    };
 
 #ifdef SERVER
     void receive(int receiver, int sender, ucharbuf &p);
@@ -365,7 +577,11 @@ void send_DoClick(int button, int down, float x, float y, float z, int uid);
 
 struct RequestPrivateEditMode : MessageType
 {
-    RequestPrivateEditMode() : MessageType(1034, "RequestPrivateEditMode") { };
+    enum { CODE = 1034 };
+
+    RequestPrivateEditMode() : MessageType(CODE, "RequestPrivateEditMode") { };
+
+    typedef NoFields Fields;
 
 #ifdef SERVER
     void receive(int receiver, int sender, ucharbuf &p);
@@ -379,7 +595,11 @@ void send_RequestPrivateEditMode();
 
 struct NotifyPrivateEditMode : MessageType
 {
-    NotifyPrivateEditMode() : MessageType(1035, "NotifyPrivateEditMode") { };
+    enum { CODE = 1035 };
+
+    NotifyPrivateEditMode() : MessageType(CODE, "NotifyPrivateEditMode") { };
+
+    typedef NoFields Fields;
 
 #ifndef SERVER
     void receive(int receiver, int sender, ucharbuf &p);
@@ -388,4 +608,53 @@ struct NotifyPrivateEditMode : MessageType
 
 void send_NotifyPrivateEditMode(int clientNumber);
 
+
+// StateDataBatch
+
+//! Several state data changes to one entity, accumulated by send_StateDataUpdate and
+//! send_UnreliableStateDataUpdate over a server tick and sent by flush_StateDataUpdates.
+struct StateDataBatch : MessageType
+{
+    enum { CODE = 1036 };
+
+    StateDataBatch() : MessageType(CODE, "StateDataBatch") { };
+
+    //! Followed by 'num' pairs of a key protocol ID and a StateDataValue
+    struct Fields
+    {
+        int uid, originalClientNumber, num;
+
+        template<class V> void visit(V &v) { v(uid); v(originalClientNumber); v(num); }
+    };
+
+    void receive(int receiver, int sender, ucharbuf &p);
+};
+
+//! Sends the state data updates accumulated since the last call, one message per client and entity.
+//! Given a uid, sends only those about that entity, e.g. before another message about it
+void flush_StateDataUpdates(int uid = -1);
+//! Drops any accumulated state data updates, e.g. when the scenario changes
+void clear_StateDataUpdates();
+
+
+// EntityStreamReceived
+
+//! Sent by a client once it has applied the last chunk of the entity snapshot streamed to it, see
+//! server::startentitystream. The server holds back main channel messages to it until then, as
+//! ENet does not order them against ENTITY_CHANNEL.
+struct EntityStreamReceived : MessageType
+{
+    enum { CODE = 1037 };
+
+    EntityStreamReceived() : MessageType(CODE, "EntityStreamReceived") { };
+
+    typedef NoFields Fields;
+
+#ifdef SERVER
+    void receive(int receiver, int sender, ucharbuf &p);
+#endif
+};
+
+void send_EntityStreamReceived();
+
 #endif
@@ -243,6 +243,7 @@ void QuantizedInfo::applyToEntity(gameent *d)
         d->smoothmillis = 0;
 
     if(d->state==CS_LAGGED || d->state==CS_SPAWNING) d->state = CS_ALIVE;
+    updatedynentcache(d);
 }
 
 void QuantizedInfo::applyToBuffer(ucharbuf& q)
@@ -312,6 +313,337 @@ void QuantizedInfo::applyToBuffer(ucharbuf& q)
 ///////////////////////printf("***Generated size: %d\r\n", q.length());
 }
 
+void QuantizedInfo::mergeInto(QuantizedInfo& state) const
+{
+    state.clientNumber = clientNumber;
+    if (hasPosition) state.position = position;
+    if (hasYaw) state.yaw = yaw;
+    if (hasPitch) state.pitch = pitch;
+    if (hasRoll) state.roll = roll;
+    if (hasVelocity) state.velocity = velocity;
+    state.falling = falling; // XXX: hasFalling is done the old Sauer way - when not present, it is zero
+    if (hasMisc) state.misc = misc;
+    state.crouching = crouching;
+    if (hasMapDefinedPositionData) state.mapDefinedPositionData = mapDefinedPositionData;
+}
+
+
+//======================================
+// Snapshot deltas
+//======================================
+
+// Fields of a snapshot entry, in the order their change bits are written
+enum
+{
+    SNAP_POSITION = 1<<0, SNAP_YAW = 1<<1, SNAP_PITCH = 1<<2, SNAP_ROLL = 1<<3,
+    SNAP_VELOCITY = 1<<4, SNAP_FALLING = 1<<5, SNAP_MISC = 1<<6, SNAP_CROUCHING = 1<<7,
+    SNAP_MAPDATA = 1<<8,
+    SNAP_NUMFIELDS = 9
+};
+
+//! Packs values into a byte vector, least significant bit first
+struct BitWriter
+{
+    vector<uchar>& out;
+    unsigned long long bits;
+    int numBits;
+
+    BitWriter(vector<uchar>& out) : out(out), bits(0), numBits(0) {}
+
+    void put(uint value, int n)
+    {
+        if (n <= 0) return;
+        bits |= (unsigned long long)(value & (0xFFFFFFFFU >> (32 - n))) << numBits;
+        numBits += n;
+        while (numBits >= 8)
+        {
+            out.add(uchar(bits));
+            bits >>= 8;
+            numBits -= 8;
+        }
+    }
+
+    //! Exp-Golomb code: small values take few bits (0 takes 1, 1-2 take 3, 3-6 take 5...)
+    void putGolomb(uint value)
+    {
+        unsigned long long x = (unsigned long long)value + 1;
+        int n = 0;
+        while (x >> (n + 1)) n++;
+        put(0, n);
+        put(1, 1);
+        put(uint(x), n); // The leading 1 is implied
+    }
+
+    void putSigned(int value) { putGolomb(uint((value << 1) ^ (value >> 31))); } // Zigzag
+
+    void flush()
+    {
+        if (numBits > 0) out.add(uchar(bits));
+        bits = 0;
+        numBits = 0;
+    }
+};
+
+struct BitReader
+{
+    const uchar *buf;
+    int len, pos;
+    unsigned long long bits;
+    int numBits;
+    bool overread;
+
+    BitReader(const uchar *buf, int len) : buf(buf), len(len), pos(0), bits(0), numBits(0), overread(false) {}
+
+    uint get(int n)
+    {
+        if (n <= 0) return 0;
+        while (numBits < n)
+        {
+            if (pos >= len) { overread = true; return 0; }
+            bits |= (unsigned long long)buf[pos++] << numBits;
+            numBits += 8;
+        }
+        uint value = uint(bits & (0xFFFFFFFFU >> (32 - n)));
+        bits >>= n;
+        numBits -= n;
+        return value;
+    }
+
+    uint getGolomb()
+    {
+        int n = 0;
+        while (!get(1))
+        {
+            if (overread || ++n > 32) { overread = true; return 0; }
+        }
+        return uint(((1ULL << n) | get(n)) - 1);
+    }
+
+    int getSigned() { uint value = getGolomb(); return int(value >> 1) ^ -int(value & 1); }
+};
+
+static const QuantizedInfo& emptyState()
+{
+    static QuantizedInfo empty;
+    static bool initialized = false;
+    if (!initialized)
+    {
+        empty.clientNumber = -1;
+        empty.position = empty.velocity = empty.falling = ivec(0, 0, 0);
+        empty.yaw = empty.pitch = empty.roll = empty.misc = 0;
+        empty.crouching = false;
+        empty.mapDefinedPositionData = 0;
+        initialized = true;
+    }
+    return empty;
+}
+
+static int changedFields(const QuantizedInfo& state, const QuantizedInfo& base)
+{
+    int fields = 0;
+    if (state.position != base.position) fields |= SNAP_POSITION;
+    if (state.yaw != base.yaw) fields |= SNAP_YAW;
+    if (state.pitch != base.pitch) fields |= SNAP_PITCH;
+    if (state.roll != base.roll) fields |= SNAP_ROLL;
+    if (state.velocity != base.velocity) fields |= SNAP_VELOCITY;
+    if (state.falling != base.falling) fields |= SNAP_FALLING;
+    if (state.misc != base.misc) fields |= SNAP_MISC;
+    if (state.crouching != base.crouching) fields |= SNAP_CROUCHING;
+    if (state.mapDefinedPositionData != base.mapDefinedPositionData) fields |= SNAP_MAPDATA;
+    return fields;
+}
+
+// Angles wrap around, so their deltas are taken modulo 256
+static inline int angleDelta(uchar value, uchar base) { return int((signed char)(uchar)(value - base)); }
+
+static void writeEntity(BitWriter& w, const QuantizedInfo& state, const QuantizedInfo& base, int fields)
+{
+    w.put(fields, SNAP_NUMFIELDS);
+    if (fields & SNAP_POSITION) loopk(3) w.putSigned(state.position[k] - base.position[k]);
+    if (fields & SNAP_YAW) w.putSigned(angleDelta(state.yaw, base.yaw));
+    if (fields & SNAP_PITCH) w.putSigned(angleDelta(state.pitch, base.pitch));
+    if (fields & SNAP_ROLL) w.putSigned(angleDelta(state.roll, base.roll));
+    if (fields & SNAP_VELOCITY) loopk(3) w.putSigned(state.velocity[k] - base.velocity[k]);
+    if (fields & SNAP_FALLING) loopk(3) w.putSigned(state.falling[k] - base.falling[k]);
+    if (fields & SNAP_MISC) w.put(state.misc, 8);
+    if (fields & SNAP_CROUCHING) w.put(state.crouching ? 1 : 0, 1);
+    if (fields & SNAP_MAPDATA) w.putGolomb(state.mapDefinedPositionData);
+}
+
+static void readEntity(BitReader& r, QuantizedInfo& state, const QuantizedInfo& base)
+{
+    int fields = r.get(SNAP_NUMFIELDS);
+    state.position = base.position;
+    state.yaw = base.yaw;
+    state.pitch = base.pitch;
+    state.roll = base.roll;
+    state.velocity = base.velocity;
+    state.falling = base.falling;
+    state.misc = base.misc;
+    state.crouching = base.crouching;
+    state.mapDefinedPositionData = base.mapDefinedPositionData;
+    if (fields & SNAP_POSITION) loopk(3) state.position[k] += r.getSigned();
+    if (fields & SNAP_YAW) state.yaw += r.getSigned();
+    if (fields & SNAP_PITCH) state.pitch += r.getSigned();
+    if (fields & SNAP_ROLL) state.roll += r.getSigned();
+    if (fields & SNAP_VELOCITY) loopk(3) state.velocity[k] += r.getSigned();
+    if (fields & SNAP_FALLING) loopk(3) state.falling[k] += r.getSigned();
+    if (fields & SNAP_MISC) state.misc = r.get(8);
+    if (fields & SNAP_CROUCHING) state.crouching = r.get(1) != 0;
+    if (fields & SNAP_MAPDATA) state.mapDefinedPositionData = r.getGolomb();
+    state.hasPosition = state.hasYaw = state.hasPitch = state.hasRoll = state.hasVelocity = state.hasMisc = true;
+    state.hasMapDefinedPositionData = true;
+    state.hasFalling = !state.falling.iszero();
+}
+
+const QuantizedInfo *Snapshot::find(int clientNumber) const
+{
+    int lo = 0, hi = entities.length() - 1;
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) / 2, cn = entities[mid].clientNumber;
+        if (cn == clientNumber) return &entities[mid];
+        if (cn < clientNumber) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return NULL;
+}
+
+void Snapshot::set(const QuantizedInfo& state)
+{
+    int i = entities.length();
+    while (i > 0 && entities[i-1].clientNumber > state.clientNumber) i--;
+    if (i > 0 && entities[i-1].clientNumber == state.clientNumber) entities[i-1] = state;
+    else entities.insert(i, state);
+}
+
+void SnapshotHistory::reset()
+{
+    loopi(MAXSNAPSHOTS)
+    {
+        snapshots[i].sequence = 0;
+        snapshots[i].entities.setsize(0);
+    }
+    nextSequence = 1;
+    acked = 0;
+}
+
+Snapshot *SnapshotHistory::find(int sequence)
+{
+    if (sequence <= 0) return NULL;
+    Snapshot &snap = snapshots[sequence % MAXSNAPSHOTS];
+    return snap.sequence == sequence ? &snap : NULL;
+}
+
+Snapshot& SnapshotHistory::start(int sequence, const Snapshot *base)
+{
+    Snapshot &snap = snapshots[sequence % MAXSNAPSHOTS];
+    assert(&snap != base);
+    snap.sequence = sequence;
+    snap.entities.setsize(0);
+    if (base) snap.entities.put(base->entities.getbuf(), base->entities.length());
+    return snap;
+}
+
+int deltaBits(const QuantizedInfo& state, const QuantizedInfo *base)
+{
+    const QuantizedInfo &from = base ? *base : emptyState();
+    int fields = changedFields(state, from);
+    if (!fields) return 0;
+    static vector<uchar> scratch;
+    scratch.setsize(0);
+    BitWriter w(scratch);
+    w.put(1, 1);
+    writeEntity(w, state, from, fields);
+    return scratch.length()*8 + w.numBits;
+}
+
+bool writeSnapshot(packetbuf& q, const Snapshot& snap, const Snapshot *base)
+{
+    static vector<int> changed;
+    changed.setsize(0);
+    loopv(snap.entities)
+    {
+        const QuantizedInfo *baseState = base ? base->find(snap.entities[i].clientNumber) : NULL;
+        if (changedFields(snap.entities[i], baseState ? *baseState : emptyState())) changed.add(i);
+    }
+    if (changed.empty()) return false;
+
+    static vector<uchar> bits;
+    bits.setsize(0);
+    BitWriter w(bits);
+    w.putGolomb(changed.length());
+    int lastClientNumber = -1;
+    loopv(changed)
+    {
+        const QuantizedInfo &state = snap.entities[changed[i]];
+        const QuantizedInfo *baseState = base ? base->find(state.clientNumber) : NULL;
+        const QuantizedInfo &from = baseState ? *baseState : emptyState();
+        w.putGolomb(state.clientNumber - lastClientNumber - 1); // Sorted, so only the gap from the previous one
+        lastClientNumber = state.clientNumber;
+        w.put(baseState ? 1 : 0, 1); // Whether this is a delta or a new entity
+        writeEntity(w, state, from, changedFields(state, from));
+    }
+    w.flush();
+
+    putint(q, N_SNAPSHOT);
+    putint(q, snap.sequence);
+    putint(q, base ? base->sequence : 0);
+    putuint(q, bits.length());
+    q.put(bits.getbuf(), bits.length());
+    return true;
+}
+
+int readSnapshot(ucharbuf& p, SnapshotHistory& history)
+{
+    int sequence = getint(p);
+    int baseSequence = getint(p);
+    int len = getuint(p);
+    ucharbuf data = p.subbuf(len);
+    if (sequence <= 0 || data.maxlen != len) return 0;
+
+    Snapshot *base = NULL;
+    if (baseSequence)
+    {
+        base = history.find(baseSequence);
+        if (!base || sequence - baseSequence <= 0 || sequence - baseSequence >= MAXSNAPSHOTS)
+        {
+            logger::log(logger::WARNING, "Snapshot %d is based on %d, which we do not have", sequence, baseSequence);
+            return 0;
+        }
+    }
+
+    // The whole packet is decoded before anything is applied, so a malformed one changes nothing
+    static vector<QuantizedInfo> states;
+    states.setsize(0);
+    BitReader r(data.buf, data.maxlen);
+    int count = r.getGolomb(), lastClientNumber = -1;
+    loopi(count)
+    {
+        QuantizedInfo state;
+        state.clientNumber = lastClientNumber + 1 + r.getGolomb();
+        lastClientNumber = state.clientNumber;
+        bool delta = r.get(1) != 0;
+        const QuantizedInfo *baseState = delta && base ? base->find(state.clientNumber) : NULL;
+        if (delta && !baseState) r.overread = true;
+        readEntity(r, state, baseState ? *baseState : emptyState());
+        if (r.overread) break;
+        states.add(state);
+    }
+    if (r.overread)
+    {
+        logger::log(logger::WARNING, "Malformed snapshot %d", sequence);
+        return 0;
+    }
+    Snapshot &snap = history.start(sequence, base);
+    loopv(states)
+    {
+        snap.set(states[i]);
+        states[i].applyToEntity();
+    }
+    return sequence;
+}
+
 
 //======================================
 // Bandwidth optimization system for
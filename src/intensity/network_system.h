@@ -81,7 +81,59 @@ namespace NetworkSystem
             //! fields in quantized form. Applies compression of bitfields, packing, unsent
             //! fields, etc., i.e., the opposite of generateFrom(buffer).
             void applyToBuffer(ucharbuf& q);
+
+            //! Copies the fields present here into 'state', which keeps the full current state of
+            //! an entity (all fields present), as used in snapshots.
+            void mergeInto(QuantizedInfo& state) const;
+        };
+
+        //! Snapshot deltas: instead of relaying each N_POS as is, the server keeps, for each
+        //! client, the last few snapshots it sent (the full position state of every entity the
+        //! client was told about), and encodes each new snapshot against the newest one the
+        //! client has acknowledged (N_SNAPACK). Entities that did not change since then are
+        //! not sent at all, and the rest only as the bit-packed differences.
+        #define MAXSNAPSHOTS 32
+
+        struct Snapshot
+        {
+            int sequence; //!< 0 if unused
+            vector<QuantizedInfo> entities; //!< Full state of each entity, sorted by client number
+
+            Snapshot() : sequence(0) {}
+
+            const QuantizedInfo *find(int clientNumber) const;
+            //! Adds or replaces the state of an entity
+            void set(const QuantizedInfo& state);
         };
+
+        struct SnapshotHistory
+        {
+            Snapshot snapshots[MAXSNAPSHOTS];
+            int nextSequence; //!< Server: the sequence number of the next snapshot to send
+            int acked; //!< Server: the newest sequence number the client acknowledged, or 0
+
+            SnapshotHistory() { reset(); }
+
+            void reset();
+            Snapshot *find(int sequence);
+            //! Begins snapshot 'sequence' as a copy of 'base' (or empty), reusing the oldest slot.
+            //! 'base' must be newer than sequence - MAXSNAPSHOTS.
+            Snapshot& start(int sequence, const Snapshot *base);
+        };
+
+        //! The number of bits writeSnapshot() would take to send 'state' against 'base' (or as a new
+        //! entity, if there is none), not counting its client number. 0 if nothing changed.
+        int deltaBits(const QuantizedInfo& state, const QuantizedInfo *base);
+
+        //! Writes an N_SNAPSHOT message with the entities of 'snap' that differ from 'base' (all of them
+        //! if there is no base). Returns false, writing nothing, if no entity differs.
+        bool writeSnapshot(packetbuf& q, const Snapshot& snap, const Snapshot *base);
+
+        //! Reads an N_SNAPSHOT message (after the type), records it in 'history' and applies the
+        //! entities in it. Returns the sequence number to acknowledge, or 0 if the snapshot could not
+        //! be decoded (its base is not in our history); acknowledging 0 makes the server start over
+        //! with a full snapshot.
+        int readSnapshot(ucharbuf& p, SnapshotHistory& history);
     }
 }
 
@@ -17,7 +17,8 @@ int xtravertsva;
 void serverkeepalive()
 {
     extern ENetHost *serverhost;
-    if(serverhost)
+    extern bool netthreadactive();
+    if(serverhost && !netthreadactive()) // Otherwise the network I/O thread keeps servicing it
         enet_host_service(serverhost, NULL, 0);
 }
 
@@ -18,10 +18,13 @@ void TargetingControl::intersectClosestDynamicEntity(vec &from, vec &to, physent
 {
     dynent *best = NULL;
     float bestdist = 1e16f;
-    loopi(game::numdynents())
+    static vector<physent *> nearby;
+    nearby.setsize(0);
+    dynentsnearray(from, to, nearby);
+    loopv(nearby)
     {
-        dynent *o = game::iterdynents(i);
-        if(!o || o==targeter) continue;
+        dynent *o = (dynent *)nearby[i];
+        if(o==targeter) continue;
         if(!game::intersect(o, from, to)) continue;
         float dist = from.dist(o->o);
         if(dist<bestdist)
@@ -230,6 +230,7 @@ namespace entities
 
         /* no need to interpolate to the last position - just jump */
         d->resetinterp();
+        updatedynentcache(d);
 
         logger::log(
             logger::INFO, "(%i).setdynent0(%f, %f, %f)",
@@ -271,6 +272,157 @@ namespace entities
     DYNENTVEC(falling, falling)
     #undef DYNENTVEC
 
+    /* Batches: one call reads or writes a whole list of entities, which
+     * saves a lookup and an FFI call per field. Every field is an array
+     * over the list and NULL skips a field. Vectors are laid out as
+     * stride x then stride y then stride z, so the first n entities of a
+     * longer list can be covered. If found is given it tells which uids
+     * exist; the fields of the others are left alone. */
+
+    static inline gameent *batch_dynent(int uid) {
+        CLogicEntity *entity = LogicSystem::getLogicEntity(uid);
+        return entity ? (gameent*)entity->dynamicEntity : NULL;
+    }
+
+    static inline extentity *batch_extent(int uid) {
+        CLogicEntity *entity = LogicSystem::getLogicEntity(uid);
+        return entity ? entity->staticEntity : NULL;
+    }
+
+    static int get_dynents(const int *uids, int n, int stride, double *pos,
+    double *vel, float *yaw, float *pitch, bool *found) {
+        int nfound = 0;
+        for (int i = 0; i < n; ++i) {
+            gameent *d = batch_dynent(uids[i]);
+            if (found) found[i] = d != NULL;
+            if (!d) continue;
+            ++nfound;
+            if (pos) {
+                pos[i] = d->o.x;
+                pos[stride + i] = d->o.y;
+                pos[2*stride + i] = d->o.z - d->eyeheight;
+            }
+            if (vel) {
+                vel[i] = d->vel.x;
+                vel[stride + i] = d->vel.y;
+                vel[2*stride + i] = d->vel.z;
+            }
+            if (yaw) yaw[i] = d->yaw;
+            if (pitch) pitch[i] = d->pitch;
+        }
+        return nfound;
+    }
+
+    CLUAICOMMAND(get_dynents, int, (const int *uids, int n, int stride,
+    double *pos, double *vel, float *yaw, float *pitch, bool *found), {
+        if (n > stride) return 0;
+        return get_dynents(uids, n, stride, pos, vel, yaw, pitch, found);
+    });
+
+    CLUAICOMMAND(set_dynents, int, (const int *uids, int n, int stride,
+    const double *pos, const double *vel, const float *yaw,
+    const float *pitch), {
+        if (n > stride) return 0;
+        int nfound = 0;
+        for (int i = 0; i < n; ++i) {
+            gameent *d = batch_dynent(uids[i]);
+            if (!d) continue;
+            ++nfound;
+            if (pos) {
+                d->o = vec(pos[i], pos[stride + i], pos[2*stride + i] + d->eyeheight);
+                d->newpos = d->o;
+                d->resetinterp();
+                updatedynentcache(d);
+            }
+            if (vel) d->vel = vec(vel[i], vel[stride + i], vel[2*stride + i]);
+            if (yaw) d->yaw = yaw[i];
+            if (pitch) d->pitch = pitch[i];
+        }
+        return nfound;
+    });
+
+    /* attributes first .. first+count-1, attribute a of entity i at
+     * attrs[a*n + i] */
+    CLUAICOMMAND(get_attrs, int, (const int *uids, int n, int first,
+    int count, int *attrs, bool *found), {
+        if (first < 0 || count < 0) return 0;
+        int nfound = 0;
+        for (int i = 0; i < n; ++i) {
+            extentity *ext = batch_extent(uids[i]);
+            if (found) found[i] = ext != NULL;
+            if (!ext) continue;
+            ++nfound;
+            for (int a = 0; a < count; ++a)
+                if (first + a < ext->attr.length())
+                    attrs[a*n + i] = ext->attr[first + a];
+        }
+        return nfound;
+    });
+
+    CLUAICOMMAND(set_attrs, int, (const int *uids, int n, int first,
+    int count, const int *attrs), {
+        if (first < 0 || count < 0) return 0;
+        int nfound = 0;
+        for (int i = 0; i < n; ++i) {
+            extentity *ext = batch_extent(uids[i]);
+            if (!ext) continue;
+            ++nfound;
+            if (!world::loading) removeentity(ext);
+            for (int a = 0; a < count; ++a)
+                if (first + a < ext->attr.length())
+                    ext->attr[first + a] = attrs[a*n + i];
+            if (!world::loading) addentity(ext);
+        }
+        return nfound;
+    });
+
+    /* Compares reading position, velocity, yaw and pitch of n entities
+     * (the live dynents over and over) field by field, as the single
+     * accessors do with a lookup each, against one batch. */
+    static volatile double dynentbatchsink;
+
+    static void dynentbatchbench(int *n) {
+        int num = *n > 0 ? *n : 1000, numdyns = game::numdynents();
+        vector<int> uids;
+        loopi(numdyns) {
+            dynent *d = game::iterdynents(i);
+            if (d && LogicSystem::getLogicEntity(d)) uids.add(LogicSystem::getUniqueId(d));
+        }
+        int live = uids.length();
+        if (!live) { conoutf(CON_ERROR, "no entities to benchmark"); return; }
+        while (uids.length() < num) uids.add(uids[uids.length() % live]);
+
+        vector<double> pos, vel;
+        vector<float> yaw, pitch;
+        pos.pad(3*num); vel.pad(3*num); yaw.pad(num); pitch.pad(num);
+        const int frames = 100;
+        double sum = 0;
+
+        llong start = getmicros();
+        loopk(frames) loopi(num) {
+            int uid = uids[i];
+            gameent *d;
+            if ((d = batch_dynent(uid))) { pos[i] = d->o.x; pos[num + i] = d->o.y; pos[2*num + i] = d->o.z - d->eyeheight; }
+            if ((d = batch_dynent(uid))) { vel[i] = d->vel.x; vel[num + i] = d->vel.y; vel[2*num + i] = d->vel.z; }
+            if ((d = batch_dynent(uid))) yaw[i] = d->yaw;
+            if ((d = batch_dynent(uid))) pitch[i] = d->pitch;
+            sum += pos[i] + vel[i] + yaw[i] + pitch[i];
+        }
+        llong single = getmicros() - start;
+
+        start = getmicros();
+        loopk(frames) {
+            get_dynents(uids.getbuf(), num, num, pos.getbuf(), vel.getbuf(), yaw.getbuf(), pitch.getbuf(), NULL);
+            loopi(num) sum += pos[i] + vel[i] + yaw[i] + pitch[i];
+        }
+        llong batch = getmicros() - start;
+
+        dynentbatchsink = sum;
+        conoutf("%d entities: per field %.1f us/frame, batched %.1f us/frame (%.2fx)", num,
+            single/double(frames), batch/double(frames), batch ? single/double(batch) : 0.0);
+    }
+    COMMAND(dynentbatchbench, "i");
+
 #ifndef SERVER
     CLUAICOMMAND(get_target_entity_uid, bool, (int *uid), {
         if (TargetingControl::targetLogicEntity) {
@@ -297,6 +449,13 @@ namespace entities
         return true;
     });
 
+    CLUAICOMMAND(set_network_priority, void, (int uid, float weight), {
+        LUA_GET_ENT(entity, uid, "_C.setnetworkpriority", return)
+        gameent *d = (gameent*)entity->dynamicEntity;
+        assert(d);
+        d->networkpriority = max(weight, 0.0f);
+    });
+
     CLUAICOMMAND(get_selected_entity, int, (), {
         const vector<extentity *> &ents = entities::getents();
         if (!ents.inrange(efocus)) return -1;
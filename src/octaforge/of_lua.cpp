@@ -198,9 +198,42 @@ namespace lua
     void pop_external_ret(lua_State *L, int n) { if (n > 0) lua_pop(L, n); }
     void pop_external_ret(int n) { pop_external_ret(L, n); }
 
+    static external *externals = NULL;
+
+    external::external(const char *name): name(name), ref(LUA_NOREF),
+    next(externals) {
+        externals = this;
+    }
+
+    bool resolve_external(lua_State *L, external &ext) {
+        if (external_handler == LUA_REFNIL) return false;
+        if (!push_external(L, ext.name)) {
+            /* remembered as missing until the externals change */
+            lua_pop(L, 1);
+            ext.ref = LUA_REFNIL;
+            return false;
+        }
+        ext.ref = luaL_ref(L, LUA_REGISTRYINDEX);
+        return true;
+    }
+
+    /* pass NULL when the state the references live in is going away */
+    static void drop_externals(lua_State *L) {
+        for (external *ext = externals; ext; ext = ext->next) {
+            if (L) luaL_unref(L, LUA_REGISTRYINDEX, ext->ref);
+            ext->ref = LUA_NOREF;
+        }
+    }
+
     LUAICOMMAND(external_hook, {
         lua_pushvalue(L, 1);
         external_handler = luaL_ref(L, LUA_REGISTRYINDEX);
+        drop_externals(L);
+        return 0;
+    })
+
+    LUAICOMMAND(external_changed, {
+        drop_externals(L);
         return 0;
     })
 
@@ -553,7 +586,8 @@ namespace lua
             "struct particle_t; typedef struct particle_t particle_t;\n"
             "struct selinfo_t; typedef struct selinfo_t selinfo_t;\n"
             "struct vslot_t; typedef struct vslot_t vslot_t;\n"
-            "struct cube_t; typedef struct cube_t cube_t;\n");
+            "struct cube_t; typedef struct cube_t cube_t;\n"
+            "struct ray_t; typedef struct ray_t ray_t;\n");
         lua_call(L, 1, 0);
         lua_getfield(L, -1, "cast");
         lua_replace(L, -2);
@@ -614,6 +648,108 @@ namespace lua
         load_module("init");
     }
 
+    /* The collector is kept stopped and stepped by the engine instead, in
+     * the idle time at the end of a frame (the fps limiter's sleep on the
+     * client, the network wait on the server), so its work does not land in
+     * the middle of a frame whenever an allocation trips it. A cycle starts
+     * once the heap has grown by luagcpause percent since the last one
+     * finished and then takes up to luagcbudget microseconds of idle time
+     * per frame, in steps of luagcstepsize KB. At least one step is taken
+     * per frame while collecting. Past twice the threshold the whole budget
+     * is used even without idle time and past four times the heap is
+     * collected at once, so frames without idle time cannot grow the heap
+     * without bounds.
+     * A budget of 0 hands the collector back to Lua. */
+    VAR(luagcbudget, 0, 1000, 100000);
+    VAR(luagcpause, 110, 200, 1000);
+    VAR(luagcstepsize, 1, 16, 1024);
+
+    static lua_State *gcstate = NULL; /* the state being managed, if any */
+    static bool gccollecting = false;
+    static int gcbase = 0, gcheap = 0; /* KB after the last cycle, frame */
+
+    /* metrics, reset by luagcstats */
+    static int gcframes = 0, gccycles = 0, gcforced = 0;
+    static int gctimemax = 0, gcallocmax = 0, gcheapmax = 0;
+    static llong gctime = 0, gcalloc = 0;
+    static int gclasttime = 0, gclastalloc = 0;
+
+    int gc_step(int slack) {
+        if (!L) return 0;
+        if (!luagcbudget) {
+            if (gcstate == L) lua_gc(L, LUA_GCRESTART, 0);
+            gcstate = NULL;
+            gcheap = lua_gc(L, LUA_GCCOUNT, 0);
+            return 0;
+        }
+        int heap = lua_gc(L, LUA_GCCOUNT, 0);
+        if (gcstate != L) {
+            /* a new state, or the budget was 0 until now */
+            lua_gc(L, LUA_GCSTOP, 0);
+            gcstate = L;
+            gccollecting = false;
+            gcbase = gcheap = heap;
+        }
+        /* no frees happen outside of our steps, so growth is allocation */
+        int alloc = max(heap - gcheap, 0);
+        llong start = getmicros();
+        llong threshold = llong(max(gcbase, 1024))*luagcpause/100;
+        if (heap >= 4*threshold) {
+            lua_gc(L, LUA_GCCOLLECT, 0);
+            lua_gc(L, LUA_GCSTOP, 0);
+            gccollecting = false;
+            gcbase = lua_gc(L, LUA_GCCOUNT, 0);
+            gccycles++;
+            gcforced++;
+        } else if (gccollecting || heap >= threshold) {
+            gccollecting = true;
+            int budget = heap >= 2*threshold ? luagcbudget : min(luagcbudget, slack);
+            do {
+                if (lua_gc(L, LUA_GCSTEP, luagcstepsize)) {
+                    gccollecting = false;
+                    gcbase = lua_gc(L, LUA_GCCOUNT, 0);
+                    gccycles++;
+                    break;
+                }
+            } while (getmicros() - start < budget);
+            /* stepping sets the threshold again, so stop once more */
+            lua_gc(L, LUA_GCSTOP, 0);
+        }
+        int spent = int(getmicros() - start);
+        gcheap = lua_gc(L, LUA_GCCOUNT, 0);
+
+        gcframes++;
+        gctime += spent;
+        gctimemax = max(gctimemax, spent);
+        gcalloc += alloc;
+        gcallocmax = max(gcallocmax, alloc);
+        gcheapmax = max(gcheapmax, heap);
+        gclasttime = spent;
+        gclastalloc = alloc;
+        return spent;
+    }
+
+    static void luagcstats() {
+        if (!L) { conoutf("lua collector: no state"); return; }
+        conoutf("lua collector: %s, heap %d KB (peak %d KB), %d KB after the last cycle",
+            gcstate == L ? "engine stepped" : "automatic", lua_gc(L, LUA_GCCOUNT, 0), gcheapmax, gcbase);
+        if (gcframes)
+            conoutf("%.3f ms per frame (max %.3f ms), %.1f KB allocated per frame (max %d KB), %d cycles (%d forced) over %d frames",
+                gctime/(1000.0f*gcframes), gctimemax/1000.0f, float(gcalloc)/gcframes, gcallocmax, gccycles, gcforced, gcframes);
+        gcframes = gccycles = gcforced = 0;
+        gctimemax = gcallocmax = gcheapmax = 0;
+        gctime = gcalloc = 0;
+    }
+    COMMAND(luagcstats, "");
+
+    /* Fills vals with the heap size in KB, the microseconds the collector
+     * took and the KB allocated, all as of the end of the last frame */
+    CLUAICOMMAND(gc_get_stats, void, (int *vals), {
+        vals[0] = gcheap;
+        vals[1] = gclasttime;
+        vals[2] = gclastalloc;
+    });
+
     void reset() {
 #ifndef SERVER
         deleteparticles();
@@ -621,6 +757,8 @@ namespace lua
         clearanims();
 #endif
         external_handler = LUA_REFNIL;
+        drop_externals(NULL);
+        gcstate = NULL;
         lua_close(L);
         L = NULL;
         init();
@@ -630,6 +768,8 @@ namespace lua
     }
 
     void close() {
+        drop_externals(NULL);
+        gcstate = NULL;
         lua_close(L);
         delete funs;
         delete cfuns;
@@ -11,6 +11,10 @@ namespace lua
     void close     ();
     int load_string(const char *str, const char *ch = NULL);
 
+    /* Runs the collector for about slack microseconds of the frame's idle
+     * time, returns the microseconds it took */
+    int gc_step(int slack);
+
     bool call_external(lua_State *L, const char *name, const char *args, ...);
     bool call_external(              const char *name, const char *args, ...);
 
@@ -21,6 +25,89 @@ namespace lua
 
     void pop_external_ret(lua_State *L, int n);
     void pop_external_ret(int n);
+
+    /* A handle to an external, for calls on hot paths. It is looked up by
+     * name once and then kept as a registry reference, dropped again when
+     * the external is set or unset, so a call costs one lua_rawgeti plus
+     * pushing the arguments, with the pushes picked by argument type
+     * instead of parsed from a format string. Handles are meant to be
+     * static, e.g.
+     *
+     *     static lua::external frame_handle("frame_handle");
+     *     lua::call_external(frame_handle, millis, lastmillis);
+     */
+    struct external {
+        const char *name;
+        int ref;
+        external *next;
+
+        external(const char *name);
+    };
+
+    bool resolve_external(lua_State *L, external &ext);
+
+    inline bool push_external(lua_State *L, external &ext) {
+        if (ext.ref == LUA_NOREF && !resolve_external(L, ext)) return false;
+        if (ext.ref == LUA_REFNIL) return false;
+        lua_rawgeti(L, LUA_REGISTRYINDEX, ext.ref);
+        return true;
+    }
+
+    inline void push_arg(lua_State *L, int v) { lua_pushinteger(L, v); }
+    inline void push_arg(lua_State *L, float v) { lua_pushnumber(L, v); }
+    inline void push_arg(lua_State *L, double v) { lua_pushnumber(L, v); }
+    inline void push_arg(lua_State *L, bool v) { lua_pushboolean(L, v); }
+    inline void push_arg(lua_State *L, const char *v) { lua_pushstring(L, v); }
+
+    inline bool call_external(external &ext) {
+        if (!push_external(L, ext)) return false;
+        lua_call(L, 0, 0);
+        return true;
+    }
+
+    template<class A>
+    inline bool call_external(external &ext, const A &a) {
+        if (!push_external(L, ext)) return false;
+        push_arg(L, a);
+        lua_call(L, 1, 0);
+        return true;
+    }
+
+    template<class A, class B>
+    inline bool call_external(external &ext, const A &a, const B &b) {
+        if (!push_external(L, ext)) return false;
+        push_arg(L, a); push_arg(L, b);
+        lua_call(L, 2, 0);
+        return true;
+    }
+
+    template<class A, class B, class C>
+    inline bool call_external(external &ext, const A &a, const B &b,
+    const C &c) {
+        if (!push_external(L, ext)) return false;
+        push_arg(L, a); push_arg(L, b); push_arg(L, c);
+        lua_call(L, 3, 0);
+        return true;
+    }
+
+    template<class A, class B, class C, class D>
+    inline bool call_external(external &ext, const A &a, const B &b,
+    const C &c, const D &d) {
+        if (!push_external(L, ext)) return false;
+        push_arg(L, a); push_arg(L, b); push_arg(L, c); push_arg(L, d);
+        lua_call(L, 4, 0);
+        return true;
+    }
+
+    template<class A, class B, class C, class D, class E>
+    inline bool call_external(external &ext, const A &a, const B &b,
+    const C &c, const D &d, const E &e) {
+        if (!push_external(L, ext)) return false;
+        push_arg(L, a); push_arg(L, b); push_arg(L, c); push_arg(L, d);
+        push_arg(L, e);
+        lua_call(L, 5, 0);
+        return true;
+    }
 }
 
 #define LUACOMMAND(name, fun) \
@@ -6,7 +6,6 @@ namespace game
 }
 
 extern float GRAVITY;
-extern physent *collideplayer;
 void writemediacfg(int level);
 
 namespace lapi_binds
@@ -129,17 +128,57 @@ namespace lapi_binds
         return 0;
     }
 
+    /* state data values keep their Lua type on the wire; strings are not
+     * copied, so the value is only valid while it stays on the stack */
+    static StateDataValue sdata_value(lua_State *L, int idx) {
+        StateDataValue v;
+        switch (lua_type(L, idx)) {
+            case LUA_TNONE: case LUA_TNIL:
+                break;
+            case LUA_TBOOLEAN:
+                v.setbool(lua_toboolean(L, idx));
+                break;
+            case LUA_TNUMBER: {
+                lua_Number n = lua_tonumber(L, idx);
+                if (n >= INT_MIN && n <= INT_MAX && lua_Number(int(n)) == n)
+                    v.setint(int(n));
+                else
+                    v.setfloat(float(n));
+                break;
+            }
+            case LUA_TTABLE: {
+                if (lua_objlen(L, idx) != 3) {
+                    luaL_argerror(L, idx, "expected a 3 component vector");
+                    break;
+                }
+                float c[3];
+                loopk(3) {
+                    lua_rawgeti(L, idx, k + 1);
+                    c[k] = lua_tonumber(L, -1);
+                    lua_pop(L, 1);
+                }
+                v.setvec(c[0], c[1], c[2]);
+                break;
+            }
+            default: {
+                size_t len;
+                const char *str = luaL_checklstring(L, idx, &len);
+                v.setstring(str, int(len));
+                break;
+            }
+        }
+        return v;
+    }
+
     int _lua_statedata_changerequest(lua_State *L) {
-        const char *val = luaL_optstring(L, 3, "");
         send_StateDataChangeRequest(luaL_checkinteger(L, 1),
-            luaL_checkinteger(L, 2), val);
+            luaL_checkinteger(L, 2), sdata_value(L, 3));
         return 0;
     }
 
     int _lua_statedata_changerequest_unreliable(lua_State *L) {
-        const char *val = luaL_optstring(L, 3, "");
         send_UnreliableStateDataChangeRequest(luaL_checkinteger(L, 1),
-            luaL_checkinteger(L, 2), val);
+            luaL_checkinteger(L, 2), sdata_value(L, 3));
         return 0;
     }
 
@@ -162,17 +201,15 @@ namespace lapi_binds
     }
 
     int _lua_statedata_update(lua_State *L) {
-        const char *val = luaL_checkstring(L, 4);
         send_StateDataUpdate(luaL_checkinteger(L, 1), luaL_checkinteger(L, 2),
-            luaL_checkinteger(L, 3), val ? val : "" , luaL_checkinteger(L, 5));
+            luaL_checkinteger(L, 3), sdata_value(L, 4), luaL_checkinteger(L, 5));
         return 0;
     }
 
     int _lua_statedata_update_unreliable(lua_State *L) {
-        const char *val = luaL_checkstring(L, 4);
         send_UnreliableStateDataUpdate(luaL_checkinteger(L, 1),
-            luaL_checkinteger(L, 2), luaL_checkinteger(L, 3), val ? val : "",
-            luaL_checkinteger(L, 5));
+            luaL_checkinteger(L, 2), luaL_checkinteger(L, 3),
+            sdata_value(L, 4), luaL_checkinteger(L, 5));
         return 0;
     }
 
@@ -345,6 +382,7 @@ namespace lapi_binds
 
                 bool ret = collide(&tester, vec(0));
                 ignore->dynamicEntity->o = save;
+                updatedynentcache(ignore->dynamicEntity);
 
                 lua_pushboolean(L, ret);
             }
@@ -0,0 +1,183 @@
+/*
+ * of_timers.cpp, version 1
+ * Timer scheduling for OctaForge scripting.
+ *
+ * license: see COPYING.txt
+ */
+
+#include "cube.h"
+#include "engine.h"
+#include "game.h"
+
+namespace timers
+{
+    /* Lua schedules timers here by deadline and keeps the callbacks itself,
+     * by handle. The timers sit in a hierarchical wheel: four wheels of 64
+     * slots, the lowest one millisecond per slot and each one above 64 times
+     * coarser, so everything within about 4.6 hours is placed directly and
+     * later timers wait in the top wheel. Advancing the clock only visits the
+     * slots passed, cascading a coarse slot into the finer wheels when the
+     * clock reaches it, so a frame costs what is due rather than what is
+     * scheduled. Due handles are collected and handed to Lua in batches. */
+
+    #define TIMER_WHEELBITS 6
+    #define TIMER_WHEELSIZE (1<<TIMER_WHEELBITS)
+    #define TIMER_WHEELS 4
+
+    /* handles are built like LogicHandles: slot index in the low bits,
+     * generation in the high bits, 0 never valid */
+    #define TIMER_INDEXBITS 20
+    #define TIMER_INDEXMASK ((1<<TIMER_INDEXBITS)-1)
+    #define TIMER_GENERATIONMASK ((1<<(32-TIMER_INDEXBITS))-1)
+
+    struct timer {
+        uint deadline, period, generation;
+        int next, prev; /* within a wheel slot, next also in the free list */
+        int slot;       /* -1 when not scheduled */
+    };
+
+    static vector<timer> pool;
+    static int wheel[TIMER_WHEELS*TIMER_WHEELSIZE];
+    static int firstfree = -1;
+    static uint now = 0;
+    static vector<uint> due;
+    static int duepos = 0;
+    static bool wheelready = false;
+
+    static inline uint handle(int i) {
+        return (pool[i].generation<<TIMER_INDEXBITS) | i;
+    }
+
+    static inline int lookup(uint h) {
+        uint i = h & TIMER_INDEXMASK;
+        if (i >= uint(pool.length())) return -1;
+        timer &t = pool[i];
+        return t.slot >= 0 && t.generation == h>>TIMER_INDEXBITS ? int(i) : -1;
+    }
+
+    static void unlink(int i) {
+        timer &t = pool[i];
+        if (t.prev >= 0) pool[t.prev].next = t.next;
+        else wheel[t.slot] = t.next;
+        if (t.next >= 0) pool[t.next].prev = t.prev;
+        t.slot = -1;
+    }
+
+    static void place(int i) {
+        timer &t = pool[i];
+        uint delta = t.deadline - now;
+        int level = 0;
+        while (level < TIMER_WHEELS-1 && delta >= 1u<<(TIMER_WHEELBITS*(level+1))) ++level;
+        t.slot = level*TIMER_WHEELSIZE + ((t.deadline>>(TIMER_WHEELBITS*level))&(TIMER_WHEELSIZE-1));
+        t.prev = -1;
+        t.next = wheel[t.slot];
+        if (t.next >= 0) pool[t.next].prev = i;
+        wheel[t.slot] = i;
+    }
+
+    static void release(int i) {
+        timer &t = pool[i];
+        t.generation = (t.generation + 1) & TIMER_GENERATIONMASK;
+        if (!t.generation) t.generation = 1;
+        t.next = firstfree;
+        firstfree = i;
+    }
+
+    static void clear() {
+        pool.setsize(0);
+        loopi(TIMER_WHEELS*TIMER_WHEELSIZE) wheel[i] = -1;
+        firstfree = -1;
+        due.setsize(0);
+        duepos = 0;
+        wheelready = true;
+    }
+
+    /* moves every timer in a slot of an upper wheel down to where it
+     * belongs now */
+    static void cascade(int slot) {
+        int i = wheel[slot];
+        wheel[slot] = -1;
+        while (i >= 0) {
+            int next = pool[i].next;
+            place(i);
+            i = next;
+        }
+    }
+
+    static void fire(int slot) {
+        int i = wheel[slot];
+        wheel[slot] = -1;
+        while (i >= 0) {
+            timer &t = pool[i];
+            int next = t.next;
+            due.add(handle(i));
+            if (t.period) {
+                t.deadline += t.period;
+                place(i);
+            } else {
+                t.slot = -1;
+                release(i);
+            }
+            i = next;
+        }
+    }
+
+    /* Advances the clock, returns how many timers are due */
+    int advance(uint millis) {
+        if (!wheelready) clear();
+        /* whatever Lua did not take last time is dropped */
+        due.setsize(0);
+        duepos = 0;
+        if (pool.empty()) { now += millis; return 0; }
+        while (millis--) {
+            ++now;
+            for (int level = 1; level < TIMER_WHEELS; ++level) {
+                if (now & ((1u<<(TIMER_WHEELBITS*level))-1)) break;
+                cascade(level*TIMER_WHEELSIZE + ((now>>(TIMER_WHEELBITS*level))&(TIMER_WHEELSIZE-1)));
+            }
+            fire(now&(TIMER_WHEELSIZE-1));
+        }
+        return due.length() - duepos;
+    }
+
+    /* Schedules a timer delay milliseconds from now, the earliest being the
+     * next millisecond, repeating every period milliseconds unless that is
+     * 0. Returns its handle. */
+    CLUAICOMMAND(timer_add, uint, (uint delay, uint period), {
+        if (!wheelready) clear();
+        int i = firstfree;
+        if (i >= 0) firstfree = pool[i].next;
+        else {
+            if (pool.length() > TIMER_INDEXMASK) return 0;
+            i = pool.length();
+            pool.add().generation = 1;
+        }
+        timer &t = pool[i];
+        t.deadline = now + max(delay, 1u);
+        t.period = period;
+        place(i);
+        return handle(i);
+    });
+
+    /* Returns false if the timer was not scheduled anymore */
+    CLUAICOMMAND(timer_cancel, bool, (uint h), {
+        int i = lookup(h);
+        if (i < 0) return false;
+        unlink(i);
+        release(i);
+        return true;
+    });
+
+    /* Fills handles with up to max of the timers due, returns how many */
+    CLUAICOMMAND(timer_fetch, int, (uint *handles, int maxhandles), {
+        int n = min(maxhandles, due.length() - duepos);
+        if (n <= 0) return 0;
+        memcpy(handles, &due[duepos], n*sizeof(uint));
+        duepos += n;
+        return n;
+    });
+
+    CLUAICOMMAND(timers_clear, void, (), {
+        clear();
+    });
+} /* end namespace timers */
@@ -49,6 +49,8 @@
 #include "engine/octarender.cpp"
 #include "engine/server.cpp"
 #include "engine/client.cpp"
+#include "engine/netcompress.cpp"
+#include "engine/maptransfer.cpp"
 #include "engine/dynlight.cpp"
 #include "engine/decal.cpp"
 #include "engine/sound.cpp"
@@ -64,3 +66,4 @@
 #include "octaforge/of_world.cpp"
 #include "octaforge/of_logger.cpp"
 #include "octaforge/of_entities.cpp"
+#include "octaforge/of_timers.cpp"
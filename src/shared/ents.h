@@ -34,8 +34,9 @@ struct extentity : entity                       // part of the entity that doesn
 
     model *m, *collide;
     int uid;
+    uint logichandle;
 
-    extentity() : flags(0), attached(NULL), m(NULL), collide(NULL), uid(-1) {}
+    extentity() : flags(0), attached(NULL), m(NULL), collide(NULL), uid(-1), logichandle(0) {}
 
     bool spawned() const { return (flags&EF_SPAWNED) != 0; }
     void setspawned(bool val) { if(val) flags |= EF_SPAWNED; else flags &= ~EF_SPAWNED; }
@@ -79,13 +80,14 @@ struct physent                                  // base entity type, can be affe
     bool blocked, moving;                       // used by physics to signal ai
     physent *onplayer;
     int lastmove, lastmoveattempt;
+    int dynentslot;                             // where the dynent cache last stored it, checked before use
 
     physent() : o(0, 0, 0), deltapos(0, 0, 0), newpos(0, 0, 0), yaw(0), pitch(0), roll(0), maxspeed(100), crouchtime(150),
                radius(0), eyeheight(0), maxheight(0), aboveeye(0), crouchheight(1), crouchspeed(1), jumpvel(0), gravity(0), xradius(4.1f), yradius(4.1f), zmargin(0),
                state(CS_ALIVE), editstate(CS_ALIVE), type(ENT_PLAYER),
                collidetype(COLLIDE_ELLIPSE),
                blocked(false), moving(true),
-               onplayer(NULL), lastmove(0), lastmoveattempt(0)
+               onplayer(NULL), lastmove(0), lastmoveattempt(0), dynentslot(-1)
                { reset(); }
 
     void resetinterp()
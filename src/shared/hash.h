@@ -66,6 +66,12 @@ namespace tiger
             chunk tmp = a; a = c; c = b; b = tmp;
         }
 
+#undef sb1
+#undef sb2
+#undef sb3
+#undef sb4
+#undef round
+
         a ^= aa;
         b -= bb;
         c += cc;
@@ -286,18 +286,39 @@ extern uint getmapcrc();
 extern void clearmapcrc();
 
 // physics
+
+// The standalone server moves its NPCs on a pool of worker threads, so there the results
+// of the last collision test are kept by each thread moving entities
+#if defined(SERVER) && !defined(WIN32)
+#define PHYSTHREADS
+
+struct physcollision
+{
+    vec wall;
+    bool inside;
+    physent *player;
+};
+
+extern physcollision &curphyscollision();
+#define collidewall (curphyscollision().wall)
+#define collideinside (curphyscollision().inside)
+#define collideplayer (curphyscollision().player)
+#else
 extern vec collidewall;
 extern bool collideinside;
 extern physent *collideplayer;
+#endif
 
 extern void moveplayer(physent *pl, int moveres, bool local);
 extern bool moveplayer(physent *pl, int moveres, bool local, int curtime);
+extern void moveplayers(physent **ents, int numents, int moveres);
 extern void crouchplayer(physent *pl, int moveres, bool local);
 extern bool collide(physent *d, const vec &dir = vec(0, 0, 0), float cutoff = 0.0f, bool playercol = true);
 extern bool bounce(physent *d, float secs, float elasticity, float waterfric, float grav);
 extern bool bounce(physent *d, float elasticity, float waterfric, float grav);
 extern void avoidcollision(physent *d, const vec &dir, physent *obstacle, float space);
 extern bool overlapsdynent(const vec &o, float radius);
+extern void dynentsnearray(const vec &from, const vec &to, vector<physent *> &nearby);
 extern bool movecamera(physent *pl, const vec &dir, float dist, float stepdist);
 extern void physicsframe();
 extern void dropenttofloor(entity *e);
@@ -374,6 +395,8 @@ extern void flushserver(bool force);
 extern int getservermtu();
 extern int getnumclients();
 extern uint getclientip(int n);
+extern ENetPeer *getclientpeer(int n);
+extern void recordbroadcast(int chan, const void *data, int len);
 extern int localconnect(); // INTENSITY: Added returning of client number
 extern void disconnect_client(int n, int reason);
 extern void kicknonlocalclients(int reason = DISC_NONE);
@@ -381,6 +404,7 @@ extern bool hasnonlocalclients();
 extern bool haslocalclients();
 extern void sendserverinforeply(ucharbuf &p);
 extern bool isdedicatedserver();
+extern int getnetdictionary();
 
 // client
 extern void sendclientpacket(ENetPacket *packet, int chan, int cn=-1); // INTENSITY: added cn
@@ -388,10 +412,17 @@ extern void flushclient();
 extern void disconnect(bool async = false, bool cleanup = true);
 extern bool isconnected(bool attempt = false, bool local = true);
 extern const ENetAddress *connectedpeer();
+extern void setservernetdictionary(int id);
 extern bool multiplayer(bool msg = true);
 extern void neterr(const char *s, bool disc = true);
 extern void gets2c();
 
+// maptransfer
+extern void sendmapmanifest(int cn);
+extern void parsemaprequest(int cn, ucharbuf &p);
+extern bool startmapdownload(const char *name);
+extern void parsemapdata(ucharbuf &p);
+
 // crypto
 extern void genprivkey(const char *seed, vector<char> &privstr, vector<char> &pubstr);
 extern bool hashstring(const char *str, char *result, int maxlen);
@@ -12,6 +12,9 @@
 #include "shared/tools.cpp"
 #include "engine/command.cpp"
 #include "engine/server.cpp"
+#include "engine/netcompress.cpp"
+#include "engine/maptransfer.cpp"
+#include "engine/botswarm.cpp"
 #include "game/game.cpp"
 #include "game/server.cpp"
 #include "game/client.cpp"
@@ -24,6 +27,7 @@
 #include "engine/octa.cpp"
 #include "engine/physics.cpp"
 #include "engine/bih.cpp"
+#include "engine/pvs.cpp"
 #include "shared/geom.cpp"
 #include "shared/glemu.cpp"
 #include "engine/client.cpp"
@@ -36,3 +40,4 @@
 #include "octaforge/of_world.cpp"
 #include "octaforge/of_logger.cpp"
 #include "octaforge/of_entities.cpp"
+#include "octaforge/of_timers.cpp"
@@ -2,8 +2,19 @@
 
 #include "cube.h"
 
+uint allocations = 0;
+
+// The network I/O thread and the physics workers allocate too, so the count is kept atomically;
+// those only exist in POSIX builds, elsewhere a plain increment is enough
+#ifdef __GNUC__
+#define COUNTALLOCATION __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED)
+#else
+#define COUNTALLOCATION allocations++
+#endif
+
 void *operator new(size_t size)
 {
+    COUNTALLOCATION;
     void *p = malloc(size);
     if(!p) abort();
     return p;
@@ -11,6 +22,7 @@ void *operator new(size_t size)
 
 void *operator new[](size_t size)
 {
+    COUNTALLOCATION;
     void *p = malloc(size);
     if(!p) abort();
     return p;
@@ -20,6 +32,21 @@ void operator delete(void *p) { if(p) free(p); }
 
 void operator delete[](void *p) { if(p) free(p); }
 
+llong getmicros()
+{
+#ifdef WIN32
+    static LARGE_INTEGER frequency = { 0 };
+    if(!frequency.QuadPart) QueryPerformanceFrequency(&frequency);
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return counter.QuadPart*1000000/frequency.QuadPart;
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return llong(ts.tv_sec)*1000000 + ts.tv_nsec/1000;
+#endif
+}
+
 ////////////////////////// strings ////////////////////////////////////////
 
 static string tmpstr[4];
@@ -26,6 +26,9 @@ typedef unsigned long long int ullong;
 #define RESTRICT
 #endif
 
+extern uint allocations; // Counted by the global operator new, from any thread
+extern llong getmicros(); // Monotonic clock in microseconds, for timing that milliseconds are too coarse for
+
 inline void *operator new(size_t, void *p) { return p; }
 inline void *operator new[](size_t, void *p) { return p; }
 inline void operator delete(void *, void *) {}